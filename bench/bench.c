@@ -0,0 +1,392 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Benchmark Harness
+ *
+ * description:
+ * Generates a fixed set of synthetic workloads and renders each of them
+ * repeatedly, reporting one JSON object per workload on stdout:
+ *
+ *   ns_per_byte      mean render time divided by the bytes rendered
+ *   tags_per_sec     tags processed per second (the workload generator
+ *                    knows how many tags each render processes)
+ *   allocs_per_render, bytes_alloced_per_render
+ *                    calls to malloc/calloc/realloc per render, counted by
+ *                    interposing on the C library allocator
+ *   peak_rss_kb      peak resident set size of the process so far
+ *   p50_ns .. max_ns latency percentiles over the timed renders
+ *
+ * The workloads are generated deterministically and each is rendered a fixed
+ * number of times (after one untimed warm-up render), so numbers from two
+ * runs on the same machine can be compared directly.  Output is written to
+ * /dev/null, except for the warm-up render, which goes to memory so the
+ * output size can be measured.
+ *
+ * usage:
+ *   ae_bench [-n iterations-scale] [workload ...]
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "templates.h"
+#include "extensions.h"
+
+/* ------------------------------------------------------------------------- */
+/* allocation counting                                                       */
+/* ------------------------------------------------------------------------- */
+
+  /* every allocation in the process (including the ones the C library makes
+   * on the library's behalf, like strdup and fopen) goes through these */
+
+extern void* __libc_malloc( size_t size );
+extern void* __libc_calloc( size_t count, size_t size );
+extern void* __libc_realloc( void* ptr, size_t size );
+extern void  __libc_free( void* ptr );
+
+static long static_alloc_count = 0;
+static long static_alloc_bytes = 0;
+
+void* malloc( size_t size ) {
+  static_alloc_count++;
+  static_alloc_bytes += size;
+  return __libc_malloc( size );
+}
+
+void* calloc( size_t count, size_t size ) {
+  static_alloc_count++;
+  static_alloc_bytes += count * size;
+  return __libc_calloc( count, size );
+}
+
+void* realloc( void* ptr, size_t size ) {
+  static_alloc_count++;
+  static_alloc_bytes += size;
+  return __libc_realloc( ptr, size );
+}
+
+void free( void* ptr ) {
+  __libc_free( ptr );
+}
+
+/* ------------------------------------------------------------------------- */
+/* type definitions                                                          */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+  char* buffer;
+  size_t length;
+  size_t alloced;
+} t_bench_text;
+
+typedef struct {
+  CONST char* name;
+  void (*setup)( t_ae_template_mgr mgr, t_bench_text* tem, long* tags );
+  int iterations;
+} t_bench_workload;
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+static char static_dir[ 256 ];
+static int  static_file_count = 0;
+
+/* ------------------------------------------------------------------------- */
+/* helpers                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static void text_append( t_bench_text* text, CONST char* fmt, ... ) {
+  va_list args;
+  int len;
+
+  for( ;; ) {
+    va_start( args, fmt );
+    len = vsnprintf( text->buffer + text->length, text->alloced - text->length, fmt, args );
+    va_end( args );
+    if( len >= 0 && text->length + len < text->alloced ) break;
+    text->alloced = ( text->alloced + len + 1 ) * 2;
+    text->buffer = (char*)realloc( text->buffer, text->alloced );
+  }
+  text->length += len;
+}
+
+static void write_file( CONST char* name, t_bench_text* text ) {
+  char  path[ 512 ];
+  FILE* fptr;
+
+  snprintf( path, sizeof( path ), "%s/%s", static_dir, name );
+  fptr = fopen( path, "w" );
+  fwrite( text->buffer, 1, text->length, fptr );
+  fclose( fptr );
+  static_file_count++;
+}
+
+static long now_ns( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long( CONST void* a, CONST void* b ) {
+  long x = *(CONST long*)a;
+  long y = *(CONST long*)b;
+  return ( x < y ? -1 : ( x > y ? 1 : 0 ) );
+}
+
+/* ------------------------------------------------------------------------- */
+/* workloads                                                                 */
+/* ------------------------------------------------------------------------- */
+
+  /* three quarters of a megabyte of plain markup, with a replace tag every 3K */
+static void setup_static( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  int i;
+  int j;
+
+  ae_add_tag( mgr, "title", "Benchmark" );
+  for( i = 0; i < 256; i++ ) {
+    for( j = 0; j < 64; j++ ) {
+      text_append( tem, "<tr><td class=\"c%d\">row %d cell %d</td></tr>\n", j % 7, i, j );
+    }
+    text_append( tem, "<h2><!--%%title%%--></h2>\n" );
+  }
+  *tags = 256;
+}
+
+  /* IF tags nested 64 deep, 32 times over */
+static void setup_deep_if( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  int i;
+  int j;
+
+  ae_add_tag( mgr, "flag", "1" );
+  for( i = 0; i < 32; i++ ) {
+    for( j = 0; j < 64; j++ ) {
+      text_append( tem, "<div><!--%%IF=flag=" );
+    }
+    text_append( tem, "innermost" );
+    for( j = 0; j < 64; j++ ) {
+      text_append( tem, "%%--></div>\n" );
+    }
+  }
+  *tags = 32 * 64;
+}
+
+  /* a 100,000 row REPEAT2 table */
+static void setup_repeat( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  t_bench_text list = { NULL, 0, 0 };
+  int i;
+
+  for( i = 0; i < 100000; i++ ) {
+    text_append( &list, "item %d|", i );
+  }
+  ae_add_tag( mgr, "list", list.buffer );
+  free( list.buffer );
+
+  text_append( tem, "<table>\n<!--%%REPEAT2=list=item=|=<tr><td><!--%%ae_row_num%%--></td><td><!--%%item%%--></td></tr>\n%%--></table>\n" );
+  *tags = 1 + 100000L * 2;
+}
+
+  /* a 100,000 row, three column STRUCT table */
+static void setup_struct( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  t_bench_text data = { NULL, 0, 0 };
+  int i;
+
+  for( i = 0; i < 100000; i++ ) {
+    text_append( &data, "name %d|mail%d@example.com|555-%04d|", i, i, i % 10000 );
+  }
+  ae_add_tag_ex( mgr, ae_struct_tag() );
+  ae_add_tag( mgr, "fields", "name|email|phone|" );
+  ae_add_tag( mgr, "rows", data.buffer );
+  free( data.buffer );
+
+  text_append( tem, "<table>\n<!--%%STRUCT=fields=rows=|=<tr><td><!--%%name%%--></td><td><!--%%email%%--></td><td><!--%%phone%%--></td></tr>\n%%--></table>\n" );
+  *tags = 1 + 100000L * 3;
+}
+
+  /* 2,000 replace tags in the manager, each referenced once */
+static void setup_replace( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  char name[ 32 ];
+  char value[ 32 ];
+  int i;
+
+  for( i = 0; i < 2000; i++ ) {
+    sprintf( name, "value_%d", i );
+    sprintf( value, "v%d", i );
+    ae_add_tag( mgr, name, value );
+    text_append( tem, "<span><!--%%%s%%--></span>\n", name );
+  }
+  *tags = 2000;
+}
+
+  /* 200 includes of 20 small files */
+static void setup_include( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  t_bench_text part;
+  char name[ 32 ];
+  char path[ 512 ];
+  int i;
+
+  ae_add_tag( mgr, "user", "someone" );
+  for( i = 0; i < 20; i++ ) {
+    part.buffer = NULL;
+    part.length = part.alloced = 0;
+    text_append( &part, "<div class=\"part%d\">hello <!--%%user%%-->, this is part %d</div>\n", i, i );
+    sprintf( name, "part%d.tem", i );
+    write_file( name, &part );
+    free( part.buffer );
+  }
+  for( i = 0; i < 200; i++ ) {
+    snprintf( path, sizeof( path ), "%s/part%d.tem", static_dir, i % 20 );
+    text_append( tem, "<!--%%INCLUDE=%s%%-->", path );
+  }
+  *tags = 200 * 2;
+}
+
+  /* a quarter megabyte of markup-heavy text pushed through ESCAPE-HTML */
+static void setup_escape( t_ae_template_mgr mgr, t_bench_text* tem, long* tags ) {
+  int i;
+
+  ae_add_tag_ex( mgr, ae_escape_html_tag() );
+  ae_add_tag( mgr, "quote", "\"<b>it's</b> & more\"" );
+  *tags = 0;
+  for( i = 0; i < 64; i++ ) {
+    text_append( tem, "<!--%%ESCAPE-HTML=" );
+    (*tags)++;
+    while( tem->length < (size_t)( i+1 ) * 4096 ) {
+      text_append( tem, "<a href=\"x?a=1&b=2\">it's <!--%%quote%%--></a>\n" );
+      (*tags)++;
+    }
+    text_append( tem, "%%-->" );
+  }
+}
+
+static t_bench_workload static_workloads[] = {
+  { "static",  setup_static,  200 },
+  { "deep_if", setup_deep_if, 50 },
+  { "repeat2", setup_repeat,  5 },
+  { "struct",  setup_struct,  5 },
+  { "replace", setup_replace, 50 },
+  { "include", setup_include, 200 },
+  { "escape",  setup_escape,  100 },
+  { NULL, NULL, 0 }
+};
+
+/* ------------------------------------------------------------------------- */
+/* driver                                                                    */
+/* ------------------------------------------------------------------------- */
+
+static void run_workload( t_bench_workload* workload, int scale ) {
+  t_ae_template_mgr mgr;
+  t_bench_text tem = { NULL, 0, 0 };
+  struct rusage usage;
+  FILE*  devnull;
+  FILE*  memory;
+  char*  out_buffer = NULL;
+  size_t out_length = 0;
+  long*  samples;
+  long   tags = 0;
+  long   allocs;
+  long   alloc_bytes;
+  long   start;
+  double total;
+  int    iterations;
+  int    i;
+
+  mgr = ae_template_mgr_new();
+  workload->setup( mgr, &tem, &tags );
+
+  /* untimed warm-up, which also tells us how much output a render produces */
+  memory = open_memstream( &out_buffer, &out_length );
+  ae_process_buffer( mgr, tem.buffer, memory );
+  fclose( memory );
+  free( out_buffer );
+
+  iterations = workload->iterations * scale;
+  if( iterations < 1 ) iterations = 1;
+  samples = (long*)malloc( iterations * sizeof( long ) );
+  devnull = fopen( "/dev/null", "w" );
+
+  allocs = static_alloc_count;
+  alloc_bytes = static_alloc_bytes;
+  total = 0;
+  for( i = 0; i < iterations; i++ ) {
+    start = now_ns();
+    ae_process_buffer( mgr, tem.buffer, devnull );
+    fflush( devnull );
+    samples[ i ] = now_ns() - start;
+    total += samples[ i ];
+  }
+  allocs = static_alloc_count - allocs;
+  alloc_bytes = static_alloc_bytes - alloc_bytes;
+
+  fclose( devnull );
+  qsort( samples, iterations, sizeof( long ), cmp_long );
+  getrusage( RUSAGE_SELF, &usage );
+
+  printf( "{\"workload\":\"%s\",\"iterations\":%d,\"template_bytes\":%lu,"
+          "\"output_bytes\":%lu,\"tags_per_render\":%ld,"
+          "\"mean_ns\":%.0f,\"ns_per_byte\":%.3f,\"tags_per_sec\":%.0f,"
+          "\"allocs_per_render\":%.1f,\"bytes_alloced_per_render\":%.0f,"
+          "\"peak_rss_kb\":%ld,"
+          "\"p50_ns\":%ld,\"p90_ns\":%ld,\"p99_ns\":%ld,\"max_ns\":%ld}\n",
+          workload->name, iterations, (unsigned long)tem.length,
+          (unsigned long)out_length, tags,
+          total / iterations,
+          ( out_length > 0 ? total / iterations / out_length : 0.0 ),
+          ( total > 0 ? tags * iterations / ( total / 1e9 ) : 0.0 ),
+          (double)allocs / iterations, (double)alloc_bytes / iterations,
+          usage.ru_maxrss,
+          samples[ iterations * 50 / 100 ],
+          samples[ iterations * 90 / 100 ],
+          samples[ iterations * 99 / 100 ],
+          samples[ iterations - 1 ] );
+  fflush( stdout );
+
+  free( samples );
+  free( tem.buffer );
+  ae_template_mgr_done( mgr );
+}
+
+int main( int argc, char** argv ) {
+  char  path[ 512 ];
+  int   scale = 1;
+  int   selected;
+  int   i;
+  int   j;
+
+  strcpy( static_dir, "/tmp/ae_bench.XXXXXX" );
+  if( mkdtemp( static_dir ) == NULL ) {
+    perror( "mkdtemp" );
+    return 1;
+  }
+
+  i = 1;
+  if( argc > 2 && strcmp( argv[ 1 ], "-n" ) == 0 ) {
+    scale = atoi( argv[ 2 ] );
+    i = 3;
+  }
+  selected = ( i < argc );
+
+  for( j = 0; static_workloads[ j ].name != NULL; j++ ) {
+    if( selected ) {
+      int k;
+      for( k = i; k < argc; k++ ) {
+        if( strcmp( argv[ k ], static_workloads[ j ].name ) == 0 ) break;
+      }
+      if( k == argc ) continue;
+    }
+    run_workload( &static_workloads[ j ], scale );
+  }
+
+  /* clean up the generated include files */
+  for( i = 0; i < static_file_count; i++ ) {
+    snprintf( path, sizeof( path ), "%s/part%d.tem", static_dir, i );
+    unlink( path );
+  }
+  rmdir( static_dir );
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Template References
+ *
+ * description:
+ * A program that builds the values for a page before rendering it may
+ * compute many that the page's template never uses.  ae_template_references
+ * reads a template without rendering it and reports what it refers to:
+ *
+ *   - the names of the tags it could read: plain replace tags, the tokens
+ *     tested by the IF family (and named in IF_EXPR expressions, condition
+ *     tags included), the sources of REPEAT2 and STRUCT (and of their
+ *     _SLICE forms, with the tags naming an offset or limit), the names
+ *     given to INCLUDE, EXEC and EXEC_SHARED, and the type of any other tag
+ *     with fields (its first field)
+ *   - the environment variables named by ENV tags
+ *   - the files it includes, directly or through other included files
+ *
+ * Every branch is followed, so the answer is what the template could use,
+ * not what one render will.  The names a REPEAT2 or STRUCT tag defines for
+ * its body (the row token, the struct's field names and the row-number
+ * tags) are not reported from inside that body; an INCLUDE naming one of
+ * them is only counted (see ae_references_row_includes).
+ *
+ * Tags are recognised by their type, as the standard tags and ESCAPE-HTML,
+ * ESCAPE-JS, STRUCT and STRUCT_SLICE (include/extensions.h) name them,
+ * whether or not the manager has them.  The manager supplies the
+ * delimiters, and the value of any tag it already has that names an
+ * included file or a STRUCT's fields.
+ * Included files are read from disk; one that cannot be read is reported
+ * but not examined, as is any file reached again through its own includes.
+ *
+ * The answer depends only on the template and those values, so it can be
+ * kept and reused for every render of the template.
+ *
+ * Example:
+ *
+ *   refs = ae_template_references( mgr, "page.tem" );
+ *   if( ae_references_uses( refs, "user_list" ) ) {
+ *     ae_add_tag( mgr, "user_list", build_user_list() );
+ *   }
+ *   ...
+ *   ae_references_free( refs );
+ * ------------------------------------------------------------------------- */
+
+#ifndef __ANALYZE_H__
+#define __ANALYZE_H__
+
+#include "templates.h"
+
+typedef void* t_ae_references;
+
+  /* ----------------------------------------------------------------------- *
+   * Examine the given template file or buffer, splitting it with the
+   * delimiters of 'mgr'.  ae_template_references returns NULL if the file
+   * cannot be read.  Release the result with ae_references_free.
+   * ----------------------------------------------------------------------- */
+t_ae_references ae_template_references( t_ae_template_mgr mgr, CONST char* file );
+t_ae_references ae_buffer_references( t_ae_template_mgr mgr, CONST char* buffer );
+void            ae_references_free( t_ae_references refs );
+
+  /* ----------------------------------------------------------------------- *
+   * Return the tag names, environment variables and included files found,
+   * each as a NULL-terminated list in the order they were first seen.  The
+   * lists belong to 'refs'.
+   * ----------------------------------------------------------------------- */
+CONST char**    ae_references_tags( t_ae_references refs );
+CONST char**    ae_references_env( t_ae_references refs );
+CONST char**    ae_references_files( t_ae_references refs );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns non-zero if the template could read the tag with the given name.
+   * ----------------------------------------------------------------------- */
+int             ae_references_uses( t_ae_references refs, CONST char* name );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns non-zero if the template has an EXEC or EXEC_SHARED tag, whose
+   * output nothing else it refers to can account for.
+   * ----------------------------------------------------------------------- */
+int             ae_references_runs( t_ae_references refs );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns non-zero if the template has an INCLUDE naming a token that an
+   * enclosing REPEAT2 or STRUCT binds, so that the files it includes depend
+   * on the rows and are not in ae_references_files.
+   * ----------------------------------------------------------------------- */
+int             ae_references_row_includes( t_ae_references refs );
+
+#endif
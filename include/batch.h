@@ -0,0 +1,80 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Batch Rendering
+ *
+ * description:
+ * This module renders one template against many independent sets of tags,
+ * spreading the records over a number of threads.  The template is read
+ * and compiled once, as a bundle held in memory (see include/bundle.h), and
+ * shared (read-only) by every thread, so no record parses it again; each
+ * record is rendered against a manager of its own, so records cannot see
+ * each other's tags.  (A record whose fill function changes its manager's
+ * delimiters is rendered from the template's text instead.)
+ *
+ * Records are divided evenly between the threads up front.  A thread that
+ * runs out of records of its own takes the next unclaimed record of
+ * whichever thread has the most left, so a few slow records don't leave
+ * the other threads idle.
+ *
+ * The tags for each record come either from an array of name/value lists
+ * (as accepted by ae_add_tags) or from a callback that adds them to the
+ * record's manager.  The rendered text of each record is handed to an
+ * 'emit' callback; ae_batch_emit_files and ae_batch_emit_buffers are
+ * provided for the common cases of writing each record to its own file or
+ * keeping it in memory.  The emit callback is called from the worker
+ * threads, and so must be thread-safe.
+ *
+ * Example:
+ *
+ *   t_ae_tag_set npcs[ 10000 ];
+ *   ...
+ *   ae_render_batch( "npc.tem", npcs, NULL, NULL, 10000, 0,
+ *                    ae_batch_emit_files, "npc-%05d.html" );
+ *
+ * Applications using this module must link with -lpthread.
+ * ------------------------------------------------------------------------- */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "templates.h"
+
+typedef struct {
+  char** names;
+  char** values;
+} t_ae_tag_set;
+
+  /* ----------------------------------------------------------------------- *
+   * A fill function adds the tags for the given record (0-based) to the
+   * given manager, returning 0 on success.  An emit function receives the
+   * rendered text of a record, returning 0 on success.
+   * ----------------------------------------------------------------------- */
+typedef int (*t_ae_batch_fill_fn)( void* cookie, int record, t_ae_template_mgr mgr );
+typedef int (*t_ae_batch_emit_fn)( void* cookie, int record, CONST char* data, int length );
+
+  /* ----------------------------------------------------------------------- *
+   * Render 'tem_file' once for each of 'count' records, on 'threads'
+   * threads (0 means one per online processor).  If 'sets' is non-NULL,
+   * record i gets the tags in sets[i]; otherwise 'fill' is called to add
+   * them.  Returns -1 if the template could not be read, otherwise the
+   * number of records that failed to fill, render or emit.
+   * ----------------------------------------------------------------------- */
+int ae_render_batch( CONST char* tem_file,
+                     t_ae_tag_set* sets,
+                     t_ae_batch_fill_fn fill,
+                     void* fill_cookie,
+                     int count,
+                     int threads,
+                     t_ae_batch_emit_fn emit,
+                     void* emit_cookie );
+
+  /* ----------------------------------------------------------------------- *
+   * Stock emit functions.  For ae_batch_emit_files, the cookie is a printf
+   * format (taking the record number as an int) naming the file to write.
+   * For ae_batch_emit_buffers, the cookie is an array of 'count' char*,
+   * which receives a null-terminated copy of each record's output.  Each
+   * buffer must be freed (with ae_free) by the calling application.
+   * ----------------------------------------------------------------------- */
+int ae_batch_emit_files( void* cookie, int record, CONST char* data, int length );
+int ae_batch_emit_buffers( void* cookie, int record, CONST char* data, int length );
+
+#endif
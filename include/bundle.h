@@ -0,0 +1,102 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Precompiled Bundles
+ *
+ * description:
+ * A bundle is a single binary file holding any number of templates, already
+ * split into literal text and tag instructions, with an index by path.  It
+ * is written once, offline (see tools/ae_bundle.c), and mapped into memory
+ * by each process that uses it, so rendering from a bundle involves no
+ * reading or parsing of template files and no allocation per template.
+ *
+ * The instructions are the same ones ae_compile generates code for: literal
+ * text; the IF, IF_NOT and IF_xx tags; INCLUDE; REPEAT2; ESCAPE-HTML and
+ * ESCAPE-JS.  Any other tag is stored as its text and handed to the
+ * manager's tags at render time.
+ *
+ * A bundle records the version of the instruction format it was written
+ * with (AE_BUNDLE_VERSION), a checksum of the library's standard tags
+ * (ae_standard_tags_checksum), the byte order of the machine that wrote
+ * it, and the tag and field delimiters its templates were split with.
+ * ae_bundle_open refuses a bundle of another version, set of standard tags
+ * or byte order, and a bundle will only render for a manager with the same
+ * delimiters.
+ *
+ * When the library is built with compression, longer literal text is also
+ * stored compressed, and rendering to a gzip stream copies it out as it is
+ * rather than compressing it again (see include/gzip.h).
+ *
+ * Templates are looked up by the path they were compiled from, exactly as
+ * given to the compiler (less any leading "./").  Once ae_set_bundle has
+ * been called for a manager, INCLUDE tags (in bundled templates, or in
+ * templates read from disk) whose file is in the bundle render from it;
+ * other files are read from disk as usual.
+ *
+ * Example:
+ *
+ *   bundle = ae_bundle_open( "site.bundle" );
+ *   mgr = ae_template_mgr_new();
+ *   ae_set_bundle( mgr, bundle );
+ *   ...
+ *   ae_bundle_process( bundle, mgr, "templates/page.tem", stdout );
+ * ------------------------------------------------------------------------- */
+
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include "templates.h"
+
+  /* ----------------------------------------------------------------------- *
+   * The version of the bundle format.  It changes whenever the layout of a
+   * bundle or the meaning of its instructions changes.
+   * ----------------------------------------------------------------------- */
+#define AE_BUNDLE_VERSION   ( 3 )
+
+typedef void* t_ae_bundle;
+
+  /* ----------------------------------------------------------------------- *
+   * Write the given template files to 'output' as a bundle, splitting them
+   * with the delimiters of 'mgr' (and minifying them first, if the manager
+   * has been given ae_set_minify; see include/minify.h).  Returns 0 on success, or -1 if a file
+   * could not be read or the bundle could not be written.
+   * ----------------------------------------------------------------------- */
+int         ae_bundle_write( t_ae_template_mgr mgr, char** files, int count, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * Map a bundle into memory, or release it.  ae_bundle_open returns NULL if
+   * the file cannot be mapped, or is not a valid bundle of this version and
+   * set of standard tags.
+   * ----------------------------------------------------------------------- */
+t_ae_bundle ae_bundle_open( CONST char* file_name );
+void        ae_bundle_close( t_ae_bundle bundle );
+
+  /* ----------------------------------------------------------------------- *
+   * As ae_bundle_open, for a bundle already in memory (written by
+   * ae_bundle_write to a memory stream, say).  The bundle is used where it
+   * is, so 'data' must be left alone until the bundle is closed, and
+   * ae_bundle_close does not free it.
+   * ----------------------------------------------------------------------- */
+t_ae_bundle ae_bundle_open_buffer( CONST char* data, size_t size );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns non-zero if the bundle holds a template with the given path.
+   * ----------------------------------------------------------------------- */
+int         ae_bundle_has( t_ae_bundle bundle, CONST char* path );
+
+  /* ----------------------------------------------------------------------- *
+   * Render the template with the given path from the bundle, as
+   * ae_process_template would render the file.  Returns -1 if the template
+   * is not in the bundle or the bundle's delimiters differ from the
+   * manager's (nothing is written in either case), and otherwise what
+   * ae_process_template would have returned.
+   * ----------------------------------------------------------------------- */
+int         ae_bundle_process( t_ae_bundle bundle, t_ae_template_mgr mgr,
+                               CONST char* path, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * Resolve INCLUDE tags rendered by 'mgr' from the bundle where possible
+   * (this sets the manager's include function).  The bundle must stay open
+   * while the manager is in use.
+   * ----------------------------------------------------------------------- */
+void        ae_set_bundle( t_ae_template_mgr mgr, t_ae_bundle bundle );
+
+#endif
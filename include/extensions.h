@@ -57,6 +57,14 @@
  *     The 'delimiter' is a string that is used to separate fields in the
  *     field name and data lists. This must be a literal string.
  *
+ *     As with REPEAT2_SLICE, STRUCT_SLICE takes an offset (from 0) and a
+ *     limit on the number of rows between the delimiter and the output:
+ *
+ *       <!--%STRUCT_SLICE=struct-fields=struct-data=##=20=10=...%-->
+ *
+ *     Each is a number or the name of a tag holding one, and row numbers
+ *     count from the start of the data.
+ *
  *     Using the above template, if 'struct-fields' is the following
  *     string:
  *     
@@ -85,5 +93,6 @@
 t_ae_tag ae_escape_js_tag( void );
 t_ae_tag ae_escape_html_tag( void );
 t_ae_tag ae_struct_tag( void );
+t_ae_tag ae_struct_slice_tag( void );
 
 #endif
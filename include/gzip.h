@@ -0,0 +1,75 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Compressed Output
+ *
+ * description:
+ * A gzip stream is a FILE that compresses whatever is written to it, as it
+ * is written, onto another FILE.  Any of the process functions may render
+ * to one; ae_done_html renders to one itself when HTML_GZIP is given (see
+ * include/templates.h).  Nothing is buffered beyond the stream's own stdio
+ * buffer and zlib's window, so output still leaves as it is rendered.
+ *
+ * Literal text that has been compressed ahead of time -- bundles store
+ * their longer text spans this way -- is written to a gzip stream with
+ * ae_gzip_write_span, which copies the compressed bytes straight to the
+ * output instead of compressing the text again.
+ *
+ * Compression is only available if the library was built with zlib
+ * ("make ZLIB=1", which defines AE_GZIP; programs then link with -lz).
+ * Otherwise ae_gzip_open returns NULL, and spans are written uncompressed.
+ *
+ * Output written to the standard output's file descriptor directly, rather
+ * than to the FILE a tag is given, bypasses the stream and is not
+ * compressed.
+ *
+ * Example:
+ *
+ *   gz = ae_gzip_open( stdout, AE_GZIP_DEFAULT );
+ *   ae_process_template( mgr, "page.tem", gz );
+ *   ae_gzip_close( gz );
+ * ------------------------------------------------------------------------- */
+
+#ifndef __GZIP_H__
+#define __GZIP_H__
+
+#include "templates.h"
+
+  /* compression levels, as zlib has them */
+#define AE_GZIP_DEFAULT     ( -1 )
+#define AE_GZIP_FASTEST     ( 1 )
+#define AE_GZIP_BEST        ( 9 )
+
+  /* text shorter than this is not worth compressing ahead of time: the
+   * flush around a precompressed span costs a few bytes, and the span loses
+   * the context of the text before it */
+#define AE_GZIP_SPAN_MIN    ( 256 )
+
+  /* ----------------------------------------------------------------------- *
+   * Returns non-zero if the library was built with compression.
+   * ----------------------------------------------------------------------- */
+int   ae_gzip_available( void );
+
+  /* ----------------------------------------------------------------------- *
+   * Open a gzip stream that writes to 'output' at the given level, or close
+   * one, writing the end of the compressed data.  Closing a gzip stream
+   * does not close 'output'.  ae_gzip_open returns NULL if compression is
+   * not available; ae_gzip_close returns 0 if all the output was written.
+   * ----------------------------------------------------------------------- */
+FILE* ae_gzip_open( FILE* output, int level );
+int   ae_gzip_close( FILE* stream );
+
+  /* ----------------------------------------------------------------------- *
+   * ae_gzip_deflate compresses 'text' so that it can later be written to any
+   * gzip stream with ae_gzip_write_span.  Returns the size of the compressed
+   * data, which is returned in 'deflated' (release it with ae_free), or 0 if
+   * compression is not available.
+   *
+   * ae_gzip_write_span writes 'size' bytes of 'text' to 'output'.  If
+   * 'output' is a gzip stream and 'deflated' is the text compressed by
+   * ae_gzip_deflate, the compressed bytes are written as they are;
+   * otherwise the text is written (and compressed, if need be) as usual.
+   * ----------------------------------------------------------------------- */
+size_t ae_gzip_deflate( CONST char* text, size_t size, char** deflated );
+void   ae_gzip_write_span( FILE* output, CONST char* text, size_t size,
+                           CONST char* deflated, size_t deflated_size );
+
+#endif
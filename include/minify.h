@@ -0,0 +1,50 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- HTML Minification
+ *
+ * description:
+ * Hand-indented HTML templates spend much of their output on whitespace.
+ * ae_minify_html rewrites a template's literal text so that it renders to
+ * the same page with less of it:
+ *
+ *   - each run of whitespace becomes a single newline (if it held one) or a
+ *     single space
+ *   - HTML comments are removed, except conditional comments ("<!--[if")
+ *     and comments with a tag inside them
+ *   - the contents of <pre>, <textarea>, <script> and <style> elements, and
+ *     quoted attribute values, are left exactly as they are
+ *
+ * Tags are found with the manager's delimiters, so the default "<!--%",
+ * which looks like the start of a comment, is never taken for one.  Tags
+ * are kept as they are, except that the bodies of the standard block tags
+ * -- IF, IF_NOT, IF_EXPR, the IF_xx comparisons, REPEAT2, REPEAT2_SLICE,
+ * STRUCT and STRUCT_SLICE -- are minified too, each as a template of its
+ * own, when the tag is not inside an HTML tag, attribute value or one of
+ * the elements above.  ESCAPE-HTML and ESCAPE-JS bodies are left alone.
+ *
+ * Minification is meant to happen once, when a template is loaded to be
+ * kept: ae_bundle_write, ae_compile and ae_served all minify the templates
+ * they load if the manager they load them with has been given
+ * ae_set_minify (or -m, for the tools).  ae_process_template reads its file
+ * on every render, and does not minify.
+ * ------------------------------------------------------------------------- */
+
+#ifndef __MINIFY_H__
+#define __MINIFY_H__
+
+#include "templates.h"
+
+  /* ----------------------------------------------------------------------- *
+   * Returns a minified copy of the template 'text', split into tags with
+   * the delimiters of 'mgr'.  Release it with ae_free.
+   * ----------------------------------------------------------------------- */
+char* ae_minify_html( t_ae_template_mgr mgr, CONST char* text );
+
+  /* ----------------------------------------------------------------------- *
+   * Set (or ask) whether templates loaded with 'mgr' for keeping -- in a
+   * bundle, by the compiler, or by the render server -- are minified.  Off
+   * by default.
+   * ----------------------------------------------------------------------- */
+void  ae_set_minify( t_ae_template_mgr mgr, int minify );
+int   ae_get_minify( t_ae_template_mgr mgr );
+
+#endif
@@ -0,0 +1,83 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Static Tracepoints
+ *
+ * description:
+ * Built with "make SDT=1" (which defines AE_SDT, and needs sys/sdt.h, from
+ * systemtap's SDT headers), the library carries USDT probes that perf,
+ * bpftrace and systemtap can attach to in any program linked with it,
+ * without rebuilding it or turning on profiling or tracing.  A probe is a
+ * single nop in the code until something attaches to it; built without
+ * SDT, the probes are not there at all.
+ *
+ * The probes, all of provider "ae", and their arguments:
+ *
+ *   render__start     name, depth          a stream is about to be rendered:
+ *                                          the template's file name (NULL
+ *                                          for a buffer or other stream)
+ *                                          and how deeply it is nested (1
+ *                                          for a top-level render)
+ *   render__end       name, depth, rc,     ... and has been, returning rc,
+ *                     bytes                having written 'bytes' bytes (-1
+ *                                          if they could not be counted)
+ *   tag__start        text                 a tag's text is to be dispatched
+ *   tag__end          text, tag, matched   ... and was: 'tag' is the name
+ *                                          of the tag that applied it ("" if
+ *                                          none did), and 'matched' is 0 if
+ *                                          none did
+ *   include__open     file, depth          a file is to be included
+ *   exec__start       command              an EXEC command is to be run
+ *   exec__end         command              ... and has finished
+ *   exec_shared__start lib, func           an EXEC_SHARED function is to be
+ *                                          called
+ *   exec_shared__end  lib, func            ... and has returned
+ *   loop__iteration                        REPEAT2 or STRUCT starts a row
+ *
+ * Strings are the library's own and only valid while the probe fires.
+ *
+ * Counting render__end's bytes and naming tag__end's tag cost something,
+ * so the library only does so while something is attached to that probe.
+ * It knows by the probes' semaphores (AE_PROBE_ENABLED), which the tools
+ * above set as they attach.
+ *
+ * Example:
+ *
+ *   bpftrace -e 'usdt:./cgi:ae:render__start /arg1 == 1/ { @s[tid] = nsecs; }
+ *     usdt:./cgi:ae:render__end /@s[tid]/ {
+ *       @us = hist( ( nsecs - @s[tid] ) / 1000 ); delete( @s[tid] ); }'
+ * ------------------------------------------------------------------------- */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifdef AE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define AE_PROBE0( name )                     DTRACE_PROBE( ae, name )
+#define AE_PROBE1( name, a )                  DTRACE_PROBE1( ae, name, a )
+#define AE_PROBE2( name, a, b )               DTRACE_PROBE2( ae, name, a, b )
+#define AE_PROBE3( name, a, b, c )            DTRACE_PROBE3( ae, name, a, b, c )
+#define AE_PROBE4( name, a, b, c, d )         DTRACE_PROBE4( ae, name, a, b, c, d )
+
+  /* every probe has a semaphore, defined once (in src/templates.c) */
+#define AE_PROBE_SEMAPHORE( name )            unsigned short ae_##name##_semaphore \
+                                                __attribute__(( section( ".probes" ) ))
+#define AE_PROBE_ENABLED( name )              __builtin_expect( ae_##name##_semaphore != 0, 0 )
+
+#else
+
+  /* (the arguments are never evaluated, but count as used) */
+#define AE_PROBE0( name )                     do { } while( 0 )
+#define AE_PROBE1( name, a )                  do { if( 0 ) { (void)( a ); } } while( 0 )
+#define AE_PROBE2( name, a, b )               do { if( 0 ) { (void)( a ); (void)( b ); } } while( 0 )
+#define AE_PROBE3( name, a, b, c )            do { if( 0 ) { (void)( a ); (void)( b ); \
+                                                             (void)( c ); } } while( 0 )
+#define AE_PROBE4( name, a, b, c, d )         do { if( 0 ) { (void)( a ); (void)( b ); \
+                                                             (void)( c ); (void)( d ); } } while( 0 )
+
+#define AE_PROBE_ENABLED( name )              ( 0 )
+
+#endif
+
+#endif
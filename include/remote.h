@@ -0,0 +1,87 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Remote Rendering
+ *
+ * description:
+ * This module lets a short-lived process (a CGI program, say) hand its
+ * rendering to a long-lived render server (see tools/ae_served.c) over a
+ * Unix domain socket.  The server keeps its managers, template cache and
+ * bundle warm between requests, so the client pays for neither process
+ * setup nor template loading.
+ *
+ * The protocol is a simple framing over the stream socket.  All integers
+ * are 32 bits, in network byte order.  A request is:
+ *
+ *   magic       AE_REMOTE_MAGIC
+ *   count       the number of strings that follow (1 + 2 * tags)
+ *   strings     each a length followed by that many bytes: the template
+ *               name, then the name and value of each tag
+ *
+ * The response is the rendered output as a series of chunks, each a length
+ * followed by that many bytes, ended by a zero length and then the render's
+ * return code (as ae_process_template would return it).  A connection may
+ * carry any number of requests, one after another.
+ *
+ * Example (in a CGI program):
+ *
+ *   ae_remote_html( "/var/run/ae.sock", "page.tem", tokens, values,
+ *                   HTML_HEADER );
+ * ------------------------------------------------------------------------- */
+
+#ifndef __REMOTE_H__
+#define __REMOTE_H__
+
+#include "templates.h"
+
+#define AE_REMOTE_MAGIC         ( 0x41455231 )  /* "AER1" */
+
+  /* returned by the client functions if the server could not be reached,
+   * or the exchange with it failed */
+#define AE_REMOTE_UNAVAILABLE   ( -2 )
+
+/* ------------------------------------------------------------------------- */
+/* client functions                                                          */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * Ask the server listening on 'socket_path' to render 'tem_file' with the
+   * given name/value pairs (null-terminated, as with ae_add_tags; names
+   * beginning with '-' name tag objects, which cannot be sent, and are
+   * skipped), writing the result to 'output'.  Returns the render's return
+   * code, or AE_REMOTE_UNAVAILABLE.
+   * ----------------------------------------------------------------------- */
+int ae_remote_render( CONST char* socket_path, CONST char* tem_file,
+                      char** names, char** values, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * A drop-in replacement for ToHTML2 that renders through the server.  The
+   * headers asked for by 'mode' are written locally, and the page is
+   * rendered remotely, to stdout.  If the server cannot be reached, the page
+   * is rendered locally with ToHTML2 instead.  HTML_GZIP is ignored.
+   * Returns 1 on success and 0 on failure, as ToHTML2 does.
+   * ----------------------------------------------------------------------- */
+int ae_remote_html( CONST char* socket_path, CONST char* tem_file,
+                    char** tokens, char** values, int mode );
+
+/* ------------------------------------------------------------------------- */
+/* server functions                                                          */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * Read the next request from 'fd'.  On success, returns 0 and sets
+   * 'tem_file' and the null-terminated 'names' and 'values' lists, which
+   * must be released with ae_remote_free_request.  Returns -1 at the end of
+   * the connection, or if the request is malformed.
+   * ----------------------------------------------------------------------- */
+int   ae_remote_read_request( int fd, char** tem_file, char*** names, char*** values );
+void  ae_remote_free_request( char* tem_file, char** names, char** values );
+
+  /* ----------------------------------------------------------------------- *
+   * ae_remote_open_response returns a stream whose output is sent to 'fd' in
+   * chunks as it is written.  ae_remote_close_response closes the stream
+   * and ends the response on 'fd' with the given return code, returning 0
+   * if the whole response was sent.
+   * ----------------------------------------------------------------------- */
+FILE* ae_remote_open_response( int fd );
+int   ae_remote_close_response( FILE* response, int fd, int rc );
+
+#endif
@@ -0,0 +1,86 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Resumable Rendering
+ *
+ * description:
+ * ae_process_template writes the whole page before it returns, blocking on
+ * its output for as long as that takes.  A server writing to a slow client
+ * on a non-blocking socket would rather take the page a piece at a time,
+ * as the socket has room for it.
+ *
+ * A resumable render is started with ae_render_start_template (or _buffer)
+ * and then stepped: each call to ae_render_step fills the caller's buffer
+ * with the next part of the page and returns AE_RENDER_MORE, until the last
+ * part, when it returns AE_RENDER_DONE.  Between steps the render is simply
+ * paused -- wherever it was, however deeply nested in IF, REPEAT2 or
+ * INCLUDE tags -- and nothing runs until the next step.  One thread can so
+ * interleave any number of renders, stepping each as its client is ready.
+ *
+ * Each render runs on a stack of its own (RENDER_STACK_SIZE bytes, in
+ * src/resume.c, reserved as it is touched), and switches to it and back
+ * with swapcontext.  A render must be stepped on the thread that started
+ * it: code compiled into the library and the C library may keep the
+ * address of a thread's own variables (errno, say) across a pause.  While
+ * a render is unfinished its manager is in use, as it is during
+ * ae_process_template: give interleaved renders managers of their own
+ * (overlays of a shared base, say; see ae_template_mgr_overlay).
+ *
+ * Each step saves the thread's library state (see ae_save_thread_state)
+ * and runs the render with its own, so a paused render's allocations stay
+ * charged to its own manager, and each render's trace events are put on a
+ * thread of their own.  A paused render's time limit (max_ms) is stopped
+ * until its next step.
+ *
+ * Example:
+ *
+ *   render = ae_render_start_template( mgr, "page.tem" );
+ *   ...
+ *   (whenever the socket is writable, and the last chunk has been sent)
+ *   status = ae_render_step( render, chunk, sizeof( chunk ), &length );
+ *   (send 'length' bytes of 'chunk')
+ *   if( status == AE_RENDER_DONE ) ae_render_free( render );
+ * ------------------------------------------------------------------------- */
+
+#ifndef __RESUME_H__
+#define __RESUME_H__
+
+#include "templates.h"
+
+#define AE_RENDER_DONE          ( 0 )
+#define AE_RENDER_MORE          ( 1 )
+
+typedef void* t_ae_render;
+
+  /* ----------------------------------------------------------------------- *
+   * Start rendering the given template file or buffer with 'mgr'.  Nothing
+   * is rendered until the first step.  The buffer is copied.  Returns NULL
+   * if the render's stack could not be set up.
+   * ----------------------------------------------------------------------- */
+t_ae_render ae_render_start_template( t_ae_template_mgr mgr, CONST char* file );
+t_ae_render ae_render_start_buffer( t_ae_template_mgr mgr, CONST char* buffer );
+
+  /* ----------------------------------------------------------------------- *
+   * Render into 'buffer' until it holds 'size' bytes (size must be at
+   * least 1) or the page is finished, setting 'length' to the number of
+   * bytes written.  Returns AE_RENDER_MORE if there may be more to come, or
+   * AE_RENDER_DONE if the page is finished (after which each step writes
+   * nothing and returns AE_RENDER_DONE again).
+   * ----------------------------------------------------------------------- */
+int         ae_render_step( t_ae_render render, char* buffer, int size, int* length );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns what ae_process_template (or ae_process_buffer) returned for the
+   * page, once the render is done, or -1 before then.
+   * ----------------------------------------------------------------------- */
+int         ae_render_result( t_ae_render render );
+
+  /* ----------------------------------------------------------------------- *
+   * Release a render.  An unfinished render is first cancelled (see
+   * ae_cancel_render) and then resumed, with its output thrown away, so
+   * that it unwinds and releases everything it holds.  It gives up at its
+   * next check -- between tags, or before the next REPEAT2 or STRUCT row --
+   * so freeing it costs at most the tag it was in the middle of (an EXEC
+   * command already started is waited for), not the rest of the page.
+   * ----------------------------------------------------------------------- */
+void        ae_render_free( t_ae_render render );
+
+#endif
@@ -0,0 +1,72 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Render Statistics
+ *
+ * description:
+ * A CGI program renders one page and exits, so whatever it measures about
+ * that render is lost with it.  Render statistics are kept in a file that
+ * every process maps and adds to: once a process has called
+ * ae_stats_attach, each top-level ae_process_template (and so each
+ * ae_done_html) it makes is counted against its template's path, with
+ *
+ *   - the number of renders, and of those that failed (returned non-zero,
+ *     or found no template)
+ *   - the bytes written, where the output could be measured
+ *   - the render's time, in a latency histogram
+ *
+ * The histogram's buckets are log-linear, as in HdrHistogram: each power
+ * of two microseconds is split into STATS_SUB_BUCKETS (16) equal parts,
+ * so any latency, from one microsecond to some hours, is placed within
+ * about 6%.  ae_stats_report reads the file and writes, for each template,
+ * its counts and the 50th, 90th, 99th and 99.9th percentile latencies;
+ * tools/ae_stats does so from the command line.
+ *
+ * The file has a fixed layout, of STATS_SLOTS (256) templates.  Processes
+ * update it with atomic adds, without locks, and a template's slot is
+ * claimed the first time any process renders it; renders of templates
+ * once the slots are all taken are only counted as unrecorded.  A path is
+ * recorded to its first STATS_NAME_MAX-1 (231) bytes, as it was given.
+ *
+ * Example:
+ *
+ *   ae_stats_attach( "/dev/shm/ae-stats" );   (once, at startup)
+ *   ...
+ *   ae_done_html( mgr, "page.tem" );           (counted)
+ *
+ *   $ ae_stats /dev/shm/ae-stats
+ * ------------------------------------------------------------------------- */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "templates.h"
+
+  /* ----------------------------------------------------------------------- *
+   * Count this process's renders in the statistics file 'path', creating it
+   * if there is none.  Returns 0, or -1 if the file cannot be opened or
+   * mapped, or holds something other than render statistics.  Attach
+   * before rendering, and detach only when nothing is rendering.
+   * ae_stats_attached returns non-zero while the process is attached.
+   * ----------------------------------------------------------------------- */
+int   ae_stats_attach( CONST char* path );
+void  ae_stats_detach( void );
+int   ae_stats_attached( void );
+
+  /* ----------------------------------------------------------------------- *
+   * Count one render of the template 'name' that took 'elapsed_ns'
+   * nanoseconds and wrote 'bytes' bytes (or -1 if that isn't known), and
+   * that failed if 'failed' is non-zero.  ae_process_template calls this
+   * itself; it is here for programs that render some other way.  Does
+   * nothing if the process is not attached.
+   * ----------------------------------------------------------------------- */
+void  ae_stats_record( CONST char* name, long elapsed_ns, long bytes, int failed );
+
+  /* ----------------------------------------------------------------------- *
+   * Write a report of the statistics file 'path' to 'output', one line per
+   * template, the slowest (by 99th percentile) first.  ae_stats_reset sets
+   * every count in the file back to zero.  Both return 0, or -1 if the file
+   * cannot be read or holds something other than render statistics.
+   * ----------------------------------------------------------------------- */
+int   ae_stats_report( CONST char* path, FILE* output );
+int   ae_stats_reset( CONST char* path );
+
+#endif
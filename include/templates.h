@@ -29,6 +29,20 @@
  *   IF_GE=tok=value=data
  *     If the tag 'tok' is defined, and it's value is (<,<=,>,>=) 'value'
  *     (case sensitive string comparison), then print the data.
+ *   IF_EXPR=expression=data
+ *     Print the data if the expression is true.  An expression is built
+ *     from 'and', 'or', 'not' and parentheses, over conditions that are
+ *     either an operand -- true if its value is not NULL or empty, as IF
+ *     tests a tag -- or two operands compared with 'eq', 'ne', 'lt', 'le',
+ *     'gt' or 'ge' (as numbers if both are numbers, and otherwise as
+ *     strings), or a condition tag applied to an argument, written
+ *     'name(argument)' (see ae_condition_tag).  An operand is a tag name,
+ *     meaning the tag's value, or a number or a quoted string (in single
+ *     or double quotes), meaning itself.  'and' binds more tightly than
+ *     'or', and both stop as soon as the answer is known.  Since the
+ *     expression is a field, it may not hold the field delimiter.  For
+ *     example:
+ *       IF_EXPR=user and (admin or not count gt 10)=data
  *   INCLUDE=tok
  *     If the tag 'tok' exists, treat its value as a file-name, otherwise
  *     treat 'tok' as a file-name.  Parse the file's contents and place
@@ -44,7 +58,17 @@
  *     represent the (1-based) number of the current row.  If the repeat tag
  *     is nested within another repeat tag, the row-number tag will be named
  *     "ae_row_num_%" where '%' is the depth at which the repeat is nested
- *     within other repeats.
+ *     within other repeats.  The number of rows is in "ae_row_count" (or
+ *     "ae_row_count_%", alongside "ae_row_num_%").  Over a row source
+ *     (ae_row_source_tag), the count is not known until the last row, so
+ *     "ae_row_count" is only set once the repeat is done, to the number of
+ *     rows read, and is left set for the text that follows it.
+ *   REPEAT2_SLICE=source=newtok=delim=offset=limit=data
+ *     As REPEAT2, but starting at row 'offset' (from 0) and repeating at
+ *     most 'limit' rows.  Each is a number, or the name of a tag whose
+ *     value is a number; an offset that is neither is 0, and a limit that
+ *     is neither is no limit.  Row numbers (and the row count) are for the
+ *     whole list.
  *   ENV=env
  *     Write the value of the given environment variable.
  *   EXEC_SHARED=tok
@@ -70,6 +94,7 @@
 /* ------------------------------------------------------------------------- */
 
 #include <stdio.h> /* for FILE */
+#include <stddef.h> /* for size_t */
 
 /* ------------------------------------------------------------------------- */
 /* macro definitions                                                         */
@@ -129,10 +154,30 @@
   /* ----------------------------------------------------------------------- *
    * For HTML parsing, these defines are used with the ToHTML2 function,
    * and define what kind of headers to print out before parsing the stream.
+   *
+   * HTML_GZIP compresses the page (see include/gzip.h) and says so in the
+   * headers, if HTML_HEADER is also given, the library was built with
+   * compression, and the client's Accept-Encoding (HTTP_ACCEPT_ENCODING, in
+   * the CGI environment) includes gzip.  Otherwise it is ignored.
+   *
+   * HTML_ETAG, with HTML_HEADER, gives the page a strong ETag: a hash of the
+   * template and the files it includes (their names, modification times
+   * and sizes), the values of the tags and environment variables it reads
+   * (see include/analyze.h), and the delimiters and content encoding.  If
+   * the client's If-None-Match (HTTP_IF_NONE_MATCH) names it, ae_done_html
+   * writes a 304 Not Modified header and does not render the page.  The
+   * file a named include tag (ae_include_tag_named) names is hashed, and
+   * examined, as the template's own includes are.  A page that runs EXEC or
+   * EXEC_SHARED, reads a custom tag, a row source or any value tag other
+   * than a replace, raw, cyclical, lazy or named include tag, includes a
+   * file named by a REPEAT2 or STRUCT row, or is rendered by a manager with
+   * an include function gets no ETag.
    * ----------------------------------------------------------------------- */
 
 #define HTML_HEADER         ( 0x01 )
 #define HTML_NO_CACHE       ( 0x02 )
+#define HTML_GZIP           ( 0x04 )
+#define HTML_ETAG           ( 0x08 )
 
   /* ----------------------------------------------------------------------- *
    * Some tags have values, others (like BYU_IF) don't.  If a tag is of type
@@ -155,6 +200,10 @@ typedef void*    t_ae_tag;
 typedef int (*t_ae_tag_fn)( t_ae_tag, CONST char*, t_ae_template_mgr, FILE* );
 typedef char* (*t_ae_tag_get_fn)( t_ae_tag );
 typedef int (*t_ae_preproc_fn)( t_ae_template_mgr, FILE* );
+typedef int (*t_ae_include_fn)( void*, t_ae_template_mgr, CONST char*, FILE* );
+typedef char* (*t_ae_lazy_fn)( void*, CONST char* );
+typedef int (*t_ae_row_fn)( void*, t_ae_template_mgr, char** );
+typedef int (*t_ae_condition_fn)( void*, t_ae_template_mgr, CONST char* );
 
 typedef struct {
   STANDARD_TAG_HDR;
@@ -203,6 +252,43 @@ int         ae_stream_close( t_ae_stream stream );
 t_ae_template_mgr ae_template_mgr_new( void );
 void              ae_template_mgr_done( t_ae_template_mgr mgr );
 
+  /* ----------------------------------------------------------------------- *
+   * Create a manager that overlays 'base'.  The overlay starts with base's
+   * delimiters and settings but none of its own tags; tags looked up or
+   * applied through it are taken from its own tags first, then from base's
+   * (so a tag added to the overlay overrides base's tag of the same name).
+   * Tags added to or removed from the overlay never touch base, and
+   * destroying it (with ae_template_mgr_done) destroys only its own tags,
+   * so creating and destroying an overlay costs the same however many tags
+   * base has.
+   *
+   * Base must not be changed or destroyed while it has overlays, but any
+   * number of overlays, on any threads, may share one base.  An overlay can
+   * itself be the base of another overlay.  ae_get_base returns the base of
+   * an overlay, or NULL for a manager made by ae_template_mgr_new.
+   *
+   * An overlay has no cookie (ae_set_mgr_cookie) of its own until it is
+   * given one, and until then ae_get_mgr_cookie returns base's.  The page
+   * that ae_init_html sets up belongs to the manager it returned, so
+   * ae_done_html, ae_set_cookie and ae_set_html_output do nothing given an
+   * overlay (and ae_done_html returns 0); renders through an overlay still
+   * write the page's headers.
+   *
+   * Every manager made by ae_template_mgr_new shares one instance of each
+   * standard tag; destroying one of those (by removing it or destroying the
+   * manager) does nothing.
+   * ----------------------------------------------------------------------- */
+t_ae_template_mgr ae_template_mgr_overlay( t_ae_template_mgr base );
+t_ae_template_mgr ae_get_base( t_ae_template_mgr mgr );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns a checksum of the names of the standard tags, in the order
+   * every manager is given them, so that anything saved by one build of
+   * the library (a bundle, say) can tell whether another build has the
+   * same standard tags.
+   * ----------------------------------------------------------------------- */
+unsigned int      ae_standard_tags_checksum( void );
+
   /* ----------------------------------------------------------------------- *
    * Add a tag to the template manager.  ae_add_tag adds a new replace token
    * to the manager with the given name and value.  ae_add_tag_ex adds the
@@ -225,13 +311,15 @@ void              ae_add_tags( t_ae_template_mgr mgr, char** names, char** value
 
   /* ----------------------------------------------------------------------- *
    * Removes a tag from the manager, either by name or by reference.  The
-   * tag is destroyed and deallocated.
+   * tag is destroyed and deallocated.  An overlay only removes its own
+   * tags; a tag of its base's stays visible.
    * ----------------------------------------------------------------------- */
 void              ae_remove_tag( t_ae_template_mgr mgr, CONST char* name );
 void              ae_remove_tag_ex( t_ae_template_mgr mgr, t_ae_tag tag );
 
   /* ----------------------------------------------------------------------- *
-   * Returns the number of tags in the manager.
+   * Returns the number of tags in the manager.  An overlay's count, and
+   * the indices of ae_get_tag_at, take in its base's tags after its own.
    * ----------------------------------------------------------------------- */
 int               ae_tag_count( t_ae_template_mgr mgr );
 
@@ -242,6 +330,16 @@ void              ae_set_start_end_delim( t_ae_template_mgr mgr,
                                           CONST char* start,
                                           CONST char* end );
 
+  /* ----------------------------------------------------------------------- *
+   * Returns the delimiters that surround the tags, and the delimiter given
+   * to tags added to the manager (to separate their fields).  Any of the
+   * pointers may be NULL.  The strings belong to the manager.
+   * ----------------------------------------------------------------------- */
+void              ae_get_delims( t_ae_template_mgr mgr,
+                                 CONST char** start,
+                                 CONST char** end,
+                                 CONST char** field );
+
   /* ----------------------------------------------------------------------- *
    * Returns the tag object that answers to the given name.  Tag names are
    * case sensitive, so be sure the case is the same as the tag you are
@@ -270,6 +368,16 @@ int ae_process_template( t_ae_template_mgr mgr, CONST char* file, FILE* output )
 int ae_process_buffer( t_ae_template_mgr mgr, CONST char* buffer, FILE* output );
 int ae_process_stream( t_ae_template_mgr mgr, t_ae_stream stream, FILE* output ); 
 
+  /* ----------------------------------------------------------------------- *
+   * INCLUDE tags render the file they name with ae_process_include.  If an
+   * include function has been set, it is offered the file name first, and
+   * returns non-zero if it rendered the file itself (from a bundle or a
+   * cache, say); otherwise, or if it returns 0, the file is processed with
+   * ae_process_template.
+   * ----------------------------------------------------------------------- */
+int  ae_process_include( t_ae_template_mgr mgr, CONST char* file, FILE* output );
+void ae_set_include_func( t_ae_template_mgr mgr, t_ae_include_fn func, void* cookie );
+
   /* ----------------------------------------------------------------------- *
    * The preprocessor function, if set, is called prior to any template
    * processing when any of the ae_process_xxx functions are called.  The
@@ -284,6 +392,418 @@ void  ae_set_preprocessor_func( t_ae_template_mgr mgr, t_ae_preproc_fn func );
 void  ae_set_mgr_cookie( t_ae_template_mgr mgr, void* cookie );
 void* ae_get_mgr_cookie( t_ae_template_mgr mgr );
 
+  /* ----------------------------------------------------------------------- *
+   * Allow the top level of a template to be rendered by up to 'workers'
+   * threads (0 or 1 turns this off, which is the default).  INCLUDE and
+   * EXEC tags whose output cannot affect the manager are rendered
+   * concurrently into private buffers, and the buffers are written to the
+   * output in document order.  Any tag that might change the manager
+   * (REPEAT2, STRUCT, EXEC_SHARED, cyclical replace tags, and any custom
+   * tag) is a barrier: everything before it is finished before it is
+   * processed.  Tags nested inside other tags are always rendered in
+   * sequence.  An INCLUDE's file is read once, when it is checked, and
+   * rendered from what was read then.  Applications using this must link
+   * with -lpthread.
+   * ----------------------------------------------------------------------- */
+void  ae_set_parallel_sections( t_ae_template_mgr mgr, int workers );
+
+/* ------------------------------------------------------------------------- */
+/* render limit functions                                                    */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * A manager can put limits on what any one top-level render may do:
+   *
+   *   max_depth       -- how deeply renders may nest (every IF body,
+   *                      INCLUDE, and REPEAT2 pass is one level deeper)
+   *   max_includes    -- the number of INCLUDE tags processed
+   *   max_output      -- the number of bytes written to the output
+   *   max_ms          -- the wall-clock time, in milliseconds, from the
+   *                      start of the render
+   *   max_iterations  -- the number of passes made by all REPEAT2 and
+   *                      STRUCT tags together
+   *
+   * A limit of 0 is no limit, and no limits is the default.  The first
+   * limit exceeded stops the render: nothing more is written (beyond a
+   * note such as "[include limit exceeded]" where the limit was reached,
+   * for every limit but max_output, whose output is simply cut off at that
+   * many bytes), and ae_process_template and the rest return
+   * AE_LIMIT_EXCEEDED.  ae_limit_reached returns which limit stopped the
+   * manager's last render, or AE_LIMIT_NONE.
+   *
+   * The time limit is checked between tags, between loop passes, and while
+   * EXEC tags wait for their command, which is killed if time runs out.
+   * Output is limited by writing through a counting stream, which needs
+   * fopencookie (Linux); elsewhere max_output is ignored.
+   *
+   * An overlay starts with its base's limits, so limits for one render can
+   * be set on the overlay made for it.  Custom loop tags should call
+   * ae_next_iteration before each pass, and stop if it returns 0; it
+   * counts the pass against max_iterations and checks the other limits.
+   * Renderers that run their own tag loop (such as the bundle loader in
+   * bundle.h) should call ae_check_limits between tags, and stop if it
+   * returns non-zero; it checks the limits without counting anything.
+   *
+   * With no limits set, the only cost is one test per tag.
+   * ----------------------------------------------------------------------- */
+
+#define AE_LIMIT_EXCEEDED   ( -3 )
+
+#define AE_LIMIT_NONE       ( 0 )
+#define AE_LIMIT_DEPTH      ( 1 )
+#define AE_LIMIT_INCLUDES   ( 2 )
+#define AE_LIMIT_OUTPUT     ( 3 )
+#define AE_LIMIT_TIME       ( 4 )
+#define AE_LIMIT_ITERATIONS ( 5 )
+#define AE_LIMIT_CANCELLED  ( 6 )
+
+typedef struct {
+  int  max_depth;
+  long max_includes;
+  long max_output;
+  long max_ms;
+  long max_iterations;
+} t_ae_limits;
+
+void  ae_set_limits( t_ae_template_mgr mgr, CONST t_ae_limits* limits );
+void  ae_get_limits( t_ae_template_mgr mgr, t_ae_limits* limits );
+int   ae_limit_reached( t_ae_template_mgr mgr );
+int   ae_check_limits( t_ae_template_mgr mgr, FILE* output );
+int   ae_next_iteration( t_ae_template_mgr mgr, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * Code that pauses a render part way through and runs something else on
+   * the same thread, as resumable renders do (include/resume.h), must stop
+   * the render's clock while it waits: ae_pause_limits stops the clock of
+   * the manager's time limit (max_ms), and ae_resume_limits restarts it, so
+   * that the time spent paused is not counted.  Both do nothing outside a
+   * render, or for a render with no time limit.
+   *
+   * It must also give each render the library's per-thread state (the
+   * manager the thread's allocations are charged to, and the thread its
+   * trace events are put on) as its own.  ae_save_thread_state saves the
+   * calling thread's state into 'state', and ae_restore_thread_state puts a
+   * saved state back.  A zeroed state is that of a thread that has not yet
+   * rendered anything.
+   *
+   * ae_cancel_render stops the manager's render part way through, as a
+   * limit would: once it resumes, loops and tags give up at their next
+   * check, and the render returns AE_LIMIT_EXCEEDED, with ae_limit_reached
+   * saying AE_LIMIT_CANCELLED (no note is written).  Only a render with
+   * limits, or of a manager given ae_set_cancellable, can be cancelled;
+   * for any other, and outside a render, it does nothing.
+   * ----------------------------------------------------------------------- */
+typedef struct {
+  void* m_alloc_mgr;
+  int   m_trace_tid;
+} t_ae_thread_state;
+
+void  ae_pause_limits( t_ae_template_mgr mgr );
+void  ae_resume_limits( t_ae_template_mgr mgr );
+void  ae_set_cancellable( t_ae_template_mgr mgr, int cancellable );
+int   ae_get_cancellable( t_ae_template_mgr mgr );
+void  ae_cancel_render( t_ae_template_mgr mgr );
+void  ae_save_thread_state( t_ae_thread_state* state );
+void  ae_restore_thread_state( CONST t_ae_thread_state* state );
+
+/* ------------------------------------------------------------------------- */
+/* compiled template functions                                               */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * The ae_compile tool (see tools/ae_compile.c) turns a template file into
+   * C source, with one render function per template.  Literal text is
+   * written directly, and the IF, IF_NOT, IF_xx comparison, INCLUDE,
+   * REPEAT2, ESCAPE-HTML and ESCAPE-JS tags become straight-line code.  Any
+   * other tag is handed to the manager's tags at runtime, exactly as the
+   * interpreter would.
+   *
+   * A render function must be run with ae_process_compiled, which does the
+   * same setup as ae_process_stream (the preprocessor function, profiling,
+   * allocation accounting) around the call.  Parallel sections do not apply
+   * to compiled templates.
+   * ----------------------------------------------------------------------- */
+
+#define AE_ESCAPE_NONE      ( -1 )
+#define AE_ESCAPE_HTML      ( 0 )
+#define AE_ESCAPE_JS        ( 1 )
+
+typedef int (*t_ae_compiled_fn)( t_ae_template_mgr, FILE* );
+typedef int (*t_ae_body_fn)( void*, t_ae_template_mgr, FILE* );
+
+int ae_process_compiled( t_ae_template_mgr mgr, t_ae_compiled_fn render, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * As ae_process_compiled, for renderers that need a cookie of their own
+   * (such as the bundle loader in bundle.h).
+   * ----------------------------------------------------------------------- */
+int ae_process_body( t_ae_template_mgr mgr, t_ae_body_fn body, void* cookie, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * As ae_process_body, for a body that is the text of the file 'file':
+   * the include is counted, checked against the limits, probed and traced
+   * just as ae_process_include would (see the bundle loader in bundle.h).
+   * A NULL body is the same as ae_process_include.
+   * ----------------------------------------------------------------------- */
+int ae_include_body( t_ae_template_mgr mgr, CONST char* file,
+                     t_ae_body_fn body, void* cookie, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * The following are used by compiled templates, and by the compiler.
+   *
+   * ae_next_tag finds the next tag in 'text' using the manager's
+   * delimiters, setting 'start' to the starting delimiter and 'end' to the
+   * matching ending delimiter (nested tags are skipped over).  Returns 1 if
+   * a tag was found, 0 if there are no more tags, or -1 if a tag was opened
+   * but never closed.
+   *
+   * ae_dispatch_tag hands the text of a tag (without its delimiters) to the
+   * first tag in the manager that will apply it, returning 0 if none did.
+   *
+   * ae_repeat_compiled (and ae_repeat_body) does the work of a REPEAT2 tag,
+   * calling 'body' for each row.  ae_escape_compiled calls 'body' and writes
+   * its output, escaped with ae_write_escaped.  ae_write_escaped writes
+   * 'text' with the characters that are special in HTML (AE_ESCAPE_HTML) or
+   * in a javascript string (AE_ESCAPE_JS) escaped.  ae_escape_body does the
+   * work of the ESCAPE-HTML and ESCAPE-JS tags for any body function: the
+   * body runs with the manager's auto-escaping off (see ae_set_auto_escape),
+   * so that its output is escaped once, as a whole.
+   * ----------------------------------------------------------------------- */
+int  ae_next_tag( t_ae_template_mgr mgr, CONST char* text, char** start, char** end );
+int  ae_dispatch_tag( t_ae_template_mgr mgr, CONST char* text, FILE* output );
+int  ae_repeat_compiled( t_ae_template_mgr mgr,
+                         CONST char* source,
+                         CONST char* token,
+                         CONST char* delim,
+                         t_ae_compiled_fn body,
+                         FILE* output );
+int  ae_repeat_body( t_ae_template_mgr mgr,
+                     CONST char* source,
+                     CONST char* token,
+                     CONST char* delim,
+                     t_ae_body_fn body,
+                     void* cookie,
+                     FILE* output );
+int  ae_escape_compiled( t_ae_template_mgr mgr, t_ae_compiled_fn body,
+                         int mode, FILE* output );
+int  ae_escape_body( t_ae_template_mgr mgr, t_ae_body_fn body, void* cookie,
+                     int mode, FILE* output );
+void ae_write_escaped( CONST char* text, int mode, FILE* output );
+
+  /* ----------------------------------------------------------------------- *
+   * ae_get_slice reads the offset and limit of a REPEAT2_SLICE (or
+   * STRUCT_SLICE) tag from fields 'which' and 'which'+1 of 'text', returning
+   * non-zero if the fields are there.  'offset' is 0 and 'limit' is -1 (no
+   * limit) unless the field is a number or the name of a tag, looked up in
+   * the manager, whose value is one.
+   * ----------------------------------------------------------------------- */
+int  ae_get_slice( t_ae_template_mgr mgr, CONST char* text, CONST char* delim,
+                   int which, int* offset, int* limit );
+
+/* ------------------------------------------------------------------------- */
+/* auto-escaping functions                                                   */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * With auto-escaping on (AE_ESCAPE_HTML or AE_ESCAPE_JS), a manager's
+   * replace tags, cyclical replace tags (the rows of REPEAT2), lazy tags and
+   * ENV tags write their values escaped, as ESCAPE-HTML or ESCAPE-JS would,
+   * with no need to wrap every reference in one.  A replace tag escapes its
+   * value the first time it is written in each mode and keeps the result, so
+   * a value referenced many times (or in every row of a loop) is escaped
+   * once.  AE_ESCAPE_NONE, the default, turns auto-escaping off.  Values
+   * read with ae_get_value, and so tested by IF and the like, are never
+   * escaped.  Nor is what EXEC and EXEC_SHARED write: a command's or a
+   * function's output is taken to be markup, and an untrusted one should be
+   * wrapped in ESCAPE-HTML or ESCAPE-JS.
+   *
+   * A raw tag is a replace tag that is never escaped, for values that are
+   * trusted markup.  ae_add_raw_tag adds one to the manager.
+   *
+   * An ESCAPE-HTML or ESCAPE-JS tag turns auto-escaping off for its body,
+   * which it escapes as a whole.  An overlay starts with its base's mode.
+   * ----------------------------------------------------------------------- */
+void     ae_set_auto_escape( t_ae_template_mgr mgr, int mode );
+int      ae_get_auto_escape( t_ae_template_mgr mgr );
+t_ae_tag ae_raw_tag( CONST char* name, CONST char* data );
+void     ae_add_raw_tag( t_ae_template_mgr mgr, CONST char* name, CONST char* value );
+
+/* ------------------------------------------------------------------------- */
+/* profiling functions                                                       */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * When profiling is turned on for a manager, every render records, for
+   * each tag name:
+   *
+   *   attempts      -- the number of times the tag was asked to apply text
+   *   calls         -- the number of times the tag recognised the text and
+   *                    its 'process' method was called
+   *   matches       -- the number of times the tag handled the text (so no
+   *                    other tag was asked).  This is less than 'calls' for
+   *                    tags like IF, whose process method declines the text
+   *                    when the condition is false.
+   *   inclusive_ns  -- time spent processing, including nested tags
+   *   exclusive_ns  -- as inclusive_ns, less the time spent in nested tags
+   *   bytes         -- bytes written while processing, including nested tags
+   *
+   * For tags with custom 'apply' methods, recognising and processing the
+   * text cannot be told apart, so 'calls' and 'matches' both count the
+   * times the apply method returned non-zero.
+   *
+   * The manager also records, per render, the number of streams processed
+   * (including nested ones), INCLUDE and EXEC/EXEC_SHARED counts, the
+   * deepest nesting reached, and the elapsed time and bytes written.
+   *
+   * Statistics are kept both for the most recent top-level render
+   * (AE_PROFILE_LAST) and cumulatively (AE_PROFILE_TOTAL) until
+   * ae_profile_reset is called.  Byte counts are measured with ftell; if
+   * the output stream is not seekable, it is wrapped in a counting stream
+   * for the duration of the render.  Sections rendered in parallel (see
+   * ae_set_parallel_sections) are not profiled individually.
+   *
+   * When profiling is off (the default), the only cost is one test per tag.
+   * ----------------------------------------------------------------------- */
+
+#define AE_PROFILE_LAST     ( 0 )
+#define AE_PROFILE_TOTAL    ( 1 )
+
+typedef struct {
+  CONST char* name;
+  long attempts;
+  long calls;
+  long matches;
+  long inclusive_ns;
+  long exclusive_ns;
+  long bytes;
+} t_ae_tag_stats;
+
+typedef struct {
+  long renders;
+  long streams;
+  long includes;
+  long execs;
+  int  max_depth;
+  long elapsed_ns;
+  long bytes;
+} t_ae_render_stats;
+
+void  ae_set_profiling( t_ae_template_mgr mgr, int enabled );
+void  ae_profile_reset( t_ae_template_mgr mgr );
+
+  /* ----------------------------------------------------------------------- *
+   * Retrieve the recorded statistics.  ae_profile_tag_count returns the
+   * number of tag names seen so far, and ae_profile_get_tag fills in the
+   * statistics for the one at the given index, returning 0 if the index is
+   * out of range.  The name in the returned statistics belongs to the
+   * manager and is valid until profiling is turned off.
+   *
+   * ae_profile_report writes the whole report as a JSON object.
+   * ----------------------------------------------------------------------- */
+int   ae_profile_tag_count( t_ae_template_mgr mgr );
+int   ae_profile_get_tag( t_ae_template_mgr mgr, int index, int which,
+                          t_ae_tag_stats* stats );
+void  ae_profile_get_render( t_ae_template_mgr mgr, int which,
+                             t_ae_render_stats* stats );
+void  ae_profile_report( t_ae_template_mgr mgr, int which, FILE* output );
+
+/* ------------------------------------------------------------------------- */
+/* tracing functions                                                         */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * A tracer writes a timeline of each render in the Chrome trace-event
+   * format, which chrome://tracing and Perfetto (ui.perfetto.dev) open.
+   * Every ae_process_stream call, every tag processed (named for the tag,
+   * with the first 32 bytes of its text), every ae_process_include (with
+   * the file name), every EXEC command and every EXEC_SHARED call is a
+   * span; spans nest as the calls did, on the thread that made them, so
+   * the sections of a parallel render each show on their own thread.
+   *
+   * ae_tracer_open opens a tracer writing to 'path'.  With AE_TRACE_PROCESS,
+   * every render traced goes in that one file, which is finished when the
+   * tracer is closed.  With AE_TRACE_RENDER, each top-level render goes in
+   * a file of its own, named 'path' followed by ".<pid>.<n>.json", where n
+   * counts the tracer's renders from 1.  Returns NULL if the file (in
+   * AE_TRACE_PROCESS mode) cannot be opened.
+   *
+   * ae_set_tracer traces the manager's renders with 'tracer' (or, if NULL,
+   * stops tracing them).  A tracer may serve any number of managers, on any
+   * threads; an overlay starts with its base's tracer.  Close the tracer
+   * only when no manager using it is rendering.  A render may be traced,
+   * profiled and recorded (see ae_record_template) all at once.
+   *
+   * When tracing is off (the default), the only cost is one test per tag.
+   * ----------------------------------------------------------------------- */
+
+#define AE_TRACE_PROCESS    ( 0 )
+#define AE_TRACE_RENDER     ( 1 )
+
+typedef void* t_ae_tracer;
+
+t_ae_tracer ae_tracer_open( CONST char* path, int mode );
+void        ae_tracer_close( t_ae_tracer tracer );
+void        ae_set_tracer( t_ae_template_mgr mgr, t_ae_tracer tracer );
+
+/* ------------------------------------------------------------------------- */
+/* incremental rendering functions                                           */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * A recorded render remembers, for each tag at the top level of the
+   * template, the output it produced and the names of the tags it depended
+   * on: the tag that applied it, every name looked up with ae_get_value or
+   * ae_get_tag while it was processed (IF conditions, REPEAT2 sources and
+   * the like), and those of all the tags nested in it, down through
+   * INCLUDEs.  A tag that no tag applied depends on its own text, in case a
+   * tag of that name is added later.
+   *
+   * ae_rerender then renders the template again, given the names of the
+   * tags whose values have changed (or been added or removed) since: only
+   * the top-level tags that depended on one of them are processed again,
+   * and every other part of the page is written from the record, byte for
+   * byte.  The record is brought up to date, so it can be re-rendered
+   * again.  If 'changed' is NULL, every tag is processed again.
+   *
+   * Tags whose output can change without any tag changing -- ENV, EXEC,
+   * EXEC_SHARED, and custom tags, which cannot be looked into -- are
+   * processed on every re-render, as are the top-level tags that contain
+   * them.  Included files are assumed not to change between renders.
+   *
+   * Parallel sections (see ae_set_parallel_sections) are not used for a
+   * recorded render or a re-render.  Both are profiled (ae_set_profiling)
+   * and traced (ae_set_tracer) tag by tag, as any other render is.
+   *
+   * ae_record_template and ae_record_buffer render as ae_process_template
+   * and ae_process_buffer do, and return the record, or NULL if the file
+   * could not be read.  The render's return code is kept in the record,
+   * and returned by ae_rerender.
+   *
+   * Example:
+   *
+   *   record = ae_record_template( mgr, "page.tem", output );
+   *   ...
+   *   ae_add_tag( mgr, "counter", "12" );
+   *   changed[ 0 ] = "counter";
+   *   changed[ 1 ] = NULL;
+   *   ae_rerender( record, mgr, changed, output );
+   * ----------------------------------------------------------------------- */
+
+typedef void* t_ae_record;
+
+t_ae_record ae_record_template( t_ae_template_mgr mgr, CONST char* file, FILE* output );
+t_ae_record ae_record_buffer( t_ae_template_mgr mgr, CONST char* buffer, FILE* output );
+int         ae_rerender( t_ae_record record, t_ae_template_mgr mgr,
+                         char** changed, FILE* output );
+void        ae_record_free( t_ae_record record );
+
+  /* ----------------------------------------------------------------------- *
+   * Returns the number of top-level tags in the record, and the number
+   * that the last ae_rerender (or the recorded render) processed.
+   * ----------------------------------------------------------------------- */
+int         ae_record_regions( t_ae_record record );
+int         ae_record_rendered( t_ae_record record );
+
 /* ------------------------------------------------------------------------- */
 /* tag manipulation functions                                                */
 /* ------------------------------------------------------------------------- */
@@ -322,6 +842,16 @@ t_ae_tag          ae_replace_tag( CONST char* name, CONST char* data );
    * ----------------------------------------------------------------------- */
 t_ae_tag          ae_cyclical_replace_tag( CONST char* name, CONST char* data, CONST char* delim );
 
+  /* ----------------------------------------------------------------------- *
+   * A cyclical replace tag splits its list into items when it is created.
+   * ae_cyclical_count returns the number of items (not counting any text
+   * after the last delimiter), and ae_cyclical_seek makes 'row' (from 0)
+   * the item the tag writes next, returning -1 if there is no such row.
+   * Both must only be given cyclical replace tags.
+   * ----------------------------------------------------------------------- */
+int               ae_cyclical_count( t_ae_tag tag );
+int               ae_cyclical_seek( t_ae_tag tag, int row );
+
   /* ----------------------------------------------------------------------- *
    * This function is used internally to create a generic "typed" tag,
    * that is to say, a tag like "IF", "INCLUDE", or "REPEAT2", rather than
@@ -345,8 +875,10 @@ t_ae_tag          ae_if_lt_tag( void );
 t_ae_tag          ae_if_le_tag( void );
 t_ae_tag          ae_if_gt_tag( void );
 t_ae_tag          ae_if_ge_tag( void );
+t_ae_tag          ae_if_expr_tag( void );
 t_ae_tag          ae_include_tag( void );
 t_ae_tag          ae_repeat_tag( void );
+t_ae_tag          ae_repeat_slice_tag( void );
 t_ae_tag          ae_env_tag( void );
 t_ae_tag          ae_exec_tag( void );
 
@@ -376,6 +908,63 @@ t_ae_tag          ae_shared_fn_tag_named( CONST char* name, CONST char* lib,
    * ----------------------------------------------------------------------- */
 t_ae_tag          ae_include_tag_named( CONST char* name, CONST char* file );
 
+  /* ----------------------------------------------------------------------- *
+   * Create a lazy tag, which behaves as a replace tag whose value is not
+   * known until it is wanted.  The first time the tag is rendered or its
+   * value is asked for (by ae_get_value, so also by the IF tags and as the
+   * source of a REPEAT2 or STRUCT), 'provider' is called with 'cookie' and
+   * the tag's name.  It returns the value, allocated with ae_malloc (the tag
+   * frees it), or NULL for none.  The value is kept, across renders, until
+   * ae_invalidate_tag is called for the tag, or the tag is destroyed.
+   *
+   * ae_add_lazy_tag creates a lazy tag and adds it to the manager.
+   *
+   * ae_invalidate_tag makes the named lazy tag in the manager (or every lazy
+   * tag, if 'name' is NULL) ask its provider again the next time its value
+   * is wanted.  Other tags are left alone.
+   * ----------------------------------------------------------------------- */
+t_ae_tag          ae_lazy_tag( CONST char* name, t_ae_lazy_fn provider, void* cookie );
+void              ae_add_lazy_tag( t_ae_template_mgr mgr, CONST char* name,
+                                   t_ae_lazy_fn provider, void* cookie );
+void              ae_invalidate_tag( t_ae_template_mgr mgr, CONST char* name );
+
+  /* ----------------------------------------------------------------------- *
+   * Create a row source: a tag that REPEAT2 and STRUCT (include/
+   * extensions.h) can name as their source, and that gives them one row at
+   * a time rather than a delimited string holding them all.  Before each
+   * row, the loop calls 'next_row' with 'cookie', the manager, and the
+   * NULL-terminated names of the fields it wants: REPEAT2's token, or
+   * STRUCT's field names.  The callback sets each of them (ae_add_tag, say)
+   * and returns non-zero, or returns 0 when there are no more rows.  Each
+   * row is rendered before the next is asked for, so nothing needs to hold
+   * more than one row.  A source is not rewound between loops; a callback
+   * that wants each loop to start over should do so when it returns 0.
+   *
+   * ae_add_row_source creates a row source and adds it to the manager.
+   *
+   * ae_is_row_source returns non-zero if the tag is a row source, and
+   * ae_next_row asks one for its next row (for custom loop tags), returning
+   * 1 for a row, 0 at the end, or -1 if the tag is not a row source.
+   * ----------------------------------------------------------------------- */
+t_ae_tag          ae_row_source_tag( CONST char* name, t_ae_row_fn next_row, void* cookie );
+void              ae_add_row_source( t_ae_template_mgr mgr, CONST char* name,
+                                     t_ae_row_fn next_row, void* cookie );
+int               ae_is_row_source( t_ae_tag tag );
+int               ae_next_row( t_ae_template_mgr mgr, t_ae_tag tag, char** fields );
+
+  /* ----------------------------------------------------------------------- *
+   * Create a condition tag: a check that IF_EXPR expressions can make by
+   * name, as 'name(argument)'.  The expression calls 'check' with 'cookie',
+   * the manager, and the argument as written (without quotes, if quoted),
+   * and the condition is true if it returns non-zero.  Rendered on its own,
+   * a condition tag writes nothing.
+   *
+   * ae_add_condition creates a condition tag and adds it to the manager.
+   * ----------------------------------------------------------------------- */
+t_ae_tag          ae_condition_tag( CONST char* name, t_ae_condition_fn check, void* cookie );
+void              ae_add_condition( t_ae_template_mgr mgr, CONST char* name,
+                                    t_ae_condition_fn check, void* cookie );
+
 /* ------------------------------------------------------------------------- */
 /* ToHTML Replacement Functions                                              */
 /* ------------------------------------------------------------------------- */
@@ -425,6 +1014,62 @@ void              ae_set_cookie( t_ae_template_mgr mgr,
 void              ae_set_html_output( t_ae_template_mgr mgr,
                                       FILE* output );
 
+/* ------------------------------------------------------------------------- */
+/* memory management functions                                               */
+/* ------------------------------------------------------------------------- */
+
+  /* ----------------------------------------------------------------------- *
+   * Every allocation the library makes goes through ae_malloc, ae_realloc
+   * and ae_free, which in turn call the functions given to ae_set_allocator
+   * (or malloc, realloc and free, if none have been given).  The context is
+   * passed as the first argument of each function.  Passing NULL functions
+   * restores the defaults.
+   *
+   * If accounting is turned on, the library counts allocations, frees, bytes
+   * allocated, live bytes and peak live bytes, process-wide and per manager.
+   * Allocations are charged to a manager while one of its functions (adding
+   * or removing tags, rendering) is running on the current thread, or while
+   * a worker renders one of its parallel sections
+   * (ae_set_parallel_sections); the per-render counts (AE_PROFILE_LAST)
+   * cover the most recent top-level render, and AE_PROFILE_TOTAL covers the
+   * manager's lifetime.  Passing a NULL manager to ae_get_alloc_stats returns
+   * the process-wide counts.  To know the size of each block, accounting
+   * adds a small header to every allocation.
+   *
+   * Both ae_set_allocator and ae_set_alloc_accounting must be called before
+   * any other library function, since memory must be freed by the allocator
+   * (and with the header) it was allocated with.
+   *
+   * Memory the library hands back to the application (from
+   * ae_get_field_alloc, ae_build_library_name, ae_strdup and so on) must be
+   * released with ae_free.  Plain free() only works when neither an
+   * allocator nor accounting has been set up.
+   * ----------------------------------------------------------------------- */
+
+typedef void* (*t_ae_malloc_fn)( void* context, size_t size );
+typedef void* (*t_ae_realloc_fn)( void* context, void* ptr, size_t size );
+typedef void  (*t_ae_free_fn)( void* context, void* ptr );
+
+typedef struct {
+  long allocs;
+  long frees;
+  long bytes;
+  long live_bytes;
+  long peak_bytes;
+} t_ae_alloc_stats;
+
+void  ae_set_allocator( t_ae_malloc_fn malloc_fn,
+                        t_ae_realloc_fn realloc_fn,
+                        t_ae_free_fn free_fn,
+                        void* context );
+void  ae_set_alloc_accounting( int enabled );
+void  ae_get_alloc_stats( t_ae_template_mgr mgr, int which, t_ae_alloc_stats* stats );
+
+void* ae_malloc( size_t size );
+void* ae_realloc( void* ptr, size_t size );
+void  ae_free( void* ptr );
+char* ae_strdup( CONST char* text );
+
 /* ------------------------------------------------------------------------- */
 /* miscellaneous utility functions                                           */
 /* ------------------------------------------------------------------------- */
@@ -438,7 +1083,7 @@ void              ae_set_html_output( t_ae_template_mgr mgr,
    * never be freed.
    *
    * ae_get_field_alloc returns a new null-terminated string that MUST be
-   * freed by the calling application.
+   * freed (with ae_free) by the calling application.
    *
    * ae_field_cmp compares the given field (terminated either by a NULL or
    * by the given delimiter) with the given null-terminated text, as with
@@ -457,6 +1102,14 @@ int   ae_field_cmp( CONST char* field, CONST char* text, CONST char* delim );
 int   ae_field_len( CONST char* field, CONST char* delim );
 char* ae_field_cpy( char* dest, CONST char* field, CONST char* delim );
 
+  /* ----------------------------------------------------------------------- *
+   * ae_is_decimal returns non-zero if the first 'length' bytes of text are
+   * a decimal number: an optional sign, digits with at most one '.', and an
+   * optional exponent.  Words such as "inf", "nan" or "0x1F" are not, so
+   * they may name tags.  If 'number' is non-NULL, the value is stored there.
+   * ----------------------------------------------------------------------- */
+int   ae_is_decimal( CONST char* text, int length, double* number );
+
   /* ----------------------------------------------------------------------- *
    * This function loads the given library (which must be either a fully
    * qualified path name, or the name of a library in LD_LIBRARY_PATH) and
@@ -469,8 +1122,8 @@ void* ae_load_dynamic_function( CONST char* lib, CONST char* func );
    * From the given root, builds the name of a shared library in a platform
    * dependant manner.  If 'dest' is non-NULL, the name will be copied into
    * 'dest' and 'dest' will be returned.  If 'dest' is NULL, a new buffer
-   * will be allocated and returned, which must be freed by the calling
-   * routine.
+   * will be allocated and returned, which must be freed (with ae_free) by the
+   * calling routine.
    * ----------------------------------------------------------------------- */
 char* ae_build_library_name( char* dest, CONST char* root );
 
@@ -483,7 +1136,8 @@ char* ae_build_library_name( char* dest, CONST char* root );
    * written to what 'original_fd' was originally writing to, but anything
    * written to original_fd after a call to this function will be written to
    * 'output' instead. This function returns a -1 if 'output' and
-   * 'original_fd' are the same.
+   * 'original_fd' are the same, or if 'output' has no file descriptor of its
+   * own (a memory or cookie stream) and so cannot be redirected to.
    *
    * ae_restore_file makes 'file' point to a copy of the given file-descriptor,
    * and then closes 'original_fd'.  Note that if 'original_fd' is negative,
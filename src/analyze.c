@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "analyze.h"
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the prefix shared by the row-number tags of REPEAT2 ("ae_row_num",
+   * "ae_row_num_2", ...) and STRUCT ("ae_row_number", ...), and of the
+   * row-count tags of REPEAT2 */
+#define ROW_NUM_PREFIX      "ae_row_num"
+#define ROW_COUNT_PREFIX    "ae_row_count"
+
+  /* how deeply includes are followed, in case the check for files already
+   * seen is defeated by naming one file two ways */
+#define MAX_INCLUDE_DEPTH   ( 32 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the lists are kept NULL-terminated, so that they can be handed out as
+   * they are */
+
+typedef struct {
+  char** names;
+  int    count;
+  int    alloced;
+} t_ae_name_list;
+
+typedef struct {
+  t_ae_template_mgr mgr;
+  CONST char*       start;
+  CONST char*       end;
+  CONST char*       delim;
+  t_ae_name_list    tags;
+  t_ae_name_list    env;
+  t_ae_name_list    files;
+  t_ae_name_list    bound;
+  int               repeats;
+  int               runs;
+  int               row_includes;
+} t_ae_refs_data;
+
+typedef struct {
+  CONST char* type;
+  int         data_field;
+} t_ae_refs_condition;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_refs_data* static_ae_refs_new( t_ae_template_mgr mgr );
+static void  static_ae_refs_scan( t_ae_refs_data* refs, CONST char* text, int depth );
+static void  static_ae_refs_tag( t_ae_refs_data* refs, CONST char* text, int depth );
+static void  static_ae_refs_include( t_ae_refs_data* refs, CONST char* file, int depth );
+static void  static_ae_refs_bind_list( t_ae_refs_data* refs, CONST char* list, CONST char* delim );
+static char* static_ae_refs_slice( t_ae_refs_data* refs, CONST char* text );
+static void  static_ae_refs_expr( t_ae_refs_data* refs, CONST char* expr, int length );
+static void  static_ae_refs_name( t_ae_refs_data* refs, CONST char* name, int length );
+static char* static_ae_refs_read( CONST char* file_name );
+static int   static_ae_names_add( t_ae_name_list* list, CONST char* name, int length );
+static int   static_ae_names_find( t_ae_name_list* list, CONST char* name, int length );
+static void  static_ae_names_truncate( t_ae_name_list* list, int count );
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+  /* the conditional tags: the token they test is always the first field,
+   * and the text they render is the field given */
+static t_ae_refs_condition static_conditions[] = {
+  { "IF",        2 },
+  { "IF_NOT",    2 },
+  { "IF_EQ",     3 },
+  { "IF_NOT_EQ", 3 },
+  { "IF_LT",     3 },
+  { "IF_LE",     3 },
+  { "IF_GT",     3 },
+  { "IF_GE",     3 },
+  { NULL,        0 }
+};
+
+  /* the words of an IF_EXPR expression that are not tag names */
+static CONST char* static_expr_keywords[] = {
+  "and", "or", "not", "eq", "ne", "lt", "le", "gt", "ge", NULL
+};
+
+/* ------------------------------------------------------------------------- */
+/* reference function implementations                                        */
+/* ------------------------------------------------------------------------- */
+
+t_ae_references ae_template_references( t_ae_template_mgr mgr, CONST char* file ) {
+  t_ae_refs_data* refs;
+  char* text;
+
+  text = static_ae_refs_read( file );
+  if( text == NULL ) {
+    return NULL;
+  }
+
+  /* the template itself counts as seen, so that including it again doesn't
+   * examine it twice (it is dropped from the list afterwards) */
+  refs = static_ae_refs_new( mgr );
+  static_ae_names_add( &refs->files, file, strlen( file ) );
+  static_ae_refs_scan( refs, text, 0 );
+  ae_free( text );
+
+  ae_free( refs->files.names[ 0 ] );
+  memmove( refs->files.names, refs->files.names + 1, refs->files.count * sizeof( char* ) );
+  refs->files.count--;
+
+  return refs;
+}
+
+t_ae_references ae_buffer_references( t_ae_template_mgr mgr, CONST char* buffer ) {
+  t_ae_refs_data* refs;
+
+  refs = static_ae_refs_new( mgr );
+  static_ae_refs_scan( refs, buffer, 0 );
+
+  return refs;
+}
+
+void ae_references_free( t_ae_references refs ) {
+  t_ae_refs_data* refs_data = (t_ae_refs_data*)refs;
+
+  if( refs_data == NULL ) return;
+  static_ae_names_truncate( &refs_data->tags, 0 );
+  static_ae_names_truncate( &refs_data->env, 0 );
+  static_ae_names_truncate( &refs_data->files, 0 );
+  static_ae_names_truncate( &refs_data->bound, 0 );
+  ae_free( refs_data->tags.names );
+  ae_free( refs_data->env.names );
+  ae_free( refs_data->files.names );
+  ae_free( refs_data->bound.names );
+  ae_free( refs_data );
+}
+
+CONST char** ae_references_tags( t_ae_references refs ) {
+  return (CONST char**)( (t_ae_refs_data*)refs )->tags.names;
+}
+
+CONST char** ae_references_env( t_ae_references refs ) {
+  return (CONST char**)( (t_ae_refs_data*)refs )->env.names;
+}
+
+CONST char** ae_references_files( t_ae_references refs ) {
+  return (CONST char**)( (t_ae_refs_data*)refs )->files.names;
+}
+
+int ae_references_uses( t_ae_references refs, CONST char* name ) {
+  return static_ae_names_find( &( (t_ae_refs_data*)refs )->tags, name, strlen( name ) );
+}
+
+int ae_references_runs( t_ae_references refs ) {
+  return ( ( (t_ae_refs_data*)refs )->runs > 0 );
+}
+
+int ae_references_row_includes( t_ae_references refs ) {
+  return ( ( (t_ae_refs_data*)refs )->row_includes > 0 );
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_refs_data* static_ae_refs_new( t_ae_template_mgr mgr ) {
+  t_ae_refs_data* refs;
+
+  refs = (t_ae_refs_data*)ae_malloc( sizeof( t_ae_refs_data ) );
+  memset( refs, 0, sizeof( t_ae_refs_data ) );
+  refs->mgr = mgr;
+  ae_get_delims( mgr, &refs->start, &refs->end, &refs->delim );
+
+  /* start every list off empty, rather than NULL */
+  static_ae_names_truncate( &refs->tags, 0 );
+  static_ae_names_truncate( &refs->env, 0 );
+  static_ae_names_truncate( &refs->files, 0 );
+  static_ae_names_truncate( &refs->bound, 0 );
+
+  return refs;
+}
+
+static void static_ae_refs_scan( t_ae_refs_data* refs, CONST char* text, int depth ) {
+  char* start;
+  char* end;
+  char* tag_text;
+  int   start_delim_len;
+
+  /* split the text as ae_process_stream would, and examine each tag (an
+   * unclosed tag is never applied, so is of no interest) */
+  start_delim_len = strlen( refs->start );
+  while( ae_next_tag( refs->mgr, text, &start, &end ) > 0 ) {
+    start += start_delim_len;
+    tag_text = (char*)ae_malloc( end - start + 1 );
+    memcpy( tag_text, start, end - start );
+    tag_text[ end - start ] = 0;
+
+    static_ae_refs_tag( refs, tag_text, depth );
+    ae_free( tag_text );
+
+    text = end + strlen( refs->end );
+  }
+}
+
+static void static_ae_refs_tag( t_ae_refs_data* refs, CONST char* text, int depth ) {
+  CONST char* delim = refs->delim;
+  CONST char* value;
+  char* f1;
+  char* f2;
+  char* f3;
+  char* f4;
+  char* list;
+  char* list_delim;
+  int   bound;
+  int   sliced;
+  int   i;
+
+  f1 = ae_get_field( text, delim, 1 );
+  f2 = ( f1 ? ae_get_field( text, delim, 2 ) : NULL );
+  f3 = ( f2 ? ae_get_field( text, delim, 3 ) : NULL );
+  f4 = ( f3 ? ae_get_field( text, delim, 4 ) : NULL );
+
+  /* a tag without fields can only be a replace tag (or a cyclical one) */
+  if( f1 == NULL ) {
+    static_ae_refs_name( refs, text, strlen( text ) );
+    return;
+  }
+
+  /* IF=tok=data, IF_xx=tok=value=data, and so on */
+  for( i = 0; static_conditions[ i ].type != NULL; i++ ) {
+    if( ae_field_cmp( text, static_conditions[ i ].type, delim ) == 0 ) {
+      static_ae_refs_name( refs, f1, ae_field_len( f1, delim ) );
+      f4 = ( static_conditions[ i ].data_field == 2 ? f2 : f3 );
+      if( f4 != NULL ) {
+        static_ae_refs_scan( refs, f4, depth );
+      }
+      return;
+    }
+  }
+
+  /* IF_EXPR=expression=data */
+  if( ae_field_cmp( text, "IF_EXPR", delim ) == 0 ) {
+    static_ae_refs_expr( refs, f1, ae_field_len( f1, delim ) );
+    if( f2 != NULL ) {
+      static_ae_refs_scan( refs, f2, depth );
+    }
+    return;
+  }
+
+  /* INCLUDE=tok, where 'tok' names a tag holding the file name, or is the
+   * file name itself -- unless an enclosing REPEAT2 or STRUCT binds it, when
+   * each row names a file that can't be known here */
+  if( ae_field_cmp( text, "INCLUDE", delim ) == 0 ) {
+    if( static_ae_names_find( &refs->bound, f1, strlen( f1 ) ) ) {
+      refs->row_includes++;
+      return;
+    }
+    static_ae_refs_name( refs, f1, strlen( f1 ) );
+    value = ( ae_get_tag( refs->mgr, f1 ) != NULL ? ae_get_value( refs->mgr, f1 ) : f1 );
+    if( value != NULL ) {
+      static_ae_refs_include( refs, value, depth );
+    }
+    return;
+  }
+
+  /* REPEAT2=source=newtok=delim=data, and REPEAT2_SLICE, with an offset and
+   * limit before the data */
+  sliced = ( ae_field_cmp( text, "REPEAT2_SLICE", delim ) == 0 );
+  if( sliced || ae_field_cmp( text, "REPEAT2", delim ) == 0 ) {
+    static_ae_refs_name( refs, f1, ae_field_len( f1, delim ) );
+    if( sliced && f4 != NULL ) {
+      f4 = static_ae_refs_slice( refs, text );
+    }
+    if( f4 != NULL ) {
+      bound = refs->bound.count;
+      static_ae_names_add( &refs->bound, f2, ae_field_len( f2, delim ) );
+      refs->repeats++;
+      static_ae_refs_scan( refs, f4, depth );
+      refs->repeats--;
+      static_ae_names_truncate( &refs->bound, bound );
+    }
+    return;
+  }
+
+  /* STRUCT=fields=source=delim=data, where 'fields' is either a tag holding
+   * the list of field names or the list itself (which ends with 'delim') */
+  sliced = ( ae_field_cmp( text, "STRUCT_SLICE", delim ) == 0 );
+  if( sliced || ae_field_cmp( text, "STRUCT", delim ) == 0 ) {
+    if( f2 != NULL ) {
+      static_ae_refs_name( refs, f2, ae_field_len( f2, delim ) );
+    }
+    if( sliced && f4 != NULL ) {
+      f4 = static_ae_refs_slice( refs, text );
+    }
+    if( f4 != NULL ) {
+      list = ae_get_field_alloc( text, delim, 1 );
+      list_delim = ae_get_field_alloc( text, delim, 3 );
+
+      bound = refs->bound.count;
+      if( *list_delim == 0 || strstr( list, list_delim ) == NULL ) {
+        static_ae_refs_name( refs, list, strlen( list ) );
+        value = ae_get_value( refs->mgr, list );
+        if( value != NULL && *list_delim != 0 ) {
+          static_ae_refs_bind_list( refs, value, list_delim );
+        }
+      } else {
+        static_ae_refs_bind_list( refs, list, list_delim );
+      }
+      refs->repeats++;
+      static_ae_refs_scan( refs, f4, depth );
+      refs->repeats--;
+      static_ae_names_truncate( &refs->bound, bound );
+
+      ae_free( list );
+      ae_free( list_delim );
+    }
+    return;
+  }
+
+  /* ESCAPE-HTML=data and ESCAPE-JS=data */
+  if( ae_field_cmp( text, "ESCAPE-HTML", delim ) == 0 || ae_field_cmp( text, "ESCAPE-JS", delim ) == 0 ) {
+    static_ae_refs_scan( refs, f1, depth );
+    return;
+  }
+
+  /* ENV=env, where 'env' is the rest of the tag */
+  if( ae_field_cmp( text, "ENV", delim ) == 0 ) {
+    static_ae_names_add( &refs->env, f1, strlen( f1 ) );
+    return;
+  }
+
+  /* EXEC=tok and EXEC_SHARED=tok name the tag they run */
+  if( ae_field_cmp( text, "EXEC", delim ) == 0 ) {
+    static_ae_refs_name( refs, f1, strlen( f1 ) );
+    refs->runs++;
+    return;
+  }
+  if( ae_field_cmp( text, "EXEC_SHARED", delim ) == 0 ) {
+    static_ae_refs_name( refs, f1, ae_field_len( f1, delim ) );
+    refs->runs++;
+    return;
+  }
+
+  /* anything else is a custom tag, answering to its type */
+  static_ae_refs_name( refs, text, ae_field_len( text, delim ) );
+}
+
+static void static_ae_refs_include( t_ae_refs_data* refs, CONST char* file, int depth ) {
+  char* text;
+
+  if( !static_ae_names_add( &refs->files, file, strlen( file ) ) ) return;
+  if( depth >= MAX_INCLUDE_DEPTH ) return;
+
+  text = static_ae_refs_read( file );
+  if( text == NULL ) return;
+  static_ae_refs_scan( refs, text, depth+1 );
+  ae_free( text );
+}
+
+static void static_ae_refs_bind_list( t_ae_refs_data* refs, CONST char* list, CONST char* delim ) {
+  CONST char* end;
+
+  /* the names in a STRUCT field list each end with the delimiter */
+  while( ( end = strstr( list, delim ) ) != NULL ) {
+    static_ae_names_add( &refs->bound, list, end - list );
+    list = end + strlen( delim );
+  }
+}
+
+static char* static_ae_refs_slice( t_ae_refs_data* refs, CONST char* text ) {
+  char* field;
+  int length;
+  int i;
+
+  /* the offset and limit of a REPEAT2_SLICE or STRUCT_SLICE may name tags;
+   * returns the data after them */
+  for( i = 4; i < 6; i++ ) {
+    field = ae_get_field( text, refs->delim, i );
+    if( field == NULL ) return NULL;
+    length = ae_field_len( field, refs->delim );
+    if( (int)strspn( field, "0123456789" ) < length ) {
+      static_ae_refs_name( refs, field, length );
+    }
+  }
+
+  return ae_get_field( text, refs->delim, 6 );
+}
+
+static void static_ae_refs_expr( t_ae_refs_data* refs, CONST char* expr, int length ) {
+  CONST char* limit = expr + length;
+  CONST char* word;
+  int   i;
+
+  /* every word of an expression that is not an operator or a number names
+   * a tag, or a condition tag if a parenthesis follows it.  A condition's
+   * argument, like a quoted string, is taken as it is written. */
+  while( expr < limit ) {
+    if( isspace( (unsigned char)*expr ) || *expr == '(' || *expr == ')' ) {
+      expr++;
+      continue;
+    }
+    if( *expr == '"' || *expr == '\'' ) {
+      word = memchr( expr + 1, *expr, limit - expr - 1 );
+      expr = ( word != NULL ? word + 1 : limit );
+      continue;
+    }
+
+    word = expr;
+    while( expr < limit && !isspace( (unsigned char)*expr ) &&
+           *expr != '(' && *expr != ')' && *expr != '"' && *expr != '\'' )
+    {
+      expr++;
+    }
+
+    for( i = 0; static_expr_keywords[ i ] != NULL; i++ ) {
+      if( (int)strlen( static_expr_keywords[ i ] ) == expr - word &&
+          strncmp( word, static_expr_keywords[ i ], expr - word ) == 0 )
+      {
+        break;
+      }
+    }
+    if( static_expr_keywords[ i ] != NULL ) continue;
+
+    if( ae_is_decimal( word, expr - word, NULL ) ) continue;
+
+    static_ae_refs_name( refs, word, expr - word );
+
+    /* skip a condition's argument */
+    while( expr < limit && isspace( (unsigned char)*expr ) ) expr++;
+    if( expr < limit && *expr == '(' ) {
+      word = memchr( expr, ')', limit - expr );
+      expr = ( word != NULL ? word + 1 : limit );
+    }
+  }
+}
+
+static void static_ae_refs_name( t_ae_refs_data* refs, CONST char* name, int length ) {
+  /* names defined by an enclosing REPEAT2 or STRUCT are not the caller's to
+   * supply */
+  if( static_ae_names_find( &refs->bound, name, length ) ) return;
+  if( refs->repeats > 0 &&
+      ( ( length >= (int)strlen( ROW_NUM_PREFIX ) &&
+          strncmp( name, ROW_NUM_PREFIX, strlen( ROW_NUM_PREFIX ) ) == 0 ) ||
+        ( length >= (int)strlen( ROW_COUNT_PREFIX ) &&
+          strncmp( name, ROW_COUNT_PREFIX, strlen( ROW_COUNT_PREFIX ) ) == 0 ) ) )
+  {
+    return;
+  }
+
+  static_ae_names_add( &refs->tags, name, length );
+}
+
+static char* static_ae_refs_read( CONST char* file_name ) {
+  t_ae_stream stream;
+  char* text;
+  int   size;
+
+  stream = ae_stream_open_file( file_name );
+  if( stream == NULL ) {
+    return NULL;
+  }
+  size = ae_stream_get_length( stream );
+  text = (char*)ae_malloc( size+1 );
+  size = ae_stream_read( stream, text, size );
+  text[ size > 0 ? size : 0 ] = 0;
+  ae_stream_close( stream );
+
+  return text;
+}
+
+static int static_ae_names_add( t_ae_name_list* list, CONST char* name, int length ) {
+  char* copy;
+
+  /* returns 1 if the name was added, or 0 if it was already there */
+  if( static_ae_names_find( list, name, length ) ) return 0;
+
+  if( list->count + 1 >= list->alloced ) {
+    list->alloced = list->alloced * 2 + 8;
+    list->names = (char**)ae_realloc( list->names, list->alloced * sizeof( char* ) );
+  }
+  copy = (char*)ae_malloc( length + 1 );
+  memcpy( copy, name, length );
+  copy[ length ] = 0;
+  list->names[ list->count++ ] = copy;
+  list->names[ list->count ] = NULL;
+
+  return 1;
+}
+
+static int static_ae_names_find( t_ae_name_list* list, CONST char* name, int length ) {
+  int i;
+
+  for( i = 0; i < list->count; i++ ) {
+    if( strncmp( list->names[ i ], name, length ) == 0 && list->names[ i ][ length ] == 0 ) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void static_ae_names_truncate( t_ae_name_list* list, int count ) {
+  /* drop the names after the first 'count' (making sure there is room for
+   * the terminator, for a list that has never had any) */
+  while( list->count > count ) {
+    ae_free( list->names[ --list->count ] );
+  }
+  if( list->alloced == 0 ) {
+    list->alloced = 8;
+    list->names = (char**)ae_realloc( list->names, list->alloced * sizeof( char* ) );
+  }
+  list->names[ list->count ] = NULL;
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "bundle.h"
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* each worker owns the records [next, end).  'next' is only ever advanced
+   * with an atomic fetch-and-add, by the owner or by a thief, so every record
+   * below 'end' is handed out exactly once. */
+
+typedef struct {
+  volatile int next;
+  int          end;
+} t_ae_batch_range;
+
+  /* the template is compiled once, into 'bundle' (held in 'compiled'), and
+   * rendered from that; 'text' is kept for any record whose manager is
+   * given delimiters other than 'delims', which the bundle was split with. */
+
+typedef struct {
+  CONST char*        tem_file;
+  char*              text;
+  char*              compiled;
+  t_ae_bundle        bundle;
+  t_ae_template_mgr  delims;
+  t_ae_tag_set*      sets;
+  t_ae_batch_fill_fn fill;
+  void*              fill_cookie;
+  t_ae_batch_emit_fn emit;
+  void*              emit_cookie;
+  t_ae_batch_range*  ranges;
+  int                threads;
+  volatile int       failures;
+} t_ae_batch;
+
+typedef struct {
+  t_ae_batch* batch;
+  int         id;
+} t_ae_batch_worker;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static void* static_ae_batch_worker( void* arg );
+static int   static_ae_batch_claim( t_ae_batch* batch, int id );
+static int   static_ae_batch_render( t_ae_batch* batch, int record );
+static char* static_ae_batch_load( CONST char* tem_file );
+static t_ae_bundle static_ae_batch_compile( t_ae_batch* batch );
+static int   static_ae_batch_same_delims( t_ae_template_mgr a, t_ae_template_mgr b );
+
+/* ------------------------------------------------------------------------- */
+/* batch function implementations                                            */
+/* ------------------------------------------------------------------------- */
+
+int ae_render_batch( CONST char* tem_file,
+                     t_ae_tag_set* sets,
+                     t_ae_batch_fill_fn fill,
+                     void* fill_cookie,
+                     int count,
+                     int threads,
+                     t_ae_batch_emit_fn emit,
+                     void* emit_cookie )
+{
+  t_ae_batch batch;
+  t_ae_batch_worker* workers;
+  pthread_t* ids;
+  int started;
+  int i;
+
+  batch.tem_file = tem_file;
+  batch.text = static_ae_batch_load( tem_file );
+  if( batch.text == NULL ) {
+    return -1;
+  }
+  batch.delims = ae_template_mgr_new();
+  batch.bundle = static_ae_batch_compile( &batch );
+
+  if( threads < 1 ) {
+    threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+    if( threads < 1 ) threads = 1;
+  }
+  if( threads > count ) {
+    threads = ( count > 0 ? count : 1 );
+  }
+
+  batch.sets = sets;
+  batch.fill = fill;
+  batch.fill_cookie = fill_cookie;
+  batch.emit = emit;
+  batch.emit_cookie = emit_cookie;
+  batch.threads = threads;
+  batch.failures = 0;
+
+  /* deal the records out evenly, the first (count % threads) workers getting
+   * one extra */
+  batch.ranges = (t_ae_batch_range*)ae_malloc( threads * sizeof( t_ae_batch_range ) );
+  for( i = 0; i < threads; i++ ) {
+    batch.ranges[ i ].next = (int)( (long)count * i / threads );
+    batch.ranges[ i ].end  = (int)( (long)count * ( i+1 ) / threads );
+  }
+
+  workers = (t_ae_batch_worker*)ae_malloc( threads * sizeof( t_ae_batch_worker ) );
+  ids = (pthread_t*)ae_malloc( threads * sizeof( pthread_t ) );
+
+  /* worker 0 is the calling thread.  If a thread can't be started, its
+   * records are simply stolen by the others. */
+  started = 0;
+  for( i = 1; i < threads; i++ ) {
+    workers[ i ].batch = &batch;
+    workers[ i ].id = i;
+    if( pthread_create( &ids[ started ], NULL, static_ae_batch_worker, &workers[ i ] ) == 0 ) {
+      started++;
+    }
+  }
+
+  workers[ 0 ].batch = &batch;
+  workers[ 0 ].id = 0;
+  static_ae_batch_worker( &workers[ 0 ] );
+
+  for( i = 0; i < started; i++ ) {
+    pthread_join( ids[ i ], NULL );
+  }
+
+  ae_free( ids );
+  ae_free( workers );
+  ae_free( batch.ranges );
+  ae_bundle_close( batch.bundle );
+  free( batch.compiled );
+  ae_template_mgr_done( batch.delims );
+  ae_free( batch.text );
+
+  return batch.failures;
+}
+
+int ae_batch_emit_files( void* cookie, int record, CONST char* data, int length ) {
+  char  file_name[ 1024 ];
+  FILE* output;
+  int   rc = 0;
+
+  snprintf( file_name, sizeof( file_name ), (CONST char*)cookie, record );
+  output = fopen( file_name, "w" );
+  if( output == NULL ) {
+    return -1;
+  }
+  if( fwrite( data, 1, length, output ) != (size_t)length ) {
+    rc = -1;
+  }
+  if( fclose( output ) != 0 ) {
+    rc = -1;
+  }
+
+  return rc;
+}
+
+int ae_batch_emit_buffers( void* cookie, int record, CONST char* data, int length ) {
+  char** buffers = (char**)cookie;
+
+  buffers[ record ] = (char*)ae_malloc( length+1 );
+  if( buffers[ record ] == NULL ) {
+    return -1;
+  }
+  memcpy( buffers[ record ], data, length );
+  buffers[ record ][ length ] = 0;
+
+  return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static void* static_ae_batch_worker( void* arg ) {
+  t_ae_batch_worker* worker = (t_ae_batch_worker*)arg;
+  int record;
+
+  while( ( record = static_ae_batch_claim( worker->batch, worker->id ) ) >= 0 ) {
+    if( static_ae_batch_render( worker->batch, record ) != 0 ) {
+      __sync_fetch_and_add( &worker->batch->failures, 1 );
+    }
+  }
+
+  return NULL;
+}
+
+static int static_ae_batch_claim( t_ae_batch* batch, int id ) {
+  t_ae_batch_range* range;
+  int record;
+  int victim;
+  int left;
+  int most;
+  int i;
+
+  /* take the next record of our own, if there is one */
+  range = &batch->ranges[ id ];
+  if( range->next < range->end ) {
+    record = __sync_fetch_and_add( &range->next, 1 );
+    if( record < range->end ) return record;
+  }
+
+  /* otherwise steal from whoever has the most left, until nobody has any */
+  for( ;; ) {
+    victim = -1;
+    most = 0;
+    for( i = 0; i < batch->threads; i++ ) {
+      left = batch->ranges[ i ].end - batch->ranges[ i ].next;
+      if( left > most ) {
+        most = left;
+        victim = i;
+      }
+    }
+    if( victim < 0 ) return -1;
+
+    range = &batch->ranges[ victim ];
+    record = __sync_fetch_and_add( &range->next, 1 );
+    if( record < range->end ) return record;
+  }
+}
+
+static int static_ae_batch_render( t_ae_batch* batch, int record ) {
+  t_ae_template_mgr mgr;
+  FILE*  output;
+  char*  buffer = NULL;
+  size_t length = 0;
+  int    rc = 0;
+
+  /* every record gets a manager of its own, so tags from one record can never
+   * leak into the next */
+  mgr = ae_template_mgr_new();
+  if( batch->sets != NULL ) {
+    ae_add_tags( mgr, batch->sets[ record ].names, batch->sets[ record ].values );
+  } else if( batch->fill != NULL ) {
+    rc = batch->fill( batch->fill_cookie, record, mgr );
+  }
+
+  if( rc == 0 ) {
+    output = open_memstream( &buffer, &length );
+    if( output == NULL ) {
+      rc = -1;
+    } else {
+      if( batch->bundle != NULL && static_ae_batch_same_delims( mgr, batch->delims ) ) {
+        rc = ae_bundle_process( batch->bundle, mgr, batch->tem_file, output );
+      } else {
+        rc = ae_process_buffer( mgr, batch->text, output );
+      }
+      fclose( output );
+      if( rc == 0 && batch->emit != NULL ) {
+        rc = batch->emit( batch->emit_cookie, record, buffer, (int)length );
+      }
+      free( buffer );
+    }
+  }
+
+  ae_template_mgr_done( mgr );
+  return rc;
+}
+
+static char* static_ae_batch_load( CONST char* tem_file ) {
+  t_ae_stream stream;
+  char* text;
+  int   size;
+
+  /* read the template once, for any record that can't use the compiled copy */
+  stream = ae_stream_open_file( tem_file );
+  if( stream == NULL ) {
+    return NULL;
+  }
+  size = ae_stream_get_length( stream );
+  text = (char*)ae_malloc( size+1 );
+  size = ae_stream_read( stream, text, size );
+  text[ size > 0 ? size : 0 ] = 0;
+  ae_stream_close( stream );
+
+  return text;
+}
+
+static t_ae_bundle static_ae_batch_compile( t_ae_batch* batch ) {
+  t_ae_bundle bundle = NULL;
+  FILE*  output;
+  char*  files[ 1 ];
+  size_t length = 0;
+  int    rc;
+
+  /* split the template into instructions once, for every worker to render
+   * from; if that can't be done, the records are rendered from the text */
+  batch->compiled = NULL;
+  output = open_memstream( &batch->compiled, &length );
+  if( output == NULL ) {
+    return NULL;
+  }
+  files[ 0 ] = (char*)batch->tem_file;
+  rc = ae_bundle_write( batch->delims, files, 1, output );
+  if( fclose( output ) == 0 && rc == 0 ) {
+    bundle = ae_bundle_open_buffer( batch->compiled, length );
+  }
+  if( bundle == NULL ) {
+    free( batch->compiled );
+    batch->compiled = NULL;
+  }
+
+  return bundle;
+}
+
+static int static_ae_batch_same_delims( t_ae_template_mgr a, t_ae_template_mgr b ) {
+  CONST char* a_start;
+  CONST char* a_end;
+  CONST char* a_delim;
+  CONST char* b_start;
+  CONST char* b_end;
+  CONST char* b_delim;
+
+  ae_get_delims( a, &a_start, &a_end, &a_delim );
+  ae_get_delims( b, &b_start, &b_end, &b_delim );
+  return ( strcmp( a_start, b_start ) == 0 &&
+           strcmp( a_end, b_end ) == 0 &&
+           strcmp( a_delim, b_delim ) == 0 );
+}
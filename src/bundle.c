@@ -0,0 +1,793 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bundle.h"
+#include "gzip.h"
+#include "minify.h"
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+#define BUNDLE_MAGIC        "AEBUNDLE"
+#define BUNDLE_BYTE_ORDER   ( 0x01020304 )
+#define BUNDLE_DELIM_SIZE   ( 16 )
+
+#define OP_TEXT             ( 0 )
+#define OP_TAG              ( 1 )
+#define OP_IF               ( 2 )
+#define OP_IF_NOT           ( 3 )
+#define OP_COMPARE          ( 4 )
+#define OP_INCLUDE          ( 5 )
+#define OP_REPEAT           ( 6 )
+#define OP_ESCAPE           ( 7 )
+
+#define COMP_TYPE_EQ        ( 0 )
+#define COMP_TYPE_NE        ( 1 )
+#define COMP_TYPE_LT        ( 2 )
+#define COMP_TYPE_LE        ( 3 )
+#define COMP_TYPE_GT        ( 4 )
+#define COMP_TYPE_GE        ( 5 )
+
+  /* set in a template's index entry if it has an unclosed tag */
+#define ENTRY_UNCLOSED      ( 0x01 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* a bundle is laid out as the header, the index (sorted by path), the
+   * instructions of every template, and a pool of null-terminated strings
+   * that the index and instructions refer to by offset.  Everything is in
+   * the byte order of the machine that wrote it. */
+
+typedef struct {
+  char         magic[ 8 ];
+  unsigned int version;
+  unsigned int tag_set;
+  unsigned int byte_order;
+  unsigned int header_size;
+  char         tag_start[ BUNDLE_DELIM_SIZE ];
+  char         tag_end[ BUNDLE_DELIM_SIZE ];
+  char         field_delim[ BUNDLE_DELIM_SIZE ];
+  unsigned int templates;
+  unsigned int index_offset;
+  unsigned int code_offset;
+  unsigned int code_count;
+  unsigned int pool_offset;
+  unsigned int pool_size;
+  unsigned int total_size;
+} t_ae_bundle_header;
+
+typedef struct {
+  unsigned int path;
+  unsigned int first;
+  unsigned int count;
+  unsigned int flags;
+} t_ae_bundle_entry;
+
+  /* 'skip' is the number of instructions that follow which make up the data
+   * of an IF, COMPARE, REPEAT or ESCAPE instruction.  For TEXT, 'a' and 'b'
+   * are the text's offset and length, and 'c' is zero or one more than the
+   * offset of the text compressed (see include/gzip.h). */
+
+typedef struct {
+  unsigned int op;
+  unsigned int a;
+  unsigned int b;
+  unsigned int c;
+  unsigned int skip;
+} t_ae_bundle_op;
+
+typedef struct {
+  char*               base;
+  size_t              size;
+  int                 mapped;
+  t_ae_bundle_header* header;
+  t_ae_bundle_entry*  index;
+  t_ae_bundle_op*     code;
+  char*               pool;
+} t_ae_bundle_data;
+
+typedef struct {
+  t_ae_bundle_data* bundle;
+  unsigned int      first;
+  unsigned int      count;
+} t_ae_bundle_run;
+
+typedef struct {
+  t_ae_template_mgr  mgr;
+  CONST char*        start;
+  CONST char*        end;
+  CONST char*        delim;
+  t_ae_bundle_op*    code;
+  unsigned int       code_count;
+  unsigned int       code_alloced;
+  char*              pool;
+  unsigned int       pool_size;
+  unsigned int       pool_alloced;
+} t_ae_bundle_writer;
+
+typedef struct {
+  CONST char* type;
+  int         comp_type;
+} t_ae_bundle_comparison;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static unsigned int static_ae_bundle_emit( t_ae_bundle_writer* writer, unsigned int op,
+                                           unsigned int a, unsigned int b, unsigned int c );
+static unsigned int static_ae_bundle_string( t_ae_bundle_writer* writer, CONST char* text, int length );
+static int   static_ae_bundle_compile( t_ae_bundle_writer* writer, char* text );
+static void  static_ae_bundle_compile_tag( t_ae_bundle_writer* writer, char* text );
+static void  static_ae_bundle_text( t_ae_bundle_writer* writer, CONST char* text );
+static char* static_ae_bundle_read( CONST char* file_name );
+static CONST char* static_ae_bundle_path( CONST char* path );
+static int   static_ae_bundle_cmp_paths( CONST void* a, CONST void* b );
+
+static t_ae_bundle_data* static_ae_bundle_load( char* base, size_t size, int mapped );
+static int   static_ae_bundle_valid( t_ae_bundle_data* bundle );
+static t_ae_bundle_entry* static_ae_bundle_find( t_ae_bundle_data* bundle, CONST char* path );
+static int   static_ae_bundle_matches( t_ae_bundle_data* bundle, t_ae_template_mgr mgr );
+static int   static_ae_bundle_run( void* cookie, t_ae_template_mgr mgr, FILE* output );
+static int   static_ae_bundle_include( void* cookie, t_ae_template_mgr mgr,
+                                       CONST char* file, FILE* output );
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_bundle_comparison static_comparisons[] = {
+  { "IF_EQ",     COMP_TYPE_EQ },
+  { "IF_NOT_EQ", COMP_TYPE_NE },
+  { "IF_LT",     COMP_TYPE_LT },
+  { "IF_LE",     COMP_TYPE_LE },
+  { "IF_GT",     COMP_TYPE_GT },
+  { "IF_GE",     COMP_TYPE_GE },
+  { NULL,        0 }
+};
+
+/* ------------------------------------------------------------------------- */
+/* bundle function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+int ae_bundle_write( t_ae_template_mgr mgr, char** files, int count, FILE* output ) {
+  t_ae_bundle_writer writer;
+  t_ae_bundle_header header;
+  t_ae_bundle_entry* entries;
+  CONST char** paths;
+  char* text;
+  char* minified;
+  int   templates;
+  int   rc = 0;
+  int   i;
+
+  memset( &writer, 0, sizeof( writer ) );
+  writer.mgr = mgr;
+  ae_get_delims( mgr, &writer.start, &writer.end, &writer.delim );
+  if( strlen( writer.start ) >= BUNDLE_DELIM_SIZE ||
+      strlen( writer.end ) >= BUNDLE_DELIM_SIZE ||
+      strlen( writer.delim ) >= BUNDLE_DELIM_SIZE )
+  {
+    return -1;
+  }
+
+  /* the index is searched by path, so compile the templates in path order
+   * (dropping any named twice) */
+  paths = (CONST char**)ae_malloc( ( count > 0 ? count : 1 ) * sizeof( char* ) );
+  for( i = 0; i < count; i++ ) {
+    paths[ i ] = static_ae_bundle_path( files[ i ] );
+  }
+  qsort( paths, count, sizeof( char* ), static_ae_bundle_cmp_paths );
+
+  entries = (t_ae_bundle_entry*)ae_malloc( ( count > 0 ? count : 1 ) * sizeof( t_ae_bundle_entry ) );
+  templates = 0;
+  for( i = 0; i < count && rc == 0; i++ ) {
+    if( i > 0 && strcmp( paths[ i ], paths[ i-1 ] ) == 0 ) continue;
+
+    text = static_ae_bundle_read( paths[ i ] );
+    if( text == NULL ) {
+      rc = -1;
+      break;
+    }
+    if( ae_get_minify( mgr ) ) {
+      minified = ae_minify_html( mgr, text );
+      ae_free( text );
+      text = minified;
+    }
+    entries[ templates ].path = static_ae_bundle_string( &writer, paths[ i ], strlen( paths[ i ] ) );
+    entries[ templates ].first = writer.code_count;
+    entries[ templates ].flags = ( static_ae_bundle_compile( &writer, text ) < 0 ? ENTRY_UNCLOSED : 0 );
+    entries[ templates ].count = writer.code_count - entries[ templates ].first;
+    templates++;
+    ae_free( text );
+  }
+
+  if( rc == 0 ) {
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, BUNDLE_MAGIC, sizeof( header.magic ) );
+    header.version = AE_BUNDLE_VERSION;
+    header.tag_set = ae_standard_tags_checksum();
+    header.byte_order = BUNDLE_BYTE_ORDER;
+    header.header_size = sizeof( header );
+    strcpy( header.tag_start, writer.start );
+    strcpy( header.tag_end, writer.end );
+    strcpy( header.field_delim, writer.delim );
+    header.templates = templates;
+    header.index_offset = sizeof( header );
+    header.code_offset = header.index_offset + templates * sizeof( t_ae_bundle_entry );
+    header.code_count = writer.code_count;
+    header.pool_offset = header.code_offset + writer.code_count * sizeof( t_ae_bundle_op );
+    header.pool_size = writer.pool_size;
+    header.total_size = header.pool_offset + writer.pool_size;
+
+    if( fwrite( &header, sizeof( header ), 1, output ) != 1 ||
+        fwrite( entries, sizeof( t_ae_bundle_entry ), templates, output ) != (size_t)templates ||
+        fwrite( writer.code, sizeof( t_ae_bundle_op ), writer.code_count, output ) != writer.code_count ||
+        fwrite( writer.pool, 1, writer.pool_size, output ) != writer.pool_size ||
+        fflush( output ) != 0 )
+    {
+      rc = -1;
+    }
+  }
+
+  ae_free( entries );
+  ae_free( paths );
+  ae_free( writer.code );
+  ae_free( writer.pool );
+
+  return rc;
+}
+
+t_ae_bundle ae_bundle_open( CONST char* file_name ) {
+  t_ae_bundle_data* bundle;
+  struct stat info;
+  void* base;
+  int   fd;
+
+  fd = open( file_name, O_RDONLY );
+  if( fd < 0 ) {
+    return NULL;
+  }
+  if( fstat( fd, &info ) != 0 || info.st_size < (off_t)sizeof( t_ae_bundle_header ) ) {
+    close( fd );
+    return NULL;
+  }
+  base = mmap( NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( base == MAP_FAILED ) {
+    return NULL;
+  }
+
+  bundle = static_ae_bundle_load( (char*)base, info.st_size, 1 );
+  if( bundle == NULL ) {
+    munmap( base, info.st_size );
+  }
+
+  return bundle;
+}
+
+t_ae_bundle ae_bundle_open_buffer( CONST char* data, size_t size ) {
+  if( size < sizeof( t_ae_bundle_header ) ) {
+    return NULL;
+  }
+  return static_ae_bundle_load( (char*)data, size, 0 );
+}
+
+void ae_bundle_close( t_ae_bundle bundle ) {
+  t_ae_bundle_data* bundle_data = (t_ae_bundle_data*)bundle;
+
+  if( bundle_data == NULL ) return;
+  if( bundle_data->mapped ) {
+    munmap( bundle_data->base, bundle_data->size );
+  }
+  ae_free( bundle_data );
+}
+
+int ae_bundle_has( t_ae_bundle bundle, CONST char* path ) {
+  return ( static_ae_bundle_find( (t_ae_bundle_data*)bundle, path ) != NULL );
+}
+
+int ae_bundle_process( t_ae_bundle bundle, t_ae_template_mgr mgr,
+                       CONST char* path, FILE* output )
+{
+  t_ae_bundle_data* bundle_data = (t_ae_bundle_data*)bundle;
+  t_ae_bundle_entry* entry;
+  t_ae_bundle_run run;
+
+  entry = static_ae_bundle_find( bundle_data, path );
+  if( entry == NULL || !static_ae_bundle_matches( bundle_data, mgr ) ) {
+    return -1;
+  }
+
+  run.bundle = bundle_data;
+  run.first = entry->first;
+  run.count = entry->count;
+  if( ae_process_body( mgr, static_ae_bundle_run, &run, output ) == AE_LIMIT_EXCEEDED ) {
+    return AE_LIMIT_EXCEEDED;
+  }
+
+  return ( entry->flags & ENTRY_UNCLOSED ? -1 : 0 );
+}
+
+void ae_set_bundle( t_ae_template_mgr mgr, t_ae_bundle bundle ) {
+  ae_set_include_func( mgr, ( bundle != NULL ? static_ae_bundle_include : NULL ), bundle );
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static unsigned int static_ae_bundle_emit( t_ae_bundle_writer* writer, unsigned int op,
+                                           unsigned int a, unsigned int b, unsigned int c )
+{
+  t_ae_bundle_op* code;
+
+  if( writer->code_count == writer->code_alloced ) {
+    writer->code_alloced = ( writer->code_alloced ? writer->code_alloced * 2 : 256 );
+    writer->code = (t_ae_bundle_op*)ae_realloc( writer->code,
+                                                writer->code_alloced * sizeof( t_ae_bundle_op ) );
+  }
+
+  code = &writer->code[ writer->code_count ];
+  code->op = op;
+  code->a = a;
+  code->b = b;
+  code->c = c;
+  code->skip = 0;
+
+  return writer->code_count++;
+}
+
+static unsigned int static_ae_bundle_string( t_ae_bundle_writer* writer, CONST char* text, int length ) {
+  unsigned int offset;
+
+  /* every string in the pool is null-terminated, so tag text can be handed
+   * straight to the manager */
+  while( writer->pool_size + length + 1 > writer->pool_alloced ) {
+    writer->pool_alloced = ( writer->pool_alloced ? writer->pool_alloced * 2 : 4096 );
+    writer->pool = (char*)ae_realloc( writer->pool, writer->pool_alloced );
+  }
+
+  offset = writer->pool_size;
+  memcpy( writer->pool + offset, text, length );
+  writer->pool[ offset + length ] = 0;
+  writer->pool_size += length + 1;
+
+  return offset;
+}
+
+static int static_ae_bundle_compile( t_ae_bundle_writer* writer, char* text ) {
+  char* start;
+  char* end;
+  int   start_delim_len;
+  int   end_delim_len;
+  int   rc;
+
+  /* split the text as ae_process_stream would, emitting instructions in
+   * place of output */
+  start_delim_len = strlen( writer->start );
+  end_delim_len = strlen( writer->end );
+
+  while( ( rc = ae_next_tag( writer->mgr, text, &start, &end ) ) > 0 ) {
+    *start = 0;
+    static_ae_bundle_text( writer, text );
+
+    start = start + start_delim_len;
+    *end = 0;
+    static_ae_bundle_compile_tag( writer, start );
+
+    text = end + end_delim_len;
+  }
+
+  if( rc < 0 ) {
+    *start = 0;
+    static_ae_bundle_text( writer, text );
+    static_ae_bundle_text( writer, "[unclosed tag]" );
+    return rc;
+  }
+
+  static_ae_bundle_text( writer, text );
+  return rc;
+}
+
+static void static_ae_bundle_compile_tag( t_ae_bundle_writer* writer, char* text ) {
+  CONST char* delim = writer->delim;
+  unsigned int at;
+  char* type;
+  char* f1;
+  char* f2;
+  char* f3;
+  char* f4;
+  int   i;
+
+  type = ae_get_field( text, delim, 0 );
+  f1 = ae_get_field( text, delim, 1 );
+  f2 = ( f1 ? ae_get_field( text, delim, 2 ) : NULL );
+  f3 = ( f2 ? ae_get_field( text, delim, 3 ) : NULL );
+  f4 = ( f3 ? ae_get_field( text, delim, 4 ) : NULL );
+
+  /* IF=tok=data and IF_NOT=tok=data (the interpreter only copes with names
+   * of less than 64 characters, so longer ones are left to it) */
+  if( ( ae_field_cmp( type, "IF", delim ) == 0 || ae_field_cmp( type, "IF_NOT", delim ) == 0 )
+      && f2 != NULL && ae_field_len( f1, delim ) < 64 )
+  {
+    at = static_ae_bundle_emit( writer, ( ae_field_cmp( type, "IF", delim ) == 0 ? OP_IF : OP_IF_NOT ),
+                                static_ae_bundle_string( writer, f1, ae_field_len( f1, delim ) ), 0, 0 );
+    static_ae_bundle_compile( writer, f2 );
+    writer->code[ at ].skip = writer->code_count - at - 1;
+    return;
+  }
+
+  /* IF_xx=tok=value=data */
+  for( i = 0; static_comparisons[ i ].type != NULL; i++ ) {
+    if( ae_field_cmp( type, static_comparisons[ i ].type, delim ) == 0 && f3 != NULL ) {
+      at = static_ae_bundle_emit( writer, OP_COMPARE,
+                                  static_ae_bundle_string( writer, f1, ae_field_len( f1, delim ) ),
+                                  static_ae_bundle_string( writer, f2, ae_field_len( f2, delim ) ),
+                                  static_comparisons[ i ].comp_type );
+      static_ae_bundle_compile( writer, f3 );
+      writer->code[ at ].skip = writer->code_count - at - 1;
+      return;
+    }
+  }
+
+  /* INCLUDE=tok, where 'tok' is the rest of the tag */
+  if( ae_field_cmp( type, "INCLUDE", delim ) == 0 && f1 != NULL ) {
+    static_ae_bundle_emit( writer, OP_INCLUDE, static_ae_bundle_string( writer, f1, strlen( f1 ) ), 0, 0 );
+    return;
+  }
+
+  /* REPEAT2=source=newtok=delim=data */
+  if( ae_field_cmp( type, "REPEAT2", delim ) == 0 && f4 != NULL ) {
+    at = static_ae_bundle_emit( writer, OP_REPEAT,
+                                static_ae_bundle_string( writer, f1, ae_field_len( f1, delim ) ),
+                                static_ae_bundle_string( writer, f2, ae_field_len( f2, delim ) ),
+                                static_ae_bundle_string( writer, f3, ae_field_len( f3, delim ) ) );
+    static_ae_bundle_compile( writer, f4 );
+    writer->code[ at ].skip = writer->code_count - at - 1;
+    return;
+  }
+
+  /* ESCAPE-HTML=data and ESCAPE-JS=data */
+  if( ( ae_field_cmp( type, "ESCAPE-HTML", delim ) == 0 || ae_field_cmp( type, "ESCAPE-JS", delim ) == 0 )
+      && f1 != NULL )
+  {
+    at = static_ae_bundle_emit( writer, OP_ESCAPE,
+                                ( ae_field_cmp( type, "ESCAPE-JS", delim ) == 0 ? AE_ESCAPE_JS : AE_ESCAPE_HTML ),
+                                0, 0 );
+    static_ae_bundle_compile( writer, f1 );
+    writer->code[ at ].skip = writer->code_count - at - 1;
+    return;
+  }
+
+  /* anything else is up to the manager's tags at render time */
+  static_ae_bundle_emit( writer, OP_TAG, static_ae_bundle_string( writer, text, strlen( text ) ), 0, 0 );
+}
+
+static void static_ae_bundle_text( t_ae_bundle_writer* writer, CONST char* text ) {
+  unsigned int deflated_at = 0;
+  unsigned int size;
+  char* deflated;
+  char* record;
+  int   length;
+
+  length = strlen( text );
+  if( length == 0 ) return;
+
+  /* longer text is also kept compressed, as its size followed by the data,
+   * for rendering to a gzip stream */
+  if( length >= AE_GZIP_SPAN_MIN ) {
+    size = ae_gzip_deflate( text, length, &deflated );
+    if( size > 0 ) {
+      record = (char*)ae_malloc( sizeof( size ) + size );
+      memcpy( record, &size, sizeof( size ) );
+      memcpy( record + sizeof( size ), deflated, size );
+      deflated_at = static_ae_bundle_string( writer, record, sizeof( size ) + size ) + 1;
+      ae_free( record );
+      ae_free( deflated );
+    }
+  }
+
+  static_ae_bundle_emit( writer, OP_TEXT, static_ae_bundle_string( writer, text, length ), length,
+                         deflated_at );
+}
+
+static char* static_ae_bundle_read( CONST char* file_name ) {
+  t_ae_stream stream;
+  char* text;
+  int   size;
+
+  stream = ae_stream_open_file( file_name );
+  if( stream == NULL ) {
+    return NULL;
+  }
+  size = ae_stream_get_length( stream );
+  text = (char*)ae_malloc( size+1 );
+  size = ae_stream_read( stream, text, size );
+  text[ size > 0 ? size : 0 ] = 0;
+  ae_stream_close( stream );
+
+  return text;
+}
+
+static CONST char* static_ae_bundle_path( CONST char* path ) {
+  while( path[ 0 ] == '.' && path[ 1 ] == '/' ) {
+    path += 2;
+  }
+  return path;
+}
+
+static int static_ae_bundle_cmp_paths( CONST void* a, CONST void* b ) {
+  return strcmp( *(CONST char**)a, *(CONST char**)b );
+}
+
+static t_ae_bundle_data* static_ae_bundle_load( char* base, size_t size, int mapped ) {
+  t_ae_bundle_data* bundle;
+
+  bundle = (t_ae_bundle_data*)ae_malloc( sizeof( t_ae_bundle_data ) );
+  bundle->base = base;
+  bundle->size = size;
+  bundle->mapped = mapped;
+  bundle->header = (t_ae_bundle_header*)base;
+  bundle->index = (t_ae_bundle_entry*)( bundle->base + bundle->header->index_offset );
+  bundle->code = (t_ae_bundle_op*)( bundle->base + bundle->header->code_offset );
+  bundle->pool = bundle->base + bundle->header->pool_offset;
+
+  if( !static_ae_bundle_valid( bundle ) ) {
+    ae_free( bundle );
+    return NULL;
+  }
+
+  return bundle;
+}
+
+static int static_ae_bundle_valid( t_ae_bundle_data* bundle ) {
+  t_ae_bundle_header* header = bundle->header;
+  t_ae_bundle_entry* entry;
+  t_ae_bundle_op* op;
+  unsigned int size;
+  unsigned int end;
+  unsigned int i;
+  unsigned int j;
+
+  /* check the header against this library, and that every offset in the
+   * bundle lies within it, so that rendering need not check anything */
+
+  if( memcmp( header->magic, BUNDLE_MAGIC, sizeof( header->magic ) ) != 0 ) return 0;
+  if( header->byte_order != BUNDLE_BYTE_ORDER ) return 0;
+  if( header->version != AE_BUNDLE_VERSION ) return 0;
+  if( header->tag_set != ae_standard_tags_checksum() ) return 0;
+  if( header->header_size != sizeof( t_ae_bundle_header ) ) return 0;
+  if( header->total_size != bundle->size ) return 0;
+
+  if( memchr( header->tag_start, 0, BUNDLE_DELIM_SIZE ) == NULL ||
+      memchr( header->tag_end, 0, BUNDLE_DELIM_SIZE ) == NULL ||
+      memchr( header->field_delim, 0, BUNDLE_DELIM_SIZE ) == NULL )
+  {
+    return 0;
+  }
+
+  /* bound the counts by the file before multiplying, so that a crafted
+   * header cannot wrap the products round and past the checks below */
+  if( header->templates > ( bundle->size - sizeof( t_ae_bundle_header ) ) / sizeof( t_ae_bundle_entry ) ||
+      header->code_count > ( bundle->size - sizeof( t_ae_bundle_header ) -
+                             header->templates * sizeof( t_ae_bundle_entry ) ) / sizeof( t_ae_bundle_op ) )
+  {
+    return 0;
+  }
+
+  if( header->index_offset != sizeof( t_ae_bundle_header ) ||
+      header->code_offset != header->index_offset + header->templates * sizeof( t_ae_bundle_entry ) ||
+      header->pool_offset != header->code_offset + header->code_count * sizeof( t_ae_bundle_op ) ||
+      header->pool_size != header->total_size - header->pool_offset )
+  {
+    return 0;
+  }
+  if( header->pool_size > 0 && bundle->pool[ header->pool_size - 1 ] != 0 ) return 0;
+
+  for( i = 0; i < header->templates; i++ ) {
+    entry = &bundle->index[ i ];
+    if( entry->path >= header->pool_size ) return 0;
+    if( entry->first > header->code_count || entry->count > header->code_count - entry->first ) return 0;
+
+    end = entry->first + entry->count;
+    for( j = entry->first; j < end; j++ ) {
+      op = &bundle->code[ j ];
+      if( op->skip > end - j - 1 ) return 0;
+      switch( op->op ) {
+        case OP_TEXT:
+          if( op->a > header->pool_size || op->b > header->pool_size - op->a ) return 0;
+          if( op->c != 0 ) {
+            if( header->pool_size < sizeof( size ) || op->c - 1 > header->pool_size - sizeof( size ) ) {
+              return 0;
+            }
+            memcpy( &size, bundle->pool + op->c - 1, sizeof( size ) );
+            if( size > header->pool_size - ( op->c - 1 ) - sizeof( size ) ) return 0;
+          }
+          break;
+        case OP_TAG:
+        case OP_IF:
+        case OP_IF_NOT:
+        case OP_INCLUDE:
+          if( op->a >= header->pool_size ) return 0;
+          break;
+        case OP_COMPARE:
+          if( op->a >= header->pool_size || op->b >= header->pool_size ) return 0;
+          if( op->c > COMP_TYPE_GE ) return 0;
+          break;
+        case OP_REPEAT:
+          if( op->a >= header->pool_size || op->b >= header->pool_size ||
+              op->c >= header->pool_size )
+          {
+            return 0;
+          }
+          break;
+        case OP_ESCAPE:
+          break;
+        default:
+          return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+static t_ae_bundle_entry* static_ae_bundle_find( t_ae_bundle_data* bundle, CONST char* path ) {
+  int low;
+  int high;
+  int mid;
+  int cmp;
+
+  path = static_ae_bundle_path( path );
+  low = 0;
+  high = (int)bundle->header->templates - 1;
+  while( low <= high ) {
+    mid = ( low + high ) / 2;
+    cmp = strcmp( path, bundle->pool + bundle->index[ mid ].path );
+    if( cmp == 0 ) return &bundle->index[ mid ];
+    if( cmp < 0 ) {
+      high = mid - 1;
+    } else {
+      low = mid + 1;
+    }
+  }
+
+  return NULL;
+}
+
+static int static_ae_bundle_matches( t_ae_bundle_data* bundle, t_ae_template_mgr mgr ) {
+  CONST char* start;
+  CONST char* end;
+  CONST char* delim;
+
+  ae_get_delims( mgr, &start, &end, &delim );
+  return ( strcmp( start, bundle->header->tag_start ) == 0 &&
+           strcmp( end, bundle->header->tag_end ) == 0 &&
+           strcmp( delim, bundle->header->field_delim ) == 0 );
+}
+
+static int static_ae_bundle_run( void* cookie, t_ae_template_mgr mgr, FILE* output ) {
+  t_ae_bundle_run* run = (t_ae_bundle_run*)cookie;
+  t_ae_bundle_data* bundle = run->bundle;
+  t_ae_bundle_entry* entry;
+  t_ae_bundle_run body;
+  t_ae_bundle_op* op;
+  CONST char* file;
+  char*  value;
+  unsigned int size;
+  unsigned int end;
+  unsigned int i;
+  int    cmp;
+
+  /* a render that has reached one of its limits stops at the next op, as
+   * the interpreter does at the next tag */
+  end = run->first + run->count;
+  for( i = run->first; i < end && !ae_check_limits( mgr, output ); i++ ) {
+    op = &bundle->code[ i ];
+    body.bundle = bundle;
+    body.first = i + 1;
+    body.count = op->skip;
+
+    switch( op->op ) {
+      case OP_TEXT:
+        if( op->c != 0 ) {
+          memcpy( &size, bundle->pool + op->c - 1, sizeof( size ) );
+          ae_gzip_write_span( output, bundle->pool + op->a, op->b,
+                              bundle->pool + op->c - 1 + sizeof( size ), size );
+        } else {
+          fwrite( bundle->pool + op->a, 1, op->b, output );
+        }
+        break;
+
+      case OP_TAG:
+        ae_dispatch_tag( mgr, bundle->pool + op->a, output );
+        break;
+
+      case OP_IF:
+      case OP_IF_NOT:
+        value = ae_get_value( mgr, bundle->pool + op->a );
+        if( ( value && *value ) == ( op->op == OP_IF ) ) {
+          static_ae_bundle_run( &body, mgr, output );
+        }
+        i += op->skip;
+        break;
+
+      case OP_COMPARE:
+        value = ae_get_value( mgr, bundle->pool + op->a );
+        cmp = strcmp( value ? value : "", bundle->pool + op->b );
+        switch( op->c ) {
+          case COMP_TYPE_EQ: cmp = ( cmp == 0 ); break;
+          case COMP_TYPE_NE: cmp = ( cmp != 0 ); break;
+          case COMP_TYPE_LT: cmp = ( cmp < 0 ); break;
+          case COMP_TYPE_LE: cmp = ( cmp <= 0 ); break;
+          case COMP_TYPE_GT: cmp = ( cmp > 0 ); break;
+          case COMP_TYPE_GE: cmp = ( cmp >= 0 ); break;
+        }
+        if( cmp ) {
+          static_ae_bundle_run( &body, mgr, output );
+        }
+        i += op->skip;
+        break;
+
+      case OP_INCLUDE:
+        /* files in this bundle render from it, whether or not the manager
+         * has been pointed at the bundle */
+        file = bundle->pool + op->a;
+        if( ae_get_tag( mgr, file ) != NULL ) {
+          file = ae_get_value( mgr, file );
+        }
+        entry = ( file != NULL ? static_ae_bundle_find( bundle, file ) : NULL );
+        if( entry != NULL ) {
+          body.first = entry->first;
+          body.count = entry->count;
+          ae_include_body( mgr, file, static_ae_bundle_run, &body, output );
+        } else {
+          ae_process_include( mgr, file, output );
+        }
+        break;
+
+      case OP_REPEAT:
+        ae_repeat_body( mgr, bundle->pool + op->a, bundle->pool + op->b, bundle->pool + op->c,
+                        static_ae_bundle_run, &body, output );
+        i += op->skip;
+        break;
+
+      case OP_ESCAPE:
+        ae_escape_body( mgr, static_ae_bundle_run, &body, (int)op->a, output );
+        i += op->skip;
+        break;
+    }
+  }
+
+  return 0;
+}
+
+static int static_ae_bundle_include( void* cookie, t_ae_template_mgr mgr,
+                                     CONST char* file, FILE* output )
+{
+  t_ae_bundle_data* bundle = (t_ae_bundle_data*)cookie;
+  t_ae_bundle_entry* entry;
+  t_ae_bundle_run run;
+
+  entry = static_ae_bundle_find( bundle, file );
+  if( entry == NULL || !static_ae_bundle_matches( bundle, mgr ) ) {
+    return 0;
+  }
+
+  run.bundle = bundle;
+  run.first = entry->first;
+  run.count = entry->count;
+  ae_process_body( mgr, static_ae_bundle_run, &run, output );
+
+  return 1;
+}
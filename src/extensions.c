@@ -14,15 +14,35 @@ static int static_ae_escape_html_tag_process( t_ae_tag tag,
                                               t_ae_template_mgr mgr,
                                               FILE* output );
 
-static char* static_ae_process_embedded_data( t_ae_tag tag,
-                                              CONST char* text,
-                                              t_ae_template_mgr mgr );
+static int static_ae_process_embedded_data( void* cookie,
+                                            t_ae_template_mgr mgr,
+                                            FILE* output );
 
 int static_ae_struct_tag_process( t_ae_tag tag,
                                   CONST char* text,
                                   t_ae_template_mgr mgr,
                                   FILE* output );
 
+static int static_ae_struct_slice_tag_process( t_ae_tag tag,
+                                               CONST char* text,
+                                               t_ae_template_mgr mgr,
+                                               FILE* output );
+
+static int static_ae_struct_render( t_ae_tag tag,
+                                    CONST char* text,
+                                    int sliced,
+                                    t_ae_template_mgr mgr,
+                                    FILE* output );
+
+static void static_ae_struct_rows( t_ae_tag rows,
+                                   char* hdr,
+                                   CONST char* delim,
+                                   int offset,
+                                   int limit,
+                                   CONST char* data,
+                                   t_ae_template_mgr mgr,
+                                   FILE* output );
+
 
 t_ae_tag ae_escape_js_tag( void ) /*{{{*/
 {
@@ -48,43 +68,23 @@ t_ae_tag ae_struct_tag( void ) /* {{{ */
 }
 /* }}} */
 
+t_ae_tag ae_struct_slice_tag( void ) /* {{{ */
+{
+  return ae_typed_tag( "STRUCT_SLICE",
+                       static_ae_struct_slice_tag_process,
+                       sizeof( t_ae_generic_tag ) );
+}
+/* }}} */
+
 
 static int static_ae_escape_js_tag_process( t_ae_tag tag, /*{{{*/
                                             CONST char* text,
                                             t_ae_template_mgr mgr,
                                             FILE* output )
 {
-  char* buffer;
-  char* p;
-
-  /* process the embedded data into a temporary buffer */
-  p = buffer = static_ae_process_embedded_data( tag, text, mgr );
-
-  /* write the buffer, escaping illegal characters */
-  while( *p ) {
-    switch( *p ) {
-      case '\'':
-      case '"':
-      case '\\':
-        fputc( '\\', output );
-        fputc( *p, output );
-        break;
-      case '\n':
-        fputs( "\\n", output );
-        break;
-      case '\r':
-        fputs( "\\r", output );
-        break;
-      case '\t':
-        fputs( "\\t", output );
-        break;
-      default:
-        fputc( *p, output );
-    }
-    p++;
-  }
-
-  free( buffer );
+  /* process the embedded data, and write it escaped */
+  ae_escape_body( mgr, static_ae_process_embedded_data,
+                  ae_get_field( text, ae_get_tag_delim( tag ), 1 ), AE_ESCAPE_JS, output );
   return 1;
 }
 /*}}}*/
@@ -94,56 +94,18 @@ static int static_ae_escape_html_tag_process( t_ae_tag tag, /*{{{*/
                                               t_ae_template_mgr mgr,
                                               FILE* output )
 {
-  char* buffer;
-  char* p;
-
-  /* process the embedded data into a temporary buffer */
-  p = buffer = static_ae_process_embedded_data( tag, text, mgr );
-
-  /* write the buffer, escaping illegal characters */
-  while( *p ) {
-    switch( *p ) {
-      case '<': fputs( "&lt;", output ); break;
-      case '>': fputs( "&gt;", output ); break;
-      case '&': fputs( "&amp;", output ); break;
-      case '"': fputs( "&quot;", output ); break;
-      case '\'': fputs( "&#39;", output ); break;
-      default:
-        fputc( *p, output );
-    }
-    p++;
-  }
-
-  free( buffer );
+  /* process the embedded data, and write it escaped */
+  ae_escape_body( mgr, static_ae_process_embedded_data,
+                  ae_get_field( text, ae_get_tag_delim( tag ), 1 ), AE_ESCAPE_HTML, output );
   return 1;
 }
 /*}}}*/
 
-static char* static_ae_process_embedded_data( t_ae_tag tag, /*{{{*/
-                                              CONST char* text,
-                                              t_ae_template_mgr mgr )
+static int static_ae_process_embedded_data( void* cookie, /*{{{*/
+                                            t_ae_template_mgr mgr,
+                                            FILE* output )
 {
-  FILE* tmp_dest;
-  int   length;
-  char* buffer;
-
-  /* create a temporary file and process the embedded data into it */
-
-  tmp_dest = tmpfile();
-  ae_process_buffer( mgr, ae_get_field( text, ae_get_tag_delim( tag ), 1 ), tmp_dest );
-  fflush( tmp_dest );
-  length = ftell( tmp_dest );
-  rewind( tmp_dest );
-
-  /* allocate a buffer big enough to hold the data, read the data into it, close the
-   * temporary file, and return the buffer */
-
-  buffer = (char*)malloc( length+1 );
-  fread( buffer, 1, length, tmp_dest );
-  buffer[length] = 0;
-  fclose( tmp_dest );
-
-  return buffer;
+  return ae_process_buffer( mgr, (CONST char*)cookie, output );
 }
 /*}}}*/
 
@@ -151,6 +113,25 @@ int static_ae_struct_tag_process( t_ae_tag tag, /* {{{ */
                                   CONST char* text,
                                   t_ae_template_mgr mgr,
                                   FILE* output )
+{
+  return static_ae_struct_render( tag, text, 0, mgr, output );
+}
+/* }}} */
+
+static int static_ae_struct_slice_tag_process( t_ae_tag tag, /* {{{ */
+                                               CONST char* text,
+                                               t_ae_template_mgr mgr,
+                                               FILE* output )
+{
+  return static_ae_struct_render( tag, text, 1, mgr, output );
+}
+/* }}} */
+
+static int static_ae_struct_render( t_ae_tag tag, /* {{{ */
+                                    CONST char* text,
+                                    int sliced,
+                                    t_ae_template_mgr mgr,
+                                    FILE* output )
 {
   char* hdr;
   char* data_tok;
@@ -163,13 +144,17 @@ int static_ae_struct_tag_process( t_ae_tag tag, /* {{{ */
   char* hdr_value;
   char* data_value;
   char* p;
-  char  row_num_tag[ 18 ];
+  char  row_num_tag[ sizeof "ae_row_number_" + 11 ];
   int   max_hdr_len;
   int   max_data_len;
   int   row;
+  int   offset;
+  int   limit;
+  int   skip;
 
   /* <!--%STRUCT=hdr-tag=data-tag=delim=data%-->
    * <!--%STRUCT=hdr-list=data-tag=delim=data%-->
+   * <!--%STRUCT_SLICE=hdr-list=data-tag=delim=offset=limit=data%-->
    * */
 
   /* hdr is a 'delim' delimited list of header fields.  For each iteration of the
@@ -178,36 +163,68 @@ int static_ae_struct_tag_process( t_ae_tag tag, /* {{{ */
   hdr = ae_get_field_alloc( text, ae_get_tag_delim( tag ), 1 );
   value = ae_get_value( mgr, hdr );
   if( value ) {
-    free( hdr );
-    hdr = strdup( value );
+    ae_free( hdr );
+    hdr = ae_strdup( value );
   }
 
   /* the data-tok is the name of the token that has the data to query for this
    * tag. */
 
   data_tok = ae_get_field_alloc( text, ae_get_tag_delim( tag ), 2 );
+
+  /* STRUCT_SLICE gives the rows wanted as an offset and limit before the data */
+  offset = 0;
+  limit = -1;
+  if( sliced ) {
+    ae_get_slice( mgr, text, ae_get_tag_delim( tag ), 4, &offset, &limit );
+    data = ae_get_field( text, ae_get_tag_delim( tag ), 6 );
+  } else {
+    data = ae_get_field( text, ae_get_tag_delim( tag ), 4 );
+  }
+
+  /* a row source gives the data a row at a time */
+  if( ae_is_row_source( ae_get_tag( mgr, data_tok ) ) ) {
+    delim = ae_get_field_alloc( text, ae_get_tag_delim( tag ), 3 );
+    static_ae_struct_rows( ae_get_tag( mgr, data_tok ), hdr, delim, offset, limit, data, mgr, output );
+    ae_free( delim );
+    ae_free( data_tok );
+    ae_free( hdr );
+    return 1;
+  }
+
   value = ae_get_value( mgr, data_tok );
-  free( data_tok );
+  ae_free( data_tok );
   if( value ) {
     delim = ae_get_field_alloc( text, ae_get_tag_delim( tag ), 3 );
-    data = ae_get_field( text, ae_get_tag_delim( tag ), 4 );
 
     /* determine the name of the tag that will identify this row */
     row = 1;
     strcpy( row_num_tag, "ae_row_number" );
     while( ae_get_tag( mgr, row_num_tag ) != NULL ) {
       row++;
-      sprintf( row_num_tag, "ae_row_number_%d", row );
+      snprintf( row_num_tag, sizeof( row_num_tag ), "ae_row_number_%d", row );
     }
  
     /* allocate the buffers that we'll use to hold the data and header info */
     max_hdr_len = 32;
     max_data_len = 32;
-    hdr_value = (char*)malloc( max_hdr_len );
-    data_value = (char*)malloc( max_data_len );
+    hdr_value = (char*)ae_malloc( max_hdr_len );
+    data_value = (char*)ae_malloc( max_data_len );
 
-    row = 1;
-    while( *value ) {
+    /* skip the rows before the offset: one data item for each header field */
+    skip = 0;
+    for( hdrP = hdr; *delim && ( hdr_item = strstr( hdrP, delim ) ) != NULL; hdrP = hdr_item + strlen( delim ) ) {
+      skip++;
+    }
+    for( skip *= offset; skip > 0 && *value; skip-- ) {
+      data_item = strstr( value, delim );
+      value = ( data_item != NULL ? data_item + strlen( delim ) : value + strlen( value ) );
+    }
+
+    row = offset + 1;
+    while( *value && ( limit < 0 || row <= offset + limit ) &&
+           ae_next_iteration( mgr, output ) )
+    {
       ae_add_tag_i( mgr, row_num_tag, row );
 
       /* assign the token values to the manager */
@@ -226,8 +243,8 @@ int static_ae_struct_tag_process( t_ae_tag tag, /* {{{ */
 
         if( hdr_item - hdrP + 1 > max_hdr_len ) {
           max_hdr_len = hdr_item - hdrP + 1;
-          free( hdr_value );
-          hdr_value = (char*)malloc( max_hdr_len );
+          ae_free( hdr_value );
+          hdr_value = (char*)ae_malloc( max_hdr_len );
         }
         p = hdr_value;
         while( hdrP < hdr_item ) {
@@ -240,8 +257,8 @@ int static_ae_struct_tag_process( t_ae_tag tag, /* {{{ */
 
         if( data_item - value + 1 > max_data_len ) {
           max_data_len = data_item - value + 1;
-          free( data_value );
-          data_value = (char*)malloc( max_data_len );
+          ae_free( data_value );
+          data_value = (char*)ae_malloc( max_data_len );
         }
         p = data_value;
         while( value < data_item ) {
@@ -259,12 +276,70 @@ int static_ae_struct_tag_process( t_ae_tag tag, /* {{{ */
       row++;
     }
 
-    free( hdr_value );
-    free( data_value );
+    ae_free( hdr_value );
+    ae_free( data_value );
   }
 
-  free( hdr );
+  ae_free( hdr );
   return 1;
 }
 /* }}} */
 
+static void static_ae_struct_rows( t_ae_tag rows, /* {{{ */
+                                   char* hdr,
+                                   CONST char* delim,
+                                   int offset,
+                                   int limit,
+                                   CONST char* data,
+                                   t_ae_template_mgr mgr,
+                                   FILE* output )
+{
+  char** fields;
+  char*  hdrP;
+  char*  hdr_item;
+  char   row_num_tag[ sizeof "ae_row_number_" + 11 ];
+  int    count;
+  int    row;
+
+  /* split the header list in place into the names of the fields, which the
+   * row source is asked to fill for each row */
+  count = 0;
+  for( hdrP = hdr; *delim && ( hdr_item = strstr( hdrP, delim ) ) != NULL; hdrP = hdr_item + strlen( delim ) ) {
+    count++;
+  }
+  fields = (char**)ae_malloc( ( count + 1 ) * sizeof( char* ) );
+  count = 0;
+  for( hdrP = hdr; *delim && ( hdr_item = strstr( hdrP, delim ) ) != NULL; hdrP = hdr_item + strlen( delim ) ) {
+    *hdr_item = 0;
+    fields[ count++ ] = hdrP;
+  }
+  fields[ count ] = NULL;
+
+  /* determine the name of the tag that will identify this row */
+  row = 1;
+  strcpy( row_num_tag, "ae_row_number" );
+  while( ae_get_tag( mgr, row_num_tag ) != NULL ) {
+    row++;
+    snprintf( row_num_tag, sizeof( row_num_tag ), "ae_row_number_%d", row );
+  }
+
+  /* a row source can only be read up to the offset */
+  for( row = 0; row < offset; row++ ) {
+    if( ae_next_row( mgr, rows, fields ) <= 0 ) {
+      limit = 0;
+      break;
+    }
+  }
+
+  row = offset + 1;
+  while( ( limit < 0 || row <= offset + limit ) && ae_next_row( mgr, rows, fields ) > 0 &&
+         ae_next_iteration( mgr, output ) )
+  {
+    ae_add_tag_i( mgr, row_num_tag, row );
+    ae_process_buffer( mgr, data, output );
+    row++;
+  }
+
+  ae_free( fields );
+}
+/* }}} */
@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "gzip.h"
+
+#ifdef AE_GZIP
+
+#include <pthread.h>
+#include <zlib.h>
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the size of the buffers on either side of the compressor */
+#define GZIP_BUFFER_SIZE    ( 16 * 1024 )
+
+  /* the size of the window -- and so of the most text a dictionary can
+   * usefully hold */
+#define GZIP_WINDOW_SIZE    ( 32 * 1024 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the compressor makes raw deflate data, and the gzip header and trailer
+   * are written here, so that a dictionary can be set after a precompressed
+   * span (zlib only allows that mid-stream for raw data) */
+
+typedef struct t_ae_gzip {
+  FILE*         stream;
+  FILE*         output;
+  z_stream      z;
+  uLong         crc;
+  uLong         total;
+  int           started;
+  int           failed;
+  unsigned char out[ GZIP_BUFFER_SIZE ];
+  struct t_ae_gzip* next;
+} t_ae_gzip;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static voidpf  static_ae_gzip_alloc( voidpf opaque, uInt items, uInt size );
+static void    static_ae_gzip_free( voidpf opaque, voidpf address );
+static void    static_ae_gzip_start( t_ae_gzip* gz );
+static int     static_ae_gzip_deflate( t_ae_gzip* gz, int flush );
+static void    static_ae_gzip_write_int( t_ae_gzip* gz, uLong value );
+static t_ae_gzip* static_ae_gzip_find( FILE* stream );
+static ssize_t static_ae_gzip_write_fn( void* cookie, CONST char* buffer, size_t size );
+static int     static_ae_gzip_close_fn( void* cookie );
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+  /* the open gzip streams, so that a span can tell whether it is being
+   * written to one */
+static t_ae_gzip*      static_gzip_streams = NULL;
+static pthread_mutex_t static_gzip_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------------------------------------------------------------------- */
+/* gzip function implementations                                             */
+/* ------------------------------------------------------------------------- */
+
+int ae_gzip_available( void ) {
+  return 1;
+}
+
+FILE* ae_gzip_open( FILE* output, int level ) {
+  cookie_io_functions_t functions;
+  t_ae_gzip* gz;
+
+  gz = (t_ae_gzip*)ae_malloc( sizeof( t_ae_gzip ) );
+  memset( gz, 0, sizeof( t_ae_gzip ) );
+  gz->output = output;
+  gz->crc = crc32( 0L, Z_NULL, 0 );
+  gz->z.zalloc = static_ae_gzip_alloc;
+  gz->z.zfree = static_ae_gzip_free;
+  if( deflateInit2( &gz->z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+    ae_free( gz );
+    return NULL;
+  }
+
+  memset( &functions, 0, sizeof( functions ) );
+  functions.write = static_ae_gzip_write_fn;
+  functions.close = static_ae_gzip_close_fn;
+  gz->stream = fopencookie( gz, "w", functions );
+  if( gz->stream == NULL ) {
+    deflateEnd( &gz->z );
+    ae_free( gz );
+    return NULL;
+  }
+  setvbuf( gz->stream, NULL, _IOFBF, GZIP_BUFFER_SIZE );
+
+  pthread_mutex_lock( &static_gzip_lock );
+  gz->next = static_gzip_streams;
+  static_gzip_streams = gz;
+  pthread_mutex_unlock( &static_gzip_lock );
+
+  return gz->stream;
+}
+
+int ae_gzip_close( FILE* stream ) {
+  if( stream == NULL ) return -1;
+  return ( fclose( stream ) == 0 ? 0 : -1 );
+}
+
+size_t ae_gzip_deflate( CONST char* text, size_t size, char** deflated ) {
+  z_stream z;
+  size_t   bound;
+  size_t   result = 0;
+
+  *deflated = NULL;
+
+  memset( &z, 0, sizeof( z ) );
+  z.zalloc = static_ae_gzip_alloc;
+  z.zfree = static_ae_gzip_free;
+  if( deflateInit2( &z, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) {
+    return 0;
+  }
+
+  /* a full flush leaves the data on a byte boundary, with no block marked
+   * as the last, and refers to nothing before it -- so it can be dropped
+   * into the middle of any other raw deflate data */
+  bound = deflateBound( &z, size ) + 64;
+  *deflated = (char*)ae_malloc( bound );
+  z.next_in = (Bytef*)text;
+  z.avail_in = size;
+  z.next_out = (Bytef*)*deflated;
+  z.avail_out = bound;
+  if( deflate( &z, Z_FULL_FLUSH ) == Z_OK && z.avail_in == 0 && z.avail_out > 0 ) {
+    result = bound - z.avail_out;
+  } else {
+    ae_free( *deflated );
+    *deflated = NULL;
+  }
+  deflateEnd( &z );
+
+  return result;
+}
+
+void ae_gzip_write_span( FILE* output, CONST char* text, size_t size,
+                         CONST char* deflated, size_t deflated_size )
+{
+  t_ae_gzip* gz = NULL;
+  size_t dictionary;
+
+  if( deflated != NULL ) {
+    gz = static_ae_gzip_find( output );
+  }
+  if( gz == NULL ) {
+    fwrite( text, 1, size, output );
+    return;
+  }
+
+  /* compress everything written so far, and flush the compressor so that
+   * the span starts on a byte boundary and nothing after it refers back
+   * past it */
+  fflush( output );
+  static_ae_gzip_start( gz );
+  if( gz->failed || static_ae_gzip_deflate( gz, Z_FULL_FLUSH ) != 0 ) {
+    gz->failed = 1;
+    return;
+  }
+  if( fwrite( deflated, 1, deflated_size, gz->output ) != deflated_size ) {
+    gz->failed = 1;
+    return;
+  }
+  gz->crc = crc32( gz->crc, (CONST Bytef*)text, size );
+  gz->total += size;
+
+  /* the text that follows may still refer back into the span */
+  dictionary = ( size < GZIP_WINDOW_SIZE ? size : GZIP_WINDOW_SIZE );
+  deflateSetDictionary( &gz->z, (CONST Bytef*)( text + size - dictionary ), dictionary );
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static voidpf static_ae_gzip_alloc( voidpf opaque, uInt items, uInt size ) {
+  (void)opaque;
+  return ae_malloc( (size_t)items * size );
+}
+
+static void static_ae_gzip_free( voidpf opaque, voidpf address ) {
+  (void)opaque;
+  ae_free( address );
+}
+
+static void static_ae_gzip_start( t_ae_gzip* gz ) {
+  static CONST unsigned char header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+
+  /* the gzip header (no name, no time, from Unix) is held back until there
+   * is something to compress, so that anything written to the output
+   * between opening the stream and rendering to it (the HTTP headers, say)
+   * comes first */
+  if( gz->started ) return;
+  gz->started = 1;
+  if( fwrite( header, 1, sizeof( header ), gz->output ) != sizeof( header ) ) {
+    gz->failed = 1;
+  }
+}
+
+static int static_ae_gzip_deflate( t_ae_gzip* gz, int flush ) {
+  size_t have;
+
+  /* run the compressor until it has taken all of its input and has no
+   * more output to give */
+  do {
+    gz->z.next_out = gz->out;
+    gz->z.avail_out = sizeof( gz->out );
+    if( deflate( &gz->z, flush ) == Z_STREAM_ERROR ) {
+      return -1;
+    }
+    have = sizeof( gz->out ) - gz->z.avail_out;
+    if( have > 0 && fwrite( gz->out, 1, have, gz->output ) != have ) {
+      return -1;
+    }
+  } while( gz->z.avail_out == 0 );
+
+  return 0;
+}
+
+static void static_ae_gzip_write_int( t_ae_gzip* gz, uLong value ) {
+  unsigned char bytes[ 4 ];
+
+  bytes[ 0 ] = (unsigned char)( value & 0xff );
+  bytes[ 1 ] = (unsigned char)( ( value >> 8 ) & 0xff );
+  bytes[ 2 ] = (unsigned char)( ( value >> 16 ) & 0xff );
+  bytes[ 3 ] = (unsigned char)( ( value >> 24 ) & 0xff );
+  if( fwrite( bytes, 1, sizeof( bytes ), gz->output ) != sizeof( bytes ) ) {
+    gz->failed = 1;
+  }
+}
+
+static t_ae_gzip* static_ae_gzip_find( FILE* stream ) {
+  t_ae_gzip* gz;
+
+  pthread_mutex_lock( &static_gzip_lock );
+  for( gz = static_gzip_streams; gz != NULL; gz = gz->next ) {
+    if( gz->stream == stream ) break;
+  }
+  pthread_mutex_unlock( &static_gzip_lock );
+
+  return gz;
+}
+
+static ssize_t static_ae_gzip_write_fn( void* cookie, CONST char* buffer, size_t size ) {
+  t_ae_gzip* gz = (t_ae_gzip*)cookie;
+
+  static_ae_gzip_start( gz );
+  if( gz->failed ) return 0;
+
+  gz->crc = crc32( gz->crc, (CONST Bytef*)buffer, size );
+  gz->total += size;
+  gz->z.next_in = (Bytef*)buffer;
+  gz->z.avail_in = size;
+  if( static_ae_gzip_deflate( gz, Z_NO_FLUSH ) != 0 ) {
+    /* a cookie write function reports an error by writing nothing */
+    gz->failed = 1;
+    return 0;
+  }
+
+  return (ssize_t)size;
+}
+
+static int static_ae_gzip_close_fn( void* cookie ) {
+  t_ae_gzip* gz = (t_ae_gzip*)cookie;
+  t_ae_gzip** link;
+  int failed;
+
+  pthread_mutex_lock( &static_gzip_lock );
+  for( link = &static_gzip_streams; *link != NULL; link = &(*link)->next ) {
+    if( *link == gz ) {
+      *link = gz->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock( &static_gzip_lock );
+
+  /* finish the compressed data, then write the gzip trailer */
+  static_ae_gzip_start( gz );
+  if( !gz->failed && static_ae_gzip_deflate( gz, Z_FINISH ) != 0 ) {
+    gz->failed = 1;
+  }
+  if( !gz->failed ) {
+    static_ae_gzip_write_int( gz, gz->crc );
+    static_ae_gzip_write_int( gz, gz->total );
+  }
+  deflateEnd( &gz->z );
+
+  failed = gz->failed;
+  ae_free( gz );
+
+  return ( failed ? -1 : 0 );
+}
+
+#else
+
+/* ------------------------------------------------------------------------- */
+/* gzip function implementations (without zlib)                              */
+/* ------------------------------------------------------------------------- */
+
+int ae_gzip_available( void ) {
+  return 0;
+}
+
+FILE* ae_gzip_open( FILE* output, int level ) {
+  (void)output;
+  (void)level;
+  return NULL;
+}
+
+int ae_gzip_close( FILE* stream ) {
+  (void)stream;
+  return -1;
+}
+
+size_t ae_gzip_deflate( CONST char* text, size_t size, char** deflated ) {
+  (void)text;
+  (void)size;
+  *deflated = NULL;
+  return 0;
+}
+
+void ae_gzip_write_span( FILE* output, CONST char* text, size_t size,
+                         CONST char* deflated, size_t deflated_size )
+{
+  (void)deflated;
+  (void)deflated_size;
+  fwrite( text, 1, size, output );
+}
+
+#endif
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <strings.h>
+
+#include "minify.h"
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+#define WS_NONE             ( 0 )
+#define WS_SPACE            ( 1 )
+#define WS_NEWLINE          ( 2 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the state of the minifier carries from one literal span to the next, so
+   * that an element, an HTML tag or an attribute value can have template
+   * tags inside it */
+
+typedef struct {
+  char*       out;
+  int         whitespace;
+  CONST char* raw_close;
+  int         in_tag;
+  char        quote;
+} t_ae_minify_state;
+
+  /* a standard tag whose last field, 'body', is template text of its own */
+
+typedef struct {
+  CONST char* type;
+  int         body;
+} t_ae_minify_block;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static void  static_ae_minify_tag( t_ae_minify_state* state, t_ae_template_mgr mgr,
+                                   CONST char* tag, size_t length );
+static void  static_ae_minify_span( t_ae_minify_state* state, CONST char* p, CONST char* limit );
+static void  static_ae_minify_copy( t_ae_minify_state* state, CONST char* p, size_t length );
+static CONST char* static_ae_minify_find( CONST char* p, CONST char* limit,
+                                          CONST char* what, int ignore_case );
+static CONST char* static_ae_minify_raw( CONST char* p, CONST char* limit );
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+  /* the elements whose contents are kept as they are, and the text that
+   * ends each */
+static CONST char* static_raw_elements[] = {
+  "pre",      "</pre",
+  "textarea", "</textarea",
+  "script",   "</script",
+  "style",    "</style",
+  NULL,       NULL
+};
+
+  /* the block tags whose bodies are minified with the rest of the template
+   * (ESCAPE-HTML and ESCAPE-JS bodies are data, and are left alone) */
+static t_ae_minify_block static_block_tags[] = {
+  { "IF",            2 },
+  { "IF_NOT",        2 },
+  { "IF_EXPR",       2 },
+  { "IF_EQ",         3 },
+  { "IF_NOT_EQ",     3 },
+  { "IF_LT",         3 },
+  { "IF_LE",         3 },
+  { "IF_GT",         3 },
+  { "IF_GE",         3 },
+  { "REPEAT2",       4 },
+  { "REPEAT2_SLICE", 6 },
+  { "STRUCT",        4 },
+  { "STRUCT_SLICE",  6 },
+  { NULL,            0 }
+};
+
+/* ------------------------------------------------------------------------- */
+/* minify function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+char* ae_minify_html( t_ae_template_mgr mgr, CONST char* text ) {
+  t_ae_minify_state state;
+  CONST char* end_delim;
+  char* result;
+  char* start;
+  char* end;
+  int   found;
+
+  ae_get_delims( mgr, NULL, &end_delim, NULL );
+
+  /* nothing is ever added, so the copy is at most as long as the text */
+  result = (char*)ae_malloc( strlen( text ) + 1 );
+  memset( &state, 0, sizeof( state ) );
+  state.out = result;
+
+  for( ;; ) {
+    found = ae_next_tag( mgr, text, &start, &end );
+    if( found == 0 ) {
+      static_ae_minify_span( &state, text, text + strlen( text ) );
+      break;
+    }
+
+    /* the literal text before the tag, then the tag (an unclosed tag is
+     * kept, with everything after it) */
+    static_ae_minify_span( &state, text, start );
+    static_ae_minify_copy( &state, NULL, 0 );
+    if( found < 0 ) {
+      static_ae_minify_copy( &state, start, strlen( start ) );
+      break;
+    }
+    end += strlen( end_delim );
+    static_ae_minify_tag( &state, mgr, start, end - start );
+    text = end;
+  }
+
+  static_ae_minify_copy( &state, NULL, 0 );
+  *state.out = 0;
+
+  return result;
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static void static_ae_minify_tag( t_ae_minify_state* state, t_ae_template_mgr mgr,
+                                  CONST char* tag, size_t length )
+{
+  CONST char* start_delim;
+  CONST char* end_delim;
+  CONST char* delim;
+  char*  text;
+  char*  body = NULL;
+  char*  minified;
+  size_t start_length;
+  size_t end_length;
+  int    i;
+
+  /* a tag is copied as it is, unless it is a block tag met outside any
+   * element, HTML tag or attribute value, when its body is minified as a
+   * template of its own: the body may be written any number of times, in
+   * the same place, so it starts from nothing, as the template does */
+  if( state->raw_close != NULL || state->in_tag || state->quote != 0 ) {
+    static_ae_minify_copy( state, tag, length );
+    return;
+  }
+
+  ae_get_delims( mgr, &start_delim, &end_delim, &delim );
+  start_length = strlen( start_delim );
+  end_length = strlen( end_delim );
+
+  text = (char*)ae_malloc( length - start_length - end_length + 1 );
+  memcpy( text, tag + start_length, length - start_length - end_length );
+  text[ length - start_length - end_length ] = 0;
+
+  for( i = 0; static_block_tags[ i ].type != NULL; i++ ) {
+    if( ae_field_cmp( text, static_block_tags[ i ].type, delim ) == 0 ) {
+      body = ae_get_field( text, delim, static_block_tags[ i ].body );
+      break;
+    }
+  }
+
+  if( body == NULL ) {
+    static_ae_minify_copy( state, tag, length );
+  } else {
+    minified = ae_minify_html( mgr, body );
+    static_ae_minify_copy( state, tag, start_length + ( body - text ) );
+    static_ae_minify_copy( state, minified, strlen( minified ) );
+    static_ae_minify_copy( state, tag + length - end_length, end_length );
+    ae_free( minified );
+  }
+
+  ae_free( text );
+}
+
+static void static_ae_minify_span( t_ae_minify_state* state, CONST char* p, CONST char* limit ) {
+  CONST char* q;
+
+  while( p < limit ) {
+    /* inside a raw element, copy up to its end tag */
+    if( state->raw_close != NULL ) {
+      q = static_ae_minify_find( p, limit, state->raw_close, 1 );
+      if( q == NULL ) {
+        static_ae_minify_copy( state, p, limit - p );
+        return;
+      }
+      q += strlen( state->raw_close );
+      static_ae_minify_copy( state, p, q - p );
+      state->raw_close = NULL;
+      state->in_tag = 1;
+      p = q;
+      continue;
+    }
+
+    /* inside a quoted attribute value, copy up to the closing quote */
+    if( state->quote != 0 ) {
+      q = memchr( p, state->quote, limit - p );
+      if( q == NULL ) {
+        static_ae_minify_copy( state, p, limit - p );
+        return;
+      }
+      static_ae_minify_copy( state, p, q + 1 - p );
+      state->quote = 0;
+      p = q + 1;
+      continue;
+    }
+
+    /* whitespace is held back, and collapsed with whatever follows it */
+    if( isspace( (unsigned char)*p ) ) {
+      if( *p == '\n' ) {
+        state->whitespace = WS_NEWLINE;
+      } else if( state->whitespace == WS_NONE ) {
+        state->whitespace = WS_SPACE;
+      }
+      p++;
+      continue;
+    }
+
+    if( state->in_tag ) {
+      if( *p == '"' || *p == '\'' ) {
+        state->quote = *p;
+      } else if( *p == '>' ) {
+        state->in_tag = 0;
+      }
+      static_ae_minify_copy( state, p, 1 );
+      p++;
+      continue;
+    }
+
+    if( *p == '<' ) {
+      /* a comment is dropped, whitespace and all, unless it is a conditional
+       * comment or runs into a tag (and so doesn't end in this span) */
+      if( limit - p >= 4 && strncmp( p, "<!--", 4 ) == 0 ) {
+        q = static_ae_minify_find( p + 4, limit, "-->", 0 );
+        if( q != NULL && p[ 4 ] != '[' ) {
+          p = q + 3;
+          continue;
+        }
+        static_ae_minify_copy( state, p, 4 );
+        p += 4;
+        continue;
+      }
+
+      q = static_ae_minify_raw( p, limit );
+      if( q != NULL ) {
+        state->raw_close = q;
+      } else if( p + 1 < limit && ( isalpha( (unsigned char)p[ 1 ] ) || p[ 1 ] == '/' || p[ 1 ] == '!' ) ) {
+        state->in_tag = 1;
+      }
+    }
+
+    static_ae_minify_copy( state, p, 1 );
+    p++;
+  }
+}
+
+static void static_ae_minify_copy( t_ae_minify_state* state, CONST char* p, size_t length ) {
+  /* any whitespace held back goes out first (and a copy of nothing just
+   * writes that) */
+  if( state->whitespace != WS_NONE ) {
+    *state->out++ = ( state->whitespace == WS_NEWLINE ? '\n' : ' ' );
+    state->whitespace = WS_NONE;
+  }
+  if( length > 0 ) {
+    memcpy( state->out, p, length );
+    state->out += length;
+  }
+}
+
+static CONST char* static_ae_minify_find( CONST char* p, CONST char* limit,
+                                          CONST char* what, int ignore_case )
+{
+  size_t length = strlen( what );
+
+  for( ; limit - p >= (long)length; p++ ) {
+    if( ( ignore_case ? strncasecmp( p, what, length ) : strncmp( p, what, length ) ) == 0 ) {
+      return p;
+    }
+  }
+
+  return NULL;
+}
+
+static CONST char* static_ae_minify_raw( CONST char* p, CONST char* limit ) {
+  size_t length;
+  int    i;
+
+  /* returns the end tag of the raw element 'p' opens, or NULL if it doesn't
+   * open one */
+  for( i = 0; static_raw_elements[ i ] != NULL; i += 2 ) {
+    length = strlen( static_raw_elements[ i ] );
+    if( limit - p > (long)length + 1 &&
+        strncasecmp( p + 1, static_raw_elements[ i ], length ) == 0 &&
+        ( isspace( (unsigned char)p[ length + 1 ] ) || p[ length + 1 ] == '>' || p[ length + 1 ] == '/' ) )
+    {
+      return static_raw_elements[ i + 1 ];
+    }
+  }
+
+  return NULL;
+}
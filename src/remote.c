@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "remote.h"
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* requests larger than these are refused as malformed */
+#define REMOTE_MAX_STRINGS    ( 65536 )
+#define REMOTE_MAX_STRING     ( 16 * 1024 * 1024 )
+
+  /* the size of the buffer in front of a response stream, and so the size
+   * of the chunks a response is usually sent in */
+#define REMOTE_CHUNK_SIZE     ( 16 * 1024 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+  int   fd;
+  int   failed;
+} t_ae_remote_response;
+
+/* ------------------------------------------------------------------------- */
+/* static function prototypes                                                */
+/* ------------------------------------------------------------------------- */
+
+static int     static_ae_remote_read( int fd, void* buffer, size_t size );
+static int     static_ae_remote_write( int fd, CONST void* buffer, size_t size );
+static int     static_ae_remote_read_int( int fd, unsigned int* value );
+static int     static_ae_remote_write_int( int fd, unsigned int value );
+static int     static_ae_remote_write_string( int fd, CONST char* text );
+static int     static_ae_remote_connect( CONST char* socket_path );
+static int     static_ae_remote_exchange( int fd, CONST char* tem_file,
+                                          char** names, char** values, FILE* output );
+static ssize_t static_ae_remote_chunk_fn( void* cookie, CONST char* buffer, size_t size );
+static int     static_ae_remote_close_fn( void* cookie );
+
+/* ------------------------------------------------------------------------- */
+/* client functions                                                          */
+/* ------------------------------------------------------------------------- */
+
+int ae_remote_render( CONST char* socket_path, CONST char* tem_file,
+                      char** names, char** values, FILE* output ) {
+  int fd;
+  int rc;
+
+  fd = static_ae_remote_connect( socket_path );
+  if( fd < 0 ) {
+    return AE_REMOTE_UNAVAILABLE;
+  }
+  rc = static_ae_remote_exchange( fd, tem_file, names, values, output );
+  close( fd );
+
+  return rc;
+}
+
+int ae_remote_html( CONST char* socket_path, CONST char* tem_file,
+                    char** tokens, char** values, int mode ) {
+  t_ae_template_mgr mgr;
+  int fd;
+  int rc;
+
+  /* the page arrives from the server as it is rendered, uncompressed, so
+   * it is sent on that way */
+  mode &= ~HTML_GZIP;
+
+  /* if there is no server to be had, render the page here instead */
+  fd = static_ae_remote_connect( socket_path );
+  if( fd < 0 ) {
+    return ToHTML2( tem_file, tokens, values, mode );
+  }
+
+  /* the headers are written by the HTML preprocessor, which runs when a
+   * manager renders anything at all -- so render nothing with one */
+  mgr = ae_init_html( NULL, NULL, mode );
+  ae_process_buffer( mgr, "", stdout );
+  ae_done_html( mgr, NULL );
+
+  rc = static_ae_remote_exchange( fd, tem_file, tokens, values, stdout );
+  close( fd );
+
+  return ( rc == 0 ? 1 : 0 );
+}
+
+/* ------------------------------------------------------------------------- */
+/* server functions                                                          */
+/* ------------------------------------------------------------------------- */
+
+int ae_remote_read_request( int fd, char** tem_file, char*** names, char*** values ) {
+  unsigned int magic;
+  unsigned int count;
+  unsigned int size;
+  unsigned int i;
+  char** strings;
+
+  if( static_ae_remote_read_int( fd, &magic ) != 0 || magic != AE_REMOTE_MAGIC ) {
+    return -1;
+  }
+  if( static_ae_remote_read_int( fd, &count ) != 0 ||
+      count < 1 || count > REMOTE_MAX_STRINGS || ( count % 2 ) != 1 ) {
+    return -1;
+  }
+
+  /* read the strings into one list, null-terminated, then split it */
+  strings = (char**)ae_malloc( ( count + 1 ) * sizeof( char* ) );
+  memset( strings, 0, ( count + 1 ) * sizeof( char* ) );
+  for( i = 0; i < count; i++ ) {
+    if( static_ae_remote_read_int( fd, &size ) != 0 || size > REMOTE_MAX_STRING ) {
+      break;
+    }
+    strings[ i ] = (char*)ae_malloc( size + 1 );
+    if( static_ae_remote_read( fd, strings[ i ], size ) != 0 ) {
+      break;
+    }
+    strings[ i ][ size ] = 0;
+  }
+  if( i < count ) {
+    for( i = 0; i < count; i++ ) {
+      ae_free( strings[ i ] );
+    }
+    ae_free( strings );
+    return -1;
+  }
+
+  /* hand the strings back as the template name and separate lists of
+   * names and values */
+  *tem_file = strings[ 0 ];
+  *names = (char**)ae_malloc( ( count / 2 + 1 ) * sizeof( char* ) );
+  *values = (char**)ae_malloc( ( count / 2 + 1 ) * sizeof( char* ) );
+  for( i = 0; i < count / 2; i++ ) {
+    (*names)[ i ] = strings[ 1 + i * 2 ];
+    (*values)[ i ] = strings[ 2 + i * 2 ];
+  }
+  (*names)[ i ] = NULL;
+  (*values)[ i ] = NULL;
+  ae_free( strings );
+
+  return 0;
+}
+
+void ae_remote_free_request( char* tem_file, char** names, char** values ) {
+  int i;
+
+  for( i = 0; names[ i ] != NULL; i++ ) {
+    ae_free( names[ i ] );
+    ae_free( values[ i ] );
+  }
+  ae_free( names );
+  ae_free( values );
+  ae_free( tem_file );
+}
+
+FILE* ae_remote_open_response( int fd ) {
+  cookie_io_functions_t functions;
+  t_ae_remote_response* response;
+  FILE* stream;
+
+  memset( &functions, 0, sizeof( functions ) );
+  functions.write = static_ae_remote_chunk_fn;
+  functions.close = static_ae_remote_close_fn;
+
+  response = (t_ae_remote_response*)ae_malloc( sizeof( t_ae_remote_response ) );
+  response->fd = fd;
+  response->failed = 0;
+
+  stream = fopencookie( response, "w", functions );
+  if( stream == NULL ) {
+    ae_free( response );
+    return NULL;
+  }
+  setvbuf( stream, NULL, _IOFBF, REMOTE_CHUNK_SIZE );
+
+  return stream;
+}
+
+int ae_remote_close_response( FILE* response, int fd, int rc ) {
+  int failed;
+
+  /* closing the stream sends the last chunk; the response then ends with
+   * an empty chunk and the return code */
+  failed = ( fclose( response ) != 0 );
+  if( !failed ) {
+    failed = ( static_ae_remote_write_int( fd, 0 ) != 0 ||
+               static_ae_remote_write_int( fd, (unsigned int)rc ) != 0 );
+  }
+
+  return ( failed ? -1 : 0 );
+}
+
+/* ------------------------------------------------------------------------- */
+/* static functions                                                          */
+/* ------------------------------------------------------------------------- */
+
+static int static_ae_remote_read( int fd, void* buffer, size_t size ) {
+  char*   p = (char*)buffer;
+  ssize_t count;
+
+  while( size > 0 ) {
+    count = read( fd, p, size );
+    if( count < 0 && errno == EINTR ) continue;
+    if( count <= 0 ) return -1;
+    p += count;
+    size -= count;
+  }
+
+  return 0;
+}
+
+static int static_ae_remote_write( int fd, CONST void* buffer, size_t size ) {
+  CONST char* p = (CONST char*)buffer;
+  ssize_t count;
+
+  /* MSG_NOSIGNAL, so that a peer which has gone away is an error here
+   * rather than a SIGPIPE */
+  while( size > 0 ) {
+    count = send( fd, p, size, MSG_NOSIGNAL );
+    if( count < 0 && errno == EINTR ) continue;
+    if( count <= 0 ) return -1;
+    p += count;
+    size -= count;
+  }
+
+  return 0;
+}
+
+static int static_ae_remote_read_int( int fd, unsigned int* value ) {
+  uint32_t net;
+
+  if( static_ae_remote_read( fd, &net, sizeof( net ) ) != 0 ) {
+    return -1;
+  }
+  *value = ntohl( net );
+
+  return 0;
+}
+
+static int static_ae_remote_write_int( int fd, unsigned int value ) {
+  uint32_t net = htonl( value );
+  return static_ae_remote_write( fd, &net, sizeof( net ) );
+}
+
+static int static_ae_remote_write_string( int fd, CONST char* text ) {
+  size_t size = strlen( text );
+
+  if( static_ae_remote_write_int( fd, (unsigned int)size ) != 0 ) {
+    return -1;
+  }
+  return static_ae_remote_write( fd, text, size );
+}
+
+static int static_ae_remote_connect( CONST char* socket_path ) {
+  struct sockaddr_un address;
+  int fd;
+
+  if( socket_path == NULL || strlen( socket_path ) >= sizeof( address.sun_path ) ) {
+    return -1;
+  }
+
+  memset( &address, 0, sizeof( address ) );
+  address.sun_family = AF_UNIX;
+  strcpy( address.sun_path, socket_path );
+
+  fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( fd < 0 ) {
+    return -1;
+  }
+  if( connect( fd, (struct sockaddr*)&address, sizeof( address ) ) != 0 ) {
+    close( fd );
+    return -1;
+  }
+
+  return fd;
+}
+
+static int static_ae_remote_exchange( int fd, CONST char* tem_file,
+                                      char** names, char** values, FILE* output ) {
+  unsigned int count = 1;
+  unsigned int size;
+  unsigned int rc;
+  char buffer[ 4096 ];
+  int  i;
+
+  /* count the pairs that can be sent -- tag objects live in this process,
+   * so they are left behind */
+  for( i = 0; names != NULL && names[ i ] && *names[ i ]; i++ ) {
+    if( *names[ i ] != '-' ) count += 2;
+  }
+
+  /* send the request */
+  if( static_ae_remote_write_int( fd, AE_REMOTE_MAGIC ) != 0 ||
+      static_ae_remote_write_int( fd, count ) != 0 ||
+      static_ae_remote_write_string( fd, tem_file ) != 0 ) {
+    return AE_REMOTE_UNAVAILABLE;
+  }
+  for( i = 0; names != NULL && names[ i ] && *names[ i ]; i++ ) {
+    if( *names[ i ] == '-' ) continue;
+    if( static_ae_remote_write_string( fd, names[ i ] ) != 0 ||
+        static_ae_remote_write_string( fd, values[ i ] ? values[ i ] : "" ) != 0 ) {
+      return AE_REMOTE_UNAVAILABLE;
+    }
+  }
+
+  /* copy the chunks of the response to the output, up to the empty one */
+  for( ;; ) {
+    if( static_ae_remote_read_int( fd, &size ) != 0 ) {
+      return AE_REMOTE_UNAVAILABLE;
+    }
+    if( size == 0 ) break;
+    while( size > 0 ) {
+      count = ( size < sizeof( buffer ) ? size : sizeof( buffer ) );
+      if( static_ae_remote_read( fd, buffer, count ) != 0 ) {
+        return AE_REMOTE_UNAVAILABLE;
+      }
+      fwrite( buffer, 1, count, output );
+      size -= count;
+    }
+  }
+  if( static_ae_remote_read_int( fd, &rc ) != 0 ) {
+    return AE_REMOTE_UNAVAILABLE;
+  }
+
+  return (int)rc;
+}
+
+static ssize_t static_ae_remote_chunk_fn( void* cookie, CONST char* buffer, size_t size ) {
+  t_ae_remote_response* response = (t_ae_remote_response*)cookie;
+
+  /* an empty write would end the response, so there is nothing to send */
+  if( size == 0 ) return 0;
+
+  if( response->failed ||
+      static_ae_remote_write_int( response->fd, (unsigned int)size ) != 0 ||
+      static_ae_remote_write( response->fd, buffer, size ) != 0 ) {
+    /* a cookie write function reports an error by writing nothing */
+    response->failed = 1;
+    return 0;
+  }
+
+  return (ssize_t)size;
+}
+
+static int static_ae_remote_close_fn( void* cookie ) {
+  t_ae_remote_response* response = (t_ae_remote_response*)cookie;
+  int failed = response->failed;
+
+  ae_free( response );
+
+  return ( failed ? -1 : 0 );
+}
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "resume.h"
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the stack each render runs on.  It is mapped, not allocated, so only the
+   * pages a render reaches are ever backed, and its lowest page is left
+   * inaccessible so that a render nested too deeply faults rather than
+   * overwriting whatever lies below */
+#define RENDER_STACK_SIZE   ( 512 * 1024 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+  t_ae_template_mgr mgr;
+  char*      file;
+  char*      text;
+  FILE*      stream;
+  ucontext_t caller;
+  ucontext_t context;
+  t_ae_thread_state caller_state;
+  t_ae_thread_state render_state;
+  char*      stack;
+  size_t     stack_size;
+  char*      buffer;
+  int        size;
+  int        length;
+  int        started;
+  int        done;
+  int        discard;
+  int        rc;
+} t_ae_render_data;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_render_data* static_ae_render_new( t_ae_template_mgr mgr );
+static void    static_ae_render_switch( t_ae_render_data* data );
+static void    static_ae_render_main( unsigned int high, unsigned int low );
+static ssize_t static_ae_render_write_fn( void* cookie, const char* data, size_t size );
+
+/* ------------------------------------------------------------------------- */
+/* resumable render function implementations                                 */
+/* ------------------------------------------------------------------------- */
+
+t_ae_render ae_render_start_template( t_ae_template_mgr mgr, CONST char* file ) {
+  t_ae_render_data* render;
+
+  render = static_ae_render_new( mgr );
+  if( render != NULL ) {
+    render->file = ae_strdup( file );
+  }
+
+  return (t_ae_render)render;
+}
+
+t_ae_render ae_render_start_buffer( t_ae_template_mgr mgr, CONST char* buffer ) {
+  t_ae_render_data* render;
+
+  render = static_ae_render_new( mgr );
+  if( render != NULL ) {
+    render->text = ae_strdup( buffer );
+  }
+
+  return (t_ae_render)render;
+}
+
+int ae_render_step( t_ae_render render, char* buffer, int size, int* length ) {
+  t_ae_render_data* data = (t_ae_render_data*)render;
+  uintptr_t address;
+
+  *length = 0;
+  if( data->done ) return AE_RENDER_DONE;
+
+  data->buffer = buffer;
+  data->size = size;
+  data->length = 0;
+
+  /* the first step starts the render on its own stack; later steps resume
+   * it inside the write function, where it stopped when the last buffer
+   * filled.  Either way, control comes back here when the buffer is full
+   * or the render has finished. */
+  if( !data->started ) {
+    data->started = 1;
+    getcontext( &data->context );
+    data->context.uc_stack.ss_sp = data->stack;
+    data->context.uc_stack.ss_size = data->stack_size;
+    data->context.uc_link = &data->caller;
+
+    /* makecontext passes only ints, so the render goes in two halves */
+    address = (uintptr_t)data;
+    makecontext( &data->context, (void (*)( void ))static_ae_render_main, 2,
+                 (unsigned int)( ( address >> 16 ) >> 16 ), (unsigned int)address );
+  }
+  static_ae_render_switch( data );
+
+  *length = data->length;
+  data->buffer = NULL;
+
+  return ( data->done ? AE_RENDER_DONE : AE_RENDER_MORE );
+}
+
+int ae_render_result( t_ae_render render ) {
+  t_ae_render_data* data = (t_ae_render_data*)render;
+  return ( data->done ? data->rc : -1 );
+}
+
+void ae_render_free( t_ae_render render ) {
+  t_ae_render_data* data = (t_ae_render_data*)render;
+
+  /* a render left part way through holds memory (and perhaps files) in the
+   * frames on its stack, so it is run out to let them go -- but cancelled
+   * first, so that it gives up at its next check rather than rendering the
+   * rest of the page for nobody */
+  if( data->started && !data->done ) {
+    ae_cancel_render( data->mgr );
+    data->discard = 1;
+    static_ae_render_switch( data );
+  }
+
+  munmap( data->stack - getpagesize(), data->stack_size + getpagesize() );
+  ae_free( data->file );
+  ae_free( data->text );
+  ae_free( data );
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_render_data* static_ae_render_new( t_ae_template_mgr mgr ) {
+  t_ae_render_data* render;
+  size_t page;
+  char*  stack;
+
+  page = getpagesize();
+  stack = (char*)mmap( NULL, RENDER_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+  if( stack == MAP_FAILED ) return NULL;
+  mprotect( stack, page, PROT_NONE );
+
+  render = (t_ae_render_data*)ae_malloc( sizeof( t_ae_render_data ) );
+  memset( render, 0, sizeof( t_ae_render_data ) );
+  render->mgr = mgr;
+  render->stack = stack + page;
+  render->stack_size = RENDER_STACK_SIZE;
+  render->rc = -1;
+
+  return render;
+}
+
+static void static_ae_render_switch( t_ae_render_data* data ) {
+  /* run the render until it next pauses or finishes.  The library's
+   * per-thread state is the render's while it runs and the caller's
+   * otherwise, so that renders interleaved on one thread never see each
+   * other's; and the render's clock only runs while it does */
+  ae_save_thread_state( &data->caller_state );
+  ae_restore_thread_state( &data->render_state );
+  ae_resume_limits( data->mgr );
+
+  swapcontext( &data->caller, &data->context );
+
+  ae_pause_limits( data->mgr );
+  ae_save_thread_state( &data->render_state );
+  ae_restore_thread_state( &data->caller_state );
+}
+
+static void static_ae_render_main( unsigned int high, unsigned int low ) {
+  cookie_io_functions_t functions;
+  t_ae_render_data* data;
+  int cancellable;
+
+  data = (t_ae_render_data*)( ( ( (uintptr_t)high << 16 ) << 16 ) | low );
+
+  /* the page is written to a stream whose writes go to the step's buffer;
+   * see static_ae_render_write_fn */
+  memset( &functions, 0, sizeof( functions ) );
+  functions.write = static_ae_render_write_fn;
+  data->stream = fopencookie( data, "w", functions );
+
+  if( data->stream != NULL ) {
+    /* the render can be cancelled, should it be freed unfinished */
+    cancellable = ae_get_cancellable( data->mgr );
+    ae_set_cancellable( data->mgr, 1 );
+    if( data->file != NULL ) {
+      data->rc = ae_process_template( data->mgr, data->file, data->stream );
+    } else {
+      data->rc = ae_process_buffer( data->mgr, data->text, data->stream );
+    }
+    ae_set_cancellable( data->mgr, cancellable );
+
+    /* closing the stream writes what it still holds, which may take more
+     * steps yet */
+    if( fclose( data->stream ) != 0 && data->rc == 0 ) {
+      data->rc = -1;
+    }
+    data->stream = NULL;
+  }
+
+  /* returning resumes the step that was waiting (uc_link) */
+  data->done = 1;
+}
+
+static ssize_t static_ae_render_write_fn( void* cookie, const char* data, size_t size ) {
+  t_ae_render_data* render = (t_ae_render_data*)cookie;
+  size_t written = 0;
+  size_t count;
+
+  /* copy into the step's buffer, and whenever it is full, go back to the
+   * step and wait here for the next one */
+  while( written < size && !render->discard ) {
+    count = render->size - render->length;
+    if( count > size - written ) count = size - written;
+    memcpy( render->buffer + render->length, data + written, count );
+    render->length += count;
+    written += count;
+
+    if( render->length == render->size ) {
+      swapcontext( &render->context, &render->caller );
+    }
+  }
+
+  return size;
+}
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+/* ------------------------------------------------------------------------- */
+/* macros and constants                                                      */
+/* ------------------------------------------------------------------------- */
+
+#define STATS_MAGIC         ( 0x41455354 )
+#define STATS_VERSION       ( 1 )
+
+#define STATS_SLOTS         ( 256 )
+#define STATS_NAME_MAX      ( 232 )
+
+  /* latencies are kept in microseconds.  The first STATS_SUB_BUCKETS
+   * buckets hold 0 to 15us exactly; after that, each power of two is split
+   * into STATS_SUB_BUCKETS buckets, up to 2^STATS_MAX_BITS us */
+#define STATS_SUB_BITS      ( 4 )
+#define STATS_SUB_BUCKETS   ( 1 << STATS_SUB_BITS )
+#define STATS_MAX_BITS      ( 36 )
+#define STATS_BUCKETS       ( ( STATS_MAX_BITS - STATS_SUB_BITS + 1 ) * STATS_SUB_BUCKETS )
+
+  /* slot states.  A slot being claimed has its name written before it is
+   * ready, and a process that finds one being claimed waits (a little) to
+   * see whether it is the slot it wants */
+#define SLOT_EMPTY          ( 0 )
+#define SLOT_CLAIMING       ( 1 )
+#define SLOT_READY          ( 2 )
+#define SLOT_CLAIM_SPINS    ( 1000 )
+
+/* ------------------------------------------------------------------------- */
+/* type implementations                                                      */
+/* ------------------------------------------------------------------------- */
+
+  /* the layout of the statistics file.  Everything in it is fixed in size,
+   * so any process built with the same STATS_VERSION can map it */
+
+typedef struct {
+  uint32_t state;
+  uint32_t hash;
+  char     name[ STATS_NAME_MAX ];
+  uint64_t renders;
+  uint64_t errors;
+  uint64_t measured;
+  uint64_t bytes;
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t buckets[ STATS_BUCKETS ];
+} t_ae_stats_slot;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t buckets;
+  uint64_t unrecorded;
+  t_ae_stats_slot slot[ STATS_SLOTS ];
+} t_ae_stats_file;
+
+  /* one template's line of a report */
+
+typedef struct {
+  t_ae_stats_slot* slot;
+  uint64_t         percentile[ 4 ];
+} t_ae_stats_line;
+
+/* ------------------------------------------------------------------------- */
+/* static function definitions                                               */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_stats_file* static_ae_stats_map( CONST char* path, int create );
+static void      static_ae_stats_unmap( t_ae_stats_file* stats );
+static t_ae_stats_slot* static_ae_stats_slot( t_ae_stats_file* stats, CONST char* name );
+static int       static_ae_stats_bucket( uint64_t us );
+static uint64_t  static_ae_stats_bucket_top( int bucket );
+static uint64_t  static_ae_stats_percentile( t_ae_stats_slot* slot, uint64_t count, double fraction );
+static int       static_ae_stats_compare( CONST void* a, CONST void* b );
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_stats_file* static_stats = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* statistics function implementations                                       */
+/* ------------------------------------------------------------------------- */
+
+int ae_stats_attach( CONST char* path ) {
+  t_ae_stats_file* stats;
+
+  stats = static_ae_stats_map( path, 1 );
+  if( stats == NULL ) return -1;
+
+  ae_stats_detach();
+  static_stats = stats;
+
+  return 0;
+}
+
+void ae_stats_detach( void ) {
+  if( static_stats != NULL ) {
+    static_ae_stats_unmap( static_stats );
+    static_stats = NULL;
+  }
+}
+
+int ae_stats_attached( void ) {
+  return ( static_stats != NULL );
+}
+
+void ae_stats_record( CONST char* name, long elapsed_ns, long bytes, int failed ) {
+  t_ae_stats_slot* slot;
+  uint64_t us;
+  uint64_t max;
+
+  if( static_stats == NULL ) return;
+
+  slot = static_ae_stats_slot( static_stats, name );
+  if( slot == NULL ) {
+    __sync_fetch_and_add( &static_stats->unrecorded, 1 );
+    return;
+  }
+
+  us = ( elapsed_ns > 0 ? (uint64_t)elapsed_ns / 1000 : 0 );
+  __sync_fetch_and_add( &slot->renders, 1 );
+  if( failed ) {
+    __sync_fetch_and_add( &slot->errors, 1 );
+  }
+  if( bytes >= 0 ) {
+    __sync_fetch_and_add( &slot->measured, 1 );
+    __sync_fetch_and_add( &slot->bytes, (uint64_t)bytes );
+  }
+  __sync_fetch_and_add( &slot->total_us, us );
+  __sync_fetch_and_add( &slot->buckets[ static_ae_stats_bucket( us ) ], 1 );
+
+  max = slot->max_us;
+  while( us > max && !__sync_bool_compare_and_swap( &slot->max_us, max, us ) ) {
+    max = slot->max_us;
+  }
+}
+
+int ae_stats_report( CONST char* path, FILE* output ) {
+  t_ae_stats_file* stats;
+  t_ae_stats_line* lines;
+  t_ae_stats_slot* slot;
+  uint64_t count;
+  int   total = 0;
+  int   i, j;
+
+  stats = static_ae_stats_map( path, 0 );
+  if( stats == NULL ) return -1;
+
+  /* take the percentiles from each template's histogram as it stands; its
+   * renders are counted from the histogram too, so the two agree even as
+   * other processes add to them */
+  lines = (t_ae_stats_line*)ae_malloc( STATS_SLOTS * sizeof( t_ae_stats_line ) );
+  for( i = 0; i < STATS_SLOTS; i++ ) {
+    slot = &stats->slot[ i ];
+    if( __atomic_load_n( &slot->state, __ATOMIC_ACQUIRE ) != SLOT_READY ) continue;
+
+    count = 0;
+    for( j = 0; j < STATS_BUCKETS; j++ ) {
+      count += slot->buckets[ j ];
+    }
+    if( count == 0 ) continue;
+
+    lines[ total ].slot = slot;
+    lines[ total ].percentile[ 0 ] = static_ae_stats_percentile( slot, count, 0.50 );
+    lines[ total ].percentile[ 1 ] = static_ae_stats_percentile( slot, count, 0.90 );
+    lines[ total ].percentile[ 2 ] = static_ae_stats_percentile( slot, count, 0.99 );
+    lines[ total ].percentile[ 3 ] = static_ae_stats_percentile( slot, count, 0.999 );
+    total++;
+  }
+  qsort( lines, total, sizeof( t_ae_stats_line ), static_ae_stats_compare );
+
+  fprintf( output, "%10s %8s %10s %10s %10s %10s %10s %10s %10s  %s\n",
+           "renders", "errors", "bytes", "mean_us", "p50_us", "p90_us", "p99_us",
+           "p99.9_us", "max_us", "template" );
+  for( i = 0; i < total; i++ ) {
+    slot = lines[ i ].slot;
+    fprintf( output, "%10llu %8llu %10llu %10llu %10llu %10llu %10llu %10llu %10llu  %s\n",
+             (unsigned long long)slot->renders,
+             (unsigned long long)slot->errors,
+             (unsigned long long)( slot->measured ? slot->bytes / slot->measured : 0 ),
+             (unsigned long long)( slot->renders ? slot->total_us / slot->renders : 0 ),
+             (unsigned long long)lines[ i ].percentile[ 0 ],
+             (unsigned long long)lines[ i ].percentile[ 1 ],
+             (unsigned long long)lines[ i ].percentile[ 2 ],
+             (unsigned long long)lines[ i ].percentile[ 3 ],
+             (unsigned long long)slot->max_us,
+             slot->name );
+  }
+  if( stats->unrecorded > 0 ) {
+    fprintf( output, "(%llu renders of other templates not recorded: no free slots)\n",
+             (unsigned long long)stats->unrecorded );
+  }
+
+  ae_free( lines );
+  static_ae_stats_unmap( stats );
+
+  return 0;
+}
+
+int ae_stats_reset( CONST char* path ) {
+  t_ae_stats_file* stats;
+  t_ae_stats_slot* slot;
+  int i;
+
+  stats = static_ae_stats_map( path, 0 );
+  if( stats == NULL ) return -1;
+
+  /* the slots keep their templates; only the counts go */
+  for( i = 0; i < STATS_SLOTS; i++ ) {
+    slot = &stats->slot[ i ];
+    slot->renders = 0;
+    slot->errors = 0;
+    slot->measured = 0;
+    slot->bytes = 0;
+    slot->total_us = 0;
+    slot->max_us = 0;
+    memset( slot->buckets, 0, sizeof( slot->buckets ) );
+  }
+  stats->unrecorded = 0;
+
+  static_ae_stats_unmap( stats );
+
+  return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* static function implementations                                           */
+/* ------------------------------------------------------------------------- */
+
+static t_ae_stats_file* static_ae_stats_map( CONST char* path, int create ) {
+  t_ae_stats_file* stats;
+  struct stat info;
+  int fd;
+
+  fd = open( path, ( create ? O_RDWR | O_CREAT : O_RDWR ), 0666 );
+  if( fd < 0 ) return NULL;
+
+  /* a new file is sized here, by whichever process gets to it first; the
+   * pages it gains read as zero, which is an empty set of slots */
+  if( fstat( fd, &info ) != 0 ||
+      ( info.st_size == 0 && create && ftruncate( fd, sizeof( t_ae_stats_file ) ) != 0 ) ||
+      ( info.st_size != 0 && info.st_size != sizeof( t_ae_stats_file ) ) )
+  {
+    close( fd );
+    return NULL;
+  }
+  if( info.st_size == 0 && !create ) {
+    close( fd );
+    return NULL;
+  }
+
+  stats = (t_ae_stats_file*)mmap( NULL, sizeof( t_ae_stats_file ), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, 0 );
+  close( fd );
+  if( stats == MAP_FAILED ) return NULL;
+
+  /* the header is the same whoever writes it, so processes racing to write
+   * it can all do so; the magic number goes last */
+  if( __atomic_load_n( &stats->magic, __ATOMIC_ACQUIRE ) == 0 ) {
+    stats->version = STATS_VERSION;
+    stats->slots = STATS_SLOTS;
+    stats->buckets = STATS_BUCKETS;
+    __sync_bool_compare_and_swap( &stats->magic, 0, STATS_MAGIC );
+  }
+  if( stats->magic != STATS_MAGIC || stats->version != STATS_VERSION ||
+      stats->slots != STATS_SLOTS || stats->buckets != STATS_BUCKETS )
+  {
+    static_ae_stats_unmap( stats );
+    return NULL;
+  }
+
+  return stats;
+}
+
+static void static_ae_stats_unmap( t_ae_stats_file* stats ) {
+  munmap( stats, sizeof( t_ae_stats_file ) );
+}
+
+static t_ae_stats_slot* static_ae_stats_slot( t_ae_stats_file* stats, CONST char* name ) {
+  t_ae_stats_slot* slot;
+  uint32_t hash = 2166136261u;
+  uint32_t state;
+  int length;
+  int spins;
+  int i;
+
+  /* the template's slot is found by open addressing on a hash of its
+   * (possibly shortened) name, and claimed if it has none yet */
+  for( length = 0; name[ length ] != 0 && length < STATS_NAME_MAX-1; length++ ) {
+    hash = ( hash ^ (unsigned char)name[ length ] ) * 16777619u;
+  }
+
+  for( i = 0; i < STATS_SLOTS; i++ ) {
+    slot = &stats->slot[ ( hash + i ) % STATS_SLOTS ];
+    state = __atomic_load_n( &slot->state, __ATOMIC_ACQUIRE );
+
+    if( state == SLOT_EMPTY ) {
+      if( __sync_bool_compare_and_swap( &slot->state, SLOT_EMPTY, SLOT_CLAIMING ) ) {
+        memcpy( slot->name, name, length );
+        slot->name[ length ] = 0;
+        slot->hash = hash;
+        __atomic_store_n( &slot->state, SLOT_READY, __ATOMIC_RELEASE );
+        return slot;
+      }
+      state = __atomic_load_n( &slot->state, __ATOMIC_ACQUIRE );
+    }
+
+    /* (a process that died while claiming a slot leaves it unusable, but
+     * doesn't hold the others up for long) */
+    for( spins = 0; state == SLOT_CLAIMING && spins < SLOT_CLAIM_SPINS; spins++ ) {
+      sched_yield();
+      state = __atomic_load_n( &slot->state, __ATOMIC_ACQUIRE );
+    }
+
+    if( state == SLOT_READY && slot->hash == hash &&
+        strncmp( slot->name, name, length ) == 0 && slot->name[ length ] == 0 )
+    {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+static int static_ae_stats_bucket( uint64_t us ) {
+  int bits;
+
+  if( us < STATS_SUB_BUCKETS ) return (int)us;
+  if( us >= (uint64_t)1 << STATS_MAX_BITS ) us = ( (uint64_t)1 << STATS_MAX_BITS ) - 1;
+
+  /* the power of two picks the row, and the next STATS_SUB_BITS bits below
+   * its top bit the bucket in it */
+  bits = 63 - __builtin_clzll( us );
+  return ( bits - STATS_SUB_BITS + 1 ) * STATS_SUB_BUCKETS +
+         (int)( ( us >> ( bits - STATS_SUB_BITS ) ) - STATS_SUB_BUCKETS );
+}
+
+static uint64_t static_ae_stats_bucket_top( int bucket ) {
+  int bits;
+  int sub;
+
+  if( bucket < STATS_SUB_BUCKETS ) return bucket;
+
+  bits = bucket / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+  sub = bucket % STATS_SUB_BUCKETS;
+  return ( ( (uint64_t)( STATS_SUB_BUCKETS + sub + 1 ) ) << ( bits - STATS_SUB_BITS ) ) - 1;
+}
+
+static uint64_t static_ae_stats_percentile( t_ae_stats_slot* slot, uint64_t count, double fraction ) {
+  uint64_t rank;
+  uint64_t seen = 0;
+  int i;
+
+  /* the latency below which 'fraction' of the renders fell, given as the
+   * top of the bucket holding the render of that rank */
+  rank = (uint64_t)( fraction * count );
+  if( rank < fraction * count || rank < 1 ) rank++;
+  if( rank > count ) rank = count;
+
+  for( i = 0; i < STATS_BUCKETS; i++ ) {
+    seen += slot->buckets[ i ];
+    if( seen >= rank ) return static_ae_stats_bucket_top( i );
+  }
+
+  return static_ae_stats_bucket_top( STATS_BUCKETS-1 );
+}
+
+static int static_ae_stats_compare( CONST void* a, CONST void* b ) {
+  CONST t_ae_stats_line* line_a = (CONST t_ae_stats_line*)a;
+  CONST t_ae_stats_line* line_b = (CONST t_ae_stats_line*)b;
+
+  if( line_a->percentile[ 2 ] != line_b->percentile[ 2 ] ) {
+    return ( line_a->percentile[ 2 ] > line_b->percentile[ 2 ] ? -1 : 1 );
+  }
+  return strcmp( line_a->slot->name, line_b->slot->name );
+}
@@ -1,4 +1,5 @@
 #if defined( linux )
+# define _GNU_SOURCE
 # define DLOPEN_TYPE
 # include <dlfcn.h>
 #elif defined( _HPUX_SOURCE )
@@ -10,8 +11,20 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "templates.h"
+#include "gzip.h"
+#include "minify.h"
+#include "analyze.h"
+#include "probes.h"
+#include "stats.h"
 
 /* ------------------------------------------------------------------------- */
 /* macros and constants                                                      */
@@ -30,9 +43,17 @@
 #define DEFAULT_TAG_END   "%-->"
 #define DEFAULT_DELIMITER "="
 
-#define NEW( item_name )     (item_name*)malloc( sizeof( item_name ) )
+  /* the 64-bit FNV-1a offset basis and prime, for the HTML page validator */
+#define ETAG_BASIS        ( 14695981039346656037ULL )
+#define ETAG_PRIME        ( 1099511628211ULL )
+
+  /* how deeply named include tags are followed for the validator */
+#define ETAG_MAX_DEPTH    ( 32 )
+
+#define NEW( item_name )     (item_name*)ae_malloc( sizeof( item_name ) )
 #define NEWTAG( name, type ) (type*)ae_tag_new( name, sizeof( type ) )
-#define DELETE( x )          free( x )
+
+#define DELETE( x )          ae_free( x )
 
 #define DECL_CAST( var, parm, type )  type* var = (type*)parm
 #define MGR_CAST( var, parm )         DECL_CAST( var, parm, t_ae_mgr )
@@ -45,6 +66,51 @@
 #define COMP_TYPE_GT      ( 4 )
 #define COMP_TYPE_GE      ( 5 )
 
+#define SECTION_BARRIER   ( 0 )
+#define SECTION_SERIAL    ( 1 )
+#define SECTION_PARALLEL  ( 2 )
+
+#define SECTION_MAX_DEPTH ( 16 )
+
+#define PROFILE_BUCKETS   ( 256 )
+
+  /* how much of a tag's text a trace event carries */
+#define TRACE_ARG_MAX      ( 32 )
+
+  /* how much of the name of the tag that applied some text is kept for a
+   * trace event or a probe */
+#define TAG_NAME_MAX       ( 64 )
+
+  /* a render with a deadline looks at the clock once in so many tags or
+   * loop passes */
+#define BUDGET_CLOCK_TICKS ( 32 )
+
+  /* the nodes of a compiled IF_EXPR expression */
+#define EXPR_OR           ( 0 )
+#define EXPR_AND          ( 1 )
+#define EXPR_NOT          ( 2 )
+#define EXPR_COMPARE      ( 3 )
+#define EXPR_NAME         ( 4 )
+#define EXPR_LITERAL      ( 5 )
+#define EXPR_CALL         ( 6 )
+
+  /* the tokens of an expression */
+#define EXPR_TOK_END      ( 0 )
+#define EXPR_TOK_OPEN     ( 1 )
+#define EXPR_TOK_CLOSE    ( 2 )
+#define EXPR_TOK_WORD     ( 3 )
+#define EXPR_TOK_STRING   ( 4 )
+#define EXPR_TOK_ERROR    ( 5 )
+
+  /* compiled expressions are kept by the IF_EXPR tag, up to a limit (past
+   * which they are compiled for each use) */
+#define EXPR_BUCKETS      ( 64 )
+#define EXPR_CACHE_MAX    ( 1024 )
+
+  /* when accounting is on, every block carries a header holding its size.
+   * The header is 16 bytes to keep the block that follows suitably aligned. */
+#define ALLOC_HDR_SIZE    ( 16 )
+
 /* ------------------------------------------------------------------------- */
 /* type implementations                                                      */
 /* ------------------------------------------------------------------------- */
@@ -67,14 +133,31 @@ typedef struct {
   int   pos;
 } t_ae_buffer_stream;
 
+  /* the escaped form of a replace tag's value, made the first time it is
+   * written in a mode (see ae_set_auto_escape) */
+typedef struct {
+  size_t length;
+  char   text[ 1 ];
+} t_ae_escaped;
+
 typedef struct {
   STANDARD_REPLACE_TAG_HDR;
+  t_ae_escaped* m_escaped[ 2 ];
+  int           m_raw;
 } t_ae_replace_tag;
 
+  /* the items of a cyclical replace tag's list are found once, when the tag
+   * is made: item i runs from m_offsets[i] to the delimiter before
+   * m_offsets[i+1].  m_partial is set if the list ends with an item that has
+   * no delimiter after it. */
+
 typedef struct {
   STANDARD_REPLACE_TAG_HDR;
-  char* m_rpt_delim;
-  char* m_next;
+  char*   m_rpt_delim;
+  size_t* m_offsets;
+  int     m_count;
+  int     m_row;
+  int     m_partial;
 } t_ae_cyclical_replace_tag;
 
 typedef struct {
@@ -89,6 +172,65 @@ typedef struct {
   int comp_type;
 } t_ae_comparison_tag;
 
+typedef struct {
+  STANDARD_TAG_HDR;
+  t_ae_lazy_fn    m_provider;
+  void*           m_cookie;
+  char*           m_data;
+  int             m_ready;
+  pthread_mutex_t m_lock;
+} t_ae_lazy_tag;
+
+typedef struct {
+  STANDARD_TAG_HDR;
+  t_ae_row_fn m_next_row;
+  void*       m_cookie;
+} t_ae_row_source_tag;
+
+typedef struct {
+  STANDARD_TAG_HDR;
+  t_ae_condition_fn m_check;
+  void*             m_cookie;
+} t_ae_condition_tag;
+
+  /* a compiled expression is an array of nodes; operators refer to their
+   * operands by index, and the root is the last node */
+typedef struct {
+  int    op;
+  int    left;
+  int    right;
+  int    comp_type;
+  char*  text;
+  char*  arg;
+  int    is_number;
+  double number;
+} t_ae_expr_node;
+
+typedef struct __ae_expr t_ae_expr;
+struct __ae_expr {
+  t_ae_expr*      next;
+  char*           text;
+  t_ae_expr_node* nodes;
+  int             count;
+  int             alloced;
+  int             calls;
+};
+
+typedef struct {
+  STANDARD_TAG_HDR;
+  t_ae_expr*      m_buckets[ EXPR_BUCKETS ];
+  int             m_cached;
+  pthread_mutex_t m_lock;
+} t_ae_expr_tag;
+
+typedef struct {
+  t_ae_expr*  expr;
+  CONST char* p;
+  int         token;
+  CONST char* start;
+  int         length;
+} t_ae_expr_parse;
+
 typedef struct __ae_tag_list t_ae_tag_list;
 struct __ae_tag_list {
   t_ae_tag_list*    next;
@@ -96,7 +238,87 @@ struct __ae_tag_list {
   t_ae_generic_tag* tag;
 };
 
+typedef struct __ae_prof_entry t_ae_prof_entry;
+struct __ae_prof_entry {
+  t_ae_prof_entry* next;
+  t_ae_tag_stats   last;
+  t_ae_tag_stats   total;
+};
+
+typedef struct {
+  t_ae_prof_entry*  buckets[ PROFILE_BUCKETS ];
+  t_ae_prof_entry** entries;
+  int               count;
+  int               alloced;
+  t_ae_render_stats last;
+  t_ae_render_stats total;
+  long*             child_ns;
+  int               frame;
+  int               frames;
+  long              start_ns;
+  long              start_pos;
+} t_ae_profile;
+
+  /* where a render's trace events go: the tracer's file, or (with
+   * AE_TRACE_RENDER) a file of the render's own */
+typedef struct {
+  FILE* file;
+  long  events;
+  int   own;
+} t_ae_trace_out;
+
+typedef struct {
+  char*          path;
+  int            mode;
+  long           renders;
+  t_ae_trace_out out;
+} t_ae_tracer_data;
+
+  /* what a top-level render has used of its manager's limits.  The
+   * sections of a parallel render all draw on their render's budget. */
+typedef struct {
+  int  reason;
+  long includes;
+  long iterations;
+  long deadline_ns;
+  long paused_ns;
+} t_ae_budget;
+
+typedef struct {
+  FILE*        output;
+  long         count;
+  long         limit;
+  t_ae_budget* budget;
+} t_ae_counting_cookie;
+
+  /* the names of the tags a region of a recorded render depended on, and
+   * whether it used any tag whose output can change regardless */
+typedef struct {
+  char** names;
+  int    count;
+  int    alloced;
+  int    volatile_tags;
+} t_ae_deps;
+
 typedef struct {
+  char*     literal;
+  char*     text;
+  char*     output;
+  size_t    length;
+  t_ae_deps deps;
+} t_ae_region;
+
+typedef struct {
+  char*        data;
+  t_ae_region* regions;
+  int          count;
+  char*        tail;
+  int          rc;
+  int          rendered;
+} t_ae_record_data;
+
+typedef struct __ae_mgr t_ae_mgr;
+struct __ae_mgr {
   t_ae_tag_list* m_taglist_head;
   t_ae_tag_list* m_taglist_tail;
   char* m_tag_start;
@@ -105,7 +327,76 @@ typedef struct {
   t_ae_preproc_fn preproc;
   void* cookie;
   int recursive_depth;
-} t_ae_mgr;
+  int m_workers;
+  t_ae_profile* m_profile;
+  t_ae_alloc_stats m_alloc_last;
+  t_ae_alloc_stats m_alloc_total;
+  t_ae_include_fn m_include;
+  void* m_include_cookie;
+  int m_minify;
+  t_ae_deps* m_deps;
+  t_ae_mgr* m_base;
+  t_ae_limits m_limits;
+  int m_limited;
+  int m_cancellable;
+  t_ae_budget* m_budget;
+  int m_budget_ticks;
+  int m_limit_reached;
+  int m_escape;
+  t_ae_tracer_data* m_tracer;
+  t_ae_trace_out* m_trace;
+  CONST char* m_preload_file;
+  CONST char* m_preload_text;
+};
+
+  /* what static_ae_render_enter sets up, for static_ae_render_leave to undo */
+typedef struct {
+  FILE*     output;
+  int       original_fd;
+  FILE*     counted;
+  FILE*     limited;
+  t_ae_budget budget;
+  t_ae_mgr* account;
+} t_ae_render_frame;
+
+  /* a top-level render of a template being counted in the render
+   * statistics (see include/stats.h) */
+typedef struct {
+  long      start_ns;
+  long      start_pos;
+  long      bytes;
+  FILE*     counted;
+} t_ae_measure;
+
+  /* a section that includes a file keeps the file's contents, as they were
+   * when the section was found fit to leave the calling thread, and renders
+   * the include from those */
+
+typedef struct {
+  char*  literal;
+  char*  text;
+  int    kind;
+  int    started;
+  int    done;
+  char*  buffer;
+  size_t length;
+  char*  file;
+  char*  contents;
+} t_ae_section;
+
+  /* 'shadow' is the manager record the workers render with, copied from the
+   * manager before any worker starts (see static_ae_render_section) */
+
+typedef struct {
+  t_ae_mgr*       mgr;
+  t_ae_mgr        shadow;
+  t_ae_section*   sections;
+  int             first;
+  int             last;
+  int             next;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} t_ae_section_pool;
 
 typedef struct __ae_cookie t_ae_cookie;
 struct __ae_cookie {
@@ -118,6 +409,10 @@ struct __ae_cookie {
 typedef struct {
   int headers;
   int no_cache;
+  int gzip;
+  int etag;
+  int not_modified;
+  char etag_value[ 24 ];
   t_ae_cookie* cookies;
   FILE* output;
 } t_ae_html_proc_data;
@@ -155,8 +450,21 @@ static int static_ae_cyclical_replace_tag_process( t_ae_tag tag,
                                                    t_ae_template_mgr mgr,
                                                    FILE* output );
 static int static_ae_cyclical_replace_tag_cleanup( t_ae_tag tag );
+static size_t* static_ae_index_list( CONST char* data, CONST char* delim,
+                                     int* count, int* partial );
 static int static_ae_shared_fn_tag_cleanup( t_ae_tag tag );
 
+static int static_ae_lazy_tag_process( t_ae_tag tag,
+                                       CONST char* text,
+                                       t_ae_template_mgr mgr,
+                                       FILE* output );
+static int static_ae_lazy_tag_cleanup( t_ae_tag tag );
+
+static int static_ae_row_source_process( t_ae_tag tag,
+                                         CONST char* text,
+                                         t_ae_template_mgr mgr,
+                                         FILE* output );
+
 static int static_ae_typed_tag_apply( t_ae_tag tag,
                                       CONST char* text,
                                       t_ae_template_mgr mgr,
@@ -178,6 +486,10 @@ static int static_ae_repeat_tag_process( t_ae_tag tag,
                                          CONST char* text,
                                          t_ae_template_mgr mgr,
                                          FILE* output );
+static int static_ae_repeat_slice_tag_process( t_ae_tag tag,
+                                               CONST char* text,
+                                               t_ae_template_mgr mgr,
+                                               FILE* output );
 static int static_ae_env_tag_process( t_ae_tag tag,
                                       CONST char* text,
                                       t_ae_template_mgr mgr,
@@ -194,6 +506,15 @@ static int static_ae_include_tag_named_process( t_ae_tag tag,
                                                 CONST char* text,
                                                 t_ae_template_mgr mgr,
                                                 FILE* output );
+static int static_ae_if_expr_tag_process( t_ae_tag tag,
+                                          CONST char* text,
+                                          t_ae_template_mgr mgr,
+                                          FILE* output );
+static int static_ae_if_expr_tag_cleanup( t_ae_tag tag );
+static int static_ae_condition_process( t_ae_tag tag,
+                                        CONST char* text,
+                                        t_ae_template_mgr mgr,
+                                        FILE* output );
            
 static int static_ae_shared_fn_apply( t_ae_tag tag,
                                       CONST char* text,
@@ -204,15 +525,148 @@ static int static_ae_shared_fn_process( t_ae_tag tag,
                                         t_ae_template_mgr mgr,
                                         FILE* output );
 
+static t_ae_expr* static_ae_expr_get( t_ae_expr_tag* tag, CONST char* text, int length, int* owned );
+static t_ae_expr* static_ae_expr_compile( CONST char* text, int length );
+static void  static_ae_expr_free( t_ae_expr* expr );
+static int   static_ae_expr_add( t_ae_expr* expr, int op, int left, int right );
+static void  static_ae_expr_next( t_ae_expr_parse* parse );
+static int   static_ae_expr_keyword( t_ae_expr_parse* parse, CONST char* word );
+static char* static_ae_expr_token( t_ae_expr_parse* parse );
+static int   static_ae_expr_or( t_ae_expr_parse* parse );
+static int   static_ae_expr_and( t_ae_expr_parse* parse );
+static int   static_ae_expr_not( t_ae_expr_parse* parse );
+static int   static_ae_expr_compare( t_ae_expr_parse* parse );
+static int   static_ae_expr_operand( t_ae_expr_parse* parse );
+static int   static_ae_expr_calls( t_ae_generic_tag* tag, CONST char* text );
+static int   static_ae_expr_true( t_ae_expr* expr, int node, t_ae_template_mgr mgr );
+static CONST char* static_ae_expr_value( t_ae_expr* expr, int node, t_ae_template_mgr mgr,
+                                         double* number, int* is_number );
+
 static int   static_html_preproc_fn( t_ae_template_mgr mgr, FILE* output );
+static int   static_html_etag( t_ae_template_mgr mgr, t_ae_html_proc_data* data,
+                               CONST char* tem_file );
+static int   static_html_etag_add_refs( t_ae_template_mgr mgr, uint64_t* hash,
+                                       t_ae_references refs, int depth );
+static void  static_html_etag_add( uint64_t* hash, CONST char* text );
+static void  static_html_etag_add_file( uint64_t* hash, CONST char* file );
+static int   static_html_etag_matches( CONST char* header, CONST char* etag );
+
+static void  static_ae_render_enter( t_ae_mgr* mgr_data, FILE* output,
+                                     t_ae_render_frame* frame );
+static void  static_ae_render_leave( t_ae_mgr* mgr_data, t_ae_render_frame* frame );
+static int   static_ae_repeat( t_ae_template_mgr mgr, CONST char* source,
+                               CONST char* token, CONST char* delim,
+                               int offset, int limit,
+                               CONST char* data, t_ae_body_fn body,
+                               void* cookie, FILE* output );
+static int   static_ae_slice_value( t_ae_template_mgr mgr, CONST char* field,
+                                    CONST char* delim, int* value );
+static int   static_ae_call_compiled( void* cookie, t_ae_template_mgr mgr, FILE* output );
+static int   static_ae_find_tag( t_ae_mgr* mgr_data, CONST char* text,
+                                 char** start, char** end );
+static int   static_ae_dispatch( t_ae_mgr* mgr_data, CONST char* text, FILE* output );
+static int   static_ae_process_stream( t_ae_mgr* mgr_data, t_ae_stream stream,
+                                       CONST char* name, FILE* output );
+
+static int   static_ae_process_parallel( t_ae_mgr* mgr_data, char* data, FILE* output );
+static int   static_ae_section_kind( t_ae_mgr* mgr_data, CONST char* text, int depth,
+                                     t_ae_section* section );
+static int   static_ae_text_is_pure( t_ae_mgr* mgr_data, CONST char* text, int depth );
+static int   static_ae_claim_tag( t_ae_mgr* mgr_data, CONST char* text,
+                                  t_ae_generic_tag** claimant );
+static void  static_ae_render_section( t_ae_mgr* shadow, t_ae_section* section );
+static void* static_ae_section_worker( void* arg );
+static int   static_ae_tag_recognises( t_ae_generic_tag* tag, CONST char* text );
+
+static int   static_ae_dispatch_profiled( t_ae_mgr* mgr_data, CONST char* text, FILE* output,
+                                          char* matched );
+static int   static_ae_dispatch_recorded( t_ae_mgr* mgr_data, CONST char* text, FILE* output );
+static t_ae_record static_ae_record( t_ae_mgr* mgr_data, char* data, FILE* output );
+static void  static_ae_record_write( t_ae_mgr* mgr_data, t_ae_record_data* record,
+                                     char** changed, FILE* output );
+static void  static_ae_deps_add( t_ae_deps* deps, CONST char* name );
+static void  static_ae_deps_note( t_ae_mgr* mgr_data, t_ae_generic_tag* tag, int recognised );
+static void  static_ae_deps_applied( t_ae_mgr* mgr_data, int recognised );
+static int   static_ae_deps_match( t_ae_deps* deps, char** changed );
+static void  static_ae_deps_clear( t_ae_deps* deps );
+static t_ae_prof_entry* static_ae_profile_entry( t_ae_profile* profile, CONST char* name );
+static FILE* static_ae_profile_begin( t_ae_mgr* mgr_data, FILE* output );
+static void  static_ae_profile_end( t_ae_mgr* mgr_data, FILE* output, FILE* counted );
+static FILE* static_ae_measure_begin( t_ae_measure* measure, FILE* output );
+static void  static_ae_measure_end( t_ae_measure* measure, FILE* output );
+static void  static_ae_profile_add( t_ae_tag_stats* total, t_ae_tag_stats* last );
+static long  static_ae_now_ns( void );
+static void  static_ae_write_json_string( CONST char* text, FILE* output );
+
+static int   static_ae_dispatch_traced( t_ae_mgr* mgr_data, CONST char* text, FILE* output,
+                                        char* matched );
+static t_ae_trace_out* static_ae_trace_begin( t_ae_tracer_data* tracer );
+static void  static_ae_trace_end( t_ae_trace_out* out );
+static void  static_ae_trace_span( t_ae_mgr* mgr_data, CONST char* cat, CONST char* name,
+                                   long start_ns, CONST char* arg_name, CONST char* arg );
+
+static FILE* static_ae_counting_stream( FILE* output, long limit, t_ae_budget* budget );
+
+static int   static_ae_budget_spent( t_ae_mgr* mgr_data, FILE* output );
+static void  static_ae_budget_stop( t_ae_budget* budget, int reason, FILE* output );
+static void  static_ae_exec_bounded( t_ae_mgr* mgr_data, CONST char* command, FILE* output );
+
+static t_ae_mgr* static_ae_account_enter( t_ae_mgr* mgr_data );
+static void      static_ae_account_leave( t_ae_mgr* previous );
+static void      static_ae_account( t_ae_alloc_stats* stats, long allocs, long frees,
+                                    long bytes, long live );
+
+static CONST char*   static_ae_escape_char( char c, int mode );
+static void          static_ae_write_escaped( CONST char* text, size_t length, int mode, FILE* output );
+static t_ae_escaped* static_ae_escape_copy( CONST char* text, int mode );
+
+static t_ae_tag_list* static_ae_next_item( t_ae_mgr** layer, t_ae_tag_list* item );
+
+  /* visit a manager's own tags, then those of its base (if it's an overlay),
+   * and so on down */
+#define FOR_EACH_TAG( mgr_data, layer, item ) \
+  for( layer = (mgr_data), item = static_ae_next_item( &layer, NULL ); \
+       item != NULL; \
+       item = static_ae_next_item( &layer, item ) )
+static void static_ae_make_shared_tags( void );
+static int  static_ae_is_shared_tag( t_ae_generic_tag* tag );
 
 static char* static_get_non_value( t_ae_tag tag );
 static char* static_get_replace_tag_value( t_ae_tag tag );
+static char* static_get_lazy_tag_value( t_ae_tag tag );
 
 /* ------------------------------------------------------------------------- */
 /* static data                                                               */
 /* ------------------------------------------------------------------------- */
 
+static t_ae_malloc_fn   static_malloc_fn = NULL;
+static t_ae_realloc_fn  static_realloc_fn = NULL;
+static t_ae_free_fn     static_free_fn = NULL;
+static void*            static_alloc_context = NULL;
+static int              static_alloc_accounting = 0;
+static t_ae_alloc_stats static_alloc_stats;
+
+  /* the manager that allocations on this thread are currently charged to */
+static __thread t_ae_mgr* static_alloc_mgr = NULL;
+
+  /* trace events name threads by number, in the order they first trace */
+static int         static_trace_threads = 0;
+static __thread int static_trace_tid = 0;
+
+#ifdef AE_SDT
+  /* the semaphores of the probes in include/probes.h */
+AE_PROBE_SEMAPHORE( render__start );
+AE_PROBE_SEMAPHORE( render__end );
+AE_PROBE_SEMAPHORE( tag__start );
+AE_PROBE_SEMAPHORE( tag__end );
+AE_PROBE_SEMAPHORE( include__open );
+AE_PROBE_SEMAPHORE( exec__start );
+AE_PROBE_SEMAPHORE( exec__end );
+AE_PROBE_SEMAPHORE( exec_shared__start );
+AE_PROBE_SEMAPHORE( exec_shared__end );
+AE_PROBE_SEMAPHORE( loop__iteration );
+#endif
+
 static t_standard_tag_def static_standard_tags[] = {
   ae_if_tag,
   ae_if_not_tag,
@@ -222,13 +676,20 @@ static t_standard_tag_def static_standard_tags[] = {
   ae_if_le_tag,
   ae_if_gt_tag,
   ae_if_ge_tag,
+  ae_if_expr_tag,
   ae_include_tag,
   ae_repeat_tag,
+  ae_repeat_slice_tag,
   ae_env_tag,
   ae_exec_tag,
   0
 };
 
+  /* the standard tags every manager shares, made once by
+   * static_ae_make_shared_tags */
+static t_ae_generic_tag* static_shared_tags[ sizeof( static_standard_tags ) / sizeof( t_standard_tag_def ) ];
+static pthread_once_t    static_shared_tags_once = PTHREAD_ONCE_INIT;
+
 /* ------------------------------------------------------------------------- */
 /* stream function implementations                                           */
 /* ------------------------------------------------------------------------- */
@@ -264,7 +725,7 @@ t_ae_stream ae_stream_open_buffer( CONST char* buffer ) {
   t_ae_buffer_stream* stream;
 
   stream = static_ae_buffer_stream_new();
-  stream->buffer = strdup( buffer );
+  stream->buffer = ae_strdup( buffer );
   stream->pos = 0;
 
   return (t_ae_stream)stream;
@@ -286,7 +747,7 @@ int ae_stream_read( t_ae_stream stream, char* buffer, int length ) {
 int ae_stream_close( t_ae_stream stream ) {
   DECL_CAST( str, stream, t_ae_generic_stream );
   str->close( stream );
-  free( str );
+  ae_free( str );
   return 0;
 }
 
@@ -300,9 +761,9 @@ t_ae_tag ae_tag_new( CONST char* name, int size ) {
   /* create a new tag by allocating space for it, setting it's name and
    * delimiter, and setting default values for it's methods. */
 
-  tag = (t_ae_generic_tag*)malloc( size );
-  tag->m_tag = strdup( name );
-  tag->m_delim = strdup( DEFAULT_DELIMITER );
+  tag = (t_ae_generic_tag*)ae_malloc( size );
+  tag->m_tag = ae_strdup( name );
+  tag->m_delim = ae_strdup( DEFAULT_DELIMITER );
   tag->apply = NULL;
   tag->process = NULL;
   tag->cleanup = NULL;
@@ -319,6 +780,9 @@ t_ae_tag ae_tag_new( CONST char* name, int size ) {
 void ae_tag_destroy( t_ae_tag tag ) {
   GENERIC_TAG( tag_data, tag );
 
+  /* the shared standard tags live as long as the process */
+  if( static_ae_is_shared_tag( tag_data ) ) return;
+
   /* if the tag has a cleanup function defined, call it */
 
   if( tag_data->cleanup ) {
@@ -327,9 +791,9 @@ void ae_tag_destroy( t_ae_tag tag ) {
 
   /* free the memory for the tag */
 
-  free( tag_data->m_tag );
-  free( tag_data->m_delim );
-  free( tag_data );
+  ae_free( tag_data->m_tag );
+  ae_free( tag_data->m_delim );
+  ae_free( tag_data );
 }
 
 char* ae_get_tag_name( t_ae_tag tag ) {
@@ -356,12 +820,15 @@ t_ae_tag ae_replace_tag( CONST char* name, CONST char* data ) {
 
   tag = NEWTAG( name, t_ae_replace_tag );
   if( data != NULL ) {
-/*    tag->m_data = strdup( data );*/
-    tag->m_data = (char*)malloc( strlen( data ) + 1 );
+/*    tag->m_data = ae_strdup( data );*/
+    tag->m_data = (char*)ae_malloc( strlen( data ) + 1 );
     strcpy( tag->m_data, data );
   } else {
     tag->m_data = NULL;
   }
+  tag->m_escaped[ AE_ESCAPE_HTML ] = NULL;
+  tag->m_escaped[ AE_ESCAPE_JS ] = NULL;
+  tag->m_raw = 0;
   tag->apply = static_ae_replace_tag_apply;
   tag->process = static_ae_replace_tag_process;
   tag->cleanup = static_ae_replace_tag_cleanup;
@@ -371,18 +838,29 @@ t_ae_tag ae_replace_tag( CONST char* name, CONST char* data ) {
   return (t_ae_tag)tag;
 }
 
+t_ae_tag ae_raw_tag( CONST char* name, CONST char* data ) {
+  t_ae_replace_tag* tag;
+
+  /* a raw tag is a replace tag whose value is never escaped */
+  tag = (t_ae_replace_tag*)ae_replace_tag( name, data );
+  tag->m_raw = 1;
+
+  return (t_ae_tag)tag;
+}
+
 t_ae_tag ae_cyclical_replace_tag( CONST char* name, CONST char* data, CONST char* delim ) {
   t_ae_cyclical_replace_tag* tag;
 
   /* a cyclical replace tag replaces itself with the next value in the associated delimited
-   * list of values.  Each time the cyclical tag's "process" function is called, it's
-   * m_next pointer is incremented so that on each subsequent call, the next value in the
-   * list is obtained. */
+   * list of values.  The list is split into items once, here, and each time the cyclical
+   * tag's "process" function is called it moves on to the next item. */
 
   tag = NEWTAG( name, t_ae_cyclical_replace_tag );
-  tag->m_data = strdup( data );
-  tag->m_rpt_delim = strdup( delim );
-  tag->m_next = tag->m_data;
+  tag->m_data = ae_strdup( data );
+  tag->m_rpt_delim = ae_strdup( delim );
+  tag->m_offsets = static_ae_index_list( tag->m_data, tag->m_rpt_delim,
+                                         &tag->m_count, &tag->m_partial );
+  tag->m_row = 0;
   tag->apply = static_ae_replace_tag_apply;
   tag->process = static_ae_cyclical_replace_tag_process;
   tag->cleanup = static_ae_cyclical_replace_tag_cleanup;
@@ -392,6 +870,19 @@ t_ae_tag ae_cyclical_replace_tag( CONST char* name, CONST char* data, CONST char
   return (t_ae_tag)tag;
 }
 
+int ae_cyclical_count( t_ae_tag tag ) {
+  DECL_CAST( tag_data, tag, t_ae_cyclical_replace_tag );
+  return tag_data->m_count;
+}
+
+int ae_cyclical_seek( t_ae_tag tag, int row ) {
+  DECL_CAST( tag_data, tag, t_ae_cyclical_replace_tag );
+
+  if( row < 0 || row > tag_data->m_count ) return -1;
+  tag_data->m_row = row;
+  return 0;
+}
+
 t_ae_tag ae_typed_tag( CONST char* type, t_ae_tag_fn process, int size ) {
   t_ae_generic_tag* tag;
 
@@ -434,6 +925,20 @@ t_ae_tag ae_if_ge_tag( void ) {
   return static_ae_comparison_tag( "IF_GE", COMP_TYPE_GE );
 }
 
+t_ae_tag ae_if_expr_tag( void ) {
+  t_ae_expr_tag* tag;
+
+  /* the tag keeps each expression it is given, compiled, by its text; it
+   * may be shared by managers on several threads, hence the lock */
+  tag = (t_ae_expr_tag*)ae_typed_tag( "IF_EXPR", static_ae_if_expr_tag_process, sizeof( t_ae_expr_tag ) );
+  tag->cleanup = static_ae_if_expr_tag_cleanup;
+  memset( tag->m_buckets, 0, sizeof( tag->m_buckets ) );
+  tag->m_cached = 0;
+  pthread_mutex_init( &tag->m_lock, NULL );
+
+  return (t_ae_tag)tag;
+}
+
 t_ae_tag ae_include_tag( void ) {
   return ae_typed_tag( "INCLUDE", static_ae_include_tag_process, sizeof( t_ae_generic_tag ) );
 }
@@ -442,6 +947,10 @@ t_ae_tag ae_repeat_tag( void ) {
   return ae_typed_tag( "REPEAT2", static_ae_repeat_tag_process, sizeof( t_ae_generic_tag ) );
 }
 
+t_ae_tag ae_repeat_slice_tag( void ) {
+  return ae_typed_tag( "REPEAT2_SLICE", static_ae_repeat_slice_tag_process, sizeof( t_ae_generic_tag ) );
+}
+
 t_ae_tag ae_env_tag( void ) {
   return ae_typed_tag( "ENV", static_ae_env_tag_process, sizeof( t_ae_generic_tag ) );
 }
@@ -457,8 +966,8 @@ t_ae_tag ae_shared_fn_tag( CONST char* name, CONST char* lib, CONST char* func,
   tag->apply = static_ae_shared_fn_apply;
   tag->process = static_ae_shared_fn_process;
   tag->cleanup = static_ae_shared_fn_tag_cleanup;
-  tag->m_lib = strdup( lib );
-  tag->m_func = strdup( func );
+  tag->m_lib = ae_strdup( lib );
+  tag->m_func = ae_strdup( func );
   tag->m_cookie = cookie;
 
   return (t_ae_tag)tag;
@@ -484,67 +993,271 @@ t_ae_tag ae_include_tag_named( CONST char* name, CONST char* file ) {
   return (t_ae_tag)tag;
 }
 
+t_ae_tag ae_lazy_tag( CONST char* name, t_ae_lazy_fn provider, void* cookie ) {
+  t_ae_lazy_tag* tag;
+
+  /* a lazy tag looks like a replace tag, but asks its provider for its
+   * value the first time it is wanted, and keeps it until told otherwise */
+
+  tag = NEWTAG( name, t_ae_lazy_tag );
+  tag->apply = static_ae_replace_tag_apply;
+  tag->process = static_ae_lazy_tag_process;
+  tag->cleanup = static_ae_lazy_tag_cleanup;
+  tag->get_value = static_get_lazy_tag_value;
+  tag->type = TAG_TYPE_VALUE;
+  tag->m_provider = provider;
+  tag->m_cookie = cookie;
+  tag->m_data = NULL;
+  tag->m_ready = 0;
+  pthread_mutex_init( &tag->m_lock, NULL );
+
+  return (t_ae_tag)tag;
+}
+
+void ae_add_lazy_tag( t_ae_template_mgr mgr, CONST char* name, t_ae_lazy_fn provider, void* cookie ) {
+  ae_add_tag_ex( mgr, ae_lazy_tag( name, provider, cookie ) );
+}
+
+t_ae_tag ae_row_source_tag( CONST char* name, t_ae_row_fn next_row, void* cookie ) {
+  t_ae_row_source_tag* tag;
+
+  /* a row source has no value of its own; the loop tags that name it pull
+   * their rows from it instead */
+
+  tag = NEWTAG( name, t_ae_row_source_tag );
+  tag->apply = static_ae_replace_tag_apply;
+  tag->process = static_ae_row_source_process;
+  tag->m_next_row = next_row;
+  tag->m_cookie = cookie;
+
+  return (t_ae_tag)tag;
+}
+
+void ae_add_row_source( t_ae_template_mgr mgr, CONST char* name, t_ae_row_fn next_row, void* cookie ) {
+  ae_add_tag_ex( mgr, ae_row_source_tag( name, next_row, cookie ) );
+}
+
+t_ae_tag ae_condition_tag( CONST char* name, t_ae_condition_fn check, void* cookie ) {
+  t_ae_condition_tag* tag;
+
+  /* like a row source, a condition tag has no value; IF_EXPR expressions
+   * call it by name */
+
+  tag = NEWTAG( name, t_ae_condition_tag );
+  tag->apply = static_ae_replace_tag_apply;
+  tag->process = static_ae_condition_process;
+  tag->m_check = check;
+  tag->m_cookie = cookie;
+
+  return (t_ae_tag)tag;
+}
+
+void ae_add_condition( t_ae_template_mgr mgr, CONST char* name, t_ae_condition_fn check, void* cookie ) {
+  ae_add_tag_ex( mgr, ae_condition_tag( name, check, cookie ) );
+}
+
+int ae_is_row_source( t_ae_tag tag ) {
+  GENERIC_TAG( tag_data, tag );
+  return ( tag_data != NULL && tag_data->process == static_ae_row_source_process );
+}
+
+int ae_next_row( t_ae_template_mgr mgr, t_ae_tag tag, char** fields ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_row_source_tag* tag_data = (t_ae_row_source_tag*)tag;
+
+  if( !ae_is_row_source( tag ) ) return -1;
+
+  /* the rows a source gives can change without any tag changing, so a
+   * recorded render must always render a loop over one again */
+  if( mgr_data->m_deps != NULL ) {
+    mgr_data->m_deps->volatile_tags = 1;
+  }
+
+  return ( tag_data->m_next_row( tag_data->m_cookie, mgr, fields ) ? 1 : 0 );
+}
+
+void ae_invalidate_tag( t_ae_template_mgr mgr, CONST char* name ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_tag_list* item;
+  t_ae_mgr* layer;
+  t_ae_lazy_tag* tag;
+
+  /* forget the value of the named lazy tag, or of every lazy tag, whether
+   * it is the manager's own or its base's */
+  FOR_EACH_TAG( mgr_data, layer, item ) {
+    if( item->tag->process != static_ae_lazy_tag_process ) continue;
+    if( name != NULL && strcmp( item->tag->m_tag, name ) != 0 ) continue;
+
+    tag = (t_ae_lazy_tag*)item->tag;
+    pthread_mutex_lock( &tag->m_lock );
+    ae_free( tag->m_data );
+    tag->m_data = NULL;
+    tag->m_ready = 0;
+    pthread_mutex_unlock( &tag->m_lock );
+  }
+}
+
 /* ------------------------------------------------------------------------- */
 /* template function implementations                                         */
 /* ------------------------------------------------------------------------- */
 
 t_ae_template_mgr ae_template_mgr_new( void ) {
   t_ae_mgr* mgr_data;
+  t_ae_mgr* account;
   int i;
 
   mgr_data = NEW( t_ae_mgr );
   mgr_data->m_taglist_head = NULL;
   mgr_data->m_taglist_tail = NULL;
-  mgr_data->m_tag_start = strdup( DEFAULT_TAG_START );
-  mgr_data->m_tag_end = strdup( DEFAULT_TAG_END );
-  mgr_data->m_tag_delimiter = strdup( DEFAULT_DELIMITER );
+  mgr_data->m_tag_start = ae_strdup( DEFAULT_TAG_START );
+  mgr_data->m_tag_end = ae_strdup( DEFAULT_TAG_END );
+  mgr_data->m_tag_delimiter = ae_strdup( DEFAULT_DELIMITER );
   mgr_data->preproc = NULL;
   mgr_data->cookie = NULL;
   mgr_data->recursive_depth = 0;
-
-  /* add the standard tag types, defined in the static_standard_tags array */
-  for( i = 0; static_standard_tags[i] != NULL; i++ ) {
-    ae_add_tag_ex( (t_ae_template_mgr)mgr_data, static_standard_tags[i]() );
+  mgr_data->m_workers = 0;
+  mgr_data->m_profile = NULL;
+  memset( &mgr_data->m_alloc_last, 0, sizeof( t_ae_alloc_stats ) );
+  memset( &mgr_data->m_alloc_total, 0, sizeof( t_ae_alloc_stats ) );
+  mgr_data->m_include = NULL;
+  mgr_data->m_include_cookie = NULL;
+  mgr_data->m_minify = 0;
+  mgr_data->m_deps = NULL;
+  mgr_data->m_base = NULL;
+  memset( &mgr_data->m_limits, 0, sizeof( t_ae_limits ) );
+  mgr_data->m_limited = 0;
+  mgr_data->m_cancellable = 0;
+  mgr_data->m_budget = NULL;
+  mgr_data->m_budget_ticks = 0;
+  mgr_data->m_limit_reached = AE_LIMIT_NONE;
+  mgr_data->m_escape = AE_ESCAPE_NONE;
+  mgr_data->m_tracer = NULL;
+  mgr_data->m_trace = NULL;
+  mgr_data->m_preload_file = NULL;
+  mgr_data->m_preload_text = NULL;
+
+  /* add the standard tag types, defined in the static_standard_tags array.
+   * The tags themselves are made once and shared by every manager; only the
+   * list items are the manager's own */
+  pthread_once( &static_shared_tags_once, static_ae_make_shared_tags );
+  account = static_ae_account_enter( mgr_data );
+  for( i = 0; static_shared_tags[i] != NULL; i++ ) {
+    ae_add_tag_ex( (t_ae_template_mgr)mgr_data, (t_ae_tag)static_shared_tags[i] );
   }
+  static_ae_account_leave( account );
 
   return (t_ae_template_mgr)mgr_data;
 }
 
+t_ae_template_mgr ae_template_mgr_overlay( t_ae_template_mgr base ) {
+  MGR_CAST( base_data, base );
+  t_ae_mgr* mgr_data;
+
+  /* an overlay starts with no tags of its own, and the base's settings; its
+   * lookups fall through to the base's tags, which are never copied */
+  mgr_data = NEW( t_ae_mgr );
+  memcpy( mgr_data, base_data, sizeof( t_ae_mgr ) );
+  mgr_data->m_taglist_head = NULL;
+  mgr_data->m_taglist_tail = NULL;
+  mgr_data->m_tag_start = ae_strdup( base_data->m_tag_start );
+  mgr_data->m_tag_end = ae_strdup( base_data->m_tag_end );
+  mgr_data->m_tag_delimiter = ae_strdup( base_data->m_tag_delimiter );
+  mgr_data->recursive_depth = 0;
+  mgr_data->m_profile = NULL;
+  memset( &mgr_data->m_alloc_last, 0, sizeof( t_ae_alloc_stats ) );
+  memset( &mgr_data->m_alloc_total, 0, sizeof( t_ae_alloc_stats ) );
+  mgr_data->m_deps = NULL;
+  mgr_data->m_base = base_data;
+  mgr_data->cookie = NULL;
+  mgr_data->m_budget = NULL;
+  mgr_data->m_limit_reached = AE_LIMIT_NONE;
+  mgr_data->m_trace = NULL;
+  mgr_data->m_preload_file = NULL;
+  mgr_data->m_preload_text = NULL;
+
+  return (t_ae_template_mgr)mgr_data;
+}
+
+t_ae_template_mgr ae_get_base( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  return (t_ae_template_mgr)mgr_data->m_base;
+}
+
 void ae_template_mgr_done( t_ae_template_mgr mgr ) {
   MGR_CAST( mgr_data, mgr );
   t_ae_tag_list* curr;
   t_ae_tag_list* next;
+  t_ae_mgr* account;
+
+  /* nothing is charged to the manager once it's gone */
+  account = static_ae_account_enter( NULL );
+
+  ae_free( mgr_data->m_tag_start );
+  ae_free( mgr_data->m_tag_end );
+  ae_free( mgr_data->m_tag_delimiter );
 
-  free( mgr_data->m_tag_start );
-  free( mgr_data->m_tag_end );
-  free( mgr_data->m_tag_delimiter );
+  ae_set_profiling( mgr, 0 );
 
-  /* destroy the tags associated with this manager */
+  /* destroy the tags associated with this manager (an overlay's base, and
+   * its tags, are left as they are) */
   curr = mgr_data->m_taglist_head;
   while( curr != NULL ) {
     ae_tag_destroy( (t_ae_tag)curr->tag );
     next = curr->next;
-    free( curr );
+    ae_free( curr );
     curr = next;
   }
 
   mgr_data->m_taglist_head = NULL;
   mgr_data->m_taglist_tail = NULL;
 
-  free( mgr_data );
+  ae_free( mgr_data );
+  static_ae_account_leave( account );
+}
+
+unsigned int ae_standard_tags_checksum( void ) {
+  unsigned int sum = 2166136261u;
+  char* name;
+  int   i;
+
+  /* FNV-1a over the names, each with its terminating null */
+  pthread_once( &static_shared_tags_once, static_ae_make_shared_tags );
+  for( i = 0; static_shared_tags[i] != NULL; i++ ) {
+    name = ae_get_tag_name( (t_ae_tag)static_shared_tags[i] );
+    do {
+      sum = ( sum ^ (unsigned char)*name ) * 16777619u;
+    } while( *name++ != 0 );
+  }
+
+  return sum;
 }
 
 void ae_add_tag( t_ae_template_mgr mgr, CONST char* name, CONST char* value ) {
+  t_ae_mgr* account;
+
   /* add the name/value pair as a replace tag */
+  account = static_ae_account_enter( (t_ae_mgr*)mgr );
   ae_add_tag_ex( mgr, ae_replace_tag( name, value ) );
+  static_ae_account_leave( account );
+}
+
+void ae_add_raw_tag( t_ae_template_mgr mgr, CONST char* name, CONST char* value ) {
+  t_ae_mgr* account;
+
+  account = static_ae_account_enter( (t_ae_mgr*)mgr );
+  ae_add_tag_ex( mgr, ae_raw_tag( name, value ) );
+  static_ae_account_leave( account );
 }
 
 void ae_add_tag_i( t_ae_template_mgr mgr, CONST char* name, int value ) {
+  t_ae_mgr* account;
   char buffer[ 12 ];
 
   /* add the name/value pair as a replace tag */
   snprintf( buffer, sizeof( buffer ), "%d", value );
+  account = static_ae_account_enter( (t_ae_mgr*)mgr );
   ae_add_tag_ex( mgr, ae_replace_tag( name, buffer ) );
+  static_ae_account_leave( account );
 }
 
 void ae_add_tags( t_ae_template_mgr mgr, char** names, char** values ) {
@@ -569,6 +1282,7 @@ void ae_add_tag_ex( t_ae_template_mgr mgr, t_ae_tag tag ) {
   GENERIC_TAG( tag_data, tag );
   t_ae_tag_list* item;
   t_ae_tag_list* c;
+  t_ae_mgr* account;
 
   /* add the given tag to the manager's linked list of tags.  The
    * most recently added tag is added at the end of the list, and
@@ -576,10 +1290,15 @@ void ae_add_tag_ex( t_ae_template_mgr mgr, t_ae_tag tag ) {
    * (respectively) the head and tail of the list */
 
   if( tag == NULL ) return;
+  account = static_ae_account_enter( mgr_data );
   ae_remove_tag( mgr, ae_get_tag_name( tag ) );
 
-  free( tag_data->m_delim );
-  tag_data->m_delim = strdup( mgr_data->m_tag_delimiter );
+  /* the shared tags are read by every manager at once, and all managers
+   * use the default field delimiter */
+  if( !static_ae_is_shared_tag( tag_data ) ) {
+    ae_free( tag_data->m_delim );
+    tag_data->m_delim = ae_strdup( mgr_data->m_tag_delimiter );
+  }
 
   c = mgr_data->m_taglist_tail;
   if( c == NULL ) {
@@ -605,15 +1324,19 @@ void ae_add_tag_ex( t_ae_template_mgr mgr, t_ae_tag tag ) {
       mgr_data->m_taglist_tail = item;
     }
   }
+
+  static_ae_account_leave( account );
 }
 
 void ae_remove_tag( t_ae_template_mgr mgr, CONST char* name ) {
   MGR_CAST( mgr_data, mgr );
   t_ae_tag_list* item;
+  t_ae_mgr* account;
 
   /* remove the first tag found with the given name.  The tag
    * will be destroyed. */
 
+  account = static_ae_account_enter( mgr_data );
   item = mgr_data->m_taglist_head;
   while( item != NULL ) {
     if( strcmp( item->tag->m_tag, name ) == 0 ) {
@@ -630,11 +1353,12 @@ void ae_remove_tag( t_ae_template_mgr mgr, CONST char* name ) {
         mgr_data->m_taglist_head = item->next;
       }
       ae_tag_destroy( item->tag );
-      free( item );
+      ae_free( item );
       break;
     }
     item = item->next;
   }
+  static_ae_account_leave( account );
 }
 
 void ae_remove_tag_ex( t_ae_template_mgr mgr, t_ae_tag tag ) {
@@ -645,9 +1369,12 @@ void ae_remove_tag_ex( t_ae_template_mgr mgr, t_ae_tag tag ) {
 int ae_tag_count( t_ae_template_mgr mgr ) {
   MGR_CAST( mgr_data, mgr );
   t_ae_tag_list* item;
+  t_ae_mgr* layer;
   int count = 0;
 
-  for( item = mgr_data->m_taglist_head; item != NULL; item = item->next ) {
+  /* an overlay's count includes its base's tags, even those it overrides */
+
+  FOR_EACH_TAG( mgr_data, layer, item ) {
     count++;
   }
 
@@ -660,24 +1387,39 @@ void ae_set_start_end_delim( t_ae_template_mgr mgr,
 {
   MGR_CAST( mgr_data, mgr );
 
-  free( mgr_data->m_tag_start );
-  free( mgr_data->m_tag_end );
+  ae_free( mgr_data->m_tag_start );
+  ae_free( mgr_data->m_tag_end );
+
+  mgr_data->m_tag_start = ae_strdup( start );
+  mgr_data->m_tag_end   = ae_strdup( end );
+}
 
-  mgr_data->m_tag_start = strdup( start );
-  mgr_data->m_tag_end   = strdup( end );
+void ae_get_delims( t_ae_template_mgr mgr,
+                    CONST char** start,
+                    CONST char** end,
+                    CONST char** field )
+{
+  MGR_CAST( mgr_data, mgr );
+  if( start != NULL ) *start = mgr_data->m_tag_start;
+  if( end != NULL ) *end = mgr_data->m_tag_end;
+  if( field != NULL ) *field = mgr_data->m_tag_delimiter;
 }
 
 t_ae_tag ae_get_tag( t_ae_template_mgr mgr, CONST char* name ) {
   MGR_CAST( mgr_data, mgr );
   t_ae_tag_list* item;
+  t_ae_mgr* layer;
 
-  /* return the first tag answering to the given name */
-  item = mgr_data->m_taglist_head;
-  while( item != NULL ) {
+  if( mgr_data->m_deps != NULL ) {
+    static_ae_deps_add( mgr_data->m_deps, name );
+  }
+
+  /* return the first tag answering to the given name, looking in the
+   * manager's own tags before those of its base */
+  FOR_EACH_TAG( mgr_data, layer, item ) {
     if( strcmp( item->tag->m_tag, name ) == 0 ) {
       return (t_ae_tag)item->tag;
     }
-    item = item->next;
   }
 
   return NULL;
@@ -686,15 +1428,18 @@ t_ae_tag ae_get_tag( t_ae_template_mgr mgr, CONST char* name ) {
 char* ae_get_value( t_ae_template_mgr mgr, CONST char* name ) {
   MGR_CAST( mgr_data, mgr );
   t_ae_tag_list* item;
+  t_ae_mgr* layer;
+
+  if( mgr_data->m_deps != NULL ) {
+    static_ae_deps_add( mgr_data->m_deps, name );
+  }
 
   /* return the value of the first tag answering to the given name */
-  item = mgr_data->m_taglist_head;
-  while( item != NULL ) {
+  FOR_EACH_TAG( mgr_data, layer, item ) {
     if( strcmp( item->tag->m_tag, name ) == 0 ) {
       if( item->tag->type != TAG_TYPE_VALUE ) return NULL;
       return item->tag->get_value( (t_ae_tag)item->tag );
     }
-    item = item->next;
   }
 
   return NULL;
@@ -703,16 +1448,14 @@ char* ae_get_value( t_ae_template_mgr mgr, CONST char* name ) {
 t_ae_tag ae_get_tag_at( t_ae_template_mgr mgr, int index ) {
   MGR_CAST( mgr_data, mgr );
   t_ae_tag_list* item;
+  t_ae_mgr* layer;
 
-  item = mgr_data->m_taglist_head;
-  while( index > 0 && item != NULL ) {
-    item = item->next;
-    index--;
+  /* an overlay's own tags are counted first, then its base's */
+  FOR_EACH_TAG( mgr_data, layer, item ) {
+    if( index-- == 0 ) return item->tag;
   }
 
-  if( item != NULL ) return item->tag;
-
-  return item;
+  return NULL;
 }
 
 int ae_process_template( t_ae_template_mgr mgr, CONST char* file, FILE* output ) {
@@ -723,9 +1466,12 @@ int ae_process_template( t_ae_template_mgr mgr, CONST char* file, FILE* output )
 
   stream = ae_stream_open_file( file );
   if( stream == NULL ) {
+    if( ((t_ae_mgr*)mgr)->recursive_depth < 1 ) {
+      ae_stats_record( file, 0, -1, 1 );
+    }
     return -1;
   }
-  rc = ae_process_stream( mgr, stream, output );
+  rc = static_ae_process_stream( (t_ae_mgr*)mgr, stream, file, output );
   ae_stream_close( stream );
 
   return rc;
@@ -747,28 +1493,117 @@ int ae_process_buffer( t_ae_template_mgr mgr, CONST char* buffer, FILE* output )
   return rc;
 }
 
+int ae_process_include( t_ae_template_mgr mgr, CONST char* file, FILE* output ) {
+  return ae_include_body( mgr, file, NULL, NULL, output );
+}
+
+int ae_include_body( t_ae_template_mgr mgr, CONST char* file,
+                     t_ae_body_fn body, void* cookie, FILE* output )
+{
+  MGR_CAST( mgr_data, mgr );
+  t_ae_budget* budget = mgr_data->m_budget;
+  t_ae_stream stream;
+  long start = 0;
+  int  rc;
+
+  /* every include counts against the render's limit, whoever renders it */
+  if( budget != NULL ) {
+    if( mgr_data->m_limits.max_includes > 0 &&
+        __sync_add_and_fetch( &budget->includes, 1 ) > mgr_data->m_limits.max_includes )
+    {
+      static_ae_budget_stop( budget, AE_LIMIT_INCLUDES, output );
+    }
+    if( static_ae_budget_spent( mgr_data, output ) ) return AE_LIMIT_EXCEEDED;
+  }
+
+  AE_PROBE2( include__open, file, mgr_data->recursive_depth );
+  if( mgr_data->m_trace != NULL ) {
+    start = static_ae_now_ns();
+  }
+
+  /* a body renders the file as it is told to; otherwise give the include
+   * function first refusal, then read the file itself */
+  if( body != NULL ) {
+    rc = ae_process_body( mgr, body, cookie, output );
+  } else if( mgr_data->m_preload_file != NULL && file != NULL &&
+             strcmp( file, mgr_data->m_preload_file ) == 0 )
+  {
+    /* a parallel section's include renders the contents it was vetted by
+     * (see static_ae_section_kind), once; anything it includes is read as
+     * usual */
+    stream = ae_stream_open_buffer( mgr_data->m_preload_text );
+    mgr_data->m_preload_file = NULL;
+    rc = ( stream != NULL ? static_ae_process_stream( mgr_data, stream, file, output ) : -1 );
+    if( stream != NULL ) ae_stream_close( stream );
+  } else if( mgr_data->m_include != NULL && file != NULL &&
+             mgr_data->m_include( mgr_data->m_include_cookie, mgr, file, output ) )
+  {
+    rc = 0;
+  } else {
+    rc = ae_process_template( mgr, file, output );
+  }
+
+  if( mgr_data->m_trace != NULL ) {
+    static_ae_trace_span( mgr_data, "include", "include", start, "file", file );
+  }
+
+  return rc;
+}
+
 int ae_process_stream( t_ae_template_mgr mgr, t_ae_stream stream, FILE* output ) {
   MGR_CAST( mgr_data, mgr );
-  t_ae_tag_list* item;
+  return static_ae_process_stream( mgr_data, stream, NULL, output );
+}
+
+static int static_ae_process_stream( t_ae_mgr* mgr_data, t_ae_stream stream,
+                                     CONST char* name, FILE* output )
+{
+  t_ae_render_frame frame;
+  t_ae_measure measure;
   char* text;
   char* data;
   char* start;
-  char* last_start;
   char* end;
   int   size;
   int   start_delim_len;
   int   end_delim_len;
   int   rc = 0;
-  int   original_fd = -1;
-
-  /* if a preprocessing function has been specified, use it */
-  if( mgr_data->recursive_depth < 1 && mgr_data->preproc != NULL ) {
-    original_fd = ae_redirect_to( output, STDOUT_FILENO );
-    mgr_data->preproc( mgr, output );
+  int   depth;
+  int   recorded;
+  int   measured;
+  long  trace_start = 0;
+
+  /* run the preprocessor, and set up profiling and accounting, as needed */
+  static_ae_render_enter( mgr_data, output, &frame );
+  output = frame.output;
+  depth = mgr_data->recursive_depth;
+  if( mgr_data->m_trace != NULL ) {
+    trace_start = static_ae_now_ns();
+  }
+  AE_PROBE2( render__start, name, depth );
+
+  /* a top-level render of a template file is counted in the render
+   * statistics, if the process keeps them, and any render's output is
+   * counted while something is attached to the render__end probe */
+  recorded = ( name != NULL && depth == 1 && ae_stats_attached() );
+  measured = ( recorded || AE_PROBE_ENABLED( render__end ) );
+  if( measured ) {
+    output = static_ae_measure_begin( &measure, output );
   }
 
-  /* increment the recursive depth */
-  mgr_data->recursive_depth++;
+  /* a render that has reached one of its limits (this one's depth, say)
+   * renders nothing more */
+  if( mgr_data->m_budget != NULL && static_ae_budget_spent( mgr_data, output ) ) {
+    if( measured ) {
+      static_ae_measure_end( &measure, output );
+    }
+    static_ae_render_leave( mgr_data, &frame );
+    if( recorded ) {
+      ae_stats_record( name, static_ae_now_ns() - measure.start_ns, measure.bytes, 1 );
+    }
+    AE_PROBE4( render__end, name, depth, AE_LIMIT_EXCEEDED, ( measured ? measure.bytes : -1 ) );
+    return AE_LIMIT_EXCEEDED;
+  }
 
   /* precompute the length of the start and end delimiters */
   start_delim_len = strlen( mgr_data->m_tag_start );
@@ -776,107 +1611,546 @@ int ae_process_stream( t_ae_template_mgr mgr, t_ae_stream stream, FILE* output )
 
   /* read the entire stream into a buffer */
   size = ae_stream_get_length( stream );
-  data = (char*)malloc( size+1 );
+  data = (char*)ae_malloc( size+1 );
   ae_stream_read( stream, data, size+1 );
   data[ size ] = 0;
 
-  /* search through the text of the stream, replacing tags as they are encountered */
+  /* search through the text of the stream, replacing tags as they are encountered.
+   * If parallel sections have been requested, hand the top level of the document to
+   * the section scheduler instead. */
   text = data;
-  start = strstr( text, mgr_data->m_tag_start );
-  while( start != NULL ) {
-    *start = 0;
-    fputs( text, output );
+  if( mgr_data->m_workers > 1 && mgr_data->recursive_depth == 1 ) {
+    rc = static_ae_process_parallel( mgr_data, data, output );
+    *text = 0;
+  } else {
+    while( ( rc = static_ae_find_tag( mgr_data, text, &start, &end ) ) > 0 ) {
+      *start = 0;
+      fputs( text, output );
 
-    /* find the next end-token */
-    end = strstr( start + start_delim_len, mgr_data->m_tag_end );
-    if( end == NULL ) {
-      fputs( "[unclosed tag]", output );
-      rc = -1;
-      break;
-    }
+      /* skip past the starting delimiter */
+      start = start + start_delim_len;
+      *end = 0;
 
-    /* skip past nested tags, by looking for start-tags that begin after the current
-     * start position, but before the next end-token. That is to say, if the tag delimiters
-     * are <% and %>:
-     *   <%   <%   <%  %>   %>       %>
-     *   ^    ^        ^
-     *   | last_start  |
-     *   start         end
-     * Here, start is the first start-token found, and end is the first end-token found.
-     * Nested tags are detected because last_start exists between start and end. */
-
-    last_start = strstr( start + start_delim_len, mgr_data->m_tag_start );
-    while( last_start != NULL && last_start < end ) {
-      /* We've found a nested token, so we skip it by looking for the next 'last_start' tag
-       * AND the next 'end' tag, and we continue the loop if the last_start tag is before the
-       * end tag.  In other words:
-       *   End of Iteration #1  <%   <%   <%  %>   %>       %>
-       *                        S         L        E
-       *   End of Iteration #2  <%   <%   <%  %>   %>       %>
-       *                        S                           E   ... L
-       * Thus, by the end of iteration #2, last_start is either NULL or after E, which
-       * means that the stretch of data from S to E completely contains all tags within
-       * it, with no tags overlapping the ends of S-E. */
-
-      end = strstr( end + end_delim_len, mgr_data->m_tag_end );
-      if( end == NULL ) break;
-      last_start = strstr( last_start + start_delim_len, mgr_data->m_tag_start );
-    }
-
-    /* if end is NULL, then the tag was not closed */
-    if( end == NULL ) {
-      fputs( "[unclosed tag]", output );
-      rc = -1;
-      break;
-    }
+      /* hand the tag text to the first tag that will apply it */
+      static_ae_dispatch( mgr_data, start, output );
 
-    /* skip past the starting delimiter */
-    start = start + start_delim_len;
-    *end = 0;
+      /* start the next loop after the end of the ending delimiter */
+      text = end + end_delim_len;
 
-    /* look for the first tag that can apply the given tag text.  Each tag contains
-     * the logic it needs to recognize itself at the head of a chunk of text ('start'). */
-    for( item = mgr_data->m_taglist_head; item != NULL; item = item->next ) {
-      if( item->tag->apply( item->tag, start, mgr, output ) ) {
+      /* stop, writing nothing more, once a limit has been reached */
+      if( mgr_data->m_budget != NULL && static_ae_budget_spent( mgr_data, output ) ) {
+        *text = 0;
         break;
       }
     }
 
-    /* start the next loop after the end of the ending delimiter */
-    text = end + end_delim_len;
-
-    /* look for the next starting delimiter */
-    start = strstr( text, mgr_data->m_tag_start );
+    /* if the tag was not closed, say so and stop processing */
+    if( rc < 0 ) {
+      *start = 0;
+      fputs( text, output );
+      fputs( "[unclosed tag]", output );
+      *text = 0;
+    }
   }
 
   /* write the remaining data */
   fputs( text, output );
-  free( data );
+  ae_free( data );
 
-  /* decrement the recursive depth, as we are now leaving this function */
-  mgr_data->recursive_depth--;
-  if( mgr_data->recursive_depth < 1 ) {
-    ae_restore_file( original_fd, stdout );
+  if( mgr_data->m_trace != NULL ) {
+    static_ae_trace_span( mgr_data, "stream", "ae_process_stream", trace_start, NULL, NULL );
+  }
+  if( measured ) {
+    static_ae_measure_end( &measure, output );
   }
+  static_ae_render_leave( mgr_data, &frame );
+
+  /* (asked after leaving, as the output limit may only be reached when a
+   * top-level render's output is flushed) */
+  if( ae_limit_reached( (t_ae_template_mgr)mgr_data ) != AE_LIMIT_NONE ) {
+    rc = AE_LIMIT_EXCEEDED;
+  }
+  if( recorded ) {
+    ae_stats_record( name, static_ae_now_ns() - measure.start_ns, measure.bytes, rc != 0 );
+  }
+  AE_PROBE4( render__end, name, depth, rc, ( measured ? measure.bytes : -1 ) );
 
   return rc;
 }
 
-void ae_set_preprocessor_func( t_ae_template_mgr mgr, t_ae_preproc_fn func ) {
+void ae_set_parallel_sections( t_ae_template_mgr mgr, int workers ) {
   MGR_CAST( mgr_data, mgr );
-  mgr_data->preproc = func;
+  mgr_data->m_workers = ( workers > 1 ? workers : 0 );
 }
 
-void ae_set_mgr_cookie( t_ae_template_mgr mgr, void* cookie ) {
+void ae_set_limits( t_ae_template_mgr mgr, CONST t_ae_limits* limits ) {
   MGR_CAST( mgr_data, mgr );
-  mgr_data->cookie = cookie;
-}
+
+  if( limits == NULL ) {
+    memset( &mgr_data->m_limits, 0, sizeof( t_ae_limits ) );
+  } else {
+    mgr_data->m_limits = *limits;
+  }
+  mgr_data->m_limited = ( mgr_data->m_limits.max_depth > 0 ||
+                          mgr_data->m_limits.max_includes > 0 ||
+                          mgr_data->m_limits.max_output > 0 ||
+                          mgr_data->m_limits.max_ms > 0 ||
+                          mgr_data->m_limits.max_iterations > 0 );
+}
+
+void ae_get_limits( t_ae_template_mgr mgr, t_ae_limits* limits ) {
+  MGR_CAST( mgr_data, mgr );
+  *limits = mgr_data->m_limits;
+}
+
+int ae_limit_reached( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+
+  /* while rendering, the render's own budget knows */
+  if( mgr_data->m_budget != NULL ) {
+    return __atomic_load_n( &mgr_data->m_budget->reason, __ATOMIC_RELAXED );
+  }
+  return mgr_data->m_limit_reached;
+}
+
+int ae_check_limits( t_ae_template_mgr mgr, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  return ( mgr_data->m_budget != NULL && static_ae_budget_spent( mgr_data, output ) );
+}
+
+int ae_next_iteration( t_ae_template_mgr mgr, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_budget* budget = mgr_data->m_budget;
+
+  AE_PROBE0( loop__iteration );
+  if( budget == NULL ) return 1;
+
+  if( mgr_data->m_limits.max_iterations > 0 &&
+      __sync_add_and_fetch( &budget->iterations, 1 ) > mgr_data->m_limits.max_iterations )
+  {
+    static_ae_budget_stop( budget, AE_LIMIT_ITERATIONS, output );
+  }
+  return !static_ae_budget_spent( mgr_data, output );
+}
+
+void ae_pause_limits( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_budget* budget = mgr_data->m_budget;
+
+  if( budget == NULL || budget->deadline_ns == 0 || budget->paused_ns != 0 ) return;
+  budget->paused_ns = static_ae_now_ns();
+}
+
+void ae_resume_limits( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_budget* budget = mgr_data->m_budget;
+
+  /* the deadline moves on by as long as the render was paused */
+  if( budget == NULL || budget->paused_ns == 0 ) return;
+  budget->deadline_ns += static_ae_now_ns() - budget->paused_ns;
+  budget->paused_ns = 0;
+}
+
+void ae_set_cancellable( t_ae_template_mgr mgr, int cancellable ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->m_cancellable = cancellable;
+}
+
+int ae_get_cancellable( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  return mgr_data->m_cancellable;
+}
+
+void ae_cancel_render( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+
+  if( mgr_data->m_budget == NULL ) return;
+  static_ae_budget_stop( mgr_data->m_budget, AE_LIMIT_CANCELLED, NULL );
+}
+
+void ae_save_thread_state( t_ae_thread_state* state ) {
+  state->m_alloc_mgr = static_alloc_mgr;
+  state->m_trace_tid = static_trace_tid;
+}
+
+void ae_restore_thread_state( CONST t_ae_thread_state* state ) {
+  static_alloc_mgr = (t_ae_mgr*)state->m_alloc_mgr;
+  static_trace_tid = state->m_trace_tid;
+}
+
+void ae_set_preprocessor_func( t_ae_template_mgr mgr, t_ae_preproc_fn func ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->preproc = func;
+}
+
+void ae_set_include_func( t_ae_template_mgr mgr, t_ae_include_fn func, void* cookie ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->m_include = func;
+  mgr_data->m_include_cookie = cookie;
+}
+
+void ae_set_minify( t_ae_template_mgr mgr, int minify ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->m_minify = minify;
+}
+
+int ae_get_minify( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  return mgr_data->m_minify;
+}
+
+void ae_set_mgr_cookie( t_ae_template_mgr mgr, void* cookie ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->cookie = cookie;
+}
 
 void* ae_get_mgr_cookie( t_ae_template_mgr mgr ) {
   MGR_CAST( mgr_data, mgr );
+
+  /* an overlay without a cookie of its own has its base's */
+  while( mgr_data->cookie == NULL && mgr_data->m_base != NULL ) {
+    mgr_data = mgr_data->m_base;
+  }
   return mgr_data->cookie;
 }
 
+/* ------------------------------------------------------------------------- */
+/* compiled template functions                                               */
+/* ------------------------------------------------------------------------- */
+
+int ae_process_compiled( t_ae_template_mgr mgr, t_ae_compiled_fn render, FILE* output ) {
+  return ae_process_body( mgr, static_ae_call_compiled, &render, output );
+}
+
+int ae_process_body( t_ae_template_mgr mgr, t_ae_body_fn body, void* cookie, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_render_frame frame;
+  int rc;
+
+  static_ae_render_enter( mgr_data, output, &frame );
+  if( mgr_data->m_budget != NULL && static_ae_budget_spent( mgr_data, frame.output ) ) {
+    rc = AE_LIMIT_EXCEEDED;
+  } else {
+    rc = body( cookie, mgr, frame.output );
+  }
+  static_ae_render_leave( mgr_data, &frame );
+  if( ae_limit_reached( mgr ) != AE_LIMIT_NONE ) {
+    rc = AE_LIMIT_EXCEEDED;
+  }
+
+  return rc;
+}
+
+int ae_next_tag( t_ae_template_mgr mgr, CONST char* text, char** start, char** end ) {
+  MGR_CAST( mgr_data, mgr );
+  return static_ae_find_tag( mgr_data, text, start, end );
+}
+
+int ae_dispatch_tag( t_ae_template_mgr mgr, CONST char* text, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  return static_ae_dispatch( mgr_data, text, output );
+}
+
+int ae_repeat_compiled( t_ae_template_mgr mgr,
+                        CONST char* source,
+                        CONST char* token,
+                        CONST char* delim,
+                        t_ae_compiled_fn body,
+                        FILE* output )
+{
+  return static_ae_repeat( mgr, source, token, delim, 0, -1, NULL, static_ae_call_compiled, &body, output );
+}
+
+int ae_repeat_body( t_ae_template_mgr mgr,
+                    CONST char* source,
+                    CONST char* token,
+                    CONST char* delim,
+                    t_ae_body_fn body,
+                    void* cookie,
+                    FILE* output )
+{
+  return static_ae_repeat( mgr, source, token, delim, 0, -1, NULL, body, cookie, output );
+}
+
+int ae_get_slice( t_ae_template_mgr mgr, CONST char* text, CONST char* delim,
+                  int which, int* offset, int* limit )
+{
+  CONST char* first;
+  CONST char* second;
+
+  /* a field that is not a number (nor names a tag holding one) leaves its
+   * default, so a bad offset starts at the first row and a bad limit
+   * renders them all */
+  *offset = 0;
+  *limit = -1;
+  first = ae_get_field( text, delim, which );
+  second = ( first ? ae_get_field( text, delim, which+1 ) : NULL );
+  if( second == NULL ) return 0;
+  if( !static_ae_slice_value( mgr, first, delim, offset ) ) *offset = 0;
+  if( !static_ae_slice_value( mgr, second, delim, limit ) ) *limit = -1;
+
+  return 1;
+}
+
+int ae_escape_compiled( t_ae_template_mgr mgr, t_ae_compiled_fn body,
+                        int mode, FILE* output )
+{
+  return ae_escape_body( mgr, static_ae_call_compiled, &body, mode, output );
+}
+
+int ae_escape_body( t_ae_template_mgr mgr, t_ae_body_fn body, void* cookie,
+                    int mode, FILE* output )
+{
+  MGR_CAST( mgr_data, mgr );
+  FILE*  buffer_output;
+  char*  buffer = NULL;
+  size_t length = 0;
+  int    escape;
+  int    rc;
+
+  /* the body's output has to be complete before it can be escaped, and the
+   * tags in it must not escape their values first */
+  escape = mgr_data->m_escape;
+  mgr_data->m_escape = AE_ESCAPE_NONE;
+
+  buffer_output = open_memstream( &buffer, &length );
+  if( buffer_output == NULL ) {
+    rc = body( cookie, mgr, output );
+    mgr_data->m_escape = escape;
+    return rc;
+  }
+  rc = body( cookie, mgr, buffer_output );
+  fclose( buffer_output );
+  mgr_data->m_escape = escape;
+
+  static_ae_write_escaped( buffer, length, mode, output );
+  free( buffer );
+
+  return rc;
+}
+
+void ae_write_escaped( CONST char* text, int mode, FILE* output ) {
+  static_ae_write_escaped( text, strlen( text ), mode, output );
+}
+
+void ae_set_auto_escape( t_ae_template_mgr mgr, int mode ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->m_escape = ( mode == AE_ESCAPE_HTML || mode == AE_ESCAPE_JS ? mode : AE_ESCAPE_NONE );
+}
+
+int ae_get_auto_escape( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  return mgr_data->m_escape;
+}
+
+/* ------------------------------------------------------------------------- */
+/* profiling function implementations                                        */
+/* ------------------------------------------------------------------------- */
+
+void ae_set_profiling( t_ae_template_mgr mgr, int enabled ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_profile* profile;
+  int i;
+
+  if( enabled && mgr_data->m_profile == NULL ) {
+    profile = (t_ae_profile*)ae_malloc( sizeof( t_ae_profile ) );
+    memset( profile, 0, sizeof( t_ae_profile ) );
+    profile->frames = 16;
+    profile->child_ns = (long*)ae_malloc( profile->frames * sizeof( long ) );
+    mgr_data->m_profile = profile;
+  } else if( !enabled && mgr_data->m_profile != NULL ) {
+    profile = mgr_data->m_profile;
+    for( i = 0; i < profile->count; i++ ) {
+      ae_free( (char*)profile->entries[ i ]->total.name );
+      ae_free( profile->entries[ i ] );
+    }
+    ae_free( profile->entries );
+    ae_free( profile->child_ns );
+    ae_free( profile );
+    mgr_data->m_profile = NULL;
+  }
+}
+
+void ae_profile_reset( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+
+  /* forget everything, including the tag names seen so far */
+  if( mgr_data->m_profile != NULL ) {
+    ae_set_profiling( mgr, 0 );
+    ae_set_profiling( mgr, 1 );
+  }
+}
+
+int ae_profile_tag_count( t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  if( mgr_data->m_profile == NULL ) return 0;
+  return mgr_data->m_profile->count;
+}
+
+int ae_profile_get_tag( t_ae_template_mgr mgr, int index, int which,
+                        t_ae_tag_stats* stats )
+{
+  MGR_CAST( mgr_data, mgr );
+  t_ae_prof_entry* entry;
+
+  if( mgr_data->m_profile == NULL ) return 0;
+  if( index < 0 || index >= mgr_data->m_profile->count ) return 0;
+
+  entry = mgr_data->m_profile->entries[ index ];
+  *stats = ( which == AE_PROFILE_TOTAL ? entry->total : entry->last );
+  return 1;
+}
+
+void ae_profile_get_render( t_ae_template_mgr mgr, int which,
+                            t_ae_render_stats* stats )
+{
+  MGR_CAST( mgr_data, mgr );
+
+  if( mgr_data->m_profile == NULL ) {
+    memset( stats, 0, sizeof( t_ae_render_stats ) );
+    return;
+  }
+  *stats = ( which == AE_PROFILE_TOTAL ? mgr_data->m_profile->total : mgr_data->m_profile->last );
+}
+
+void ae_profile_report( t_ae_template_mgr mgr, int which, FILE* output ) {
+  t_ae_render_stats render;
+  t_ae_tag_stats tag;
+  int i;
+
+  ae_profile_get_render( mgr, which, &render );
+  fprintf( output, "{\"renders\":%ld,\"streams\":%ld,\"includes\":%ld,\"execs\":%ld,"
+                   "\"max_depth\":%d,\"elapsed_ns\":%ld,\"bytes\":%ld,\"tags\":[",
+           render.renders, render.streams, render.includes, render.execs,
+           render.max_depth, render.elapsed_ns, render.bytes );
+
+  for( i = 0; ae_profile_get_tag( mgr, i, which, &tag ); i++ ) {
+    fprintf( output, "%s\n  {\"name\":\"", ( i > 0 ? "," : "" ) );
+    static_ae_write_json_string( tag.name, output );
+    fprintf( output, "\",\"attempts\":%ld,\"calls\":%ld,\"matches\":%ld,"
+                     "\"inclusive_ns\":%ld,\"exclusive_ns\":%ld,\"bytes\":%ld}",
+             tag.attempts, tag.calls, tag.matches,
+             tag.inclusive_ns, tag.exclusive_ns, tag.bytes );
+  }
+
+  fprintf( output, "]}\n" );
+}
+
+/* ------------------------------------------------------------------------- */
+/* tracing function implementations                                          */
+/* ------------------------------------------------------------------------- */
+
+t_ae_tracer ae_tracer_open( CONST char* path, int mode ) {
+  t_ae_tracer_data* tracer;
+
+  tracer = NEW( t_ae_tracer_data );
+  tracer->path = ae_strdup( path );
+  tracer->mode = mode;
+  tracer->renders = 0;
+  tracer->out.file = NULL;
+  tracer->out.events = 0;
+  tracer->out.own = 0;
+
+  /* one file for the process is opened now; per-render files as each
+   * render starts */
+  if( mode == AE_TRACE_PROCESS ) {
+    tracer->out.file = fopen( path, "w" );
+    if( tracer->out.file == NULL ) {
+      ae_free( tracer->path );
+      ae_free( tracer );
+      return NULL;
+    }
+    fputs( "[\n", tracer->out.file );
+  }
+
+  return (t_ae_tracer)tracer;
+}
+
+void ae_tracer_close( t_ae_tracer tracer ) {
+  t_ae_tracer_data* tracer_data = (t_ae_tracer_data*)tracer;
+
+  if( tracer_data->out.file != NULL ) {
+    fputs( "\n]\n", tracer_data->out.file );
+    fclose( tracer_data->out.file );
+  }
+  ae_free( tracer_data->path );
+  ae_free( tracer_data );
+}
+
+void ae_set_tracer( t_ae_template_mgr mgr, t_ae_tracer tracer ) {
+  MGR_CAST( mgr_data, mgr );
+  mgr_data->m_tracer = (t_ae_tracer_data*)tracer;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/* incremental rendering function implementations                            */
+/* ------------------------------------------------------------------------- */
+
+t_ae_record ae_record_template( t_ae_template_mgr mgr, CONST char* file, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_stream stream;
+  char* data;
+  int   size;
+
+  stream = ae_stream_open_file( file );
+  if( stream == NULL ) {
+    return NULL;
+  }
+  size = ae_stream_get_length( stream );
+  data = (char*)ae_malloc( size+1 );
+  ae_stream_read( stream, data, size+1 );
+  data[ size ] = 0;
+  ae_stream_close( stream );
+
+  return static_ae_record( mgr_data, data, output );
+}
+
+t_ae_record ae_record_buffer( t_ae_template_mgr mgr, CONST char* buffer, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  return static_ae_record( mgr_data, ae_strdup( buffer ), output );
+}
+
+int ae_rerender( t_ae_record record, t_ae_template_mgr mgr, char** changed, FILE* output ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_record_data* record_data = (t_ae_record_data*)record;
+  t_ae_render_frame frame;
+  int workers;
+
+  static_ae_render_enter( mgr_data, output, &frame );
+  workers = mgr_data->m_workers;
+  mgr_data->m_workers = 0;
+
+  static_ae_record_write( mgr_data, record_data, changed, frame.output );
+
+  mgr_data->m_workers = workers;
+  static_ae_render_leave( mgr_data, &frame );
+
+  return record_data->rc;
+}
+
+void ae_record_free( t_ae_record record ) {
+  t_ae_record_data* record_data = (t_ae_record_data*)record;
+  int i;
+
+  if( record_data == NULL ) return;
+  for( i = 0; i < record_data->count; i++ ) {
+    free( record_data->regions[ i ].output );
+    static_ae_deps_clear( &record_data->regions[ i ].deps );
+  }
+  ae_free( record_data->regions );
+  ae_free( record_data->data );
+  ae_free( record_data );
+}
+
+int ae_record_regions( t_ae_record record ) {
+  return ( (t_ae_record_data*)record )->count;
+}
+
+int ae_record_rendered( t_ae_record record ) {
+  return ( (t_ae_record_data*)record )->rendered;
+}
+
 
 /* ------------------------------------------------------------------------- */
 /* ToHTML Replacement Functions                                              */
@@ -890,13 +2164,22 @@ int ToHTML2( CONST char* tem_file, char** tokens, char** values, int mode ) {
 t_ae_template_mgr ae_init_html( char** tokens, char** values, int mode ) {
   t_ae_template_mgr mgr;
   t_ae_html_proc_data* data;
+  CONST char* encodings;
 
   /* set up the HTML proc data structure, with fields' values depending on the value of mode */
   data = NEW( t_ae_html_proc_data );
   data->headers = ( mode & HTML_HEADER );
   data->no_cache = ( mode & HTML_NO_CACHE );
+  data->etag = ( ( mode & HTML_ETAG ) && data->headers );
+  data->not_modified = 0;
+  data->etag_value[ 0 ] = 0;
   data->cookies = NULL;
 
+  /* only compress if the headers can say so, and the client can take it */
+  encodings = getenv( "HTTP_ACCEPT_ENCODING" );
+  data->gzip = ( ( mode & HTML_GZIP ) && data->headers && ae_gzip_available() &&
+                 encodings != NULL && strstr( encodings, "gzip" ) != NULL );
+
   /* default the output to stdout, but see ae_set_html_output */
   data->output = stdout;
 
@@ -919,28 +2202,55 @@ t_ae_template_mgr ae_init_html( char** tokens, char** values, int mode ) {
 int ae_done_html( t_ae_template_mgr mgr, CONST char* tem_file ) {
   int rc = 0;
   t_ae_html_proc_data* data;
+  FILE* gzip;
   t_ae_cookie* cookie;
   t_ae_cookie* next;
+  CONST char* match;
 
+  /* the page data belongs to the manager ae_init_html made, and is freed
+   * with it, so an overlay of that manager can't finish the page */
+  if( ae_get_base( mgr ) != NULL ) return 0;
   data = (t_ae_html_proc_data*)ae_get_mgr_cookie( mgr );
 
-  /* if a template file is specified, process it */
-  if( tem_file != NULL ) {
-    rc = ae_process_template( mgr, tem_file, data->output );
+  /* work out the page's validator before anything is written; if the client
+   * already has the page it names, the headers say so and nothing else is
+   * sent */
+  if( tem_file != NULL && data->etag ) {
+    if( static_html_etag( mgr, data, tem_file ) != 0 ) {
+      data->etag_value[ 0 ] = 0;
+    }
+    match = getenv( "HTTP_IF_NONE_MATCH" );
+    if( data->etag_value[ 0 ] != 0 && match != NULL &&
+        static_html_etag_matches( match, data->etag_value ) )
+    {
+      data->not_modified = 1;
+      static_html_preproc_fn( mgr, data->output );
+    }
+  }
+
+  /* if a template file is specified, process it -- through a gzip stream,
+   * if compressing (the headers still go straight to the output) */
+  if( tem_file != NULL && !data->not_modified ) {
+    gzip = ( data->gzip ? ae_gzip_open( data->output, AE_GZIP_DEFAULT ) : NULL );
+    data->gzip = ( gzip != NULL );
+    rc = ae_process_template( mgr, tem_file, ( gzip != NULL ? gzip : data->output ) );
+    if( gzip != NULL && ae_gzip_close( gzip ) != 0 ) {
+      rc = -1;
+    }
   }
 
   /* free the cookie list */
   cookie = data->cookies;
   while( cookie != NULL ) {
-    free( cookie->name );
-    free( cookie->value );
+    ae_free( cookie->name );
+    ae_free( cookie->value );
     next = cookie->next;
-    free( cookie );
+    ae_free( cookie );
     cookie = next;
   }
 
   /* free the data */
-  free( data );
+  ae_free( data );
 
   /* cleanup the manager */
   ae_template_mgr_done( mgr );
@@ -959,11 +2269,12 @@ void ae_set_cookie( t_ae_template_mgr mgr,
   t_ae_html_proc_data* data;
   t_ae_cookie* cookie;
 
+  if( ae_get_base( mgr ) != NULL ) return;
   data = (t_ae_html_proc_data*)ae_get_mgr_cookie( mgr );
   cookie = NEW( t_ae_cookie );
 
-  cookie->name = strdup( name );
-  cookie->value = strdup( value );
+  cookie->name = ae_strdup( name );
+  cookie->value = ae_strdup( value );
   cookie->ttl = ttl;
   cookie->next = data->cookies;
 
@@ -973,10 +2284,113 @@ void ae_set_cookie( t_ae_template_mgr mgr,
 
 void ae_set_html_output( t_ae_template_mgr mgr, FILE* output ) {
   t_ae_html_proc_data* data;
+
+  if( ae_get_base( mgr ) != NULL ) return;
   data = (t_ae_html_proc_data*)ae_get_mgr_cookie( mgr );
   data->output = output;
 }
 
+/* ------------------------------------------------------------------------- */
+/* memory management functions                                               */
+/* ------------------------------------------------------------------------- */
+
+void ae_set_allocator( t_ae_malloc_fn malloc_fn,
+                       t_ae_realloc_fn realloc_fn,
+                       t_ae_free_fn free_fn,
+                       void* context )
+{
+  static_malloc_fn = malloc_fn;
+  static_realloc_fn = realloc_fn;
+  static_free_fn = free_fn;
+  static_alloc_context = context;
+}
+
+void ae_set_alloc_accounting( int enabled ) {
+  static_alloc_accounting = enabled;
+}
+
+void ae_get_alloc_stats( t_ae_template_mgr mgr, int which, t_ae_alloc_stats* stats ) {
+  MGR_CAST( mgr_data, mgr );
+
+  if( mgr_data == NULL ) {
+    *stats = static_alloc_stats;
+  } else if( which == AE_PROFILE_TOTAL ) {
+    *stats = mgr_data->m_alloc_total;
+  } else {
+    *stats = mgr_data->m_alloc_last;
+  }
+}
+
+void* ae_malloc( size_t size ) {
+  char* block;
+
+  if( !static_alloc_accounting ) {
+    return ( static_malloc_fn ? static_malloc_fn( static_alloc_context, size ) : malloc( size ) );
+  }
+
+  /* reserve room for the header, and remember the size in it */
+  block = (char*)( static_malloc_fn ? static_malloc_fn( static_alloc_context, size + ALLOC_HDR_SIZE )
+                                    : malloc( size + ALLOC_HDR_SIZE ) );
+  if( block == NULL ) return NULL;
+  *(size_t*)block = size;
+  static_ae_account( NULL, 1, 0, size, size );
+
+  return block + ALLOC_HDR_SIZE;
+}
+
+void* ae_realloc( void* ptr, size_t size ) {
+  char*  block;
+  size_t old_size;
+
+  if( !static_alloc_accounting ) {
+    return ( static_realloc_fn ? static_realloc_fn( static_alloc_context, ptr, size ) : realloc( ptr, size ) );
+  }
+  if( ptr == NULL ) {
+    return ae_malloc( size );
+  }
+
+  block = (char*)ptr - ALLOC_HDR_SIZE;
+  old_size = *(size_t*)block;
+  block = (char*)( static_realloc_fn ? static_realloc_fn( static_alloc_context, block, size + ALLOC_HDR_SIZE )
+                                     : realloc( block, size + ALLOC_HDR_SIZE ) );
+  if( block == NULL ) return NULL;
+  *(size_t*)block = size;
+  static_ae_account( NULL, 1, 0, size, (long)size - (long)old_size );
+
+  return block + ALLOC_HDR_SIZE;
+}
+
+void ae_free( void* ptr ) {
+  char* block;
+
+  if( ptr == NULL ) return;
+
+  block = (char*)ptr;
+  if( static_alloc_accounting ) {
+    block -= ALLOC_HDR_SIZE;
+    static_ae_account( NULL, 0, 1, 0, -(long)*(size_t*)block );
+  }
+
+  if( static_free_fn ) {
+    static_free_fn( static_alloc_context, block );
+  } else {
+    free( block );
+  }
+}
+
+char* ae_strdup( CONST char* text ) {
+  char*  copy;
+  size_t len;
+
+  len = strlen( text ) + 1;
+  copy = (char*)ae_malloc( len );
+  if( copy != NULL ) {
+    memcpy( copy, text, len );
+  }
+
+  return copy;
+}
+
 /* ------------------------------------------------------------------------- */
 /* miscellaneous utility functions                                           */
 /* ------------------------------------------------------------------------- */
@@ -1002,7 +2416,7 @@ char* ae_get_field_alloc( CONST char* text, CONST char* delim, int which ) {
   ptr = ae_get_field( text, delim, which );
   if( ptr == NULL ) return NULL;
   len = ae_field_len( ptr, delim );
-  new_ptr = (char*)malloc( len+1 );
+  new_ptr = (char*)ae_malloc( len+1 );
   ae_field_cpy( new_ptr, ptr, delim );
 
   return new_ptr;
@@ -1047,7 +2461,47 @@ char* ae_field_cpy( char* dest, CONST char* field, CONST char* delim ) {
   return dest;
 }
 
-void* ae_load_dynamic_function( CONST char* lib, CONST char* func ) {
+int ae_is_decimal( CONST char* text, int length, double* number ) {
+  char  buffer[ 64 ];
+  char* copy;
+  int   digits = 0;
+  int   i = 0;
+
+  if( i < length && ( text[ i ] == '-' || text[ i ] == '+' ) ) i++;
+  while( i < length && isdigit( (unsigned char)text[ i ] ) ) {
+    i++;
+    digits++;
+  }
+  if( i < length && text[ i ] == '.' ) {
+    i++;
+    while( i < length && isdigit( (unsigned char)text[ i ] ) ) {
+      i++;
+      digits++;
+    }
+  }
+  if( digits == 0 ) return 0;
+
+  if( i < length && ( text[ i ] == 'e' || text[ i ] == 'E' ) ) {
+    i++;
+    if( i < length && ( text[ i ] == '-' || text[ i ] == '+' ) ) i++;
+    if( i == length || !isdigit( (unsigned char)text[ i ] ) ) return 0;
+    while( i < length && isdigit( (unsigned char)text[ i ] ) ) i++;
+  }
+  if( i != length ) return 0;
+
+  /* text needn't be null-terminated, so convert a copy of it */
+  if( number != NULL ) {
+    copy = ( length < (int)sizeof( buffer ) ? buffer : (char*)ae_malloc( length + 1 ) );
+    memcpy( copy, text, length );
+    copy[ length ] = 0;
+    *number = strtod( copy, NULL );
+    if( copy != buffer ) ae_free( copy );
+  }
+
+  return 1;
+}
+
+void* ae_load_dynamic_function( CONST char* lib, CONST char* func ) {
   void* func_ptr = NULL;
   int load_flags;
 
@@ -1084,13 +2538,11 @@ void* ae_load_dynamic_function( CONST char* lib, CONST char* func ) {
 
 char* ae_build_library_name( char* dest, CONST char* root ) {
   char* buffer;
-  char  cwd[ 256 ];
   char* sfx;
-  char* webroot;
 
   buffer = dest;
   if( buffer == NULL ) {
-    buffer = (char*)malloc( 256 );
+    buffer = (char*)ae_malloc( 256 );
   }
 
 #if defined( _HPUX_SOURCE )
@@ -1134,8 +2586,8 @@ char* ae_build_library_name( char* dest, CONST char* root ) {
 int ae_redirect_to( FILE* output, int original_fd ) {
   int old_fd = -1;
 
-  /* if 'output' is not already 'original_fd'... */
-  if( fileno( output ) != original_fd ) {
+  /* if 'output' is not already 'original_fd' (and is a file at all)... */
+  if( fileno( output ) >= 0 && fileno( output ) != original_fd ) {
     /* flush any cached data on output */
     fflush( output );
     /* copy original_fd */
@@ -1165,7 +2617,7 @@ void ae_restore_file( int original_fd, FILE* file ) {
 
 static t_ae_file_stream* static_ae_file_stream_new( void ) {
   t_ae_file_stream* ptr;
-  ptr = (t_ae_file_stream*)malloc( sizeof( t_ae_file_stream ) );
+  ptr = (t_ae_file_stream*)ae_malloc( sizeof( t_ae_file_stream ) );
   ptr->get_length = static_ae_file_stream_get_length;
   ptr->read = static_ae_file_stream_read;
   ptr->close = static_ae_file_stream_close;
@@ -1176,7 +2628,7 @@ static t_ae_file_stream* static_ae_file_stream_new( void ) {
 
 static t_ae_buffer_stream* static_ae_buffer_stream_new( void ) {
   t_ae_buffer_stream* ptr;
-  ptr = (t_ae_buffer_stream*)malloc( sizeof( t_ae_buffer_stream ) );
+  ptr = (t_ae_buffer_stream*)ae_malloc( sizeof( t_ae_buffer_stream ) );
   ptr->get_length = static_ae_buffer_stream_get_length;
   ptr->read = static_ae_buffer_stream_read;
   ptr->close = static_ae_buffer_stream_close;
@@ -1242,7 +2694,7 @@ static int static_ae_buffer_stream_read( t_ae_stream stream, char* buffer, int l
 static int static_ae_buffer_stream_close( t_ae_stream stream ) {
   DECL_CAST( ptr, stream, t_ae_buffer_stream );
   if( ptr->buffer == NULL ) return -1;
-  free( ptr->buffer );
+  ae_free( ptr->buffer );
   ptr->buffer = NULL;
   ptr->pos = 0;
   return 0;
@@ -1277,18 +2729,44 @@ static int static_ae_replace_tag_process( t_ae_tag tag,
                                           FILE* output )
 {
   DECL_CAST( tag_data, tag, t_ae_replace_tag );
-  if( tag_data->m_data != NULL ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_escaped* escaped;
+  int mode = mgr_data->m_escape;
+
+  if( tag_data->m_data == NULL ) {
+    return 1;
+  }
+  if( mode == AE_ESCAPE_NONE || tag_data->m_raw ) {
     fputs( tag_data->m_data, output );
+    return 1;
+  }
+
+  /* the escaped form is made once, by whichever render first wants it (a
+   * tag of a shared base may be written by several at once), and then
+   * written as it is */
+  escaped = __atomic_load_n( &tag_data->m_escaped[ mode ], __ATOMIC_ACQUIRE );
+  if( escaped == NULL ) {
+    escaped = static_ae_escape_copy( tag_data->m_data, mode );
+    if( !__sync_bool_compare_and_swap( &tag_data->m_escaped[ mode ], NULL, escaped ) ) {
+      ae_free( escaped );
+      escaped = tag_data->m_escaped[ mode ];
+    }
   }
+  fwrite( escaped->text, 1, escaped->length, output );
+
   return 1;
 }
 
 static int static_ae_replace_tag_cleanup( t_ae_tag tag ) {
   DECL_CAST( tag_data, tag, t_ae_replace_tag );
   if( tag_data->m_data != NULL ) {
-    free( tag_data->m_data );
+    ae_free( tag_data->m_data );
   }
   tag_data->m_data = NULL;
+  ae_free( tag_data->m_escaped[ AE_ESCAPE_HTML ] );
+  ae_free( tag_data->m_escaped[ AE_ESCAPE_JS ] );
+  tag_data->m_escaped[ AE_ESCAPE_HTML ] = NULL;
+  tag_data->m_escaped[ AE_ESCAPE_JS ] = NULL;
   return 0;
 }
 
@@ -1298,40 +2776,117 @@ static int static_ae_cyclical_replace_tag_process( t_ae_tag tag,
                                                    FILE* output )
 {
   DECL_CAST( tag_data, tag, t_ae_cyclical_replace_tag );
-  char* end;
-
-  if( *(tag_data->m_next) == 0 ) {
-    fputs( "no more data values in cyclical replace tag", output );
-    tag_data->m_next = 0;
+  size_t start;
+  size_t length;
+
+  if( tag_data->m_row >= tag_data->m_count ) {
+    /* an item with no delimiter after it is reported once, in its place */
+    if( tag_data->m_partial ) {
+      fputs( "non-terminated data string in cyclical replace tag", output );
+      tag_data->m_partial = 0;
+    } else {
+      fputs( "no more data values in cyclical replace tag", output );
+    }
     return 1;
   }
 
-  /* find the next delimiter, in the data */
-  end = strstr( tag_data->m_next, tag_data->m_rpt_delim );
-  if( end == 0 ) {
-    fputs( "non-terminated data string in cyclical replace tag", output );
-    tag_data->m_next = 0;
-    return 1;
+  /* write out the item, and move on to the next */
+  start = tag_data->m_offsets[ tag_data->m_row ];
+  length = tag_data->m_offsets[ tag_data->m_row + 1 ] - start - strlen( tag_data->m_rpt_delim );
+  if( ( (t_ae_mgr*)mgr )->m_escape == AE_ESCAPE_NONE ) {
+    fwrite( tag_data->m_data + start, 1, length, output );
+  } else {
+    static_ae_write_escaped( tag_data->m_data + start, length,
+                             ( (t_ae_mgr*)mgr )->m_escape, output );
   }
+  tag_data->m_row++;
+
+  return 1;
+}
+
+static size_t* static_ae_index_list( CONST char* data, CONST char* delim,
+                                     int* count, int* partial )
+{
+  size_t* offsets;
+  CONST char* p;
+  CONST char* limit;
+  size_t delim_len;
+  int    alloced;
+
+  /* find every delimiter in the list, recording where each item starts (and,
+   * after the last, where the next would).  The search is for the delimiter's
+   * first byte with memchr, which the C library vectorises, and only a match
+   * of that byte is compared in full. */
+
+  delim_len = strlen( delim );
+  limit = data + strlen( data );
+  alloced = 16;
+  offsets = (size_t*)ae_malloc( alloced * sizeof( size_t ) );
+  offsets[ 0 ] = 0;
+  *count = 0;
+
+  p = data;
+  while( delim_len > 0 && (size_t)( limit - p ) >= delim_len ) {
+    p = memchr( p, delim[ 0 ], limit - p - delim_len + 1 );
+    if( p == NULL ) break;
+    if( memcmp( p, delim, delim_len ) != 0 ) {
+      p++;
+      continue;
+    }
 
-  /* write out all data up to the 'end' pointer */
-  while( tag_data->m_next < end ) {
-    fputc( *(tag_data->m_next), output );
-    tag_data->m_next++;
+    p += delim_len;
+    if( *count + 2 > alloced ) {
+      alloced *= 2;
+      offsets = (size_t*)ae_realloc( offsets, alloced * sizeof( size_t ) );
+    }
+    offsets[ ++(*count) ] = p - data;
   }
 
-  /* move the pointer past the delimiter at the end of the record, so it now
-   * points to the beginning of the next record. */
+  *partial = ( data[ offsets[ *count ] ] != 0 );
+  return offsets;
+}
+
+static int static_ae_lazy_tag_process( t_ae_tag tag,
+                                       CONST char* text,
+                                       t_ae_template_mgr mgr,
+                                       FILE* output )
+{
+  char* value;
+
+  value = static_get_lazy_tag_value( tag );
+  if( value == NULL ) {
+    return 1;
+  }
+  if( ( (t_ae_mgr*)mgr )->m_escape == AE_ESCAPE_NONE ) {
+    fputs( value, output );
+  } else {
+    static_ae_write_escaped( value, strlen( value ), ( (t_ae_mgr*)mgr )->m_escape, output );
+  }
+  return 1;
+}
 
-  tag_data->m_next += strlen( tag_data->m_rpt_delim );
+static int static_ae_row_source_process( t_ae_tag tag,
+                                         CONST char* text,
+                                         t_ae_template_mgr mgr,
+                                         FILE* output )
+{
+  /* rendered on its own, a row source writes nothing */
   return 1;
 }
 
+static int static_ae_lazy_tag_cleanup( t_ae_tag tag ) {
+  DECL_CAST( tag_data, tag, t_ae_lazy_tag );
+  ae_free( tag_data->m_data );
+  tag_data->m_data = NULL;
+  pthread_mutex_destroy( &tag_data->m_lock );
+  return 0;
+}
+
 static int static_ae_cyclical_replace_tag_cleanup( t_ae_tag tag ) {
   DECL_CAST( tag_data, tag, t_ae_cyclical_replace_tag );
-  free( tag_data->m_data );
-  free( tag_data->m_rpt_delim );
-  tag_data->m_next = NULL;
+  ae_free( tag_data->m_data );
+  ae_free( tag_data->m_rpt_delim );
+  ae_free( tag_data->m_offsets );
   return 0;
 }
 
@@ -1405,12 +2960,13 @@ static int static_ae_include_tag_process( t_ae_tag tag,
   if( ae_get_tag( mgr, tok ) != NULL ) {
     tok = ae_get_value( mgr, tok );
   }
-  ae_process_template( mgr, tok, output );
+  ae_process_include( mgr, tok, output );
 
   return 1;
 }
 
 #define ROW_NUM_TAG_NAME "ae_row_num"
+#define ROW_COUNT_TAG_NAME "ae_row_count"
 
 static int static_ae_repeat_tag_process( t_ae_tag tag,
                                          CONST char* text,
@@ -1418,60 +2974,50 @@ static int static_ae_repeat_tag_process( t_ae_tag tag,
                                          FILE* output )
 {
   GENERIC_TAG( tag_data, tag );
-  t_ae_cyclical_replace_tag* repl_tag;
-  t_ae_replace_tag* row_tag;
   char* source;
   char* token;
   char* delim;
   char* data;
-  char  row_num_tag[32];
-  char  row_num_value[10];
-  int   i;
   
   source = ae_get_field_alloc( text, tag_data->m_delim, 1 );
   token  = ae_get_field_alloc( text, tag_data->m_delim, 2 );
   delim  = ae_get_field_alloc( text, tag_data->m_delim, 3 );
   data   = ae_get_field( text, tag_data->m_delim, 4 );
 
-  /* create a new cyclical replace tag from the delimited string associated with this
-   * repeat tag.  Add it to the manager */
+  static_ae_repeat( mgr, source, token, delim, 0, -1, data, NULL, NULL, output );
 
-  repl_tag = ae_cyclical_replace_tag( token, ae_get_value( mgr, source ), delim );
-  ae_add_tag_ex( mgr, repl_tag );
+  /* free our allocated data */
+  ae_free( source );
+  ae_free( token );
+  ae_free( delim );
 
-  /* look for the first available row_num tag name.  By default, we use ae_row_num, but
-   * if it is taken then that means that we are currently embedded inside of a repeat tag.
-   * So, we add a number to the end of the tag name and try again.  This continues until
-   * a number is found that is not taken.  This allows repeat tags to be nested to an
-   * arbitrary depth. */
+  return 1;
+}
 
-  i = 1;
-  strcpy( row_num_tag, ROW_NUM_TAG_NAME );
-  while( ae_get_tag( mgr, row_num_tag ) != NULL ) {
-    i++;
-    sprintf( row_num_tag, ROW_NUM_TAG_NAME "_%d", i );
-  }
-  
-  /* repeatedly process the data for the repeat tag, until the cyclical replace tag
-   * is out of data.  Each pass through the data, we increment the row num and set
-   * it in the row_num_tag variable. */
+static int static_ae_repeat_slice_tag_process( t_ae_tag tag,
+                                               CONST char* text,
+                                               t_ae_template_mgr mgr,
+                                               FILE* output )
+{
+  GENERIC_TAG( tag_data, tag );
+  char* source;
+  char* token;
+  char* delim;
+  int   offset;
+  int   limit;
 
-  i = 1;
-  while( *(repl_tag->m_next) != 0 ) {
-    sprintf( row_num_value, "%d", i );
-    ae_add_tag( mgr, row_num_tag, row_num_value );
-    ae_process_buffer( mgr, data, output );
-    i++;
-  }
+  /* REPEAT2_SLICE=source=newtok=delim=offset=limit=data */
+  source = ae_get_field_alloc( text, tag_data->m_delim, 1 );
+  token  = ae_get_field_alloc( text, tag_data->m_delim, 2 );
+  delim  = ae_get_field_alloc( text, tag_data->m_delim, 3 );
+  ae_get_slice( mgr, text, tag_data->m_delim, 4, &offset, &limit );
 
-  /* remove the row_num_tag and the cyclical replace tag from the manager */
-  ae_remove_tag( mgr, row_num_tag );
-  ae_remove_tag_ex( mgr, repl_tag );
+  static_ae_repeat( mgr, source, token, delim, offset, limit,
+                    ae_get_field( text, tag_data->m_delim, 6 ), NULL, NULL, output );
 
-  /* free our allocated data */
-  free( source );
-  free( token );
-  free( delim );
+  ae_free( source );
+  ae_free( token );
+  ae_free( delim );
 
   return 1;
 }
@@ -1481,14 +3027,19 @@ static int static_ae_env_tag_process( t_ae_tag tag,
                                       t_ae_template_mgr mgr,
                                       FILE* output )
 {
+  MGR_CAST( mgr_data, mgr );
   char *env;
   char* val;
 
   env = ae_get_field( text, ae_get_tag_delim( tag ), 1 );
   val = getenv( env );
 
-  if( val ) {
+  /* the environment of a CGI program holds what the client sent, so it is
+   * escaped like any other value */
+  if( val && mgr_data->m_escape == AE_ESCAPE_NONE ) {
     fputs( val, output );
+  } else if( val ) {
+    static_ae_write_escaped( val, strlen( val ), mgr_data->m_escape, output );
   }
 
   return 1;
@@ -1499,17 +3050,33 @@ static int static_ae_exec_tag_process( t_ae_tag tag,
                                        t_ae_template_mgr mgr,
                                        FILE* output )
 {
+  MGR_CAST( mgr_data, mgr );
   char *tok;
-  char* val;
   FILE* pipe_output;
   char  buf[ 128 ];
   int   count;
+  long  start = 0;
 
   tok = ae_get_field( text, ae_get_tag_delim( tag ), 1 );
   if( ae_get_tag( mgr, tok ) != NULL ) {
     tok = ae_get_value( mgr, tok );
   }
 
+  AE_PROBE1( exec__start, tok );
+  if( mgr_data->m_trace != NULL ) {
+    start = static_ae_now_ns();
+  }
+
+  /* a render with a deadline can't wait on the command for ever */
+  if( mgr_data->m_budget != NULL && mgr_data->m_budget->deadline_ns != 0 ) {
+    static_ae_exec_bounded( mgr_data, tok, output );
+    AE_PROBE1( exec__end, tok );
+    if( mgr_data->m_trace != NULL ) {
+      static_ae_trace_span( mgr_data, "exec", "exec", start, "command", tok );
+    }
+    return 1;
+  }
+
   pipe_output = popen( tok, "r" );
   if( pipe_output == NULL ) {
     fprintf( output, "[popen failed: %d (%s)]", errno, strerror( errno ) );
@@ -1517,9 +3084,14 @@ static int static_ae_exec_tag_process( t_ae_tag tag,
     while( ( count = fread( buf, 1, sizeof( buf )-1, pipe_output ) ) > 0 ) {
       buf[ count ] = 0;
       fputs( buf, output );
+      if( mgr_data->m_budget != NULL && static_ae_budget_spent( mgr_data, output ) ) break;
     }
     pclose( pipe_output );
   }
+  AE_PROBE1( exec__end, tok );
+  if( mgr_data->m_trace != NULL ) {
+    static_ae_trace_span( mgr_data, "exec", "exec", start, "command", tok );
+  }
 
   return 1;
 }
@@ -1551,8 +3123,8 @@ static int static_ae_comparison_tag_process( t_ae_tag tag,
     ae_process_buffer( mgr, ae_get_field( text, tag_data->m_delim, 3 ), output );
   }
 
-  free( val_buf );
-  free( tok_buf );
+  ae_free( val_buf );
+  ae_free( tok_buf );
 
   return 1;
 }
@@ -1562,7 +3134,67 @@ static int static_ae_include_tag_named_process( t_ae_tag tag,
                                                 t_ae_template_mgr mgr,
                                                 FILE* output )
 {
-  ae_process_template( mgr, ae_get_tag_value( tag ), output );
+  ae_process_include( mgr, ae_get_tag_value( tag ), output );
+  return 1;
+}
+
+static int static_ae_if_expr_tag_process( t_ae_tag tag,
+                                          CONST char* text,
+                                          t_ae_template_mgr mgr,
+                                          FILE* output )
+{
+  DECL_CAST( tag_data, tag, t_ae_expr_tag );
+  t_ae_expr* expr;
+  char* field;
+  char* data;
+  int   owned;
+  int   result;
+
+  field = ae_get_field( text, tag_data->m_delim, 1 );
+  data = ( field != NULL ? ae_get_field( text, tag_data->m_delim, 2 ) : NULL );
+  if( data == NULL ) return 1;
+
+  expr = static_ae_expr_get( tag_data, field, ae_field_len( field, tag_data->m_delim ), &owned );
+  if( expr->count == 0 ) {
+    fputs( "[bad IF_EXPR expression]", output );
+    result = 0;
+  } else {
+    result = static_ae_expr_true( expr, expr->count - 1, mgr );
+  }
+  if( owned ) {
+    static_ae_expr_free( expr );
+  }
+
+  if( result ) {
+    ae_process_buffer( mgr, data, output );
+  }
+
+  return 1;
+}
+
+static int static_ae_if_expr_tag_cleanup( t_ae_tag tag ) {
+  DECL_CAST( tag_data, tag, t_ae_expr_tag );
+  t_ae_expr* expr;
+  t_ae_expr* next;
+  int i;
+
+  for( i = 0; i < EXPR_BUCKETS; i++ ) {
+    for( expr = tag_data->m_buckets[ i ]; expr != NULL; expr = next ) {
+      next = expr->next;
+      static_ae_expr_free( expr );
+    }
+  }
+  pthread_mutex_destroy( &tag_data->m_lock );
+
+  return 0;
+}
+
+static int static_ae_condition_process( t_ae_tag tag,
+                                        CONST char* text,
+                                        t_ae_template_mgr mgr,
+                                        FILE* output )
+{
+  /* rendered on its own, a condition tag writes nothing */
   return 1;
 }
 
@@ -1588,8 +3220,10 @@ static int static_ae_shared_fn_process( t_ae_tag tag,
                                         FILE* output )
 {
   DECL_CAST( tag_data, tag, t_ae_shared_fn_tag );
+  MGR_CAST( mgr_data, mgr );
   int (*func_ptr)( void* );
   char libname[ 256 ];
+  long start = 0;
 
   ae_build_library_name( libname, tag_data->m_lib );
   func_ptr = (int(*)(void*))ae_load_dynamic_function( libname, tag_data->m_func );
@@ -1603,19 +3237,428 @@ static int static_ae_shared_fn_process( t_ae_tag tag,
   fflush( output );
 
   /* call the function */
+  AE_PROBE2( exec_shared__start, tag_data->m_lib, tag_data->m_func );
+  if( mgr_data->m_trace != NULL ) {
+    start = static_ae_now_ns();
+  }
   func_ptr( tag_data->m_cookie );
   fflush( stdout );
+  AE_PROBE2( exec_shared__end, tag_data->m_lib, tag_data->m_func );
+  if( mgr_data->m_trace != NULL ) {
+    static_ae_trace_span( mgr_data, "exec", tag_data->m_func, start, "lib", tag_data->m_lib );
+  }
 
   return 1;
 }
 
 static int static_ae_shared_fn_tag_cleanup( t_ae_tag tag ) {
   DECL_CAST( tag_data, tag, t_ae_shared_fn_tag );
-  free( tag_data->m_lib );
-  free( tag_data->m_func );
+  ae_free( tag_data->m_lib );
+  ae_free( tag_data->m_func );
   return 0;
 }
 
+static t_ae_expr* static_ae_expr_get( t_ae_expr_tag* tag, CONST char* text, int length, int* owned ) {
+  t_ae_expr* expr;
+  unsigned int hash;
+  int i;
+
+  /* returns the compiled form of the expression, from the tag's cache if it
+   * is there.  If the cache is full, the expression is compiled but not
+   * kept, and 'owned' tells the caller to free it.  An expression that
+   * does not compile has no nodes. */
+
+  hash = 2166136261u;
+  for( i = 0; i < length; i++ ) {
+    hash = ( hash ^ (unsigned char)text[ i ] ) * 16777619u;
+  }
+  hash %= EXPR_BUCKETS;
+
+  *owned = 0;
+  pthread_mutex_lock( &tag->m_lock );
+  for( expr = tag->m_buckets[ hash ]; expr != NULL; expr = expr->next ) {
+    if( strncmp( expr->text, text, length ) == 0 && expr->text[ length ] == 0 ) break;
+  }
+  if( expr == NULL ) {
+    expr = static_ae_expr_compile( text, length );
+    if( tag->m_cached < EXPR_CACHE_MAX ) {
+      expr->next = tag->m_buckets[ hash ];
+      tag->m_buckets[ hash ] = expr;
+      tag->m_cached++;
+    } else {
+      *owned = 1;
+    }
+  }
+  pthread_mutex_unlock( &tag->m_lock );
+
+  return expr;
+}
+
+static t_ae_expr* static_ae_expr_compile( CONST char* text, int length ) {
+  t_ae_expr_parse parse;
+  t_ae_expr* expr;
+  int i;
+
+  expr = NEW( t_ae_expr );
+  expr->next = NULL;
+  expr->text = (char*)ae_malloc( length + 1 );
+  memcpy( expr->text, text, length );
+  expr->text[ length ] = 0;
+  expr->nodes = NULL;
+  expr->count = 0;
+  expr->alloced = 0;
+  expr->calls = 0;
+
+  /* the nodes are added as the parse finishes with them, so the root comes
+   * last; anything left over after the expression is an error */
+  parse.expr = expr;
+  parse.p = expr->text;
+  static_ae_expr_next( &parse );
+  if( static_ae_expr_or( &parse ) < 0 || parse.token != EXPR_TOK_END ) {
+    for( i = 0; i < expr->count; i++ ) {
+      ae_free( expr->nodes[ i ].text );
+      ae_free( expr->nodes[ i ].arg );
+    }
+    expr->count = 0;
+  }
+
+  return expr;
+}
+
+static void static_ae_expr_free( t_ae_expr* expr ) {
+  int i;
+
+  for( i = 0; i < expr->count; i++ ) {
+    ae_free( expr->nodes[ i ].text );
+    ae_free( expr->nodes[ i ].arg );
+  }
+  ae_free( expr->nodes );
+  ae_free( expr->text );
+  ae_free( expr );
+}
+
+static int static_ae_expr_add( t_ae_expr* expr, int op, int left, int right ) {
+  t_ae_expr_node* node;
+
+  if( expr->count == expr->alloced ) {
+    expr->alloced = ( expr->alloced ? expr->alloced * 2 : 8 );
+    expr->nodes = (t_ae_expr_node*)ae_realloc( expr->nodes, expr->alloced * sizeof( t_ae_expr_node ) );
+  }
+
+  node = &expr->nodes[ expr->count ];
+  node->op = op;
+  node->left = left;
+  node->right = right;
+  node->comp_type = 0;
+  node->text = NULL;
+  node->arg = NULL;
+  node->is_number = 0;
+  node->number = 0;
+
+  return expr->count++;
+}
+
+static void static_ae_expr_next( t_ae_expr_parse* parse ) {
+  CONST char* p = parse->p;
+  char quote;
+
+  /* read the next token: a parenthesis, a quoted string (whose text is
+   * what's between the quotes), or a word, which runs to the next space,
+   * parenthesis or quote */
+
+  while( isspace( (unsigned char)*p ) ) p++;
+  parse->start = p;
+  parse->length = 1;
+
+  if( *p == 0 ) {
+    parse->token = EXPR_TOK_END;
+  } else if( *p == '(' ) {
+    parse->token = EXPR_TOK_OPEN;
+    p++;
+  } else if( *p == ')' ) {
+    parse->token = EXPR_TOK_CLOSE;
+    p++;
+  } else if( *p == '"' || *p == '\'' ) {
+    quote = *p++;
+    parse->start = p;
+    while( *p != 0 && *p != quote ) p++;
+    if( *p == 0 ) {
+      parse->token = EXPR_TOK_ERROR;
+    } else {
+      parse->token = EXPR_TOK_STRING;
+      parse->length = p - parse->start;
+      p++;
+    }
+  } else {
+    while( *p != 0 && !isspace( (unsigned char)*p ) &&
+           *p != '(' && *p != ')' && *p != '"' && *p != '\'' )
+    {
+      p++;
+    }
+    parse->token = EXPR_TOK_WORD;
+    parse->length = p - parse->start;
+  }
+
+  parse->p = p;
+}
+
+static int static_ae_expr_keyword( t_ae_expr_parse* parse, CONST char* word ) {
+  return ( parse->token == EXPR_TOK_WORD &&
+           parse->length == (int)strlen( word ) &&
+           strncmp( parse->start, word, parse->length ) == 0 );
+}
+
+static char* static_ae_expr_token( t_ae_expr_parse* parse ) {
+  char* text;
+
+  text = (char*)ae_malloc( parse->length + 1 );
+  memcpy( text, parse->start, parse->length );
+  text[ parse->length ] = 0;
+
+  return text;
+}
+
+static int static_ae_expr_or( t_ae_expr_parse* parse ) {
+  int left;
+  int right;
+
+  left = static_ae_expr_and( parse );
+  while( left >= 0 && static_ae_expr_keyword( parse, "or" ) ) {
+    static_ae_expr_next( parse );
+    right = static_ae_expr_and( parse );
+    if( right < 0 ) return -1;
+    left = static_ae_expr_add( parse->expr, EXPR_OR, left, right );
+  }
+
+  return left;
+}
+
+static int static_ae_expr_and( t_ae_expr_parse* parse ) {
+  int left;
+  int right;
+
+  left = static_ae_expr_not( parse );
+  while( left >= 0 && static_ae_expr_keyword( parse, "and" ) ) {
+    static_ae_expr_next( parse );
+    right = static_ae_expr_not( parse );
+    if( right < 0 ) return -1;
+    left = static_ae_expr_add( parse->expr, EXPR_AND, left, right );
+  }
+
+  return left;
+}
+
+static int static_ae_expr_not( t_ae_expr_parse* parse ) {
+  int operand;
+
+  if( static_ae_expr_keyword( parse, "not" ) ) {
+    static_ae_expr_next( parse );
+    operand = static_ae_expr_not( parse );
+    if( operand < 0 ) return -1;
+    return static_ae_expr_add( parse->expr, EXPR_NOT, operand, -1 );
+  }
+
+  return static_ae_expr_compare( parse );
+}
+
+static int static_ae_expr_compare( t_ae_expr_parse* parse ) {
+  static CONST char* operators[] = { "eq", "ne", "lt", "le", "gt", "ge", NULL };
+  int left;
+  int right;
+  int node;
+  int i;
+
+  /* a parenthesised expression, or an operand, perhaps compared with
+   * another */
+  if( parse->token == EXPR_TOK_OPEN ) {
+    static_ae_expr_next( parse );
+    node = static_ae_expr_or( parse );
+    if( node < 0 || parse->token != EXPR_TOK_CLOSE ) return -1;
+    static_ae_expr_next( parse );
+    return node;
+  }
+
+  left = static_ae_expr_operand( parse );
+  if( left < 0 || parse->expr->nodes[ left ].op == EXPR_CALL ) return left;
+
+  for( i = 0; operators[ i ] != NULL; i++ ) {
+    if( static_ae_expr_keyword( parse, operators[ i ] ) ) break;
+  }
+  if( operators[ i ] == NULL ) return left;
+
+  /* the COMP_TYPE values are in the same order as the operators */
+  static_ae_expr_next( parse );
+  right = static_ae_expr_operand( parse );
+  if( right < 0 || parse->expr->nodes[ right ].op == EXPR_CALL ) return -1;
+  node = static_ae_expr_add( parse->expr, EXPR_COMPARE, left, right );
+  parse->expr->nodes[ node ].comp_type = COMP_TYPE_EQ + i;
+
+  return node;
+}
+
+static int static_ae_expr_operand( t_ae_expr_parse* parse ) {
+  t_ae_expr_node* node;
+  char* text;
+  char* end;
+  int   index;
+
+  /* a quoted string, a number, a tag name, or a condition tag and its
+   * argument.  A literal is compared as a number if it is one, quoted or
+   * not. */
+  if( parse->token == EXPR_TOK_STRING ) {
+    index = static_ae_expr_add( parse->expr, EXPR_LITERAL, -1, -1 );
+    node = &parse->expr->nodes[ index ];
+    node->text = static_ae_expr_token( parse );
+    node->number = strtod( node->text, &end );
+    node->is_number = ( *node->text != 0 && *end == 0 );
+    static_ae_expr_next( parse );
+    return index;
+  }
+
+  if( parse->token != EXPR_TOK_WORD ||
+      static_ae_expr_keyword( parse, "and" ) ||
+      static_ae_expr_keyword( parse, "or" ) ||
+      static_ae_expr_keyword( parse, "not" ) )
+  {
+    return -1;
+  }
+
+  text = static_ae_expr_token( parse );
+  static_ae_expr_next( parse );
+
+  if( parse->token == EXPR_TOK_OPEN ) {
+    static_ae_expr_next( parse );
+    if( parse->token != EXPR_TOK_WORD && parse->token != EXPR_TOK_STRING ) {
+      ae_free( text );
+      return -1;
+    }
+    index = static_ae_expr_add( parse->expr, EXPR_CALL, -1, -1 );
+    node = &parse->expr->nodes[ index ];
+    node->text = text;
+    node->arg = static_ae_expr_token( parse );
+    parse->expr->calls++;
+    static_ae_expr_next( parse );
+    if( parse->token != EXPR_TOK_CLOSE ) return -1;
+    static_ae_expr_next( parse );
+    return index;
+  }
+
+  index = static_ae_expr_add( parse->expr, EXPR_NAME, -1, -1 );
+  node = &parse->expr->nodes[ index ];
+  node->text = text;
+  if( ae_is_decimal( text, strlen( text ), &node->number ) ) {
+    node->op = EXPR_LITERAL;
+    node->is_number = 1;
+  }
+
+  return index;
+}
+
+static int static_ae_expr_calls( t_ae_generic_tag* tag, CONST char* text ) {
+  t_ae_expr* expr;
+  char* field;
+  int   owned;
+  int   calls;
+
+  /* returns non-zero if the IF_EXPR tag's expression uses a condition tag
+   * (or doesn't compile), and so may do anything */
+  field = ae_get_field( text, tag->m_delim, 1 );
+  if( field == NULL ) return 0;
+
+  expr = static_ae_expr_get( (t_ae_expr_tag*)tag, field, ae_field_len( field, tag->m_delim ), &owned );
+  calls = ( expr->calls > 0 || expr->count == 0 );
+  if( owned ) {
+    static_ae_expr_free( expr );
+  }
+
+  return calls;
+}
+
+static int static_ae_expr_true( t_ae_expr* expr, int node, t_ae_template_mgr mgr ) {
+  MGR_CAST( mgr_data, mgr );
+  t_ae_expr_node* item = &expr->nodes[ node ];
+  t_ae_condition_tag* check;
+  CONST char* left;
+  CONST char* right;
+  double left_number;
+  double right_number;
+  int    left_is_number;
+  int    right_is_number;
+  int    result;
+
+  switch( item->op ) {
+    case EXPR_OR:
+      return ( static_ae_expr_true( expr, item->left, mgr ) ||
+               static_ae_expr_true( expr, item->right, mgr ) );
+
+    case EXPR_AND:
+      return ( static_ae_expr_true( expr, item->left, mgr ) &&
+               static_ae_expr_true( expr, item->right, mgr ) );
+
+    case EXPR_NOT:
+      return !static_ae_expr_true( expr, item->left, mgr );
+
+    case EXPR_CALL:
+      /* what a check says can change without any tag changing */
+      if( mgr_data->m_deps != NULL ) {
+        mgr_data->m_deps->volatile_tags = 1;
+      }
+      check = (t_ae_condition_tag*)ae_get_tag( mgr, item->text );
+      if( check == NULL || check->process != static_ae_condition_process ) return 0;
+      return ( check->m_check( check->m_cookie, mgr, item->arg ) != 0 );
+
+    case EXPR_COMPARE:
+      left = static_ae_expr_value( expr, item->left, mgr, &left_number, &left_is_number );
+      right = static_ae_expr_value( expr, item->right, mgr, &right_number, &right_is_number );
+      if( left_is_number && right_is_number ) {
+        result = ( left_number < right_number ? -1 : ( left_number > right_number ? 1 : 0 ) );
+      } else {
+        result = strcmp( left, right );
+      }
+
+      switch( item->comp_type ) {
+        case COMP_TYPE_EQ: return ( result == 0 );
+        case COMP_TYPE_NE: return ( result != 0 );
+        case COMP_TYPE_LT: return ( result < 0 );
+        case COMP_TYPE_LE: return ( result <= 0 );
+        case COMP_TYPE_GT: return ( result > 0 );
+        case COMP_TYPE_GE: return ( result >= 0 );
+      }
+      return 0;
+
+    default:
+      left = static_ae_expr_value( expr, node, mgr, NULL, NULL );
+      return ( *left != 0 );
+  }
+}
+
+static CONST char* static_ae_expr_value( t_ae_expr* expr, int node, t_ae_template_mgr mgr,
+                                         double* number, int* is_number )
+{
+  t_ae_expr_node* item = &expr->nodes[ node ];
+  CONST char* value;
+  char* end;
+
+  /* returns the operand's value (a missing tag's being the empty string),
+   * and whether it is a number, if asked */
+  if( item->op == EXPR_LITERAL ) {
+    if( number != NULL ) {
+      *number = item->number;
+      *is_number = item->is_number;
+    }
+    return item->text;
+  }
+
+  value = ae_get_value( mgr, item->text );
+  if( value == NULL ) value = "";
+  if( number != NULL ) {
+    *number = strtod( value, &end );
+    *is_number = ( *value != 0 && *end == 0 );
+  }
+
+  return value;
+}
+
 static int static_html_preproc_fn( t_ae_template_mgr mgr, FILE* output ) {
   t_ae_html_proc_data* data;
   t_ae_cookie* cookie;
@@ -1625,8 +3668,27 @@ static int static_html_preproc_fn( t_ae_template_mgr mgr, FILE* output ) {
 
   data = (t_ae_html_proc_data*)ae_get_mgr_cookie( mgr );
 
+  /* a compressed page is rendered to a gzip stream, but its headers are not
+   * compressed */
+  if( data->gzip ) {
+    output = data->output;
+  }
+
   if( data->headers ) {
-    fputs( "Content-type: text/html\n", output );
+    if( data->not_modified ) {
+      fputs( "Status: 304 Not Modified\n", output );
+    } else {
+      fputs( "Content-type: text/html\n", output );
+    }
+    if( data->etag_value[ 0 ] != 0 ) {
+      fprintf( output, "ETag: %s\n", data->etag_value );
+    }
+    if( data->gzip ) {
+      if( !data->not_modified ) {
+        fputs( "Content-Encoding: gzip\n", output );
+      }
+      fputs( "Vary: Accept-Encoding\n", output );
+    }
     if( data->no_cache ) {
       fputs( "Pragma: no-cache\n", output );
       fputs( "Expires: Thu, 1 Jan 1970 00:00:01 GMT\n", output );
@@ -1656,6 +3718,164 @@ static int static_html_preproc_fn( t_ae_template_mgr mgr, FILE* output ) {
   return 0;
 }
 
+static int static_html_etag( t_ae_template_mgr mgr, t_ae_html_proc_data* data,
+                             CONST char* tem_file )
+{
+  MGR_CAST( mgr_data, mgr );
+  t_ae_references refs;
+  uint64_t hash = ETAG_BASIS;
+  int rc;
+  int i;
+
+  /* the validator is a hash of everything the page is made from: how it is
+   * encoded, escaped and split into tags, the template and the files it
+   * includes (by name, modification time and size), and the value of every
+   * tag and environment variable it reads.  Returns -1 if that is not
+   * enough to know the page -- if it runs commands, reads a tag that has no
+   * value (a custom tag or a row source) or a value tag of some other kind,
+   * includes files named by its rows, or has includes that might be served
+   * from somewhere other than the files. */
+
+  if( mgr_data->m_include != NULL ) return -1;
+  refs = ae_template_references( mgr, tem_file );
+  if( refs == NULL ) return -1;
+
+  static_html_etag_add( &hash, data->gzip ? "gzip" : "identity" );
+  static_html_etag_add( &hash, mgr_data->m_escape == AE_ESCAPE_HTML ? "html" :
+                               mgr_data->m_escape == AE_ESCAPE_JS ? "js" : "none" );
+  static_html_etag_add( &hash, mgr_data->m_tag_start );
+  static_html_etag_add( &hash, mgr_data->m_tag_end );
+  static_html_etag_add( &hash, mgr_data->m_tag_delimiter );
+
+  static_html_etag_add_file( &hash, tem_file );
+  rc = static_html_etag_add_refs( mgr, &hash, refs, 0 );
+  ae_references_free( refs );
+
+  /* render the hash as a strong entity tag */
+  for( i = 0; i < 16; i++ ) {
+    data->etag_value[ i + 1 ] = "0123456789abcdef"[ ( hash >> ( 60 - i * 4 ) ) & 0xf ];
+  }
+  data->etag_value[ 0 ] = '"';
+  data->etag_value[ 17 ] = '"';
+  data->etag_value[ 18 ] = 0;
+
+  return rc;
+}
+
+static int static_html_etag_add_refs( t_ae_template_mgr mgr, uint64_t* hash,
+                                      t_ae_references refs, int depth )
+{
+  t_ae_references included;
+  t_ae_generic_tag* tag;
+  CONST char** names;
+  CONST char* file;
+  int rc = 0;
+
+  /* hashes what a template (or a file it includes) refers to.  A named
+   * include tag's value is a file the page includes, so that file is hashed
+   * and examined in turn, as the template's own includes were. */
+  if( ae_references_runs( refs ) || ae_references_row_includes( refs ) ) return -1;
+
+  for( names = ae_references_files( refs ); *names != NULL; names++ ) {
+    static_html_etag_add_file( hash, *names );
+  }
+
+  for( names = ae_references_tags( refs ); *names != NULL && rc == 0; names++ ) {
+    tag = (t_ae_generic_tag*)ae_get_tag( mgr, *names );
+    static_html_etag_add( hash, *names );
+    static_html_etag_add( hash, tag != NULL ? ae_get_tag_value( (t_ae_tag)tag ) : NULL );
+    if( tag == NULL ) continue;
+
+    if( tag->type != TAG_TYPE_VALUE ) {
+      rc = -1;
+    } else if( tag->process == static_ae_include_tag_named_process ) {
+      file = ae_get_tag_value( (t_ae_tag)tag );
+      if( file == NULL || depth >= ETAG_MAX_DEPTH ) {
+        rc = -1;
+        continue;
+      }
+      static_html_etag_add_file( hash, file );
+      included = ae_template_references( mgr, file );
+      if( included != NULL ) {
+        rc = static_html_etag_add_refs( mgr, hash, included, depth+1 );
+        ae_references_free( included );
+      }
+    } else if( tag->process == static_ae_replace_tag_process ) {
+      if( ( (t_ae_replace_tag*)tag )->m_raw ) {
+        static_html_etag_add( hash, "raw" );
+      }
+    } else if( tag->process != static_ae_lazy_tag_process &&
+               tag->process != static_ae_cyclical_replace_tag_process )
+    {
+      rc = -1;
+    }
+  }
+
+  for( names = ae_references_env( refs ); *names != NULL; names++ ) {
+    static_html_etag_add( hash, *names );
+    static_html_etag_add( hash, getenv( *names ) );
+  }
+
+  return rc;
+}
+
+static void static_html_etag_add( uint64_t* hash, CONST char* text ) {
+  CONST unsigned char* p;
+
+  /* each string is marked and terminated, so that no two lists of strings
+   * run together the same way, and NULL is marked differently from any */
+  if( text == NULL ) {
+    *hash = ( *hash ^ 2 ) * ETAG_PRIME;
+    return;
+  }
+
+  *hash = ( *hash ^ 1 ) * ETAG_PRIME;
+  for( p = (CONST unsigned char*)text; ; p++ ) {
+    *hash = ( *hash ^ *p ) * ETAG_PRIME;
+    if( *p == 0 ) break;
+  }
+}
+
+static void static_html_etag_add_file( uint64_t* hash, CONST char* file ) {
+  struct stat info;
+  char buffer[ 64 ];
+
+  static_html_etag_add( hash, file );
+  if( stat( file, &info ) != 0 ) {
+    static_html_etag_add( hash, NULL );
+    return;
+  }
+
+  snprintf( buffer, sizeof( buffer ), "%ld:%ld:%ld",
+            (long)info.st_mtime, (long)info.st_size, (long)info.st_ino );
+  static_html_etag_add( hash, buffer );
+}
+
+static int static_html_etag_matches( CONST char* header, CONST char* etag ) {
+  CONST char* end;
+  size_t length = strlen( etag );
+
+  /* If-None-Match is "*" or a comma-separated list of entity tags, which
+   * are compared weakly (a W/ prefix is ignored) */
+  while( *header != 0 ) {
+    while( *header == ' ' || *header == '\t' || *header == ',' ) header++;
+    if( *header == '*' ) return 1;
+    if( strncmp( header, "W/", 2 ) == 0 ) header += 2;
+
+    if( *header == '"' ) {
+      end = strchr( header + 1, '"' );
+      if( end == NULL ) return 0;
+      if( (size_t)( end + 1 - header ) == length && strncmp( header, etag, length ) == 0 ) {
+        return 1;
+      }
+      header = end + 1;
+    }
+    while( *header != 0 && *header != ',' ) header++;
+  }
+
+  return 0;
+}
+
 
 static char* static_get_non_value( t_ae_tag tag ) {
   return NULL;
@@ -1666,3 +3886,1589 @@ static char* static_get_replace_tag_value( t_ae_tag tag ) {
   return tag_data->m_data;
 }
 
+static char* static_get_lazy_tag_value( t_ae_tag tag ) {
+  DECL_CAST( tag_data, tag, t_ae_lazy_tag );
+
+  /* the provider is called at most once until the tag is invalidated, even
+   * with parallel sections asking for the value at the same time */
+  pthread_mutex_lock( &tag_data->m_lock );
+  if( !tag_data->m_ready ) {
+    tag_data->m_data = tag_data->m_provider( tag_data->m_cookie, tag_data->m_tag );
+    tag_data->m_ready = 1;
+  }
+  pthread_mutex_unlock( &tag_data->m_lock );
+
+  return tag_data->m_data;
+}
+
+
+static void static_ae_render_enter( t_ae_mgr* mgr_data, FILE* output,
+                                    t_ae_render_frame* frame )
+{
+  frame->output = output;
+  frame->original_fd = -1;
+  frame->counted = NULL;
+  frame->limited = NULL;
+
+  /* allocations made while rendering are charged to this manager, and to
+   * this render if it's a top-level one */
+  frame->account = static_ae_account_enter( mgr_data );
+  if( mgr_data->recursive_depth < 1 ) {
+    memset( &mgr_data->m_alloc_last, 0, sizeof( t_ae_alloc_stats ) );
+  }
+
+  /* if a preprocessing function has been specified, use it */
+  if( mgr_data->recursive_depth < 1 && mgr_data->preproc != NULL ) {
+    frame->original_fd = ae_redirect_to( output, STDOUT_FILENO );
+    mgr_data->preproc( (t_ae_template_mgr)mgr_data, output );
+  }
+
+  /* a traced top-level render finds out where its events go */
+  if( mgr_data->recursive_depth < 1 ) {
+    mgr_data->m_trace = static_ae_trace_begin( mgr_data->m_tracer );
+  }
+
+  /* a top-level render of a manager with limits (or that can be cancelled)
+   * gets a budget, which lives in this frame, and writes through a stream
+   * that stops at its output limit, if it has one */
+  if( mgr_data->recursive_depth < 1 ) {
+    mgr_data->m_budget = NULL;
+    mgr_data->m_limit_reached = AE_LIMIT_NONE;
+    if( mgr_data->m_limited || mgr_data->m_cancellable ) {
+      memset( &frame->budget, 0, sizeof( t_ae_budget ) );
+      if( mgr_data->m_limits.max_ms > 0 ) {
+        frame->budget.deadline_ns = static_ae_now_ns() + mgr_data->m_limits.max_ms * 1000000L;
+      }
+      mgr_data->m_budget = &frame->budget;
+      mgr_data->m_budget_ticks = BUDGET_CLOCK_TICKS;
+      if( mgr_data->m_limits.max_output > 0 ) {
+        frame->limited = static_ae_counting_stream( output, mgr_data->m_limits.max_output,
+                                                    &frame->budget );
+        if( frame->limited != NULL ) frame->output = frame->limited;
+      }
+    }
+  }
+
+  /* start a new render in the profile, if profiling.  If the output can't
+   * be measured with ftell, the render writes through a counting stream. */
+  if( mgr_data->m_profile != NULL ) {
+    if( mgr_data->recursive_depth < 1 ) {
+      frame->counted = static_ae_profile_begin( mgr_data, frame->output );
+      if( frame->counted != NULL ) frame->output = frame->counted;
+    }
+    mgr_data->m_profile->last.streams++;
+    if( mgr_data->recursive_depth+1 > mgr_data->m_profile->last.max_depth ) {
+      mgr_data->m_profile->last.max_depth = mgr_data->recursive_depth+1;
+    }
+  }
+
+  /* increment the recursive depth */
+  mgr_data->recursive_depth++;
+}
+
+static void static_ae_render_leave( t_ae_mgr* mgr_data, t_ae_render_frame* frame ) {
+  /* decrement the recursive depth, as we are now leaving the render */
+  mgr_data->recursive_depth--;
+  if( mgr_data->recursive_depth < 1 ) {
+    if( mgr_data->m_profile != NULL ) {
+      static_ae_profile_end( mgr_data, frame->output, frame->counted );
+    }
+    if( mgr_data->m_budget != NULL ) {
+      if( frame->limited != NULL ) {
+        fclose( frame->limited );
+      }
+      mgr_data->m_limit_reached = frame->budget.reason;
+      mgr_data->m_budget = NULL;
+    }
+    if( mgr_data->m_trace != NULL ) {
+      static_ae_trace_end( mgr_data->m_trace );
+      mgr_data->m_trace = NULL;
+    }
+    ae_restore_file( frame->original_fd, stdout );
+  }
+  static_ae_account_leave( frame->account );
+}
+
+static int static_ae_budget_spent( t_ae_mgr* mgr_data, FILE* output ) {
+  t_ae_budget* budget = mgr_data->m_budget;
+
+  /* returns non-zero if the render has reached one of its limits, checking
+   * the depth every time and the clock every so often.  The other limits
+   * are checked where they are counted. */
+  if( __atomic_load_n( &budget->reason, __ATOMIC_RELAXED ) != AE_LIMIT_NONE ) {
+    return 1;
+  }
+  if( mgr_data->m_limits.max_depth > 0 &&
+      mgr_data->recursive_depth > mgr_data->m_limits.max_depth )
+  {
+    static_ae_budget_stop( budget, AE_LIMIT_DEPTH, output );
+  } else if( budget->deadline_ns != 0 && --mgr_data->m_budget_ticks <= 0 ) {
+    mgr_data->m_budget_ticks = BUDGET_CLOCK_TICKS;
+    if( static_ae_now_ns() >= budget->deadline_ns ) {
+      static_ae_budget_stop( budget, AE_LIMIT_TIME, output );
+    }
+  }
+
+  return ( __atomic_load_n( &budget->reason, __ATOMIC_RELAXED ) != AE_LIMIT_NONE );
+}
+
+static void static_ae_budget_stop( t_ae_budget* budget, int reason, FILE* output ) {
+  static CONST char* names[] = { "", "depth", "include", "output", "time", "loop", "" };
+
+  /* only the first limit reached stops the render, and says so */
+  if( __sync_bool_compare_and_swap( &budget->reason, AE_LIMIT_NONE, reason ) &&
+      output != NULL && reason != AE_LIMIT_OUTPUT && reason != AE_LIMIT_CANCELLED )
+  {
+    fprintf( output, "[%s limit exceeded]", names[ reason ] );
+  }
+}
+
+static void static_ae_exec_bounded( t_ae_mgr* mgr_data, CONST char* command, FILE* output ) {
+  struct pollfd ready;
+  char  buf[ 128 ];
+  long  remaining;
+  pid_t pid;
+  int   fds[ 2 ];
+  int   count;
+  int   status;
+
+  /* run the command as popen would, but in a process group of its own, and
+   * wait for its output no longer than the render has left.  If the render
+   * stops first, the command (and anything it started) is killed. */
+  if( pipe( fds ) != 0 ) {
+    fprintf( output, "[pipe failed: %d (%s)]", errno, strerror( errno ) );
+    return;
+  }
+  pid = fork();
+  if( pid < 0 ) {
+    fprintf( output, "[fork failed: %d (%s)]", errno, strerror( errno ) );
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+    return;
+  }
+  if( pid == 0 ) {
+    setpgid( 0, 0 );
+    dup2( fds[ 1 ], STDOUT_FILENO );
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+    execl( "/bin/sh", "sh", "-c", command, (char*)NULL );
+    _exit( 127 );
+  }
+  setpgid( pid, pid );
+  close( fds[ 1 ] );
+
+  ready.fd = fds[ 0 ];
+  ready.events = POLLIN;
+  for( ;; ) {
+    remaining = mgr_data->m_budget->deadline_ns - static_ae_now_ns();
+    if( remaining <= 0 ) {
+      static_ae_budget_stop( mgr_data->m_budget, AE_LIMIT_TIME, output );
+      break;
+    }
+    count = poll( &ready, 1, (int)( remaining / 1000000L ) + 1 );
+    if( count == 0 || ( count < 0 && errno == EINTR ) ) continue;
+    if( count < 0 ) break;
+
+    count = read( fds[ 0 ], buf, sizeof( buf ) );
+    if( count < 0 && errno == EINTR ) continue;
+    if( count <= 0 ) break;
+    fwrite( buf, 1, count, output );
+    if( static_ae_budget_spent( mgr_data, output ) ) break;
+  }
+  close( fds[ 0 ] );
+
+  if( mgr_data->m_budget->reason != AE_LIMIT_NONE ) {
+    kill( -pid, SIGKILL );
+  }
+  waitpid( pid, &status, 0 );
+}
+
+static int static_ae_repeat( t_ae_template_mgr mgr, CONST char* source,
+                             CONST char* token, CONST char* delim,
+                             int offset, int limit,
+                             CONST char* data, t_ae_body_fn body,
+                             void* cookie, FILE* output )
+{
+  t_ae_cyclical_replace_tag* repl_tag = NULL;
+  t_ae_tag rows;
+  CONST char* list;
+  char* fields[ 2 ];
+  char  row_num_tag[32];
+  char  row_count_tag[32];
+  char  row_num_value[12];
+  int   row;
+  int   partial;
+  int   read = 0;
+  int   i;
+
+  /* if the source is a row source, each row's value for the token comes from its
+   * callback.  Otherwise create a new cyclical replace tag from the delimited
+   * string associated with this repeat tag (a source with no value repeats no
+   * rows), and add it to the manager */
+
+  rows = ae_get_tag( mgr, source );
+  if( ae_is_row_source( rows ) ) {
+    fields[ 0 ] = (char*)token;
+    fields[ 1 ] = NULL;
+  } else {
+    rows = NULL;
+    list = ae_get_value( mgr, source );
+    repl_tag = ae_cyclical_replace_tag( token, ( list != NULL ? list : "" ), delim );
+    ae_add_tag_ex( mgr, repl_tag );
+  }
+
+  /* look for the first available row_num tag name.  By default, we use ae_row_num, but
+   * if it is taken then that means that we are currently embedded inside of a repeat tag.
+   * So, we add a number to the end of the tag name and try again.  This continues until
+   * a number is found that is not taken.  This allows repeat tags to be nested to an
+   * arbitrary depth. */
+
+  i = 1;
+  strcpy( row_num_tag, ROW_NUM_TAG_NAME );
+  while( ae_get_tag( mgr, row_num_tag ) != NULL ) {
+    i++;
+    sprintf( row_num_tag, ROW_NUM_TAG_NAME "_%d", i );
+  }
+
+  /* the number of rows in a list is known before the first is rendered, and goes
+   * in a row-count tag named to match the row-number tag */
+  if( i == 1 ) {
+    strcpy( row_count_tag, ROW_COUNT_TAG_NAME );
+  } else {
+    sprintf( row_count_tag, ROW_COUNT_TAG_NAME "_%d", i );
+  }
+  if( repl_tag != NULL ) {
+    ae_add_tag_i( mgr, row_count_tag, repl_tag->m_count );
+  } else {
+    ae_remove_tag( mgr, row_count_tag );
+  }
+
+  /* start at the offset: a list goes straight to it, and a row source has to be
+   * read up to it (without rendering anything) */
+  if( rows != NULL ) {
+    for( i = 0; i < offset; i++ ) {
+      if( ae_next_row( mgr, rows, fields ) <= 0 ) {
+        limit = 0;
+        break;
+      }
+      read++;
+    }
+  } else if( offset > repl_tag->m_count ) {
+    ae_cyclical_seek( repl_tag, repl_tag->m_count );
+    repl_tag->m_partial = 0;
+  } else {
+    ae_cyclical_seek( repl_tag, offset );
+  }
+  
+  /* repeatedly process the data (or the compiled body) for the repeat tag, until the
+   * cyclical replace tag is out of data.  Each pass through the data, we increment the
+   * row num and set it in the row_num_tag variable (row numbers count from the
+   * start of the list, not the offset).  A list whose last item isn't terminated
+   * gets one more pass, in which the token reports it. */
+
+  i = offset + 1;
+  for( ;; ) {
+    if( limit >= 0 && i > offset + limit ) break;
+    if( rows != NULL ) {
+      if( ae_next_row( mgr, rows, fields ) <= 0 ) break;
+      read++;
+    } else if( repl_tag->m_row >= repl_tag->m_count && !repl_tag->m_partial ) {
+      break;
+    }
+    if( !ae_next_iteration( mgr, output ) ) break;
+    snprintf( row_num_value, sizeof( row_num_value ), "%d", i );
+    ae_add_tag( mgr, row_num_tag, row_num_value );
+    if( repl_tag != NULL ) {
+      row = repl_tag->m_row;
+      partial = repl_tag->m_partial;
+    }
+    if( body != NULL ) {
+      body( cookie, mgr, output );
+    } else {
+      ae_process_buffer( mgr, data, output );
+    }
+
+    /* a pass that never used the token still uses up a row */
+    if( repl_tag != NULL && repl_tag->m_row == row && repl_tag->m_partial == partial ) {
+      if( row < repl_tag->m_count ) {
+        repl_tag->m_row++;
+      } else {
+        repl_tag->m_partial = 0;
+      }
+    }
+    i++;
+  }
+
+  /* remove the row_num_tag and the cyclical replace tag (or the token the row
+   * source set) from the manager.  A row source's count is only known once it
+   * has run out, so it is set now, and left for what follows the repeat */
+  ae_remove_tag( mgr, row_num_tag );
+  if( rows != NULL ) {
+    ae_remove_tag( mgr, token );
+    ae_add_tag_i( mgr, row_count_tag, read );
+  } else {
+    ae_remove_tag( mgr, row_count_tag );
+    ae_remove_tag_ex( mgr, repl_tag );
+  }
+
+  return 1;
+}
+
+static int static_ae_call_compiled( void* cookie, t_ae_template_mgr mgr, FILE* output ) {
+  t_ae_compiled_fn* render = (t_ae_compiled_fn*)cookie;
+  return (*render)( mgr, output );
+}
+
+static int static_ae_find_tag( t_ae_mgr* mgr_data, CONST char* text,
+                               char** start, char** end )
+{
+  char* last_start;
+  int   start_delim_len;
+  int   end_delim_len;
+
+  /* locate the next complete tag in 'text'.  On return, 'start' points at the
+   * starting delimiter and 'end' at the matching ending delimiter.  The return
+   * value is 1 if a tag was found, 0 if there are no more tags, and -1 if a tag
+   * was opened but never closed (in which case only 'start' is valid). */
+
+  start_delim_len = strlen( mgr_data->m_tag_start );
+  end_delim_len = strlen( mgr_data->m_tag_end );
+
+  *start = strstr( text, mgr_data->m_tag_start );
+  if( *start == NULL ) return 0;
+
+  /* find the next end-token */
+  *end = strstr( *start + start_delim_len, mgr_data->m_tag_end );
+  if( *end == NULL ) return -1;
+
+  /* skip past nested tags, by looking for start-tags that begin after the current
+   * start position, but before the next end-token. That is to say, if the tag delimiters
+   * are <% and %>:
+   *   <%   <%   <%  %>   %>       %>
+   *   ^    ^        ^
+   *   | last_start  |
+   *   start         end
+   * Here, start is the first start-token found, and end is the first end-token found.
+   * Nested tags are detected because last_start exists between start and end. */
+
+  last_start = strstr( *start + start_delim_len, mgr_data->m_tag_start );
+  while( last_start != NULL && last_start < *end ) {
+    /* We've found a nested token, so we skip it by looking for the next 'last_start' tag
+     * AND the next 'end' tag, and we continue the loop if the last_start tag is before the
+     * end tag.  In other words:
+     *   End of Iteration #1  <%   <%   <%  %>   %>       %>
+     *                        S         L        E
+     *   End of Iteration #2  <%   <%   <%  %>   %>       %>
+     *                        S                           E   ... L
+     * Thus, by the end of iteration #2, last_start is either NULL or after E, which
+     * means that the stretch of data from S to E completely contains all tags within
+     * it, with no tags overlapping the ends of S-E. */
+
+    *end = strstr( *end + end_delim_len, mgr_data->m_tag_end );
+    if( *end == NULL ) return -1;
+    last_start = strstr( last_start + start_delim_len, mgr_data->m_tag_start );
+  }
+
+  return 1;
+}
+
+static int static_ae_dispatch( t_ae_mgr* mgr_data, CONST char* text, FILE* output ) {
+  t_ae_tag_list* item;
+  t_ae_mgr* layer;
+  char matched[ TAG_NAME_MAX ];
+  int  rc = 0;
+
+  /* each of these does what the ones after it do as well: a profiled
+   * render may be traced and recorded, and a traced one recorded.  Only
+   * they copy the name of the tag that applies the text, which the tag__end
+   * probe is given, so the traced path is taken (untraced) while something
+   * is attached to that probe. */
+  AE_PROBE1( tag__start, text );
+  matched[ 0 ] = 0;
+  if( mgr_data->m_profile != NULL ) {
+    rc = static_ae_dispatch_profiled( mgr_data, text, output, matched );
+  } else if( mgr_data->m_trace != NULL || AE_PROBE_ENABLED( tag__end ) ) {
+    rc = static_ae_dispatch_traced( mgr_data, text, output, matched );
+  } else if( mgr_data->m_deps != NULL ) {
+    rc = static_ae_dispatch_recorded( mgr_data, text, output );
+  } else {
+    /* look for the first tag that can apply the given tag text.  Each tag contains
+     * the logic it needs to recognize itself at the head of a chunk of text.
+     * An overlay's own tags are tried before its base's. */
+    FOR_EACH_TAG( mgr_data, layer, item ) {
+      if( item->tag->apply( item->tag, text, (t_ae_template_mgr)mgr_data, output ) ) {
+        rc = 1;
+        break;
+      }
+    }
+  }
+  AE_PROBE3( tag__end, text, matched, rc );
+
+  return rc;
+}
+
+static int static_ae_process_parallel( t_ae_mgr* mgr_data, char* data, FILE* output ) {
+  t_ae_section_pool pool;
+  t_ae_section* sections;
+  t_ae_section* section;
+  pthread_t* threads;
+  char* text;
+  char* start;
+  char* end;
+  int   count;
+  int   alloced;
+  int   started;
+  int   jobs;
+  int   rc;
+  int   i;
+  int   j;
+  int   k;
+
+  /* split the document into sections, one per top-level tag.  Each section
+   * remembers the literal text that precedes it, and whether its tag can be
+   * rendered off the calling thread (SECTION_PARALLEL), on the calling thread
+   * alongside the workers (SECTION_SERIAL), or only once every worker has
+   * finished (SECTION_BARRIER). */
+
+  alloced = 16;
+  count = 0;
+  sections = (t_ae_section*)ae_malloc( alloced * sizeof( t_ae_section ) );
+
+  text = data;
+  while( ( rc = static_ae_find_tag( mgr_data, text, &start, &end ) ) > 0 ) {
+    if( count == alloced ) {
+      alloced *= 2;
+      sections = (t_ae_section*)ae_realloc( sections, alloced * sizeof( t_ae_section ) );
+    }
+    section = &sections[ count++ ];
+
+    *start = 0;
+    *end = 0;
+    section->literal = text;
+    section->text = start + strlen( mgr_data->m_tag_start );
+    section->started = 0;
+    section->done = 0;
+    section->buffer = NULL;
+    section->length = 0;
+    section->file = NULL;
+    section->contents = NULL;
+    section->kind = static_ae_section_kind( mgr_data, section->text, 0, section );
+
+    text = end + strlen( mgr_data->m_tag_end );
+  }
+
+  threads = (pthread_t*)ae_malloc( mgr_data->m_workers * sizeof( pthread_t ) );
+  pool.mgr = mgr_data;
+  pool.sections = sections;
+  pthread_mutex_init( &pool.lock, NULL );
+  pthread_cond_init( &pool.cond, NULL );
+
+  /* work through the document one window at a time, where a window ends at the
+   * next barrier.  The parallel sections of a window are handed to the worker
+   * pool, and then the window is written out in document order, waiting on
+   * each parallel section as it is reached.  By the time the barrier is
+   * processed, every worker has finished and the manager is ours again. */
+
+  for( i = 0; i < count; i = j + 1 ) {
+    jobs = 0;
+    for( j = i; j < count && sections[ j ].kind != SECTION_BARRIER; j++ ) {
+      if( sections[ j ].kind == SECTION_PARALLEL ) jobs++;
+    }
+
+    pool.first = i;
+    pool.last = j;
+    pool.next = i;
+
+    /* the workers render with a copy of the manager record made now, while
+     * nothing else is running: the calling thread goes on writing to the
+     * record itself (its depth and budget) as it renders serial sections */
+    pool.shadow = *mgr_data;
+    pool.shadow.recursive_depth = 1;
+    pool.shadow.m_workers = 0;
+    pool.shadow.m_profile = NULL;
+
+    started = 0;
+    if( jobs > 1 ) {
+      for( k = 0; k < mgr_data->m_workers && k < jobs; k++ ) {
+        if( pthread_create( &threads[ started ], NULL, static_ae_section_worker, &pool ) == 0 ) {
+          started++;
+        }
+      }
+    }
+
+    for( k = i; k < j; k++ ) {
+      section = &sections[ k ];
+      fputs( section->literal, output );
+
+      if( section->kind != SECTION_PARALLEL ) {
+        static_ae_dispatch( mgr_data, section->text, output );
+        continue;
+      }
+
+      /* if no worker has picked this section up yet, render it right here
+       * rather than waiting for one to get around to it */
+      pthread_mutex_lock( &pool.lock );
+      if( !section->started ) {
+        section->started = 1;
+        pthread_mutex_unlock( &pool.lock );
+        mgr_data->m_preload_file = section->file;
+        mgr_data->m_preload_text = section->contents;
+        static_ae_dispatch( mgr_data, section->text, output );
+        mgr_data->m_preload_file = NULL;
+        mgr_data->m_preload_text = NULL;
+        continue;
+      }
+      while( !section->done ) {
+        pthread_cond_wait( &pool.cond, &pool.lock );
+      }
+      pthread_mutex_unlock( &pool.lock );
+
+      fwrite( section->buffer, 1, section->length, output );
+      free( section->buffer );
+    }
+
+    for( k = 0; k < started; k++ ) {
+      pthread_join( threads[ k ], NULL );
+    }
+
+    if( j < count ) {
+      fputs( sections[ j ].literal, output );
+      static_ae_dispatch( mgr_data, sections[ j ].text, output );
+    }
+  }
+
+  pthread_cond_destroy( &pool.cond );
+  pthread_mutex_destroy( &pool.lock );
+  for( k = 0; k < count; k++ ) {
+    ae_free( sections[ k ].file );
+    ae_free( sections[ k ].contents );
+  }
+  ae_free( threads );
+  ae_free( sections );
+
+  /* write whatever follows the last tag, up to an unclosed tag if there is one */
+  if( rc < 0 ) {
+    *start = 0;
+  }
+  fputs( text, output );
+  if( rc < 0 ) {
+    fputs( "[unclosed tag]", output );
+  }
+
+  return rc;
+}
+
+static void* static_ae_section_worker( void* arg ) {
+  t_ae_section_pool* pool = (t_ae_section_pool*)arg;
+  t_ae_section* section;
+  t_ae_mgr* account;
+
+  for( ;; ) {
+    /* claim the next parallel section in the window that nobody has started */
+    pthread_mutex_lock( &pool->lock );
+    while( pool->next < pool->last &&
+           ( pool->sections[ pool->next ].kind != SECTION_PARALLEL ||
+             pool->sections[ pool->next ].started ) )
+    {
+      pool->next++;
+    }
+    if( pool->next >= pool->last ) {
+      pthread_mutex_unlock( &pool->lock );
+      break;
+    }
+    section = &pool->sections[ pool->next++ ];
+    section->started = 1;
+    pthread_mutex_unlock( &pool->lock );
+
+    /* what the section allocates is charged to the manager it renders for,
+     * as it would be on the calling thread */
+    account = static_ae_account_enter( pool->mgr );
+    static_ae_render_section( &pool->shadow, section );
+    static_ae_account_leave( account );
+
+    pthread_mutex_lock( &pool->lock );
+    section->done = 1;
+    pthread_cond_broadcast( &pool->cond );
+    pthread_mutex_unlock( &pool->lock );
+  }
+
+  return NULL;
+}
+
+static void static_ae_render_section( t_ae_mgr* shadow, t_ae_section* section ) {
+  t_ae_mgr copy;
+  FILE* output;
+
+  /* sections are rendered against a private copy of the pool's shadow of the
+   * manager record, which nobody writes once the workers start.  The copy
+   * shares the (read-only, for the duration of the window) tag list, but has
+   * its own recursion depth and budget ticks, so the workers never write to
+   * the real manager, or to each other's.  The depth starts at one so that
+   * the preprocessor is not re-run and stdout is not redirected from a
+   * worker. */
+
+  copy = *shadow;
+  copy.m_preload_file = section->file;
+  copy.m_preload_text = section->contents;
+
+  output = open_memstream( &section->buffer, &section->length );
+  if( output == NULL ) {
+    section->buffer = NULL;
+    section->length = 0;
+    return;
+  }
+  static_ae_dispatch( &copy, section->text, output );
+  fclose( output );
+}
+
+static int static_ae_claim_tag( t_ae_mgr* mgr_data, CONST char* text,
+                                t_ae_generic_tag** claimant )
+{
+  t_ae_tag_list* item;
+  t_ae_mgr* layer;
+
+  /* work out which tag would apply the given text, without actually applying
+   * it.  This only works for the apply methods defined in this module; if a tag
+   * with any other apply method is reached first, we can't tell whether it
+   * would claim the text, and return 0.  Otherwise 'claimant' is set to the
+   * tag (or NULL, if no tag would claim it) and we return 1. */
+
+  *claimant = NULL;
+  FOR_EACH_TAG( mgr_data, layer, item ) {
+    switch( static_ae_tag_recognises( item->tag, text ) ) {
+      case 0:
+        continue;
+      case 1:
+        *claimant = item->tag;
+        return 1;
+      default:
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int static_ae_tag_recognises( t_ae_generic_tag* tag, CONST char* text ) {
+  /* returns 1 if the given tag would recognise the text (and so call its
+   * process method), 0 if it would not, and -1 if it has an apply method we
+   * know nothing about. */
+
+  if( tag->apply == static_ae_typed_tag_apply ) {
+    return ( ae_field_cmp( text, tag->m_tag, tag->m_delim ) == 0 );
+  } else if( tag->apply == static_ae_replace_tag_apply ) {
+    return ( strcmp( tag->m_tag, text ) == 0 );
+  } else if( tag->apply == static_ae_shared_fn_apply ) {
+    return ( ae_field_cmp( text, "EXEC_SHARED", tag->m_delim ) == 0 &&
+             ae_field_cmp( ae_get_field( text, tag->m_delim, 1 ), tag->m_tag, tag->m_delim ) == 0 );
+  }
+
+  return -1;
+}
+
+static int static_ae_section_kind( t_ae_mgr* mgr_data, CONST char* text, int depth,
+                                  t_ae_section* section )
+{
+  t_ae_generic_tag* tag;
+  t_ae_stream stream;
+  char* file;
+  char* tok;
+  char* contents;
+  int   size;
+  int   pure;
+
+  /* a section may only leave the calling thread if nothing it does can change
+   * the manager: no tag that adds or removes tags (REPEAT2, STRUCT), no cyclical
+   * replace tags (applying one moves it along), no shared functions (they write
+   * to stdout, which is shared by every thread) and no custom tags, since we
+   * cannot know what they do.  INCLUDE and EXEC are the sections worth moving
+   * off the calling thread; the IF family, ENV and plain replace tags are safe to
+   * run alongside them.  A top-level include that may move keeps the contents
+   * it was judged by in 'section', so that it renders those and not whatever
+   * the file holds by then. */
+
+  if( depth > SECTION_MAX_DEPTH ) return SECTION_BARRIER;
+  if( !static_ae_claim_tag( mgr_data, text, &tag ) ) return SECTION_BARRIER;
+  if( tag == NULL ) return SECTION_SERIAL;
+
+  if( tag->process == static_ae_exec_tag_process ) {
+    return SECTION_PARALLEL;
+  }
+
+  if( tag->process == static_ae_include_tag_process ||
+      tag->process == static_ae_include_tag_named_process )
+  {
+    /* an include is only as pure as the file it includes, named just as the
+     * tag will name it */
+    if( tag->process == static_ae_include_tag_process ) {
+      tok = ae_get_field( text, tag->m_delim, 1 );
+      file = ( ae_get_tag( mgr_data, tok ) != NULL ? ae_get_value( mgr_data, tok ) : tok );
+    } else {
+      file = ae_get_tag_value( tag );
+    }
+
+    /* if an include function is set, the file on disk may not be what gets
+     * included, so don't look at it */
+    pure = 0;
+    stream = ( file != NULL && mgr_data->m_include == NULL ? ae_stream_open_file( file ) : NULL );
+    if( stream != NULL ) {
+      size = ae_stream_get_length( stream );
+      contents = (char*)ae_malloc( size+1 );
+      size = ae_stream_read( stream, contents, size );
+      contents[ size > 0 ? size : 0 ] = 0;
+      ae_stream_close( stream );
+      pure = static_ae_text_is_pure( mgr_data, contents, depth+1 );
+      if( pure && section != NULL ) {
+        section->file = ae_strdup( file );
+        section->contents = contents;
+      } else {
+        ae_free( contents );
+      }
+    }
+
+    return ( pure ? SECTION_PARALLEL : SECTION_BARRIER );
+  }
+
+  if( tag->process == static_ae_replace_tag_process ||
+      tag->process == static_ae_if_tag_process ||
+      tag->process == static_ae_if_not_tag_process ||
+      tag->process == static_ae_comparison_tag_process ||
+      tag->process == static_ae_env_tag_process ||
+      ( tag->process == static_ae_if_expr_tag_process && !static_ae_expr_calls( tag, text ) ) )
+  {
+    /* these are pure themselves, but may have tags nested in their text */
+    return ( static_ae_text_is_pure( mgr_data, text, depth+1 ) ? SECTION_SERIAL : SECTION_BARRIER );
+  }
+
+  return SECTION_BARRIER;
+}
+
+static int static_ae_text_is_pure( t_ae_mgr* mgr_data, CONST char* text, int depth ) {
+  char* start;
+  char* end;
+  char* tag_text;
+  int   start_delim_len;
+  int   kind;
+  int   rc;
+
+  /* text is pure if every tag at its top level is (the nested ones are checked
+   * as each of those tags is examined) */
+
+  start_delim_len = strlen( mgr_data->m_tag_start );
+  while( ( rc = static_ae_find_tag( mgr_data, text, &start, &end ) ) > 0 ) {
+    start += start_delim_len;
+    tag_text = (char*)ae_malloc( end - start + 1 );
+    memcpy( tag_text, start, end - start );
+    tag_text[ end - start ] = 0;
+
+    kind = static_ae_section_kind( mgr_data, tag_text, depth, NULL );
+    ae_free( tag_text );
+    if( kind == SECTION_BARRIER ) return 0;
+
+    text = end + strlen( mgr_data->m_tag_end );
+  }
+
+  return ( rc == 0 );
+}
+
+static int static_ae_dispatch_profiled( t_ae_mgr* mgr_data, CONST char* text, FILE* output,
+                                       char* matched )
+{
+  t_ae_profile* profile = mgr_data->m_profile;
+  t_ae_prof_entry* entry;
+  t_ae_tag_list* item;
+  t_ae_mgr* layer;
+  t_ae_generic_tag* tag;
+  t_ae_tag_fn process;
+  long start;
+  long elapsed;
+  long pos;
+  long end_pos;
+  int  recognised;
+  int  rc;
+
+  /* as static_ae_dispatch, but rather than calling each tag's apply method we
+   * check whether the tag recognises the text ourselves, so that the call to
+   * its process method can be timed on its own.  The tag that applies the
+   * text is traced, and noted as a dependency, as it would be unprofiled,
+   * and its name is copied to 'matched'. */
+
+  FOR_EACH_TAG( mgr_data, layer, item ) {
+    tag = item->tag;
+    entry = static_ae_profile_entry( profile, tag->m_tag );
+    entry->last.attempts++;
+
+    recognised = static_ae_tag_recognises( tag, text );
+    if( recognised == 0 ) continue;
+    if( mgr_data->m_deps != NULL ) {
+      static_ae_deps_note( mgr_data, tag, recognised );
+    }
+
+    /* remember the process method now; the tag may be replaced (and so
+     * destroyed) by the time processing finishes */
+    process = tag->process;
+
+    /* open a frame to collect the time spent in nested tags */
+    if( ++profile->frame >= profile->frames ) {
+      profile->frames *= 2;
+      profile->child_ns = (long*)ae_realloc( profile->child_ns, profile->frames * sizeof( long ) );
+    }
+    profile->child_ns[ profile->frame ] = 0;
+
+    pos = ftell( output );
+    start = static_ae_now_ns();
+    if( recognised > 0 ) {
+      rc = tag->process( (t_ae_tag)tag, text, (t_ae_template_mgr)mgr_data, output );
+    } else {
+      rc = tag->apply( (t_ae_tag)tag, text, (t_ae_template_mgr)mgr_data, output );
+    }
+    elapsed = static_ae_now_ns() - start;
+    end_pos = ftell( output );
+
+    entry->last.inclusive_ns += elapsed;
+    entry->last.exclusive_ns += elapsed - profile->child_ns[ profile->frame ];
+    if( pos >= 0 && end_pos >= pos ) {
+      entry->last.bytes += end_pos - pos;
+    }
+    profile->frame--;
+    profile->child_ns[ profile->frame ] += elapsed;
+
+    if( recognised > 0 || rc ) {
+      entry->last.calls++;
+      if( process == static_ae_include_tag_process ||
+          process == static_ae_include_tag_named_process )
+      {
+        profile->last.includes++;
+      } else if( process == static_ae_exec_tag_process ||
+                 process == static_ae_shared_fn_process )
+      {
+        profile->last.execs++;
+      }
+    }
+
+    if( rc ) {
+      entry->last.matches++;
+      strncpy( matched, entry->last.name, TAG_NAME_MAX-1 );
+      matched[ TAG_NAME_MAX-1 ] = 0;
+      if( mgr_data->m_trace != NULL ) {
+        static_ae_trace_span( mgr_data, "tag", entry->last.name, start, "text", text );
+      }
+      if( mgr_data->m_deps != NULL ) {
+        static_ae_deps_applied( mgr_data, recognised );
+      }
+      return 1;
+    }
+  }
+
+  if( mgr_data->m_deps != NULL ) {
+    static_ae_deps_add( mgr_data->m_deps, text );
+  }
+  return 0;
+}
+
+static t_ae_prof_entry* static_ae_profile_entry( t_ae_profile* profile, CONST char* name ) {
+  t_ae_prof_entry* entry;
+  unsigned int hash;
+  CONST char* p;
+
+  hash = 2166136261u;
+  for( p = name; *p; p++ ) {
+    hash = ( hash ^ (unsigned char)*p ) * 16777619u;
+  }
+  hash %= PROFILE_BUCKETS;
+
+  for( entry = profile->buckets[ hash ]; entry != NULL; entry = entry->next ) {
+    if( strcmp( entry->total.name, name ) == 0 ) return entry;
+  }
+
+  /* first time we've seen this name; entries are kept in the order they were
+   * first seen, as well as in the hash table */
+  entry = (t_ae_prof_entry*)ae_malloc( sizeof( t_ae_prof_entry ) );
+  memset( entry, 0, sizeof( t_ae_prof_entry ) );
+  entry->total.name = entry->last.name = ae_strdup( name );
+  entry->next = profile->buckets[ hash ];
+  profile->buckets[ hash ] = entry;
+
+  if( profile->count == profile->alloced ) {
+    profile->alloced = ( profile->alloced ? profile->alloced * 2 : 32 );
+    profile->entries = (t_ae_prof_entry**)ae_realloc( profile->entries,
+                                                   profile->alloced * sizeof( t_ae_prof_entry* ) );
+  }
+  profile->entries[ profile->count++ ] = entry;
+
+  return entry;
+}
+
+static FILE* static_ae_profile_begin( t_ae_mgr* mgr_data, FILE* output ) {
+  t_ae_profile* profile = mgr_data->m_profile;
+  FILE* counted = NULL;
+  int i;
+
+  /* clear the statistics for the last render */
+  for( i = 0; i < profile->count; i++ ) {
+    memset( &profile->entries[ i ]->last, 0, sizeof( t_ae_tag_stats ) );
+    profile->entries[ i ]->last.name = profile->entries[ i ]->total.name;
+  }
+  memset( &profile->last, 0, sizeof( t_ae_render_stats ) );
+  profile->last.renders = 1;
+  profile->frame = 0;
+  profile->child_ns[ 0 ] = 0;
+
+  profile->start_pos = ftell( output );
+  if( profile->start_pos < 0 ) {
+    counted = static_ae_counting_stream( output, 0, NULL );
+    if( counted != NULL ) profile->start_pos = 0;
+  }
+  profile->start_ns = static_ae_now_ns();
+
+  return counted;
+}
+
+static void static_ae_profile_end( t_ae_mgr* mgr_data, FILE* output, FILE* counted ) {
+  t_ae_profile* profile = mgr_data->m_profile;
+  long pos;
+  int i;
+
+  profile->last.elapsed_ns = static_ae_now_ns() - profile->start_ns;
+
+  pos = ftell( output );
+  if( counted != NULL ) {
+    fclose( counted );
+  }
+  profile->last.bytes = ( profile->start_pos >= 0 && pos >= profile->start_pos ?
+                          pos - profile->start_pos : -1 );
+
+  /* add this render to the running totals */
+  for( i = 0; i < profile->count; i++ ) {
+    static_ae_profile_add( &profile->entries[ i ]->total, &profile->entries[ i ]->last );
+  }
+  profile->total.renders += profile->last.renders;
+  profile->total.streams += profile->last.streams;
+  profile->total.includes += profile->last.includes;
+  profile->total.execs += profile->last.execs;
+  profile->total.elapsed_ns += profile->last.elapsed_ns;
+  if( profile->last.bytes > 0 ) {
+    profile->total.bytes += profile->last.bytes;
+  }
+  if( profile->last.max_depth > profile->total.max_depth ) {
+    profile->total.max_depth = profile->last.max_depth;
+  }
+}
+
+static FILE* static_ae_measure_begin( t_ae_measure* measure, FILE* output ) {
+  /* the bytes written are found as the profiler finds them: from the
+   * output's position if it has one, or else by writing through a stream
+   * that counts them */
+  measure->counted = NULL;
+  measure->bytes = -1;
+  measure->start_pos = ftell( output );
+  if( measure->start_pos < 0 ) {
+    measure->counted = static_ae_counting_stream( output, 0, NULL );
+    if( measure->counted != NULL ) {
+      measure->start_pos = 0;
+      output = measure->counted;
+    }
+  }
+  measure->start_ns = static_ae_now_ns();
+
+  return output;
+}
+
+static void static_ae_measure_end( t_ae_measure* measure, FILE* output ) {
+  long pos;
+
+  pos = ftell( output );
+  if( measure->counted != NULL ) {
+    fclose( measure->counted );
+  }
+  if( measure->start_pos >= 0 && pos >= measure->start_pos ) {
+    measure->bytes = pos - measure->start_pos;
+  }
+}
+
+static void static_ae_profile_add( t_ae_tag_stats* total, t_ae_tag_stats* last ) {
+  total->attempts += last->attempts;
+  total->calls += last->calls;
+  total->matches += last->matches;
+  total->inclusive_ns += last->inclusive_ns;
+  total->exclusive_ns += last->exclusive_ns;
+  total->bytes += last->bytes;
+}
+
+static long static_ae_now_ns( void ) {
+  struct timespec now;
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (long)now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static int static_ae_dispatch_traced( t_ae_mgr* mgr_data, CONST char* text, FILE* output,
+                                      char* matched )
+{
+  t_ae_tag_list* item;
+  t_ae_mgr* layer;
+  long  start = 0;
+  int   recognised;
+
+  /* as static_ae_dispatch, timing the tag that applies the text, if the
+   * render is traced (and noting it as a dependency, if it is recorded).
+   * Its name is copied to 'matched' first, since it may be replaced (and
+   * so destroyed) by the time it finishes; if no tag applies the text,
+   * 'matched' is left empty. */
+  FOR_EACH_TAG( mgr_data, layer, item ) {
+    recognised = static_ae_tag_recognises( item->tag, text );
+    if( recognised == 0 ) continue;
+    if( mgr_data->m_deps != NULL ) {
+      static_ae_deps_note( mgr_data, item->tag, recognised );
+    }
+
+    strncpy( matched, item->tag->m_tag, TAG_NAME_MAX-1 );
+    matched[ TAG_NAME_MAX-1 ] = 0;
+    if( mgr_data->m_trace != NULL ) {
+      start = static_ae_now_ns();
+    }
+    if( item->tag->apply( item->tag, text, (t_ae_template_mgr)mgr_data, output ) ) {
+      if( mgr_data->m_trace != NULL ) {
+        static_ae_trace_span( mgr_data, "tag", matched, start, "text", text );
+      }
+      if( mgr_data->m_deps != NULL ) {
+        static_ae_deps_applied( mgr_data, recognised );
+      }
+      return 1;
+    }
+  }
+
+  matched[ 0 ] = 0;
+  if( mgr_data->m_deps != NULL ) {
+    static_ae_deps_add( mgr_data->m_deps, text );
+  }
+  return 0;
+}
+
+static t_ae_trace_out* static_ae_trace_begin( t_ae_tracer_data* tracer ) {
+  t_ae_trace_out* out;
+  char* name;
+  long  render;
+
+  /* returns where a top-level render's events go, opening the render's own
+   * file if the tracer has one per render */
+  if( tracer == NULL ) return NULL;
+  if( tracer->mode == AE_TRACE_PROCESS ) return &tracer->out;
+
+  render = __sync_add_and_fetch( &tracer->renders, 1 );
+  name = (char*)ae_malloc( strlen( tracer->path ) + 48 );
+  sprintf( name, "%s.%d.%ld.json", tracer->path, (int)getpid(), render );
+
+  out = NEW( t_ae_trace_out );
+  out->file = fopen( name, "w" );
+  out->events = 0;
+  out->own = 1;
+  ae_free( name );
+  if( out->file == NULL ) {
+    ae_free( out );
+    return NULL;
+  }
+  fputs( "[\n", out->file );
+
+  return out;
+}
+
+static void static_ae_trace_end( t_ae_trace_out* out ) {
+  if( out->own ) {
+    fputs( "\n]\n", out->file );
+    fclose( out->file );
+    ae_free( out );
+  }
+}
+
+static void static_ae_trace_span( t_ae_mgr* mgr_data, CONST char* cat, CONST char* name,
+                                  long start_ns, CONST char* arg_name, CONST char* arg )
+{
+  t_ae_trace_out* out = mgr_data->m_trace;
+  char  value[ TRACE_ARG_MAX + 1 ];
+  long  end_ns;
+
+  /* write a complete ("X") event for a span that started at 'start_ns' and
+   * ends now.  Times are in microseconds.  The file is locked for the
+   * event, since the sections of a parallel render trace at once. */
+  end_ns = static_ae_now_ns();
+  if( static_trace_tid == 0 ) {
+    static_trace_tid = __sync_add_and_fetch( &static_trace_threads, 1 );
+  }
+
+  flockfile( out->file );
+  fputs( ( __sync_fetch_and_add( &out->events, 1 ) > 0 ? ",\n{\"name\":\"" : "{\"name\":\"" ), out->file );
+  static_ae_write_json_string( name, out->file );
+  fprintf( out->file, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%ld.%03ld,\"dur\":%ld.%03ld,"
+                      "\"pid\":%d,\"tid\":%d",
+           cat, start_ns / 1000, start_ns % 1000,
+           ( end_ns - start_ns ) / 1000, ( end_ns - start_ns ) % 1000,
+           (int)getpid(), static_trace_tid );
+  if( arg_name != NULL && arg != NULL ) {
+    strncpy( value, arg, TRACE_ARG_MAX );
+    value[ TRACE_ARG_MAX ] = 0;
+    fprintf( out->file, ",\"args\":{\"%s\":\"", arg_name );
+    static_ae_write_json_string( value, out->file );
+    fputs( "\"}", out->file );
+  }
+  fputs( "}", out->file );
+  funlockfile( out->file );
+}
+
+static void static_ae_write_json_string( CONST char* text, FILE* output ) {
+  for( ; *text; text++ ) {
+    switch( *text ) {
+      case '"':  fputs( "\\\"", output ); break;
+      case '\\': fputs( "\\\\", output ); break;
+      case '\n': fputs( "\\n", output ); break;
+      case '\r': fputs( "\\r", output ); break;
+      case '\t': fputs( "\\t", output ); break;
+      default:
+        if( (unsigned char)*text < 0x20 ) {
+          fprintf( output, "\\u%04x", (unsigned char)*text );
+        } else {
+          fputc( *text, output );
+        }
+    }
+  }
+}
+
+#if defined( linux )
+
+  /* a counting stream passes everything written to it straight through to
+   * another stream, keeping count of the bytes as it goes.  The count is
+   * reported as the stream's position, so ftell works on it.  Each block is
+   * flushed through to the underlying stream, so that anything written
+   * directly to the underlying file descriptor (by a shared function, say)
+   * still comes out in the right order. */
+
+static ssize_t static_ae_counting_write( void* cookie, CONST char* buffer, size_t size ) {
+  t_ae_counting_cookie* counter = (t_ae_counting_cookie*)cookie;
+  size_t written;
+  size_t room;
+
+  /* a stream with a limit writes up to it, then stops the render and drops
+   * the rest (as though it had been written, so the stream stays good) */
+  if( counter->limit > 0 && counter->count + (long)size > counter->limit ) {
+    room = counter->limit - counter->count;
+    written = fwrite( buffer, 1, room, counter->output );
+    fflush( counter->output );
+    counter->count += written;
+    static_ae_budget_stop( counter->budget, AE_LIMIT_OUTPUT, NULL );
+    return size;
+  }
+
+  written = fwrite( buffer, 1, size, counter->output );
+  fflush( counter->output );
+  counter->count += written;
+  /* a cookie write function reports an error by writing nothing */
+  return (ssize_t)written;
+}
+
+static int static_ae_counting_seek( void* cookie, off64_t* offset, int whence ) {
+  t_ae_counting_cookie* counter = (t_ae_counting_cookie*)cookie;
+
+  if( whence != SEEK_CUR || *offset != 0 ) return -1;
+  *offset = counter->count;
+  return 0;
+}
+
+static int static_ae_counting_close( void* cookie ) {
+  ae_free( cookie );
+  return 0;
+}
+
+static FILE* static_ae_counting_stream( FILE* output, long limit, t_ae_budget* budget ) {
+  cookie_io_functions_t functions;
+  t_ae_counting_cookie* counter;
+  FILE* stream;
+
+  counter = (t_ae_counting_cookie*)ae_malloc( sizeof( t_ae_counting_cookie ) );
+  counter->output = output;
+  counter->count = 0;
+  counter->limit = limit;
+  counter->budget = budget;
+
+  functions.read = NULL;
+  functions.write = static_ae_counting_write;
+  functions.seek = static_ae_counting_seek;
+  functions.close = static_ae_counting_close;
+
+  stream = fopencookie( counter, "w", functions );
+  if( stream == NULL ) {
+    ae_free( counter );
+  }
+  return stream;
+}
+
+#else
+
+static FILE* static_ae_counting_stream( FILE* output, long limit, t_ae_budget* budget ) {
+  return NULL;
+}
+
+#endif
+
+static CONST char* static_ae_escape_char( char c, int mode ) {
+  /* returns what the character is written as in the given mode, or NULL if
+   * it is written as itself */
+  if( mode == AE_ESCAPE_JS ) {
+    switch( c ) {
+      case '\'': return "\\'";
+      case '"':  return "\\\"";
+      case '\\': return "\\\\";
+      case '\n': return "\\n";
+      case '\r': return "\\r";
+      case '\t': return "\\t";
+    }
+  } else {
+    switch( c ) {
+      case '<':  return "&lt;";
+      case '>':  return "&gt;";
+      case '&':  return "&amp;";
+      case '"':  return "&quot;";
+      case '\'': return "&#39;";
+    }
+  }
+
+  return NULL;
+}
+
+static void static_ae_write_escaped( CONST char* text, size_t length, int mode, FILE* output ) {
+  CONST char* run;
+  CONST char* end;
+  CONST char* escaped;
+
+  /* characters that need no escaping are written a run at a time */
+  end = text + length;
+  for( run = text; text < end; text++ ) {
+    escaped = static_ae_escape_char( *text, mode );
+    if( escaped != NULL ) {
+      fwrite( run, 1, text - run, output );
+      fputs( escaped, output );
+      run = text + 1;
+    }
+  }
+  fwrite( run, 1, text - run, output );
+}
+
+static t_ae_escaped* static_ae_escape_copy( CONST char* text, int mode ) {
+  t_ae_escaped* escaped;
+  CONST char* p;
+  CONST char* replacement;
+  size_t length = 0;
+  char*  q;
+
+  /* measure the escaped text, then write it */
+  for( p = text; *p; p++ ) {
+    replacement = static_ae_escape_char( *p, mode );
+    length += ( replacement != NULL ? strlen( replacement ) : 1 );
+  }
+
+  escaped = (t_ae_escaped*)ae_malloc( sizeof( t_ae_escaped ) + length );
+  escaped->length = length;
+  q = escaped->text;
+  for( p = text; *p; p++ ) {
+    replacement = static_ae_escape_char( *p, mode );
+    if( replacement != NULL ) {
+      strcpy( q, replacement );
+      q += strlen( replacement );
+    } else {
+      *q++ = *p;
+    }
+  }
+  *q = 0;
+
+  return escaped;
+}
+
+static t_ae_tag_list* static_ae_next_item( t_ae_mgr** layer, t_ae_tag_list* item ) {
+  /* returns the tag list item after 'item' (or the first, if 'item' is
+   * NULL), moving 'layer' on to the base of an overlay whose own tags are
+   * exhausted.  See FOR_EACH_TAG. */
+  item = ( item == NULL ? (*layer)->m_taglist_head : item->next );
+  while( item == NULL && (*layer)->m_base != NULL ) {
+    *layer = (*layer)->m_base;
+    item = (*layer)->m_taglist_head;
+  }
+
+  return item;
+}
+
+static void static_ae_make_shared_tags( void ) {
+  t_ae_mgr* account;
+  int i;
+
+  /* the shared tags belong to no manager */
+  account = static_ae_account_enter( NULL );
+  for( i = 0; static_standard_tags[i] != NULL; i++ ) {
+    static_shared_tags[i] = (t_ae_generic_tag*)static_standard_tags[i]();
+  }
+  static_shared_tags[i] = NULL;
+  static_ae_account_leave( account );
+}
+
+static int static_ae_is_shared_tag( t_ae_generic_tag* tag ) {
+  int i;
+
+  for( i = 0; static_shared_tags[i] != NULL; i++ ) {
+    if( static_shared_tags[i] == tag ) return 1;
+  }
+
+  return 0;
+}
+
+static t_ae_mgr* static_ae_account_enter( t_ae_mgr* mgr_data ) {
+  t_ae_mgr* previous;
+
+  /* charge allocations on this thread to the given manager (or to none)
+   * until the matching static_ae_account_leave */
+  if( !static_alloc_accounting ) return NULL;
+  previous = static_alloc_mgr;
+  static_alloc_mgr = mgr_data;
+  return previous;
+}
+
+static void static_ae_account_leave( t_ae_mgr* previous ) {
+  if( !static_alloc_accounting ) return;
+  static_alloc_mgr = previous;
+}
+
+static void static_ae_account( t_ae_alloc_stats* stats, long allocs, long frees,
+                               long bytes, long live )
+{
+  long peak;
+  long now;
+
+  if( stats == NULL ) {
+    static_ae_account( &static_alloc_stats, allocs, frees, bytes, live );
+    if( static_alloc_mgr != NULL ) {
+      static_ae_account( &static_alloc_mgr->m_alloc_total, allocs, frees, bytes, live );
+      if( static_alloc_mgr->recursive_depth > 0 ) {
+        static_ae_account( &static_alloc_mgr->m_alloc_last, allocs, frees, bytes, live );
+      }
+    }
+    return;
+  }
+
+  /* the process-wide counts may be updated from several threads at once, and
+   * so may a manager's, by the workers rendering its parallel sections */
+  __sync_fetch_and_add( &stats->allocs, allocs );
+  __sync_fetch_and_add( &stats->frees, frees );
+  __sync_fetch_and_add( &stats->bytes, bytes );
+  now = __sync_add_and_fetch( &stats->live_bytes, live );
+  peak = stats->peak_bytes;
+  while( now > peak && !__sync_bool_compare_and_swap( &stats->peak_bytes, peak, now ) ) {
+    peak = stats->peak_bytes;
+  }
+}
+
+static int static_ae_dispatch_recorded( t_ae_mgr* mgr_data, CONST char* text, FILE* output ) {
+  t_ae_tag_list* item;
+  t_ae_mgr* layer;
+  t_ae_generic_tag* tag;
+  int recognised;
+
+  /* as static_ae_dispatch, but noting the tag that applies the text as a
+   * dependency */
+
+  FOR_EACH_TAG( mgr_data, layer, item ) {
+    tag = item->tag;
+    recognised = static_ae_tag_recognises( tag, text );
+    if( recognised == 0 ) continue;
+
+    static_ae_deps_note( mgr_data, tag, recognised );
+    if( tag->apply( (t_ae_tag)tag, text, (t_ae_template_mgr)mgr_data, output ) ) {
+      static_ae_deps_applied( mgr_data, recognised );
+      return 1;
+    }
+  }
+
+  /* nothing applied the text, which would change if a tag named by it were
+   * added */
+  static_ae_deps_add( mgr_data->m_deps, text );
+  return 0;
+}
+
+static void static_ae_deps_note( t_ae_mgr* mgr_data, t_ae_generic_tag* tag, int recognised ) {
+  /* note a tag about to be applied as a dependency (before applying it: a
+   * tag may replace itself), and whether its output could change with no
+   * tag changing at all */
+  if( recognised > 0 ) {
+    static_ae_deps_add( mgr_data->m_deps, tag->m_tag );
+    if( tag->process == static_ae_env_tag_process ||
+        tag->process == static_ae_exec_tag_process ||
+        tag->apply == static_ae_shared_fn_apply )
+    {
+      mgr_data->m_deps->volatile_tags = 1;
+    }
+  }
+}
+
+static void static_ae_deps_applied( t_ae_mgr* mgr_data, int recognised ) {
+  /* there's no telling what a custom tag depends on */
+  if( recognised < 0 ) {
+    mgr_data->m_deps->volatile_tags = 1;
+  }
+}
+
+static t_ae_record static_ae_record( t_ae_mgr* mgr_data, char* data, FILE* output ) {
+  t_ae_record_data* record;
+  t_ae_region* region;
+  int   alloced = 0;
+  char* text;
+  char* start;
+  char* end;
+  int   start_delim_len;
+  int   end_delim_len;
+  int   rc;
+
+  record = (t_ae_record_data*)ae_malloc( sizeof( t_ae_record_data ) );
+  memset( record, 0, sizeof( t_ae_record_data ) );
+  record->data = data;
+
+  /* split the template into regions, one per top-level tag, each with the
+   * literal text before it, terminating each piece in place */
+  start_delim_len = strlen( mgr_data->m_tag_start );
+  end_delim_len = strlen( mgr_data->m_tag_end );
+  text = data;
+  while( ( rc = static_ae_find_tag( mgr_data, text, &start, &end ) ) > 0 ) {
+    if( record->count == alloced ) {
+      alloced = ( alloced ? alloced * 2 : 16 );
+      record->regions = (t_ae_region*)ae_realloc( record->regions, alloced * sizeof( t_ae_region ) );
+    }
+    region = &record->regions[ record->count++ ];
+    memset( region, 0, sizeof( t_ae_region ) );
+
+    *start = 0;
+    *end = 0;
+    region->literal = text;
+    region->text = start + start_delim_len;
+    text = end + end_delim_len;
+  }
+
+  /* anything from an unclosed tag on is dropped, as ae_process_stream
+   * drops it */
+  if( rc < 0 ) {
+    *start = 0;
+  }
+  record->tail = text;
+  record->rc = rc;
+
+  ae_rerender( record, (t_ae_template_mgr)mgr_data, NULL, output );
+
+  return record;
+}
+
+static void static_ae_record_write( t_ae_mgr* mgr_data, t_ae_record_data* record,
+                                    char** changed, FILE* output )
+{
+  t_ae_region* region;
+  t_ae_deps* outer;
+  FILE* buffer_output;
+  int   i;
+
+  record->rendered = 0;
+  for( i = 0; i < record->count; i++ ) {
+    region = &record->regions[ i ];
+    fputs( region->literal, output );
+
+    if( region->output != NULL && changed != NULL &&
+        !region->deps.volatile_tags && !static_ae_deps_match( &region->deps, changed ) )
+    {
+      fwrite( region->output, 1, region->length, output );
+      continue;
+    }
+
+    /* render the region again, into a buffer of its own, noting what it
+     * depends on this time */
+    free( region->output );
+    region->output = NULL;
+    region->length = 0;
+    static_ae_deps_clear( &region->deps );
+    record->rendered++;
+
+    outer = mgr_data->m_deps;
+    mgr_data->m_deps = &region->deps;
+    buffer_output = open_memstream( &region->output, &region->length );
+    if( buffer_output != NULL ) {
+      static_ae_dispatch( mgr_data, region->text, buffer_output );
+      fclose( buffer_output );
+      fwrite( region->output, 1, region->length, output );
+    } else {
+      /* without a buffer, the region can only be rendered every time */
+      region->output = NULL;
+      region->deps.volatile_tags = 1;
+      static_ae_dispatch( mgr_data, region->text, output );
+    }
+    mgr_data->m_deps = outer;
+  }
+
+  fputs( record->tail, output );
+  if( record->rc < 0 ) {
+    fputs( "[unclosed tag]", output );
+  }
+}
+
+static void static_ae_deps_add( t_ae_deps* deps, CONST char* name ) {
+  int i;
+
+  for( i = 0; i < deps->count; i++ ) {
+    if( strcmp( deps->names[ i ], name ) == 0 ) return;
+  }
+  if( deps->count == deps->alloced ) {
+    deps->alloced = ( deps->alloced ? deps->alloced * 2 : 8 );
+    deps->names = (char**)ae_realloc( deps->names, deps->alloced * sizeof( char* ) );
+  }
+  deps->names[ deps->count++ ] = ae_strdup( name );
+}
+
+static int static_ae_deps_match( t_ae_deps* deps, char** changed ) {
+  int i;
+  int j;
+
+  for( i = 0; changed[ i ] != NULL; i++ ) {
+    for( j = 0; j < deps->count; j++ ) {
+      if( strcmp( deps->names[ j ], changed[ i ] ) == 0 ) return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void static_ae_deps_clear( t_ae_deps* deps ) {
+  int i;
+
+  for( i = 0; i < deps->count; i++ ) {
+    ae_free( deps->names[ i ] );
+  }
+  ae_free( deps->names );
+  memset( deps, 0, sizeof( t_ae_deps ) );
+}
+
+static int static_ae_slice_value( t_ae_template_mgr mgr, CONST char* field,
+                                  CONST char* delim, int* value )
+{
+  CONST char* text;
+  char  name[ 64 ];
+  int   length;
+  int   i;
+
+  /* an offset or limit is a number, or the name of a tag whose value is one */
+  length = ae_field_len( field, delim );
+  if( length == 0 || length >= (int)sizeof( name ) ) return 0;
+  memcpy( name, field, length );
+  name[ length ] = 0;
+
+  text = name;
+  for( i = 0; i < length && isdigit( (unsigned char)name[ i ] ); i++ );
+  if( i < length ) {
+    text = ae_get_value( mgr, name );
+    if( text == NULL || *text == 0 ) return 0;
+    for( i = 0; text[ i ] != 0 && isdigit( (unsigned char)text[ i ] ); i++ );
+    if( text[ i ] != 0 ) return 0;
+  }
+
+  *value = atoi( text );
+  return 1;
+}
@@ -0,0 +1,157 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Bundle Compiler
+ *
+ * description:
+ * Writes the given template files, and every file under the given
+ * directories, into a single bundle (see include/bundle.h).  Templates are
+ * stored under the path they were found at, so run this from the directory
+ * the application renders from, naming the templates the way its INCLUDE
+ * tags and ae_bundle_process calls do.  Files and directories whose names
+ * begin with '.' are skipped.  With -m, the templates' literal text is
+ * minified first (see include/minify.h).
+ *
+ * usage:
+ *   ae_bundle [-s start-delim] [-e end-delim] [-m] -o output.bundle path ...
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bundle.h"
+#include "minify.h"
+
+/* ------------------------------------------------------------------------- */
+/* type definitions                                                          */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+  char** files;
+  int    count;
+  int    alloced;
+} t_file_list;
+
+/* ------------------------------------------------------------------------- */
+/* file collection                                                           */
+/* ------------------------------------------------------------------------- */
+
+static void add_file( t_file_list* list, CONST char* path ) {
+  if( list->count == list->alloced ) {
+    list->alloced = ( list->alloced ? list->alloced * 2 : 64 );
+    list->files = (char**)ae_realloc( list->files, list->alloced * sizeof( char* ) );
+  }
+  list->files[ list->count++ ] = ae_strdup( path );
+}
+
+static int add_path( t_file_list* list, CONST char* path ) {
+  struct stat info;
+  struct dirent* item;
+  DIR*  dir;
+  char* child;
+  int   rc = 0;
+
+  if( stat( path, &info ) != 0 ) {
+    perror( path );
+    return -1;
+  }
+
+  if( !S_ISDIR( info.st_mode ) ) {
+    add_file( list, path );
+    return 0;
+  }
+
+  dir = opendir( path );
+  if( dir == NULL ) {
+    perror( path );
+    return -1;
+  }
+  while( ( item = readdir( dir ) ) != NULL ) {
+    if( item->d_name[ 0 ] == '.' ) continue;
+
+    child = (char*)ae_malloc( strlen( path ) + strlen( item->d_name ) + 2 );
+    if( strcmp( path, "." ) == 0 ) {
+      strcpy( child, item->d_name );
+    } else {
+      sprintf( child, "%s%s%s", path, ( path[ strlen( path )-1 ] == '/' ? "" : "/" ), item->d_name );
+    }
+    if( add_path( list, child ) != 0 ) rc = -1;
+    ae_free( child );
+  }
+  closedir( dir );
+
+  return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* main                                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void usage( void ) {
+  fprintf( stderr, "usage: ae_bundle [-s start-delim] [-e end-delim] [-m] -o output.bundle path ...\n" );
+  exit( 2 );
+}
+
+int main( int argc, char** argv ) {
+  t_ae_template_mgr mgr;
+  t_file_list list;
+  CONST char* start_delim = NULL;
+  CONST char* end_delim = NULL;
+  CONST char* output_name = NULL;
+  FILE* output;
+  int   rc = 0;
+  int   minify = 0;
+  int   i;
+
+  for( i = 1; i < argc && argv[ i ][ 0 ] == '-'; i++ ) {
+    if( argv[ i ][ 1 ] == 0 || argv[ i ][ 2 ] != 0 ) usage();
+    if( argv[ i ][ 1 ] == 'm' ) {
+      minify = 1;
+      continue;
+    }
+    if( i+1 >= argc ) usage();
+    switch( argv[ i ][ 1 ] ) {
+      case 's': start_delim = argv[ ++i ]; break;
+      case 'e': end_delim = argv[ ++i ]; break;
+      case 'o': output_name = argv[ ++i ]; break;
+      default: usage();
+    }
+  }
+  if( i >= argc || output_name == NULL ) usage();
+
+  memset( &list, 0, sizeof( list ) );
+  for( ; i < argc; i++ ) {
+    if( add_path( &list, argv[ i ] ) != 0 ) rc = 1;
+  }
+  if( rc != 0 ) return rc;
+
+  mgr = ae_template_mgr_new();
+  if( start_delim != NULL || end_delim != NULL ) {
+    ae_set_start_end_delim( mgr,
+                            start_delim ? start_delim : "<!--%",
+                            end_delim ? end_delim : "%-->" );
+  }
+  ae_set_minify( mgr, minify );
+
+  output = fopen( output_name, "wb" );
+  if( output == NULL ) {
+    perror( output_name );
+    return 1;
+  }
+  if( ae_bundle_write( mgr, list.files, list.count, output ) != 0 ) {
+    fprintf( stderr, "ae_bundle: could not write %s\n", output_name );
+    rc = 1;
+  }
+  if( fclose( output ) != 0 ) rc = 1;
+  if( rc != 0 ) remove( output_name );
+
+  for( i = 0; i < list.count; i++ ) {
+    ae_free( list.files[ i ] );
+  }
+  ae_free( list.files );
+  ae_template_mgr_done( mgr );
+
+  return rc;
+}
@@ -0,0 +1,533 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Template Compiler
+ *
+ * description:
+ * Reads one or more template files and writes a C source file containing
+ * one render function per template:
+ *
+ *   int name( t_ae_template_mgr mgr, FILE* output );
+ *
+ * which is run with ae_process_compiled( mgr, name, output ).  Templates are
+ * split into tags using the library's own scanner, so the output is the
+ * same as the interpreter's for the same manager:
+ *
+ *   - literal text is kept in static const arrays and written with fwrite
+ *   - IF, IF_NOT and the IF_xx comparisons become if-statements around
+ *     their (compiled) data
+ *   - INCLUDE, REPEAT2, ESCAPE-HTML and ESCAPE-JS become calls into the
+ *     library with the fields already split out; the data of a REPEAT2 or
+ *     ESCAPE tag becomes a function of its own
+ *   - every other tag (replace tags, ENV, EXEC, STRUCT, custom tags) is
+ *     handed to the manager's tags at runtime with ae_dispatch_tag
+ *
+ * The function name is "tem_" followed by the template's file name, less
+ * its extension, with anything that isn't a letter or digit changed to
+ * '_'.  With -n, a single template may be given a name of its own.  With
+ * -H, a header declaring the render functions is written as well.  With
+ * -m, the templates' literal text is minified first (see include/minify.h).
+ *
+ * usage:
+ *   ae_compile [-s start-delim] [-e end-delim] [-n name] [-o output.c]
+ *              [-H header.h] [-m] template ...
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "templates.h"
+#include "minify.h"
+
+/* ------------------------------------------------------------------------- */
+/* type definitions                                                          */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+  t_ae_template_mgr mgr;
+  CONST char*       delim;
+  int               start_len;
+  int               end_len;
+  CONST char*       name;
+  FILE*             decls;
+  FILE*             funcs;
+  int               next_text;
+  int               next_body;
+  int               uses[ 3 ];
+} t_compiler;
+
+typedef struct {
+  CONST char* type;
+  CONST char* test;
+} t_comparison;
+
+/* ------------------------------------------------------------------------- */
+/* static data                                                               */
+/* ------------------------------------------------------------------------- */
+
+static t_comparison static_comparisons[] = {
+  { "IF_EQ",     "== 0" },
+  { "IF_NOT_EQ", "!= 0" },
+  { "IF_LT",     "< 0" },
+  { "IF_LE",     "<= 0" },
+  { "IF_GT",     "> 0" },
+  { "IF_GE",     ">= 0" },
+  { NULL,        NULL }
+};
+
+#define HELPER_IS_SET   ( 0 )
+#define HELPER_COMPARE  ( 1 )
+#define HELPER_INCLUDE  ( 2 )
+
+  /* written at the top of the generated file, if the code uses them */
+static CONST char* static_helpers[] = {
+  "static int static_ae_is_set( t_ae_template_mgr mgr, CONST char* name ) {\n"
+  "  char* value = ae_get_value( mgr, name );\n"
+  "  return ( value && *value );\n"
+  "}\n"
+  "\n",
+
+  "static int static_ae_compare( t_ae_template_mgr mgr, CONST char* name, CONST char* value ) {\n"
+  "  char* actual = ae_get_value( mgr, name );\n"
+  "  return strcmp( actual ? actual : \"\", value );\n"
+  "}\n"
+  "\n",
+
+  "static void static_ae_include( t_ae_template_mgr mgr, CONST char* file, FILE* output ) {\n"
+  "  if( ae_get_tag( mgr, file ) != NULL ) {\n"
+  "    file = ae_get_value( mgr, file );\n"
+  "  }\n"
+  "  ae_process_include( mgr, file, output );\n"
+  "}\n"
+  "\n"
+};
+
+/* ------------------------------------------------------------------------- */
+/* output helpers                                                            */
+/* ------------------------------------------------------------------------- */
+
+static void indent( FILE* output, int depth ) {
+  while( depth-- > 0 ) fputs( "  ", output );
+}
+
+static void write_string( FILE* output, CONST char* text, int length, int wrap ) {
+  int column = 0;
+  int i;
+
+  /* write 'text' as a C string literal, breaking it into several adjacent
+   * literals after newlines and long runs when 'wrap' is set */
+  fputc( '"', output );
+  for( i = 0; i < length; i++ ) {
+    unsigned char c = (unsigned char)text[ i ];
+
+    switch( c ) {
+      case '\\': fputs( "\\\\", output ); column += 2; break;
+      case '"':  fputs( "\\\"", output ); column += 2; break;
+      case '\n': fputs( "\\n", output );  column += 2; break;
+      case '\t': fputs( "\\t", output );  column += 2; break;
+      case '\r': fputs( "\\r", output );  column += 2; break;
+      case '?':
+        /* avoid writing a trigraph */
+        if( i > 0 && text[ i-1 ] == '?' ) {
+          fputs( "\\?", output );
+          column += 2;
+        } else {
+          fputc( c, output );
+          column++;
+        }
+        break;
+      default:
+        if( c < 32 || c >= 127 ) {
+          fprintf( output, "\\%03o", c );
+          column += 4;
+        } else {
+          fputc( c, output );
+          column++;
+        }
+    }
+
+    if( wrap && i+1 < length && ( c == '\n' || column >= 72 ) ) {
+      fputs( "\"\n  \"", output );
+      column = 0;
+    }
+  }
+  fputc( '"', output );
+}
+
+static void write_field( FILE* output, CONST char* field, CONST char* delim ) {
+  write_string( output, field, ae_field_len( field, delim ), 0 );
+}
+
+/* ------------------------------------------------------------------------- */
+/* code generation                                                           */
+/* ------------------------------------------------------------------------- */
+
+static int compile_text( t_compiler* compiler, char* text, FILE* output, int depth );
+
+static void compile_literal( t_compiler* compiler, CONST char* text, FILE* output, int depth ) {
+  int length;
+  int id;
+
+  length = strlen( text );
+  if( length == 0 ) return;
+
+  id = ++compiler->next_text;
+  fprintf( compiler->decls, "static CONST char static_%s_text_%d[] =\n  ", compiler->name, id );
+  write_string( compiler->decls, text, length, 1 );
+  fputs( ";\n", compiler->decls );
+
+  indent( output, depth );
+  fprintf( output, "fwrite( static_%s_text_%d, 1, sizeof( static_%s_text_%d ) - 1, output );\n",
+           compiler->name, id, compiler->name, id );
+}
+
+static int compile_body( t_compiler* compiler, char* text ) {
+  FILE*  output;
+  char*  buffer = NULL;
+  size_t length = 0;
+  int    id;
+  int    rc;
+
+  /* the data of a REPEAT2 or ESCAPE tag is called through a function pointer,
+   * so it gets a function of its own */
+  id = ++compiler->next_body;
+  fprintf( compiler->decls, "static int static_%s_body_%d( t_ae_template_mgr mgr, FILE* output );\n",
+           compiler->name, id );
+
+  output = open_memstream( &buffer, &length );
+  fprintf( output, "static int static_%s_body_%d( t_ae_template_mgr mgr, FILE* output ) {\n",
+           compiler->name, id );
+  rc = compile_text( compiler, text, output, 1 );
+  fprintf( output, "  return %d;\n}\n\n", ( rc < 0 ? -1 : 0 ) );
+  fclose( output );
+
+  fputs( buffer, compiler->funcs );
+  free( buffer );
+
+  return id;
+}
+
+static void compile_dispatch( CONST char* text, FILE* output, int depth ) {
+  indent( output, depth );
+  fputs( "ae_dispatch_tag( mgr, ", output );
+  write_string( output, text, strlen( text ), 0 );
+  fputs( ", output );\n", output );
+}
+
+static void compile_tag( t_compiler* compiler, char* text, FILE* output, int depth ) {
+  CONST char* delim = compiler->delim;
+  char* type;
+  char* f1;
+  char* f2;
+  char* f3;
+  char* f4;
+  int   i;
+  int   id;
+
+  type = ae_get_field( text, delim, 0 );
+  f1 = ae_get_field( text, delim, 1 );
+  f2 = ( f1 ? ae_get_field( text, delim, 2 ) : NULL );
+  f3 = ( f2 ? ae_get_field( text, delim, 3 ) : NULL );
+  f4 = ( f3 ? ae_get_field( text, delim, 4 ) : NULL );
+
+  /* IF=tok=data and IF_NOT=tok=data.  The interpreter copies 'tok' into a
+   * 64 byte buffer, so longer names are left to it. */
+  if( ( ae_field_cmp( type, "IF", delim ) == 0 || ae_field_cmp( type, "IF_NOT", delim ) == 0 )
+      && f2 != NULL && ae_field_len( f1, delim ) < 64 )
+  {
+    compiler->uses[ HELPER_IS_SET ] = 1;
+    indent( output, depth );
+    fprintf( output, "if( %sstatic_ae_is_set( mgr, ",
+             ( ae_field_cmp( type, "IF", delim ) == 0 ? "" : "!" ) );
+    write_field( output, f1, delim );
+    fputs( " ) ) {\n", output );
+    compile_text( compiler, f2, output, depth+1 );
+    indent( output, depth );
+    fputs( "}\n", output );
+    return;
+  }
+
+  /* IF_xx=tok=value=data */
+  for( i = 0; static_comparisons[ i ].type != NULL; i++ ) {
+    if( ae_field_cmp( type, static_comparisons[ i ].type, delim ) == 0 && f3 != NULL ) {
+      compiler->uses[ HELPER_COMPARE ] = 1;
+      indent( output, depth );
+      fputs( "if( static_ae_compare( mgr, ", output );
+      write_field( output, f1, delim );
+      fputs( ", ", output );
+      write_field( output, f2, delim );
+      fprintf( output, " ) %s ) {\n", static_comparisons[ i ].test );
+      compile_text( compiler, f3, output, depth+1 );
+      indent( output, depth );
+      fputs( "}\n", output );
+      return;
+    }
+  }
+
+  /* INCLUDE=tok, where 'tok' is the rest of the tag */
+  if( ae_field_cmp( type, "INCLUDE", delim ) == 0 && f1 != NULL ) {
+    compiler->uses[ HELPER_INCLUDE ] = 1;
+    indent( output, depth );
+    fputs( "static_ae_include( mgr, ", output );
+    write_string( output, f1, strlen( f1 ), 0 );
+    fputs( ", output );\n", output );
+    return;
+  }
+
+  /* REPEAT2=source=newtok=delim=data */
+  if( ae_field_cmp( type, "REPEAT2", delim ) == 0 && f4 != NULL ) {
+    id = compile_body( compiler, f4 );
+    indent( output, depth );
+    fputs( "ae_repeat_compiled( mgr, ", output );
+    write_field( output, f1, delim );
+    fputs( ", ", output );
+    write_field( output, f2, delim );
+    fputs( ", ", output );
+    write_field( output, f3, delim );
+    fprintf( output, ", static_%s_body_%d, output );\n", compiler->name, id );
+    return;
+  }
+
+  /* ESCAPE-HTML=data and ESCAPE-JS=data */
+  if( ( ae_field_cmp( type, "ESCAPE-HTML", delim ) == 0 || ae_field_cmp( type, "ESCAPE-JS", delim ) == 0 )
+      && f1 != NULL )
+  {
+    id = compile_body( compiler, f1 );
+    indent( output, depth );
+    fprintf( output, "ae_escape_compiled( mgr, static_%s_body_%d, %s, output );\n",
+             compiler->name, id,
+             ( ae_field_cmp( type, "ESCAPE-JS", delim ) == 0 ? "AE_ESCAPE_JS" : "AE_ESCAPE_HTML" ) );
+    return;
+  }
+
+  /* anything else is up to the manager's tags at runtime */
+  compile_dispatch( text, output, depth );
+}
+
+static int compile_text( t_compiler* compiler, char* text, FILE* output, int depth ) {
+  char* start;
+  char* end;
+  int   rc;
+
+  /* this is the same loop as ae_process_stream, writing code instead of output */
+  while( ( rc = ae_next_tag( compiler->mgr, text, &start, &end ) ) > 0 ) {
+    *start = 0;
+    compile_literal( compiler, text, output, depth );
+
+    start = start + compiler->start_len;
+    *end = 0;
+    compile_tag( compiler, start, output, depth );
+
+    text = end + compiler->end_len;
+  }
+
+  if( rc < 0 ) {
+    *start = 0;
+    compile_literal( compiler, text, output, depth );
+    compile_literal( compiler, "[unclosed tag]", output, depth );
+    return rc;
+  }
+
+  compile_literal( compiler, text, output, depth );
+  return rc;
+}
+
+static char* read_template( CONST char* file_name ) {
+  t_ae_stream stream;
+  char* text;
+  int   size;
+
+  stream = ae_stream_open_file( file_name );
+  if( stream == NULL ) {
+    return NULL;
+  }
+  size = ae_stream_get_length( stream );
+  text = (char*)ae_malloc( size+1 );
+  size = ae_stream_read( stream, text, size );
+  text[ size > 0 ? size : 0 ] = 0;
+  ae_stream_close( stream );
+
+  return text;
+}
+
+static char* function_name( CONST char* file_name ) {
+  CONST char* base;
+  CONST char* dot;
+  char* name;
+  char* p;
+
+  base = strrchr( file_name, '/' );
+  base = ( base ? base+1 : file_name );
+  dot = strchr( base, '.' );
+  if( dot == NULL || dot == base ) dot = base + strlen( base );
+
+  name = (char*)ae_malloc( ( dot - base ) + 5 );
+  strcpy( name, "tem_" );
+  p = name + 4;
+  while( base < dot ) {
+    *p++ = ( isalnum( (unsigned char)*base ) ? *base : '_' );
+    base++;
+  }
+  *p = 0;
+
+  return name;
+}
+
+static int compile_template( t_compiler* compiler, CONST char* file_name, FILE* output ) {
+  FILE*  render;
+  char*  text;
+  char*  minified;
+  char*  decls = NULL;
+  char*  funcs = NULL;
+  char*  body = NULL;
+  size_t decls_len = 0;
+  size_t funcs_len = 0;
+  size_t body_len = 0;
+  int    rc;
+
+  text = read_template( file_name );
+  if( text == NULL ) {
+    fprintf( stderr, "ae_compile: cannot read %s\n", file_name );
+    return -1;
+  }
+  if( ae_get_minify( compiler->mgr ) ) {
+    minified = ae_minify_html( compiler->mgr, text );
+    ae_free( text );
+    text = minified;
+  }
+
+  compiler->decls = open_memstream( &decls, &decls_len );
+  compiler->funcs = open_memstream( &funcs, &funcs_len );
+  compiler->next_text = 0;
+  compiler->next_body = 0;
+
+  render = open_memstream( &body, &body_len );
+  rc = compile_text( compiler, text, render, 1 );
+  fclose( render );
+
+  fclose( compiler->decls );
+  fclose( compiler->funcs );
+
+  fprintf( output, "/* %s */\n\n", file_name );
+  if( decls_len > 0 ) fprintf( output, "%s\n", decls );
+  fputs( funcs, output );
+  fprintf( output, "int %s( t_ae_template_mgr mgr, FILE* output ) {\n", compiler->name );
+  fputs( body, output );
+  fprintf( output, "  return %d;\n}\n\n", ( rc < 0 ? -1 : 0 ) );
+
+  free( decls );
+  free( funcs );
+  free( body );
+  ae_free( text );
+
+  return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* main                                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void usage( void ) {
+  fprintf( stderr, "usage: ae_compile [-s start-delim] [-e end-delim] [-n name] [-o output.c]\n"
+                   "                  [-H header.h] [-m] template ...\n" );
+  exit( 2 );
+}
+
+int main( int argc, char** argv ) {
+  t_compiler compiler;
+  CONST char* start_delim = NULL;
+  CONST char* end_delim = NULL;
+  CONST char* name = NULL;
+  CONST char* output_name = NULL;
+  CONST char* header_name = NULL;
+  FILE* output = stdout;
+  FILE* header = NULL;
+  FILE* code;
+  char* buffer = NULL;
+  size_t length = 0;
+  char* names;
+  int   first;
+  int   failures = 0;
+  int   minify = 0;
+  int   i;
+
+  for( i = 1; i < argc && argv[ i ][ 0 ] == '-'; i++ ) {
+    if( argv[ i ][ 1 ] == 0 || argv[ i ][ 2 ] != 0 ) usage();
+    if( argv[ i ][ 1 ] == 'm' ) {
+      minify = 1;
+      continue;
+    }
+    if( i+1 >= argc ) usage();
+    switch( argv[ i ][ 1 ] ) {
+      case 's': start_delim = argv[ ++i ]; break;
+      case 'e': end_delim = argv[ ++i ]; break;
+      case 'n': name = argv[ ++i ]; break;
+      case 'o': output_name = argv[ ++i ]; break;
+      case 'H': header_name = argv[ ++i ]; break;
+      default: usage();
+    }
+  }
+  first = i;
+  if( first >= argc || ( name != NULL && argc - first > 1 ) ) usage();
+
+  /* the manager supplies the grammar: its delimiters, and the field delimiter
+   * its standard tags use */
+  compiler.mgr = ae_template_mgr_new();
+  if( start_delim != NULL || end_delim != NULL ) {
+    ae_set_start_end_delim( compiler.mgr,
+                            start_delim ? start_delim : "<!--%",
+                            end_delim ? end_delim : "%-->" );
+  }
+  ae_set_minify( compiler.mgr, minify );
+  compiler.delim = ae_get_tag_delim( ae_get_tag( compiler.mgr, "IF" ) );
+  compiler.start_len = strlen( start_delim ? start_delim : "<!--%" );
+  compiler.end_len = strlen( end_delim ? end_delim : "%-->" );
+
+  if( output_name != NULL ) {
+    output = fopen( output_name, "w" );
+    if( output == NULL ) {
+      perror( output_name );
+      return 1;
+    }
+  }
+  if( header_name != NULL ) {
+    header = fopen( header_name, "w" );
+    if( header == NULL ) {
+      perror( header_name );
+      return 1;
+    }
+    fputs( "/* generated by ae_compile -- do not edit */\n\n", header );
+    fputs( "#include \"templates.h\"\n\n", header );
+  }
+
+  /* the templates are compiled first, so that only the helpers they use
+   * are written ahead of them */
+  memset( compiler.uses, 0, sizeof( compiler.uses ) );
+  code = open_memstream( &buffer, &length );
+
+  for( i = first; i < argc; i++ ) {
+    names = ( name != NULL ? ae_strdup( name ) : function_name( argv[ i ] ) );
+    compiler.name = names;
+    if( compile_template( &compiler, argv[ i ], code ) != 0 ) {
+      failures++;
+    } else if( header != NULL ) {
+      fprintf( header, "int %s( t_ae_template_mgr mgr, FILE* output );\n", names );
+    }
+    ae_free( names );
+  }
+  fclose( code );
+
+  fputs( "/* generated by ae_compile -- do not edit */\n\n", output );
+  fputs( "#include <stdio.h>\n#include <string.h>\n\n#include \"templates.h\"\n\n", output );
+  for( i = 0; i < (int)( sizeof( compiler.uses ) / sizeof( compiler.uses[ 0 ] ) ); i++ ) {
+    if( compiler.uses[ i ] ) fputs( static_helpers[ i ], output );
+  }
+  fputs( buffer, output );
+  free( buffer );
+
+  if( header != NULL ) fclose( header );
+  if( output != stdout ) fclose( output );
+  ae_template_mgr_done( compiler.mgr );
+
+  return ( failures > 0 ? 1 : 0 );
+}
@@ -0,0 +1,391 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Render Server
+ *
+ * description:
+ * Listens on a Unix domain socket and renders templates for clients of the
+ * remote module (see include/remote.h).  Each worker thread keeps its own
+ * template manager, and a cache of the template files it has read (checked
+ * against the file's modification time on every use, and holding at most
+ * the -c most recently used files, 64 by default), from one request to
+ * the next; each request's tags go in an overlay of that manager (see
+ * ae_template_mgr_overlay), made for the request and dropped after it.
+ * With -b, templates in the given bundle are rendered from it, and INCLUDE
+ * tags resolve from the bundle or the cache before the disk.  With -x, the
+ * extension tags (ESCAPE-HTML, ESCAPE-JS and STRUCT) are added to every
+ * manager.  With -m, template files are minified as they are cached (see
+ * include/minify.h).
+ *
+ * Template names, requested or included, are looked up under the -r root
+ * directory (the server's working directory by default).  A name that is
+ * absolute, or has a ".." component, is refused: the request fails, and
+ * the include writes nothing.  (Symbolic links under the root are
+ * followed.)
+ *
+ * A connection that sends nothing for -i seconds (30 by default) is
+ * dropped, so idle clients don't hold on to the workers.
+ *
+ * usage:
+ *   ae_served [-s start-delim] [-e end-delim] [-b file.bundle] [-t threads]
+ *             [-r root] [-i idle-seconds] [-c cached-files] [-x] [-m]
+ *             socket-path
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "remote.h"
+#include "bundle.h"
+#include "extensions.h"
+#include "minify.h"
+
+/* ------------------------------------------------------------------------- */
+/* type definitions                                                          */
+/* ------------------------------------------------------------------------- */
+
+typedef struct t_cached_file {
+  char*  path;
+  time_t mtime;
+  off_t  size;
+  char*  text;
+  struct t_cached_file* next;
+} t_cached_file;
+
+  /* the cache is a list, most recently used first */
+
+typedef struct {
+  t_ae_template_mgr mgr;
+  t_cached_file*    cache;
+  int               cached;
+  pthread_t         thread;
+} t_worker;
+
+/* ------------------------------------------------------------------------- */
+/* global variables                                                          */
+/* ------------------------------------------------------------------------- */
+
+static int         listen_fd = -1;
+static t_ae_bundle bundle = NULL;
+static CONST char* start_delim = NULL;
+static CONST char* end_delim = NULL;
+static int         extensions = 0;
+static int         minify = 0;
+static CONST char* root = ".";
+static int         idle_seconds = 30;
+static int         cache_size = 64;
+
+/* ------------------------------------------------------------------------- */
+/* template paths                                                            */
+/* ------------------------------------------------------------------------- */
+
+  /* writes the path of the template 'name' under the root to 'path',
+   * returning 0, or -1 if the name is absolute, climbs out with "..", or is
+   * too long */
+static int resolve_path( CONST char* name, char* path, size_t size ) {
+  CONST char* p;
+  size_t length;
+
+  if( name[ 0 ] == '/' ) {
+    return -1;
+  }
+  for( p = name; ; p += length+1 ) {
+    length = strcspn( p, "/" );
+    if( length == 2 && p[ 0 ] == '.' && p[ 1 ] == '.' ) {
+      return -1;
+    }
+    if( p[ length ] == 0 ) break;
+  }
+
+  if( (size_t)snprintf( path, size, "%s/%s", root, name ) >= size ) {
+    return -1;
+  }
+  return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* template cache                                                            */
+/* ------------------------------------------------------------------------- */
+
+  /* drops the least recently used files until the cache is no larger than
+   * it may be.  (Rendering works on a copy of a template's text, so it is
+   * safe to drop one that is being rendered, from an include.) */
+static void drop_least_used( t_worker* worker ) {
+  t_cached_file** link;
+  t_cached_file* item;
+
+  while( worker->cached > cache_size ) {
+    for( link = &worker->cache; (*link)->next != NULL; link = &(*link)->next ) {
+      /* find the last */
+    }
+    item = *link;
+    *link = NULL;
+    ae_free( item->path );
+    ae_free( item->text );
+    ae_free( item );
+    worker->cached--;
+  }
+}
+
+  /* returns the text of the given file (a path under the root), reading it
+   * again if it has changed since it was cached, or NULL if it cannot be
+   * read */
+static CONST char* cached_text( t_worker* worker, CONST char* path ) {
+  struct stat info;
+  t_cached_file* item;
+  t_cached_file** link;
+  FILE* file;
+  char* text;
+  char* minified;
+
+  if( stat( path, &info ) != 0 || !S_ISREG( info.st_mode ) ) {
+    return NULL;
+  }
+
+  /* a file found is moved to the front of the list */
+  for( link = &worker->cache; *link != NULL; link = &(*link)->next ) {
+    if( strcmp( (*link)->path, path ) == 0 ) break;
+  }
+  item = *link;
+  if( item != NULL ) {
+    *link = item->next;
+    item->next = worker->cache;
+    worker->cache = item;
+    if( item->mtime == info.st_mtime && item->size == info.st_size ) {
+      return item->text;
+    }
+  }
+
+  file = fopen( path, "rb" );
+  if( file == NULL ) {
+    return NULL;
+  }
+  text = (char*)ae_malloc( info.st_size + 1 );
+  if( fread( text, 1, info.st_size, file ) != (size_t)info.st_size ) {
+    fclose( file );
+    ae_free( text );
+    return NULL;
+  }
+  fclose( file );
+  text[ info.st_size ] = 0;
+  if( minify ) {
+    minified = ae_minify_html( worker->mgr, text );
+    ae_free( text );
+    text = minified;
+  }
+
+  if( item == NULL ) {
+    item = (t_cached_file*)ae_malloc( sizeof( t_cached_file ) );
+    item->path = ae_strdup( path );
+    item->next = worker->cache;
+    worker->cache = item;
+    worker->cached++;
+    drop_least_used( worker );
+  } else {
+    ae_free( item->text );
+  }
+  item->mtime = info.st_mtime;
+  item->size = info.st_size;
+  item->text = text;
+
+  return text;
+}
+
+/* ------------------------------------------------------------------------- */
+/* rendering                                                                 */
+/* ------------------------------------------------------------------------- */
+
+static int render( t_worker* worker, t_ae_template_mgr mgr, CONST char* name, FILE* output ) {
+  CONST char* text;
+  char path[ 4096 ];
+
+  if( resolve_path( name, path, sizeof( path ) ) != 0 ) {
+    return -1;
+  }
+  if( bundle != NULL && ae_bundle_has( bundle, name ) ) {
+    return ae_bundle_process( bundle, mgr, name, output );
+  }
+
+  text = cached_text( worker, path );
+  if( text == NULL ) {
+    return -1;
+  }
+  return ae_process_buffer( mgr, text, output );
+}
+
+static int include_fn( void* cookie, t_ae_template_mgr mgr, CONST char* file, FILE* output ) {
+  t_worker* worker = (t_worker*)cookie;
+
+  /* every include is claimed, so that the library never reads a file from
+   * outside the root; one that can't be rendered writes nothing */
+  render( worker, mgr, file, output );
+  return 1;
+}
+
+static void new_manager( t_worker* worker ) {
+  worker->mgr = ae_template_mgr_new();
+  if( start_delim != NULL || end_delim != NULL ) {
+    ae_set_start_end_delim( worker->mgr,
+                            start_delim ? start_delim : "<!--%",
+                            end_delim ? end_delim : "%-->" );
+  }
+  if( extensions ) {
+    ae_add_tag_ex( worker->mgr, ae_escape_js_tag() );
+    ae_add_tag_ex( worker->mgr, ae_escape_html_tag() );
+    ae_add_tag_ex( worker->mgr, ae_struct_tag() );
+    ae_add_tag_ex( worker->mgr, ae_struct_slice_tag() );
+  }
+  ae_set_include_func( worker->mgr, include_fn, worker );
+}
+
+  /* serves the requests on one connection until the client closes it, or
+   * has been idle for idle_seconds */
+static void serve( t_worker* worker, int fd ) {
+  t_ae_template_mgr request;
+  char*  tem_file;
+  char** names;
+  char** values;
+  FILE*  output;
+  struct timeval timeout;
+  int    rc;
+  int    i;
+
+  /* a client that sends nothing for too long is dropped (the read fails) */
+  timeout.tv_sec = idle_seconds;
+  timeout.tv_usec = 0;
+  setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+
+  while( ae_remote_read_request( fd, &tem_file, &names, &values ) == 0 ) {
+    /* a request's tags (including any that override the worker's own) go
+     * in an overlay, so the worker's manager is never changed */
+    request = ae_template_mgr_overlay( worker->mgr );
+    for( i = 0; names[ i ] != NULL; i++ ) {
+      if( *names[ i ] != 0 ) ae_add_tag( request, names[ i ], values[ i ] );
+    }
+
+    output = ae_remote_open_response( fd );
+    if( output == NULL ) {
+      rc = -1;
+    } else {
+      rc = render( worker, request, tem_file, output );
+      rc = ae_remote_close_response( output, fd, rc );
+    }
+
+    ae_template_mgr_done( request );
+    ae_remote_free_request( tem_file, names, values );
+
+    if( rc != 0 ) break;
+  }
+}
+
+static void* worker_fn( void* arg ) {
+  t_worker* worker = (t_worker*)arg;
+  int fd;
+
+  new_manager( worker );
+  for( ;; ) {
+    fd = accept( listen_fd, NULL, NULL );
+    if( fd < 0 ) {
+      if( errno == EINTR || errno == ECONNABORTED ) continue;
+      perror( "accept" );
+      break;
+    }
+    serve( worker, fd );
+    close( fd );
+  }
+
+  return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* main                                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void usage( void ) {
+  fprintf( stderr, "usage: ae_served [-s start-delim] [-e end-delim] [-b file.bundle] [-t threads]\n"
+                   "                 [-r root] [-i idle-seconds] [-c cached-files] [-x] [-m] socket-path\n" );
+  exit( 2 );
+}
+
+int main( int argc, char** argv ) {
+  struct sockaddr_un address;
+  t_worker* workers;
+  CONST char* bundle_name = NULL;
+  int threads = 4;
+  int i;
+
+  for( i = 1; i < argc && argv[ i ][ 0 ] == '-'; i++ ) {
+    if( argv[ i ][ 1 ] == 0 || argv[ i ][ 2 ] != 0 ) usage();
+    if( argv[ i ][ 1 ] == 'x' ) {
+      extensions = 1;
+      continue;
+    }
+    if( argv[ i ][ 1 ] == 'm' ) {
+      minify = 1;
+      continue;
+    }
+    if( i+1 >= argc ) usage();
+    switch( argv[ i ][ 1 ] ) {
+      case 's': start_delim = argv[ ++i ]; break;
+      case 'e': end_delim = argv[ ++i ]; break;
+      case 'b': bundle_name = argv[ ++i ]; break;
+      case 't': threads = atoi( argv[ ++i ] ); break;
+      case 'r': root = argv[ ++i ]; break;
+      case 'i': idle_seconds = atoi( argv[ ++i ] ); break;
+      case 'c': cache_size = atoi( argv[ ++i ] ); break;
+      default: usage();
+    }
+  }
+  if( i != argc-1 || threads < 1 || idle_seconds < 1 || cache_size < 1 ) usage();
+  if( strlen( argv[ i ] ) >= sizeof( address.sun_path ) ) {
+    fprintf( stderr, "ae_served: socket path too long: %s\n", argv[ i ] );
+    return 1;
+  }
+
+  if( bundle_name != NULL ) {
+    bundle = ae_bundle_open( bundle_name );
+    if( bundle == NULL ) {
+      fprintf( stderr, "ae_served: could not open bundle %s\n", bundle_name );
+      return 1;
+    }
+  }
+
+  /* clients going away mid-response must not take the server with them */
+  signal( SIGPIPE, SIG_IGN );
+
+  memset( &address, 0, sizeof( address ) );
+  address.sun_family = AF_UNIX;
+  strcpy( address.sun_path, argv[ i ] );
+  unlink( address.sun_path );
+
+  listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( listen_fd < 0 ||
+      bind( listen_fd, (struct sockaddr*)&address, sizeof( address ) ) != 0 ||
+      listen( listen_fd, 64 ) != 0 ) {
+    perror( argv[ i ] );
+    return 1;
+  }
+
+  /* the workers all accept on the one socket; the main thread just waits */
+  workers = (t_worker*)ae_malloc( threads * sizeof( t_worker ) );
+  memset( workers, 0, threads * sizeof( t_worker ) );
+  for( i = 0; i < threads; i++ ) {
+    if( pthread_create( &workers[ i ].thread, NULL, worker_fn, &workers[ i ] ) != 0 ) {
+      perror( "pthread_create" );
+      return 1;
+    }
+  }
+  for( i = 0; i < threads; i++ ) {
+    pthread_join( workers[ i ].thread, NULL );
+  }
+
+  return 1;
+}
@@ -0,0 +1,51 @@
+/* ------------------------------------------------------------------------- *
+ * Text Document Template Parser and Processor -- Render Statistics Reader
+ *
+ * description:
+ * Writes a report of the render statistics file that programs have been
+ * counting their renders in (see include/stats.h): for each template, its
+ * renders, failures, mean bytes written, and mean, 50th, 90th, 99th, 99.9th
+ * percentile and largest render times in microseconds, the slowest first.
+ * With -r, the counts are then set back to zero, so that the next report
+ * covers only the renders since.
+ *
+ * usage:
+ *   ae_stats [-r] statistics-file
+ * ------------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+/* ------------------------------------------------------------------------- */
+/* main                                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void usage( void ) {
+  fprintf( stderr, "usage: ae_stats [-r] statistics-file\n" );
+  exit( 2 );
+}
+
+int main( int argc, char** argv ) {
+  int reset = 0;
+  int i;
+
+  for( i = 1; i < argc && argv[ i ][ 0 ] == '-'; i++ ) {
+    if( strcmp( argv[ i ], "-r" ) != 0 ) usage();
+    reset = 1;
+  }
+  if( i != argc-1 ) usage();
+
+  if( ae_stats_report( argv[ i ], stdout ) != 0 ) {
+    fprintf( stderr, "ae_stats: could not read %s\n", argv[ i ] );
+    return 1;
+  }
+  if( reset && ae_stats_reset( argv[ i ] ) != 0 ) {
+    fprintf( stderr, "ae_stats: could not reset %s\n", argv[ i ] );
+    return 1;
+  }
+
+  return 0;
+}